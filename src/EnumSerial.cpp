@@ -36,12 +36,38 @@
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ************************************************************************/
 
+#ifdef _WIN32
 // The next 3 includes are needed for serial port enumeration
 #include <objbase.h>
 #include <initguid.h>
 #include <setupapi.h>
+// Walking up to the USB device of a port
+#include <cfgmgr32.h>
+#else
+// The sysfs backend only needs POSIX directory and file descriptor calls
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
 
 #include "EnumSerial.h"
+#include "PortFilter.h"
+#include "PortMerge.h"
+#include "PortProbe.h"
+#include "PortStats.h"
+#include "PortUart.h"
+#ifdef _WIN32
+#include "PortWindows.h"
+#endif
 
 //---------------------------------------------------------------
 // Helper to implement string format like in MFC library
@@ -63,11 +89,15 @@ std::string string_format( const std::string& format, Args ... args )
 // These throw a std::string on failure, describing the nature of
 // the error that occurred.
 
-void EnumPortsWdm(std::vector<SSerInfo> &asi);
-void EnumPortsWNt4(std::vector<SSerInfo> &asi);
-void EnumPortsW9x(std::vector<SSerInfo> &asi);
-void SearchPnpKeyW9x(HKEY hkPnp, BOOL bUsbDevice,
-					 std::vector<SSerInfo> &asi);
+#ifndef _WIN32
+// USB devices already read during a scan, by sysfs directory.
+typedef std::unordered_map<std::string, SUsbInfo> SysfsUsbCache;
+
+static BOOL SysfsReadPort(int fdClass, const char *szName, SSerInfo &si,
+	const SPortFilter *pFilter, DWORD dwFields, SysfsUsbCache &usbCache,
+	CUartTable &uarts, int &intUart);
+#endif
+static BOOL ReadSerInfoByPath(SSerInfo &si);
 
 //---------------------------------------------------------------
 // Routine for enumerating the available serial ports.
@@ -77,14 +107,216 @@ void SearchPnpKeyW9x(HKEY hkPnp, BOOL bUsbDevice,
 
 bool compareSerialInfoByIndex(const SSerInfo &a, const SSerInfo &b)
 {
-	return a.intPortIndex < b.intPortIndex;
+	// Linux has several ports per index (ttyS0, ttyUSB0, ttyACM0...), so
+	// break ties on the device path to keep the order stable.
+	if (a.intPortIndex != b.intPortIndex)
+		return a.intPortIndex < b.intPortIndex;
+	return a.strDevPath < b.strDevPath;
+}
+
+bool IsSameSerInfo(const SSerInfo &a, const SSerInfo &b)
+{
+	return a.strDevPath == b.strDevPath
+		&& a.strPortName == b.strPortName
+		&& a.strFriendlyName == b.strFriendlyName
+		&& a.strPortDesc == b.strPortDesc
+		&& a.bUsbDevice == b.bUsbDevice
+		&& a.intPortIndex == b.intPortIndex
+		&& a.usb.intVendorId == b.usb.intVendorId
+		&& a.usb.intProductId == b.usb.intProductId
+		&& a.usb.intInterface == b.usb.intInterface
+		&& a.usb.strSerial == b.usb.strSerial
+		&& a.usb.strManufacturer == b.usb.strManufacturer
+		&& a.usb.strProduct == b.usb.strProduct;
+}
+
+// Splits a friendly name of the form "ACME Port (COM4)" into its
+// description ("ACME Port") and port ("COM4") parts with a single scan
+// from the end. Returns false if the name doesn't end with "(...)".
+bool SplitFriendlyName(std::string_view svName,
+	std::string_view &svDesc, std::string_view &svPort)
+{
+	if (svName.size() < 3 || svName.back() != ')')
+		return false;
+	std::size_t startdex = svName.rfind(" (");
+	if (startdex == std::string_view::npos)
+		return false;
+	svDesc = svName.substr(0, startdex);
+	svPort = svName.substr(startdex + 2, svName.size() - startdex - 3);
+	return true;
+}
+
+// Most digits of a port index, so that it always fits an int.
+#define PORT_INDEX_MAX_DIGITS 9
+
+// Converts "COMx" (or "ttyUSBx") to x. Returns 0 if there is no number, -1
+// if it has more than PORT_INDEX_MAX_DIGITS digits.
+static int ParsePortIndex(std::string_view svPortName)
+{
+	std::size_t startIndex = svPortName.find("COM"); // length = 3
+	if (startIndex != std::string_view::npos) {
+		startIndex += 3;
+	}
+	else {
+		startIndex = svPortName.find_last_not_of("0123456789");
+		startIndex = (startIndex == std::string_view::npos) ? 0 : startIndex + 1;
+	}
+
+	std::string_view svDigits = svPortName.substr(startIndex);
+	if (svDigits.empty())
+		return 0;
+	if (svDigits.size() > PORT_INDEX_MAX_DIGITS)
+		return (svDigits.find_first_not_of("0123456789") == std::string_view::npos) ? -1 : 0;
+	int portIndex = 0;
+	for (std::size_t ii = 0; ii < svDigits.size(); ii++) {
+		if (svDigits[ii] < '0' || svDigits[ii] > '9')
+			return 0;
+		portIndex = portIndex * 10 + (svDigits[ii] - '0');
+	}
+	return portIndex;
+}
+
+void NormalizeSerInfo(SSerInfo &rsi)
+{
+	// Parse the friendly name once; the views stay valid until
+	// strFriendlyName itself is modified.
+	std::string_view svDesc, svPort;
+	bool bSplit = SplitFriendlyName(rsi.strFriendlyName, svDesc, svPort);
+
+	// If PortName is empty, then extract it from FriendlyName if possible...
+	// This happens on Windows 10 at least.
+	// From "ACME Port (COM4)" it will extract "COM4"
+	if (rsi.strPortName.empty() && bSplit)
+		rsi.strPortName.assign(svPort);
+
+	// If there is no description, try to make one up from
+	// the friendly name: "ACME Port (COM3)" becomes "ACME Port", or
+	// failing that, from the port name.
+	if ((rsi.dwFields & PORT_FIELD_DESC) && rsi.strPortDesc.empty()) {
+		if (bSplit)
+			rsi.strPortDesc.assign(svDesc);
+		else if (!rsi.strFriendlyName.empty())
+			rsi.strPortDesc = rsi.strFriendlyName;
+		else
+			rsi.strPortDesc = rsi.strPortName;
+	}
+
+	// Come up with a name for the device.
+	// If there is no friendly name, use the port name.
+	if ((rsi.dwFields & PORT_FIELD_FRIENDLYNAME) && rsi.strFriendlyName.empty())
+		rsi.strFriendlyName = rsi.strPortName;
+	
+	// If not detected as USB but DevPath starts with USB... then do the
+	// the change.
+	// A port with a USB device above it is a USB port, whatever its
+	// location said.
+	if ((rsi.dwFields & PORT_FIELD_USB) && !rsi.bUsbDevice
+		&& (rsi.strDevPath.compare(0, 8, "\\\\?\\usb#") == 0
+			|| rsi.usb.intVendorId >= 0)) {
+		rsi.bUsbDevice = TRUE;
+	}
+	
+	rsi.intPortIndex = ParsePortIndex(rsi.strPortName);
+}
+
+BOOL FetchSerInfoFields(SSerInfo &si, DWORD dwFields)
+{
+	DWORD dwMissing = dwFields & ~si.dwFields;
+	if (dwMissing == 0)
+		return TRUE;
+
+	SSerInfo siFull;
+	siFull.strDevPath = si.strDevPath;
+	siFull.strPortName = si.strPortName;
+	if (!ReadSerInfoByPath(siFull))
+		return FALSE;
+	NormalizeSerInfo(siFull);
+
+	if (dwMissing & PORT_FIELD_NAME) {
+		si.strPortName.swap(siFull.strPortName);
+		si.intPortIndex = siFull.intPortIndex;
+	}
+	if (dwMissing & PORT_FIELD_FRIENDLYNAME)
+		si.strFriendlyName.swap(siFull.strFriendlyName);
+	if (dwMissing & PORT_FIELD_DESC)
+		si.strPortDesc.swap(siFull.strPortDesc);
+	if (dwMissing & PORT_FIELD_USB)
+		si.bUsbDevice = siFull.bUsbDevice;
+	if (dwMissing & PORT_FIELD_USBINFO)
+		si.usb = siFull.usb;
+	si.dwFields |= dwMissing;
+	return TRUE;
+}
+
+// Merges the entries of a source that can't test the filter itself: they
+// may complete a port that passed it, or must match on what they know.
+// The new ports are passed to pfnFound if not NULL. Returns false if it
+// stopped the enumeration.
+static bool AddLegacyPorts(CPortMerger &merger, std::vector<SSerInfo> &asiSource,
+	const SPortFilter *pFilter, std::vector<SSerInfo> &asi,
+	const PortFoundCallback *pfnFound)
+{
+	if (pFilter == NULL && pfnFound == NULL) {
+		merger.AddAll(asiSource, PORT_SOURCE_LEGACY);
+		return true;
+	}
+	for (size_t ii = 0; ii < asiSource.size(); ii++) {
+		SSerInfo &si = asiSource[ii];
+		if (pFilter != NULL && !merger.Has(si) && !pFilter->MatchPartial(si))
+			continue;
+		if (merger.Add(si, PORT_SOURCE_LEGACY) && pfnFound != NULL
+			&& !(*pfnFound)(asi.back()))
+			return false;
+	}
+	return true;
 }
 
 void EnumSerialPorts(std::vector<SSerInfo> &asi, BOOL bIgnoreBusyPorts)
 {
+	EnumSerialPorts(asi, SPortFilter(), bIgnoreBusyPorts);
+}
+
+void EnumSerialPorts(std::vector<SSerInfo> &asi, const SPortFilter &filter,
+	BOOL bIgnoreBusyPorts)
+{
+	EnumSerialPorts(asi, filter, PORT_FIELD_ALL, bIgnoreBusyPorts);
+}
+
+// strRoot is only used on Linux, see EnumSerialPortsAt. dwOptions holds
+// PORT_ENUM_* values. If pfnFound is not NULL, each new port is passed to it as soon as its backend has read it,
+// and the sort is only done if bSort (see EnumSerialPortsStreaming).
+// Returns false if pfnFound stopped the enumeration.
+static bool EnumSerialPortsFrom(const std::string &strRoot,
+	std::vector<SSerInfo> &asi, const SPortFilter &filter, DWORD dwFields,
+	BOOL bIgnoreBusyPorts, DWORD dwOptions, const PortFoundCallback *pfnFound=NULL,
+	bool bSort=true)
+{
+	ENUM_STATS_SCOPE();
+	const SPortFilter *pFilter = filter.IsEmpty() ? NULL : &filter;
+	// The merge and the sort need the path and name of every port.
+	dwFields |= PORT_FIELD_BASIC;
+
 	// Clear the output array
 	asi.clear();
 
+	// Every source is folded into asi by the merger, which also
+	// normalizes the entries and drops the fields not asked for.
+	CPortMerger merger(asi, dwFields);
+	std::vector<SSerInfo> asiSource;
+
+	// When streaming, the main backend merges each port as it reads it.
+	bool bStopped = false;
+	PortSink fnMerge;
+	if (pfnFound != NULL) {
+		fnMerge = [&](SSerInfo &si) {
+			bStopped = merger.Add(si, PORT_SOURCE_DEVICE) && !(*pfnFound)(asi.back());
+			return !bStopped;
+		};
+	}
+
+#ifdef _WIN32
+	(void) strRoot;
+	(void) dwOptions;
 	// Use different techniques to enumerate the available serial
 	// ports, depending on the OS we're using
 	OSVERSIONINFO vi;
@@ -97,358 +329,432 @@ void EnumSerialPorts(std::vector<SSerInfo> &asi, BOOL bIgnoreBusyPorts)
 	}
 	// Handle windows 9x and NT4 specially
 	if (vi.dwMajorVersion < 5) {
-		if (vi.dwPlatformId == VER_PLATFORM_WIN32_NT)
-			EnumPortsWNt4(asi);
-		else
-			EnumPortsW9x(asi);
+		if (vi.dwPlatformId == VER_PLATFORM_WIN32_NT) {
+			{
+				ENUM_STATS_PHASE(ENUM_PHASE_LEGACY);
+				EnumPortsWNt4(asiSource);
+			}
+			ENUM_STATS_PHASE(ENUM_PHASE_MERGE);
+			bStopped = !AddLegacyPorts(merger, asiSource, pFilter, asi, pfnFound);
+		}
+		else {
+			{
+				ENUM_STATS_PHASE(ENUM_PHASE_LEGACY);
+				EnumPortsW9x(GetLiveDeviceApi(), merger, pFilter);
+			}
+			// The registry is read in one go: stream what it had.
+			for (size_t ii = 0; pfnFound != NULL && !bStopped && ii < asi.size(); ii++)
+				bStopped = !(*pfnFound)(asi[ii]);
+		}
 	}
 	else {
 		// Win2k and later support a standard API for
 		// enumerating hardware devices.
-		EnumPortsWdm(asi);
-	}
-
-	for (int ii=0; ii<asi.size(); ii++)
-	{
-		SSerInfo& rsi = asi[ii];    
-		if (bIgnoreBusyPorts) {
-			// Only display ports that can be opened for read/write
-			HANDLE hCom = CreateFile(rsi.strDevPath.c_str(),
-				GENERIC_READ | GENERIC_WRITE,
-				0,    /* comm devices must be opened w/exclusive-access */
-				NULL, /* no security attrs */
-				OPEN_EXISTING, /* comm devices must use OPEN_EXISTING */
-				0,    /* not overlapped I/O */
-				NULL  /* hTemplate must be NULL for comm devices */
-				);
-			if (hCom == INVALID_HANDLE_VALUE) {
-				// It can't be opened; remove it.
-				asi.erase(asi.begin() + ii);
-				ii--;               
-				continue;
-			}
-			else {
-				// It can be opened! Close it and add it to the list
-				::CloseHandle(hCom);
-			}
-		}
-				
-		// If PortName is empty, then extract it from FriendlyName if possible...
-		// This happens on Windows 10 at least.
-		if (rsi.strPortName.empty() && !rsi.strFriendlyName.empty()) {
-			// From "ACME Port (COM4)" it will extract "COM4"
-			std::string newPortName = std::string(rsi.strFriendlyName);
-			std::size_t startdex = newPortName.find(" (");
-			std::size_t enddex = newPortName.find(")");
-			if (startdex > 0 && enddex == (rsi.strFriendlyName.size() - 1)) {
-				rsi.strPortName = newPortName.substr(startdex + 2, enddex - startdex - 2);
-			}
+		if (pfnFound != NULL)
+			EnumPortsWdm(GetLiveDeviceApi(), fnMerge, pFilter, dwFields);
+		else {
+			EnumPortsWdm(GetLiveDeviceApi(), asiSource, pFilter, dwFields);
+			ENUM_STATS_PHASE(ENUM_PHASE_MERGE);
+			merger.AddAll(asiSource, PORT_SOURCE_DEVICE);
 		}
 
-		// Come up with a name for the device.
-		// If there is no friendly name, use the port name.
-		if (rsi.strFriendlyName.empty())
-			rsi.strFriendlyName = rsi.strPortName;
-
-		// If there is no description, try to make one up from
-		// the friendly name.		
-		if (rsi.strPortDesc.empty()) {
-			// If the port name is of the form "ACME Port (COM3)"
-			// then strip off the " (COM3)"
-			rsi.strPortDesc = std::string(rsi.strFriendlyName);
-			std::size_t startdex = rsi.strPortDesc.find(" (");
-			std::size_t enddex = rsi.strPortDesc.find(")");
-			if (startdex > 0 && enddex == 
-				(rsi.strPortDesc.size()-1))
-				rsi.strPortDesc = rsi.strPortDesc.substr(0, startdex);
-		}
-		
-		// If not detected as USB but DevPath starts with USB... then do the
-		// the change.
-		if (!rsi.bUsbDevice && rsi.strDevPath.rfind("\\\\?\\usb#", 0) == 0) {
-			rsi.bUsbDevice = TRUE;
-		}
-		
-		// Convert "COMx" to "x" to have it as a number.
-		rsi.intPortIndex = 0;
-		if (!rsi.strPortName.empty()) {
-			char *end;
-			std::string strPortIndex = std::string(rsi.strPortName);
-			std::size_t startIndex = strPortIndex.find("COM"); // length = 3
-			strPortIndex = strPortIndex.substr(startIndex + 3, std::string::npos);
-			unsigned int portIndex = strtol( strPortIndex.c_str(), &end, 10 );
-			if ( *end == '\0' ) {
-				rsi.intPortIndex = portIndex;
+		// Some virtual port drivers (com0com...) don't register the COM
+		// port interface; they only show up as DOS device names.
+		asiSource.clear();
+		if (!bStopped) {
+			{
+				ENUM_STATS_PHASE(ENUM_PHASE_LEGACY);
+				EnumPortsDosDevices(GetLiveDeviceApi(), asiSource);
 			}
+			ENUM_STATS_PHASE(ENUM_PHASE_MERGE);
+			bStopped = !AddLegacyPorts(merger, asiSource, pFilter, asi, pfnFound);
 		}
 	}
-	
+#else
+	// Linux exposes every tty in sysfs, whatever the driver is.
+	bool bProbeUarts = (dwOptions & PORT_ENUM_PROBE_UARTS) != 0;
+	if (pfnFound != NULL)
+		EnumPortsSysfs(fnMerge, strRoot, pFilter, dwFields, bProbeUarts);
+	else {
+		EnumPortsSysfs(asiSource, strRoot, pFilter, dwFields, bProbeUarts);
+		ENUM_STATS_PHASE(ENUM_PHASE_MERGE);
+		merger.AddAll(asiSource, PORT_SOURCE_DEVICE);
+	}
+	asiSource.clear();
+	if (!bStopped) {
+		{
+			ENUM_STATS_PHASE(ENUM_PHASE_LEGACY);
+			EnumPortsSerialById(asiSource, strRoot);
+		}
+		ENUM_STATS_PHASE(ENUM_PHASE_MERGE);
+		bStopped = !AddLegacyPorts(merger, asiSource, pFilter, asi, pfnFound);
+	}
+#endif
+	if (bStopped)
+		return false;
+
+	if (bIgnoreBusyPorts) {
+		// Only keep ports that can be opened for read/write. All of them
+		// are probed at once, then the busy ones are dropped in one pass.
+		ENUM_STATS_PHASE(ENUM_PHASE_PROBE);
+		ENUM_STATS_COUNT(uProbes, asi.size());
+		ProbeBusyPorts(asi);
+		asi.erase(std::remove_if(asi.begin(), asi.end(),
+			[](const SSerInfo &si) { return si.intPortState == PORT_STATE_BUSY; }),
+			asi.end());
+	}
+
 	// Sort by PortIndex	
-	std::sort(asi.begin(), asi.end(), compareSerialInfoByIndex);
+	if (bSort) {
+		ENUM_STATS_PHASE(ENUM_PHASE_SORT);
+		std::sort(asi.begin(), asi.end(), compareSerialInfoByIndex);
+	}
+	ENUM_STATS_COUNT(uPorts, asi.size());
+	return true;
+}
+
+void EnumSerialPorts(std::vector<SSerInfo> &asi, const SPortFilter &filter,
+	DWORD dwFields, BOOL bIgnoreBusyPorts, DWORD dwOptions)
+{
+	EnumSerialPortsFrom(std::string(), asi, filter, dwFields, bIgnoreBusyPorts,
+		dwOptions);
 }
 
+bool EnumSerialPortsStreaming(std::vector<SSerInfo> &asi,
+	const PortFoundCallback &fnFound, const SPortFilter &filter, DWORD dwFields,
+	DWORD dwOptions)
+{
+	return EnumSerialPortsFrom(std::string(), asi, filter, dwFields,
+		(dwOptions & PORT_STREAM_IGNORE_BUSY) != 0, dwOptions, &fnFound,
+		(dwOptions & PORT_STREAM_SORT) != 0);
+}
+
+#ifndef _WIN32
+void EnumSerialPortsAt(const std::string &strRoot, std::vector<SSerInfo> &asi,
+	const SPortFilter &filter, DWORD dwFields, BOOL bIgnoreBusyPorts,
+	DWORD dwOptions)
+{
+	EnumSerialPortsFrom(strRoot, asi, filter, dwFields, bIgnoreBusyPorts,
+		dwOptions);
+}
+#endif
+
 // Helpers for EnumSerialPorts
 
-void EnumPortsWdm(std::vector<SSerInfo> &asi)
+#ifdef _WIN32
+
+static BOOL ReadSerInfoByPath(SSerInfo &si)
 {
-	std::string strErr;
-	// Create a device information set that will be the container for 
-	// the device interfaces.
-	GUID *guidDev = (GUID*) &GUID_CLASS_COMPORT;
-
-	HDEVINFO hDevInfo = INVALID_HANDLE_VALUE;
-	SP_DEVICE_INTERFACE_DETAIL_DATA *pDetData = NULL;
-
-	try {
-		hDevInfo = SetupDiGetClassDevs( guidDev,
-			NULL,
-			NULL,
-			DIGCF_PRESENT | DIGCF_DEVICEINTERFACE
-			);
-
-		if(hDevInfo == INVALID_HANDLE_VALUE) 
-		{
-			strErr= string_format("SetupDiGetClassDevs failed. (err=%lx)",
-				GetLastError());
-			throw strErr;
-		}
+	return WdmReadSerInfoByPath(GetLiveDeviceApi(), si);
+}
 
-		// Enumerate the serial ports
-		BOOL bOk = TRUE;
-		SP_DEVICE_INTERFACE_DATA ifcData;
-		DWORD dwDetDataSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA) + 256;
-		pDetData = (SP_DEVICE_INTERFACE_DETAIL_DATA*) new char[dwDetDataSize];
-		// This is required, according to the documentation. Yes,
-		// it's weird.
-		ifcData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
-		pDetData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-		for (DWORD ii=0; bOk; ii++) {
-			bOk = SetupDiEnumDeviceInterfaces(hDevInfo,
-				NULL, guidDev, ii, &ifcData);
-			if (bOk) {
-				// Got a device. Get the details.
-				SP_DEVINFO_DATA devdata = {sizeof(SP_DEVINFO_DATA)};
-				bOk = SetupDiGetDeviceInterfaceDetail(hDevInfo,
-					&ifcData, pDetData, dwDetDataSize, NULL, &devdata);
-				if (bOk) {
-					std::string strDevPath(pDetData->DevicePath);
-					// Got a path to the device. Try to get some more info.
-					TCHAR fname[256];
-					TCHAR desc[256];
-					BOOL bSuccess = SetupDiGetDeviceRegistryProperty(
-						hDevInfo, &devdata, SPDRP_FRIENDLYNAME, NULL,
-						(PBYTE)fname, sizeof(fname), NULL);
-					bSuccess = bSuccess && SetupDiGetDeviceRegistryProperty(
-						hDevInfo, &devdata, SPDRP_DEVICEDESC, NULL,
-						(PBYTE)desc, sizeof(desc), NULL);
-					BOOL bUsbDevice = FALSE;
-					TCHAR locinfo[256];
-					if (SetupDiGetDeviceRegistryProperty(
-						hDevInfo, &devdata, SPDRP_LOCATION_INFORMATION, NULL,
-						(PBYTE)locinfo, sizeof(locinfo), NULL))
-					{
-						// Just check the first three characters to determine
-						// if the port is connected to the USB bus. This isn't
-						// an infallible method; it would be better to use the
-						// BUS GUID. Currently, Windows doesn't let you query
-						// that though (SPDRP_BUSTYPEGUID seems to exist in
-						// documentation only).
-						bUsbDevice = (strncmp(locinfo, "USB", 3)==0);
-					}
-					if (bSuccess) {
-						// Add an entry to the array
-						SSerInfo si;
-						si.strDevPath = strDevPath;
-						si.strFriendlyName = fname;
-						si.strPortDesc = desc;
-						si.bUsbDevice = bUsbDevice;
-						asi.push_back(si);
-					}
-
-				}
-				else {
-					strErr = string_format("SetupDiGetDeviceInterfaceDetail failed. (err=%lx)",
-						GetLastError());
-					throw strErr;
-				}
-			}
-			else {
-				DWORD err = GetLastError();
-				if (err != ERROR_NO_MORE_ITEMS) {
-					strErr= string_format("SetupDiEnumDeviceInterfaces failed. (err=%lx)", err);
-					throw strErr;
-				}
+#else
+
+// Reads a symbolic link relative to fdDir. Returns an empty string if the
+// link doesn't exist.
+static std::string SysfsReadLink(int fdDir, const char *szPath)
+{
+	char acTarget[PATH_MAX];
+	ENUM_STATS_COUNT(uPropertyReads, 1);
+	ssize_t len = readlinkat(fdDir, szPath, acTarget, sizeof(acTarget) - 1);
+	if (len < 0)
+		return std::string();
+	return std::string(acTarget, len);
+}
+
+// Returns what follows the last '/' of a sysfs link target.
+static std::string SysfsBaseName(const std::string &strPath)
+{
+	std::size_t slash = strPath.rfind('/');
+	return (slash == std::string::npos) ? strPath : strPath.substr(slash + 1);
+}
+
+void EnumPortsSysfs(std::vector<SSerInfo> &asi, const std::string &strRoot,
+	const SPortFilter *pFilter, DWORD dwFields, bool bProbeUarts)
+{
+	EnumPortsSysfs([&asi](SSerInfo &si) {
+		asi.push_back(std::move(si));
+		return true;
+	}, strRoot, pFilter, dwFields, bProbeUarts);
+}
+
+void EnumPortsSysfs(const PortSink &fnSink, const std::string &strRoot,
+	const SPortFilter *pFilter, DWORD dwFields, bool bProbeUarts)
+{
+	// Every entry of /sys/class/tty is a link to the tty device node. All
+	// the lookups below are done relative to this directory, so each path
+	// is resolved by the kernel only once per scan.
+	std::string strClass = strRoot + "/sys/class/tty";
+	int fdClass = open(strClass.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fdClass < 0) {
+		std::string strErr;
+		strErr = string_format("Could not open %s. (err=%d)",
+			strClass.c_str(), errno);
+		throw strErr;
+	}
+
+	// fdopendir() takes ownership of its descriptor, keep ours for *at().
+	int fdList = dup(fdClass);
+	DIR *pDir = (fdList < 0) ? NULL : fdopendir(fdList);
+	if (pDir == NULL) {
+		int err = errno;
+		if (fdList >= 0)
+			close(fdList);
+		close(fdClass);
+		std::string strErr;
+		strErr = string_format("Could not list %s. (err=%d)",
+			strClass.c_str(), err);
+		throw strErr;
+	}
+
+	// Multi-port adapters share their USB device: it's read once.
+	ENUM_STATS_PHASE(ENUM_PHASE_PORTS);
+	SysfsUsbCache usbCache;
+	CUartTable uarts(strRoot);
+	std::vector<SSerInfo> asiUnknown;
+	bool bStopped = false;
+	struct dirent *pEnt;
+	while ((pEnt = readdir(pDir)) != NULL) {
+		if (pEnt->d_name[0] == '.')
+			continue;
+		ENUM_STATS_COUNT(uDevices, 1);
+		ENUM_STATS_PORT_START(ullPortStart);
+		SSerInfo si;
+		int intUart;
+		if (SysfsReadPort(fdClass, pEnt->d_name, si, pFilter, dwFields, usbCache,
+			uarts, intUart)) {
+			ENUM_STATS_PORT_END(ullPortStart, pEnt->d_name);
+			if (bProbeUarts && intUart == UART_STATE_UNKNOWN)
+				asiUnknown.push_back(std::move(si));
+			else if (!fnSink(si)) {
+				bStopped = true;
+				break;
 			}
 		}
 	}
-	catch (std::string strCatchErr) {
-		strErr = strCatchErr;
+
+	closedir(pDir);
+	close(fdClass);
+
+	// Legacy ttys that neither sysfs nor /proc told about: ask their
+	// driver, all of them at once.
+	if (!asiUnknown.empty() && !bStopped) {
+		ENUM_STATS_COUNT(uProbes, asiUnknown.size());
+		std::vector<int> aiStates;
+		ProbeUartsIoctl(asiUnknown, aiStates);
+		for (size_t ii = 0; ii < asiUnknown.size(); ii++) {
+			if (aiStates[ii] != UART_STATE_ABSENT && !fnSink(asiUnknown[ii]))
+				break;
+		}
+	}
+}
+
+void EnumPortsSerialById(std::vector<SSerInfo> &asi, const std::string &strRoot)
+{
+	// udev only creates this directory when a USB serial adapter is
+	// plugged, so its absence isn't an error.
+	std::string strById = strRoot + "/dev/serial/by-id";
+	int fdById = open(strById.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fdById < 0)
+		return;
+	int fdList = dup(fdById);
+	DIR *pDir = (fdList < 0) ? NULL : fdopendir(fdList);
+	if (pDir == NULL) {
+		if (fdList >= 0)
+			close(fdList);
+		close(fdById);
+		return;
 	}
 
-	if (pDetData != NULL)
-		delete [] (char*)pDetData;
-	if (hDevInfo != INVALID_HANDLE_VALUE)
-		SetupDiDestroyDeviceInfoList(hDevInfo);
+	struct dirent *pEnt;
+	while ((pEnt = readdir(pDir)) != NULL) {
+		if (pEnt->d_name[0] == '.')
+			continue;
+		// Links are relative, e.g. "../../ttyUSB0".
+		std::string strName = SysfsBaseName(SysfsReadLink(fdById, pEnt->d_name));
+		if (strName.empty())
+			continue;
+		SSerInfo si;
+		si.strDevPath = "/dev/" + strName;
+		si.strPortName = strName;
+		si.strFriendlyName = pEnt->d_name;
+		si.bUsbDevice = (strncmp(pEnt->d_name, "usb-", 4) == 0);
+		asi.push_back(std::move(si));
+	}
 
-	if (!strErr.empty())
-		throw strErr;
+	closedir(pDir);
+	close(fdById);
 }
 
-void EnumPortsWNt4(std::vector<SSerInfo> &asi)
+BOOL ReadPortSysfs(const std::string &strName, SSerInfo &si,
+	const std::string &strRoot)
 {
-	// NT4's driver model is totally different, and not that
-	// many people use NT4 anymore. Just try all the COM ports
-	// between 1 and 16
-	SSerInfo si;
-	for (int ii=1; ii<=16; ii++) {
-		std::string strPort;
-		strPort= string_format("COM%d",ii);
-		si.strDevPath = std::string("\\\\.\\") + strPort;
-		si.strPortName = strPort;
-		asi.push_back(si);
-	}
+	std::string strClass = strRoot + "/sys/class/tty";
+	int fdClass = open(strClass.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fdClass < 0)
+		return FALSE;
+	SysfsUsbCache usbCache;
+	CUartTable uarts(strRoot);
+	int intUart;
+	BOOL bOk = SysfsReadPort(fdClass, strName.c_str(), si, NULL, PORT_FIELD_ALL,
+		usbCache, uarts, intUart);
+	close(fdClass);
+	return bOk;
 }
 
-void EnumPortsW9x(std::vector<SSerInfo> &asi)
+// Reads a small sysfs attribute, without its trailing newline. Returns an
+// empty string if it doesn't exist.
+static std::string SysfsReadAttr(int fdDir, const char *szPath)
 {
-	// Look at all keys in HKLM\Enum, searching for subkeys named
-	// *PNP0500 and *PNP0501. Within these subkeys, search for
-	// sub-subkeys containing value entries with the name "PORTNAME"
-	// Search all subkeys of HKLM\Enum\USBPORTS for PORTNAME entries.
-
-	// First, open HKLM\Enum
-	HKEY hkEnum = NULL;
-	HKEY hkSubEnum = NULL;
-	HKEY hkSubSubEnum = NULL;
-
-	try {
-		if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, "Enum", 0, KEY_READ,
-			&hkEnum) != ERROR_SUCCESS)
-			throw std::string("Could not read from HKLM\\Enum");
-
-		// Enumerate the subkeys of HKLM\Enum
-		char acSubEnum[128];
-		DWORD dwSubEnumIndex = 0;
-		DWORD dwSize = sizeof(acSubEnum);
-		while (RegEnumKeyEx(hkEnum, dwSubEnumIndex++, acSubEnum, &dwSize,
-			NULL, NULL, NULL, NULL) == ERROR_SUCCESS)
-		{
-			HKEY hkSubEnum = NULL;
-			if (RegOpenKeyEx(hkEnum, acSubEnum, 0, KEY_READ,
-				&hkSubEnum) != ERROR_SUCCESS)
-				throw std::string("Could not read from HKLM\\Enum\\")+acSubEnum;
-
-			// Enumerate the subkeys of HKLM\Enum\*\, looking for keys
-			// named *PNP0500 and *PNP0501 (or anything in USBPORTS)
-			BOOL bUsbDevice = (strcmp(acSubEnum,"USBPORTS")==0);
-			char acSubSubEnum[128];
-			dwSize = sizeof(acSubSubEnum);  // set the buffer size
-			DWORD dwSubSubEnumIndex = 0;
-			while (RegEnumKeyEx(hkSubEnum, dwSubSubEnumIndex++, acSubSubEnum,
-				&dwSize, NULL, NULL, NULL, NULL) == ERROR_SUCCESS)
-			{
-				BOOL bMatch = (strcmp(acSubSubEnum,"*PNP0500")==0 ||
-					strcmp(acSubSubEnum,"*PNP0501")==0 ||
-					bUsbDevice);
-				if (bMatch) {
-					HKEY hkSubSubEnum = NULL;
-					if (RegOpenKeyEx(hkSubEnum, acSubSubEnum, 0, KEY_READ,
-						&hkSubSubEnum) != ERROR_SUCCESS)
-						throw std::string("Could not read from HKLM\\Enum\\") + 
-						acSubEnum + "\\" + acSubSubEnum;
-					SearchPnpKeyW9x(hkSubSubEnum, bUsbDevice, asi);
-					RegCloseKey(hkSubSubEnum);
-					hkSubSubEnum = NULL;
-				}
-
-				dwSize = sizeof(acSubSubEnum);  // restore the buffer size
-			}
+	ENUM_STATS_COUNT(uPropertyReads, 1);
+	int fd = openat(fdDir, szPath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return std::string();
+	char acValue[256];
+	ssize_t len = read(fd, acValue, sizeof(acValue));
+	close(fd);
+	if (len <= 0)
+		return std::string();
+	while (len > 0 && (acValue[len - 1] == '\n' || acValue[len - 1] == '\0'))
+		len--;
+	return std::string(acValue, len);
+}
 
-			RegCloseKey(hkSubEnum);
-			hkSubEnum = NULL;
-			dwSize = sizeof(acSubEnum); // restore the buffer size
+// Finds the USB interface and device in the class link target of a tty,
+// e.g. ../../devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/ttyUSB0/tty/ttyUSB0
+// The interface is the last component named "<bus>-<ports>:<config>.<n>",
+// the USB device its parent. Returns false if there is none.
+static bool SysfsReadUsbInfo(int fdClass, const std::string &strTarget,
+	SysfsUsbCache &usbCache, SUsbInfo &usb)
+{
+	size_t nEnd = strTarget.size();
+	size_t nSlash;
+	std::string_view svInterface;
+	while ((nSlash = strTarget.rfind('/', nEnd - 1)) != std::string::npos && nSlash > 0) {
+		std::string_view svName(strTarget.data() + nSlash + 1, nEnd - nSlash - 1);
+		size_t nColon = svName.find(':');
+		size_t nDash = svName.find('-');
+		if (nColon != std::string_view::npos && nDash < nColon) {
+			svInterface = svName;
+			break;
 		}
+		nEnd = nSlash;
 	}
-	catch (std::string strError) {
-		if (hkEnum != NULL)
-			RegCloseKey(hkEnum);
-		if (hkSubEnum != NULL)
-			RegCloseKey(hkSubEnum);
-		if (hkSubSubEnum != NULL)
-			RegCloseKey(hkSubSubEnum);
-		throw strError;
+	if (svInterface.empty())
+		return false;
+
+	std::string strDevice = strTarget.substr(0, nSlash);
+	std::pair<SysfsUsbCache::iterator, bool> ins =
+		usbCache.insert(std::make_pair(strDevice, SUsbInfo()));
+	SUsbInfo &usbDevice = ins.first->second;
+	if (ins.second) {
+		std::string strVendor = SysfsReadAttr(fdClass, (strDevice + "/idVendor").c_str());
+		std::string strProduct = SysfsReadAttr(fdClass, (strDevice + "/idProduct").c_str());
+		if (!strVendor.empty())
+			usbDevice.intVendorId = (int) strtol(strVendor.c_str(), NULL, 16);
+		if (!strProduct.empty())
+			usbDevice.intProductId = (int) strtol(strProduct.c_str(), NULL, 16);
+		usbDevice.strSerial = SysfsReadAttr(fdClass, (strDevice + "/serial").c_str());
+		usbDevice.strManufacturer = SysfsReadAttr(fdClass,
+			(strDevice + "/manufacturer").c_str());
+		usbDevice.strProduct = SysfsReadAttr(fdClass, (strDevice + "/product").c_str());
 	}
-
-	RegCloseKey(hkEnum);
+	if (usbDevice.intVendorId < 0)
+		return false;
+
+	usb = usbDevice;
+	size_t nDot = svInterface.rfind('.');
+	usb.intInterface = (nDot == std::string_view::npos) ? -1
+		: atoi(std::string(svInterface.substr(nDot + 1)).c_str());
+	return true;
 }
 
-void SearchPnpKeyW9x(HKEY hkPnp, BOOL bUsbDevice,
-					 std::vector<SSerInfo> &asi)
+static BOOL SysfsReadPort(int fdClass, const char *szName, SSerInfo &si,
+	const SPortFilter *pFilter, DWORD dwFields, SysfsUsbCache &usbCache,
+	CUartTable &uarts, int &intUart)
 {
-	// Enumerate the subkeys of the given PNP key, looking for values with
-	// the name "PORTNAME"
-	// First, open HKLM\Enum
-	HKEY hkSubPnp = NULL;
-
-	try {
-		// Enumerate the subkeys of HKLM\Enum\*\PNP050[01]
-		char acSubPnp[128];
-		DWORD dwSubPnpIndex = 0;
-		DWORD dwSize = sizeof(acSubPnp);
-		while (RegEnumKeyEx(hkPnp, dwSubPnpIndex++, acSubPnp, &dwSize,
-			NULL, NULL, NULL, NULL) == ERROR_SUCCESS)
-		{
-			HKEY hkSubPnp = NULL;
-			if (RegOpenKeyEx(hkPnp, acSubPnp, 0, KEY_READ,
-				&hkSubPnp) != ERROR_SUCCESS)
-				throw std::string("Could not read from HKLM\\Enum\\...\\")
-				+ acSubPnp;
-
-			// Look for the PORTNAME value
-			char acValue[128];
-			dwSize = sizeof(acValue);
-			if (RegQueryValueEx(hkSubPnp, "PORTNAME", NULL, NULL, (BYTE*)acValue,
-				&dwSize) == ERROR_SUCCESS)
-			{
-				std::string strPortName(acValue);
-
-				// Got the portname value. Look for a friendly name.
-				std::string strFriendlyName;
-				dwSize = sizeof(acValue);
-				if (RegQueryValueEx(hkSubPnp, "FRIENDLYNAME", NULL, NULL, (BYTE*)acValue,
-					&dwSize) == ERROR_SUCCESS)
-					strFriendlyName = acValue;
-
-				// Prepare an entry for the output array.
-				SSerInfo si;
-				si.strDevPath = std::string("\\\\.\\") + strPortName;
-				si.strPortName = strPortName;
-				si.strFriendlyName = strFriendlyName;
-				si.bUsbDevice = bUsbDevice;
-
-				// Overwrite duplicates.
-				BOOL bDup = FALSE;
-				for (int ii=0; ii<asi.size() && !bDup; ii++)
-				{
-					if (asi[ii].strPortName == strPortName) {
-						bDup = TRUE;
-						asi[ii] = si;
-					}
-				}
-				if (!bDup) {
-					// Add an entry to the array
-					asi.push_back(si);
-				}
-			}
+	// The name and the path are known without any lookup: most ttys of a
+	// filtered scan stop here.
+	std::string strDevPath = std::string("/dev/") + szName;
+	if (pFilter != NULL
+		&& (!pFilter->MatchName(szName) || !pFilter->MatchDevPath(strDevPath)))
+		return FALSE;
+
+	// Virtual terminals, ptmx, console... have no "device" link. Only the
+	// ttys that are bound to real hardware are serial ports.
+	std::string strDevice = std::string(szName) + "/device";
+	struct stat st;
+	ENUM_STATS_COUNT(uPropertyReads, 1);
+	if (fstatat(fdClass, strDevice.c_str(), &st, 0) != 0)
+		return FALSE;
+
+	// The 8250 driver has a tty for every slot it reserves, with or
+	// without a UART. Drop the empty ones without opening them.
+	intUart = UART_STATE_PRESENT;
+	if (IsLegacyUartName(szName)) {
+		intUart = UartStateFromSysfs(
+			SysfsReadAttr(fdClass, (std::string(szName) + "/type").c_str()));
+		if (intUart == UART_STATE_UNKNOWN)
+			intUart = uarts.Lookup(atoi(szName + 4));
+		if (intUart == UART_STATE_ABSENT)
+			return FALSE;
+	}
 
-			RegCloseKey(hkSubPnp);
-			hkSubPnp = NULL;
-			dwSize = sizeof(acSubPnp);  // restore the buffer size
-		}
+	// The class entry points into the device hierarchy, e.g.
+	// ../../devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/ttyUSB0/tty/ttyUSB0
+	// so any "/usb" component tells us the port hangs off a USB bus.
+	BOOL bUsbDevice = FALSE;
+	std::string strTarget;
+	if ((dwFields & (PORT_FIELD_USB | PORT_FIELD_USBINFO))
+		|| (pFilter != NULL && pFilter->NeedsUsb())) {
+		strTarget = SysfsReadLink(fdClass, szName);
+		bUsbDevice = (strTarget.find("/usb") != std::string::npos);
+		if (pFilter != NULL && pFilter->NeedsUsb() && !bUsbDevice)
+			return FALSE;
 	}
-	catch (std::string strError) {
-		if (hkSubPnp != NULL)
-			RegCloseKey(hkSubPnp);
-		throw strError;
+
+	// The driver name is only needed for the friendly name and description.
+	std::string strDriver;
+	if ((dwFields & (PORT_FIELD_FRIENDLYNAME | PORT_FIELD_DESC))
+		|| (pFilter != NULL && !pFilter->strDriver.empty())) {
+		strDriver = SysfsBaseName(
+			SysfsReadLink(fdClass, (strDevice + "/driver").c_str()));
+		if (pFilter != NULL && !pFilter->MatchDriver(strDriver))
+			return FALSE;
+	}
+
+	SUsbInfo usb;
+	if (bUsbDevice && ((dwFields & PORT_FIELD_USBINFO)
+		|| (pFilter != NULL && pFilter->NeedsUsbInfo())))
+		SysfsReadUsbInfo(fdClass, strTarget, usbCache, usb);
+	if (pFilter != NULL && pFilter->NeedsUsbInfo() && !pFilter->MatchUsbInfo(usb))
+		return FALSE;
+
+	si.dwFields = dwFields;
+	si.strDevPath.swap(strDevPath);
+	si.strPortName = szName;
+	si.bUsbDevice = bUsbDevice;
+	if (dwFields & PORT_FIELD_USBINFO)
+		si.usb = std::move(usb);
+	if (!strDriver.empty() && (dwFields & (PORT_FIELD_FRIENDLYNAME | PORT_FIELD_DESC))) {
+		// Same shape as on Windows, e.g. "ftdi_sio (ttyUSB0)", so the
+		// description is derived the same way afterwards.
+		si.strFriendlyName = strDriver + " (" + szName + ")";
 	}
+	return TRUE;
 }
+
+static BOOL ReadSerInfoByPath(SSerInfo &si)
+{
+	std::string strName = SysfsBaseName(si.strDevPath);
+	if (ReadPortSysfs(strName, si))
+		return TRUE;
+	// Ports only known from /dev/serial/by-id.
+	struct stat st;
+	if (stat(si.strDevPath.c_str(), &st) != 0)
+		return FALSE;
+	si.strPortName = strName;
+	return TRUE;
+}
+
+#endif
@@ -31,12 +31,26 @@
 #ifndef __ENUMSERIAL__
 #define __ENUMSERIAL__
 
+#ifdef _WIN32
 #include <windows.h>
 
 #include <devguid.h>
 #include <setupapi.h>
 #include <stdint.h>
 #define INITGUID
+#else
+#include <stdint.h>
+
+// Minimal Win32 types so SSerInfo keeps the same layout on every platform.
+typedef int BOOL;
+typedef uint32_t DWORD;
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+#endif
 
 #include <vector>
 
@@ -44,11 +58,14 @@
 #include <stdexcept>
 
 #include <algorithm>
+#include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 
 #include <utility>
 
+#ifdef _WIN32
 // The following define is from ntddser.h in the DDK. It is also
 // needed for serial port enumeration.
 #ifndef GUID_CLASS_COMPORT
@@ -61,22 +78,190 @@ DEFINE_GUID(GUID_CLASS_COMPORT,
 DEFINE_GUID(GUID_DEVINTERFACE_COMPORT,
   0x86e0d1e0, 0x8089, 0x11d0, 0x9c, 0xe4, 0x08, 0x00, 0x3e, 0x30, 0x1f, 0x73);
 #endif
+#endif /* _WIN32 */
+
+// Result of the busy-port probe (SSerInfo::intPortState).
+enum {
+    PORT_STATE_UNPROBED = 0,         // Not probed (bIgnoreBusyPorts is FALSE)
+    PORT_STATE_AVAILABLE,            // Could be opened for read/write
+    PORT_STATE_BUSY,                 // In use or access denied
+    PORT_STATE_UNKNOWN               // Open didn't complete in time
+};
+
+// Fields of SSerInfo, for enumerating only some of them (SSerInfo::dwFields).
+// The device path and the port name (with its index) identify a port, so
+// they are always filled.
+#define PORT_FIELD_DEVPATH          0x0001
+#define PORT_FIELD_NAME             0x0002   // strPortName and intPortIndex
+#define PORT_FIELD_FRIENDLYNAME     0x0004
+#define PORT_FIELD_DESC             0x0008
+#define PORT_FIELD_USB              0x0010
+#define PORT_FIELD_USBINFO          0x0020   // SSerInfo::usb
+#define PORT_FIELD_BASIC            (PORT_FIELD_DEVPATH | PORT_FIELD_NAME)
+#define PORT_FIELD_ALL              0x003f
+
+// Properties of the USB device a port belongs to. They are read once per
+// device, however many ports (interfaces) it has.
+struct SUsbInfo {
+    SUsbInfo() : intVendorId(-1), intProductId(-1), intInterface(-1) {}
+    int intVendorId;                 // -1 if the port isn't on a USB device
+    int intProductId;
+    int intInterface;                // Interface number, -1 if unknown
+    std::string strSerial;           // Serial number, empty if none
+    std::string strManufacturer;
+    std::string strProduct;
+};
+
+// Result of the capability probe (SPortCaps::intState).
+enum {
+    PORT_CAPS_UNPROBED = 0,          // Not probed (see ProbePortsCaps)
+    PORT_CAPS_PROBED,                // Probed during this call
+    PORT_CAPS_CACHED,                // Taken from the capability cache
+    PORT_CAPS_FAILED                 // Couldn't be opened, or not in time
+};
+
+// Kind of port (SPortCaps::intKind).
+enum {
+    PORT_KIND_UNKNOWN = 0,
+    PORT_KIND_UART,                  // On-board or PCI UART (8250...)
+    PORT_KIND_CDC_ACM,               // USB modem class (ttyACM, usbser)
+    PORT_KIND_USB_SERIAL,            // USB-serial bridge (FTDI, CP210x...)
+    PORT_KIND_VIRTUAL                // A tty without hardware (pty...)
+};
+
+// Capabilities of a port. Reading them means opening the port, so they
+// are only filled by ProbePortsCaps (see PortCaps.h).
+struct SPortCaps {
+    SPortCaps() : intState(PORT_CAPS_UNPROBED), intKind(PORT_KIND_UNKNOWN),
+        intUartType(-1), dwMinBaud(0), dwMaxBaud(0), bModemControl(FALSE) {}
+    int intState;                    // One of the PORT_CAPS_* values
+    int intKind;                     // One of the PORT_KIND_* values
+    int intUartType;                 // Linux PORT_* UART type, -1 if none
+    DWORD dwMinBaud;                 // Baud range, 0 if unknown
+    DWORD dwMaxBaud;
+    BOOL bModemControl;              // Modem control lines (DTR/RTS...)
+};
 
 // Struct used when enumerating the available serial ports
 // Holds information about an individual serial port.
 struct SSerInfo {
-    SSerInfo() : bUsbDevice(FALSE) {}
-    std::string strDevPath;          // Device path for use with CreateFile()
-    std::string strPortName;         // Simple name (i.e. COM1)
+    SSerInfo() : bUsbDevice(FALSE), intPortIndex(0),
+        intPortState(PORT_STATE_UNPROBED), dwFields(PORT_FIELD_ALL) {}
+    std::string strDevPath;          // Device path for use with CreateFile() (or open() on Linux)
+    std::string strPortName;         // Simple name (i.e. COM1 or ttyUSB0)
     std::string strFriendlyName;     // Full name to be displayed to a user
     BOOL bUsbDevice;                 // Provided through a USB connection?
     std::string strPortDesc;         // friendly name without the COMx
-    int intPortIndex;
+    int intPortIndex;                // x of COMx or ttyUSBx, 0 if none, -1 if too long
+    int intPortState;                // One of the PORT_STATE_* values
+    DWORD dwFields;                  // PORT_FIELD_* values that were filled
+    SUsbInfo usb;                    // USB device (PORT_FIELD_USBINFO)
+    SPortCaps caps;                  // Capabilities, see ProbePortsCaps
 };
 
 // Routine for enumerating the available serial ports. Throws a std::string on
 // failure, describing the error that occurred. If bIgnoreBusyPorts is TRUE,
-// ports that can't be opened for read/write access are not included.
+// ports that can't be opened for read/write access are not included; ports
+// whose open doesn't complete in time are kept as PORT_STATE_UNKNOWN.
 void EnumSerialPorts(std::vector<SSerInfo> &asi, BOOL bIgnoreBusyPorts=TRUE);
 
+// Same as above, but only returns the ports matching filter (see
+// PortFilter.h). The backends test the filter before reading the
+// properties it doesn't need.
+struct SPortFilter;
+void EnumSerialPorts(std::vector<SSerInfo> &asi, const SPortFilter &filter,
+	BOOL bIgnoreBusyPorts=TRUE);
+
+// Options of EnumSerialPorts, EnumSerialPortsAt and EnumSerialPortsStreaming
+// (PORT_ENUM_* values). PORT_ENUM_PROBE_UARTS asks the driver of the legacy
+// ttys that sysfs doesn't describe whether they have a UART (Linux, see
+// PortUart.h).
+#define PORT_ENUM_PROBE_UARTS       0x0100
+
+// Same as above, but only fills the fields of dwFields (PORT_FIELD_*
+// values); the properties behind the other ones are never read. The
+// missing fields can be fetched later with FetchSerInfoFields. dwOptions
+// holds PORT_ENUM_* values.
+void EnumSerialPorts(std::vector<SSerInfo> &asi, const SPortFilter &filter,
+	DWORD dwFields, BOOL bIgnoreBusyPorts, DWORD dwOptions=0);
+
+// Options of EnumSerialPortsStreaming (PORT_STREAM_* values, and the
+// PORT_ENUM_* ones).
+#define PORT_STREAM_SORT            0x0001   // Sort the final list
+#define PORT_STREAM_IGNORE_BUSY     0x0002   // Drop the busy ports from it
+
+// Called with each new port found. Returns false to stop the enumeration.
+typedef std::function<bool(const SSerInfo &si)> PortFoundCallback;
+
+// Streaming variant of EnumSerialPorts: fnFound is called from the calling
+// thread with each port as soon as its backend has read it, so the first
+// one comes after a single device lookup rather than the whole scan. Ports
+// are deduplicated as they come: one reported again by a secondary source
+// only completes its entry in asi, which receives the final list. The
+// final pass is optional: with PORT_STREAM_SORT asi is sorted like
+// EnumSerialPorts does, with PORT_STREAM_IGNORE_BUSY the ports are probed
+// once all were found and the busy ones are dropped from asi (fnFound has
+// seen them already). Returns false if fnFound stopped the enumeration.
+// Throws a std::string on failure.
+bool EnumSerialPortsStreaming(std::vector<SSerInfo> &asi,
+	const PortFoundCallback &fnFound, const SPortFilter &filter, DWORD dwFields,
+	DWORD dwOptions);
+
+// Receives the ports of a backend one at a time, as soon as each is read.
+// Returns false to stop the backend.
+typedef std::function<bool(SSerInfo &si)> PortSink;
+
+// Fills the fields of dwFields that si doesn't have yet, looking the port
+// up again by its device path. Returns FALSE if the port is gone.
+BOOL FetchSerInfoFields(SSerInfo &si, DWORD dwFields);
+
+// Sort order of EnumSerialPorts: port index, then device path.
+bool compareSerialInfoByIndex(const SSerInfo &a, const SSerInfo &b);
+
+// TRUE if both entries describe the same port with the same properties.
+bool IsSameSerInfo(const SSerInfo &a, const SSerInfo &b);
+
+// Fills the fields a backend left empty (port name, description, index...)
+// from the ones it provided, among those of rsi.dwFields. EnumSerialPorts
+// calls it on every entry.
+void NormalizeSerInfo(SSerInfo &si);
+
+// Splits a friendly name of the form "ACME Port (COM4)" into its
+// description ("ACME Port") and port ("COM4"). Returns false if the name
+// doesn't end with "(...)".
+bool SplitFriendlyName(std::string_view svName,
+	std::string_view &svDesc, std::string_view &svPort);
+
+#ifndef _WIN32
+// EnumSerialPorts, reading <strRoot>/sys and <strRoot>/dev instead of the
+// live system (see EnumPortsSysfs).
+void EnumSerialPortsAt(const std::string &strRoot, std::vector<SSerInfo> &asi,
+	const SPortFilter &filter, DWORD dwFields, BOOL bIgnoreBusyPorts,
+	DWORD dwOptions=0);
+
+// Linux backend used by EnumSerialPorts. Walks <strRoot>/sys/class/tty once
+// and keeps every tty that is backed by a real device, leaving out the
+// empty legacy UART slots (see PortUart.h). strRoot is empty for the live
+// system; pass the path of a fake sysfs (and proc) tree to test against it.
+// Ports not matching pFilter (if not NULL) are skipped, and only the
+// fields of dwFields are read. With bProbeUarts, the legacy ttys that
+// neither sysfs nor /proc describe are checked with TIOCGSERIAL (see
+// ProbeUartsIoctl); they are kept otherwise.
+void EnumPortsSysfs(std::vector<SSerInfo> &asi, const std::string &strRoot="",
+	const SPortFilter *pFilter=NULL, DWORD dwFields=PORT_FIELD_ALL,
+	bool bProbeUarts=false);
+// Same, handing each port to fnSink as soon as it is read.
+void EnumPortsSysfs(const PortSink &fnSink, const std::string &strRoot,
+	const SPortFilter *pFilter, DWORD dwFields, bool bProbeUarts=false);
+
+// Lists the ports linked from <strRoot>/dev/serial/by-id, named after the
+// link. Used as a secondary source by EnumSerialPorts.
+void EnumPortsSerialById(std::vector<SSerInfo> &asi, const std::string &strRoot="");
+
+// Reads a single tty (e.g. "ttyUSB0") the same way EnumPortsSysfs does.
+// Returns FALSE if it doesn't exist or isn't backed by a device.
+BOOL ReadPortSysfs(const std::string &strName, SSerInfo &si,
+	const std::string &strRoot="");
+#endif
+
 #endif /* __ENUMSERIAL__ */
@@ -0,0 +1,355 @@
+/*************************************************************************
+* Persistent enumeration cache
+*
+* See PortCache.h for an overview.
+*
+* The file is a SPortCacheHeader followed by the port table in the packed
+* layout of PortPacked.h, so it is used in place once mapped.
+************************************************************************/
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "PortCache.h"
+#include "PortPacked.h"
+
+#define PORT_CACHE_MAGIC 0x41434345	// "ECCA"
+#define PORT_CACHE_VERSION 2	// 2: USB device fields
+
+struct SPortCacheHeader {
+	uint32_t dwMagic;
+	uint32_t dwVersion;
+	unsigned long long ullFingerprint;
+	unsigned long long ullPackedSize;    // Bytes following the header
+};
+
+// 64-bit FNV-1a, good enough to detect changes.
+static void HashBytes(unsigned long long &ullHash, const void *pData, size_t len)
+{
+	const unsigned char *p = (const unsigned char*) pData;
+	for (size_t ii = 0; ii < len; ii++) {
+		ullHash ^= p[ii];
+		ullHash *= 0x100000001b3ULL;
+	}
+}
+
+#ifdef _WIN32
+
+unsigned long long GetDeviceTreeFingerprint(const std::string & /*strRoot*/)
+{
+	unsigned long long ullHash = 0xcbf29ce484222325ULL;
+
+	// Windows updates the COM port interface class key whenever an
+	// interface is registered or removed.
+	HKEY hKey;
+	if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, "SYSTEM\\CurrentControlSet\\Control\\"
+		"DeviceClasses\\{86e0d1e0-8089-11d0-9ce4-08003e301f73}", 0, KEY_READ,
+		&hKey) == ERROR_SUCCESS) {
+		DWORD dwSubKeys = 0;
+		FILETIME ftWrite;
+		memset(&ftWrite, 0, sizeof(ftWrite));
+		RegQueryInfoKey(hKey, NULL, NULL, NULL, &dwSubKeys, NULL, NULL, NULL,
+			NULL, NULL, NULL, &ftWrite);
+		HashBytes(ullHash, &dwSubKeys, sizeof(dwSubKeys));
+		HashBytes(ullHash, &ftWrite, sizeof(ftWrite));
+		RegCloseKey(hKey);
+	}
+
+	// SERIALCOMM is volatile and lists every port a driver has started
+	// (including the virtual ones), keyed by device object name.
+	if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, "HARDWARE\\DEVICEMAP\\SERIALCOMM", 0,
+		KEY_READ, &hKey) == ERROR_SUCCESS) {
+		char acName[256];
+		BYTE abData[256];
+		for (DWORD dwIndex = 0; ; dwIndex++) {
+			DWORD dwNameSize = sizeof(acName);
+			DWORD dwDataSize = sizeof(abData);
+			if (RegEnumValue(hKey, dwIndex, acName, &dwNameSize, NULL, NULL,
+				abData, &dwDataSize) != ERROR_SUCCESS)
+				break;
+			HashBytes(ullHash, acName, dwNameSize);
+			HashBytes(ullHash, abData, dwDataSize);
+		}
+		RegCloseKey(hKey);
+	}
+	return ullHash;
+}
+
+bool LoadPortCache(const std::string &strCacheFile,
+	unsigned long long ullFingerprint, std::vector<SSerInfo> &asi)
+{
+	HANDLE hFile = CreateFile(strCacheFile.c_str(), GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool bOk = false;
+	LARGE_INTEGER liSize;
+	if (GetFileSizeEx(hFile, &liSize)
+		&& liSize.QuadPart >= (LONGLONG) sizeof(SPortCacheHeader)
+		&& liSize.QuadPart < 0x40000000) {
+		HANDLE hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (hMap != NULL) {
+			const char *pView = (const char*) MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+			if (pView != NULL) {
+				const SPortCacheHeader *pHeader = (const SPortCacheHeader*) pView;
+				size_t len = (size_t) liSize.QuadPart;
+				if (pHeader->dwMagic == PORT_CACHE_MAGIC
+					&& pHeader->dwVersion == PORT_CACHE_VERSION
+					&& pHeader->ullFingerprint == ullFingerprint
+					&& pHeader->ullPackedSize == len - sizeof(SPortCacheHeader))
+					bOk = UnpackSerInfo(pView + sizeof(SPortCacheHeader),
+						(size_t) pHeader->ullPackedSize, asi);
+				UnmapViewOfFile(pView);
+			}
+			CloseHandle(hMap);
+		}
+	}
+	CloseHandle(hFile);
+	return bOk;
+}
+
+static bool WriteCacheFile(const std::string &strFile, const std::string &strData)
+{
+	HANDLE hFile = CreateFile(strFile.c_str(), GENERIC_WRITE, 0, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD dwWritten = 0;
+	BOOL bOk = WriteFile(hFile, strData.data(), (DWORD) strData.size(),
+		&dwWritten, NULL);
+	CloseHandle(hFile);
+	return bOk && dwWritten == strData.size();
+}
+
+static bool RenameCacheFile(const std::string &strFrom, const std::string &strTo)
+{
+	return MoveFileEx(strFrom.c_str(), strTo.c_str(),
+		MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+static void RemoveCacheFile(const std::string &strFile)
+{
+	DeleteFile(strFile.c_str());
+}
+
+// Creates the directory of strFile if needed (not its parents: it is in
+// %LOCALAPPDATA%, which exists).
+static void MakeCacheDir(const std::string &strFile)
+{
+	size_t nSlash = strFile.find_last_of("\\/");
+	if (nSlash != std::string::npos && nSlash > 0)
+		CreateDirectory(strFile.substr(0, nSlash).c_str(), NULL);
+}
+
+static unsigned long GetProcessNumber()
+{
+	return GetCurrentProcessId();
+}
+
+std::string GetDefaultPortCachePath()
+{
+	char acDir[MAX_PATH];
+	DWORD dwLen = GetEnvironmentVariable("LOCALAPPDATA", acDir, sizeof(acDir));
+	if (dwLen == 0 || dwLen >= sizeof(acDir))
+		return std::string();
+	return std::string(acDir) + "\\enumcom.cache";
+}
+
+#else
+
+// Adds the identity and modification time of a directory to the hash.
+static void HashDirStat(unsigned long long &ullHash, const std::string &strDir)
+{
+	struct stat st;
+	if (stat(strDir.c_str(), &st) != 0) {
+		HashBytes(ullHash, "-", 1);
+		return;
+	}
+	HashBytes(ullHash, &st.st_ino, sizeof(st.st_ino));
+	HashBytes(ullHash, &st.st_mtim, sizeof(st.st_mtim));
+}
+
+unsigned long long GetDeviceTreeFingerprint(const std::string &strRoot)
+{
+	unsigned long long ullHash = 0xcbf29ce484222325ULL;
+
+	// sysfs directories keep their creation time, so hash the names (and
+	// inodes, which change when a tty is re-created) of the class entries.
+	// This is a single getdents() pass, no link is resolved.
+	std::string strClass = strRoot + "/sys/class/tty";
+	DIR *pDir = opendir(strClass.c_str());
+	if (pDir != NULL) {
+		struct dirent *pEnt;
+		while ((pEnt = readdir(pDir)) != NULL) {
+			HashBytes(ullHash, pEnt->d_name, strlen(pEnt->d_name) + 1);
+			HashBytes(ullHash, &pEnt->d_ino, sizeof(pEnt->d_ino));
+		}
+		closedir(pDir);
+	}
+
+	// devtmpfs and the udev links are tmpfs: their mtime moves on every
+	// node or link added or removed, and /dev is recreated at boot.
+	HashDirStat(ullHash, strRoot + "/dev");
+	HashDirStat(ullHash, strRoot + "/dev/serial/by-id");
+	return ullHash;
+}
+
+bool LoadPortCache(const std::string &strCacheFile,
+	unsigned long long ullFingerprint, std::vector<SSerInfo> &asi)
+{
+	int fd = open(strCacheFile.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	bool bOk = false;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(SPortCacheHeader)
+		&& st.st_size < 0x40000000) {
+		size_t len = (size_t) st.st_size;
+		void *pView = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (pView != MAP_FAILED) {
+			const SPortCacheHeader *pHeader = (const SPortCacheHeader*) pView;
+			if (pHeader->dwMagic == PORT_CACHE_MAGIC
+				&& pHeader->dwVersion == PORT_CACHE_VERSION
+				&& pHeader->ullFingerprint == ullFingerprint
+				&& pHeader->ullPackedSize == len - sizeof(SPortCacheHeader))
+				bOk = UnpackSerInfo((const char*) pView + sizeof(SPortCacheHeader),
+					(size_t) pHeader->ullPackedSize, asi);
+			munmap(pView, len);
+		}
+	}
+	close(fd);
+	return bOk;
+}
+
+static bool WriteCacheFile(const std::string &strFile, const std::string &strData)
+{
+	int fd = open(strFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+	size_t done = 0;
+	while (done < strData.size()) {
+		ssize_t len = write(fd, strData.data() + done, strData.size() - done);
+		if (len <= 0) {
+			close(fd);
+			return false;
+		}
+		done += (size_t) len;
+	}
+	return close(fd) == 0;
+}
+
+static bool RenameCacheFile(const std::string &strFrom, const std::string &strTo)
+{
+	return rename(strFrom.c_str(), strTo.c_str()) == 0;
+}
+
+static void RemoveCacheFile(const std::string &strFile)
+{
+	unlink(strFile.c_str());
+}
+
+// Creates the directory of strFile and its parents if needed, private to
+// the user like XDG wants: ~/.cache doesn't exist on a fresh account.
+static void MakeCacheDir(const std::string &strFile)
+{
+	size_t nSlash = strFile.rfind('/');
+	if (nSlash == std::string::npos || nSlash == 0)
+		return;
+	std::string strDir = strFile.substr(0, nSlash);
+	if (mkdir(strDir.c_str(), 0700) == 0 || errno != ENOENT)
+		return;
+	MakeCacheDir(strDir);
+	mkdir(strDir.c_str(), 0700);
+}
+
+static unsigned long GetProcessNumber()
+{
+	return (unsigned long) getpid();
+}
+
+std::string GetDefaultPortCachePath()
+{
+	const char *szDir = getenv("XDG_CACHE_HOME");
+	if (szDir != NULL && szDir[0] != '\0')
+		return std::string(szDir) + "/enumcom.cache";
+	szDir = getenv("HOME");
+	if (szDir != NULL && szDir[0] != '\0')
+		return std::string(szDir) + "/.cache/enumcom.cache";
+	return std::string();
+}
+
+#endif
+
+bool SavePortCache(const std::string &strCacheFile,
+	unsigned long long ullFingerprint, const std::vector<SSerInfo> &asi)
+{
+	std::string strPacked;
+	PackSerInfo(asi, 0, strPacked);
+
+	SPortCacheHeader header;
+	header.dwMagic = PORT_CACHE_MAGIC;
+	header.dwVersion = PORT_CACHE_VERSION;
+	header.ullFingerprint = ullFingerprint;
+	header.ullPackedSize = strPacked.size();
+	strPacked.insert(0, (const char*) &header, sizeof(header));
+	return SaveCacheFile(strCacheFile, strPacked);
+}
+
+bool SaveCacheFile(const std::string &strFile, const std::string &strData)
+{
+	// Write aside then rename, so a concurrent reader sees either the old
+	// or the new file, never a partial one.
+	std::string strTemp = strFile + "." + std::to_string(GetProcessNumber())
+		+ ".tmp";
+	MakeCacheDir(strFile);
+	if (!WriteCacheFile(strTemp, strData) || !RenameCacheFile(strTemp, strFile)) {
+		RemoveCacheFile(strTemp);
+		return false;
+	}
+	return true;
+}
+
+bool LoadCacheFile(const std::string &strFile, std::string &strData)
+{
+	FILE *pFile = fopen(strFile.c_str(), "rb");
+	if (pFile == NULL)
+		return false;
+	strData.clear();
+	char acBuffer[4096];
+	size_t len;
+	while ((len = fread(acBuffer, 1, sizeof(acBuffer), pFile)) > 0) {
+		strData.append(acBuffer, len);
+		if (strData.size() >= 0x40000000)
+			break;
+	}
+	bool bOk = !ferror(pFile) && strData.size() < 0x40000000;
+	fclose(pFile);
+	return bOk;
+}
+
+bool EnumSerialPortsCached(std::vector<SSerInfo> &asi,
+	const std::string &strCacheFile)
+{
+	// Fingerprint before enumerating: if the tree changes meanwhile, the
+	// saved fingerprint is already stale and the next run enumerates.
+	unsigned long long ullFingerprint = GetDeviceTreeFingerprint();
+	if (!strCacheFile.empty() && LoadPortCache(strCacheFile, ullFingerprint, asi))
+		return true;
+
+	EnumSerialPorts(asi, FALSE /*include all*/);
+	if (!strCacheFile.empty())
+		SavePortCache(strCacheFile, ullFingerprint, asi);
+	return false;
+}
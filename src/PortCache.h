@@ -0,0 +1,56 @@
+/*************************************************************************
+* Persistent enumeration cache
+*
+* The result of an enumeration is saved to a small binary file along with
+* a fingerprint of the device tree. As long as the fingerprint doesn't
+* change, later runs map the file and reuse its content instead of
+* enumerating again. Computing the fingerprint only lists directories (or
+* reads two registry keys on Windows), which is much cheaper than reading
+* the properties of every device.
+************************************************************************/
+
+#ifndef __PORTCACHE__
+#define __PORTCACHE__
+
+#include <string>
+#include <vector>
+
+#include "EnumSerial.h"
+
+// Cheap fingerprint of the device tree: it changes whenever a serial port
+// may have been added, removed or rebound. strRoot is the root of the
+// sysfs/devtmpfs tree on Linux (empty for the live system), ignored on
+// Windows.
+unsigned long long GetDeviceTreeFingerprint(const std::string &strRoot="");
+
+// Maps strCacheFile and fills asi from it if it was saved with the same
+// fingerprint. Returns false if the file is missing, stale or corrupt.
+bool LoadPortCache(const std::string &strCacheFile,
+	unsigned long long ullFingerprint, std::vector<SSerInfo> &asi);
+
+// Saves asi to strCacheFile, replacing it atomically. Returns false on
+// failure; the cache is only an optimization, so callers may ignore it.
+bool SavePortCache(const std::string &strCacheFile,
+	unsigned long long ullFingerprint, const std::vector<SSerInfo> &asi);
+
+// Replaces strFile with strData atomically: written aside, then renamed,
+// so a concurrent reader sees either the old or the new file. Returns
+// false on failure. Shared with the other caches (see PortCaps.h).
+bool SaveCacheFile(const std::string &strFile, const std::string &strData);
+
+// Reads the whole of strFile into strData. Returns false if it can't be
+// read or is unreasonably large.
+bool LoadCacheFile(const std::string &strFile, std::string &strData);
+
+// Per-user cache file: $XDG_CACHE_HOME/enumcom.cache (~/.cache by default)
+// or %LOCALAPPDATA%\enumcom.cache. Empty if there is no such directory.
+std::string GetDefaultPortCachePath();
+
+// EnumSerialPorts(asi, FALSE) backed by the cache. Busy state isn't
+// cached, since it changes without the device tree changing. Returns
+// true if the result came from the cache. Throws a std::string like
+// EnumSerialPorts.
+bool EnumSerialPortsCached(std::vector<SSerInfo> &asi,
+	const std::string &strCacheFile);
+
+#endif /* __PORTCACHE__ */
@@ -0,0 +1,430 @@
+/*************************************************************************
+* Port capability probing
+*
+* See PortCaps.h for an overview.
+*
+* The cache file is a header (magic, version, count) followed by one
+* record per port: the device path and USB serial number, each a u32
+* length and its bytes, the USB vendor and product ids and the time the
+* port was last seen, then the capabilities as six 32-bit integers.
+************************************************************************/
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+#include <ctime>
+#include <memory>
+
+#include "PortCache.h"
+#include "PortCaps.h"
+
+#define PORT_CAPS_MAGIC 0x50434345	// "ECCP"
+#define PORT_CAPS_VERSION 2
+
+// How often Find refreshes the time an entry was last seen, in seconds.
+#define PORT_CAPS_SEEN_STEP (24 * 3600)
+
+const char *PortKindName(int intKind)
+{
+	switch (intKind) {
+	case PORT_KIND_UART: return "uart";
+	case PORT_KIND_CDC_ACM: return "cdc-acm";
+	case PORT_KIND_USB_SERIAL: return "usb-serial";
+	case PORT_KIND_VIRTUAL: return "virtual";
+	default: return "unknown";
+	}
+}
+
+#ifdef _WIN32
+
+// Baud rates of the BAUD_* bits of COMMPROP, in increasing order.
+static const struct {
+	DWORD dwBit;
+	DWORD dwBaud;
+} s_aBaudBits[] = {
+	{ BAUD_075, 75 }, { BAUD_110, 110 }, { BAUD_134_5, 134 }, { BAUD_150, 150 },
+	{ BAUD_300, 300 }, { BAUD_600, 600 }, { BAUD_1200, 1200 },
+	{ BAUD_1800, 1800 }, { BAUD_2400, 2400 }, { BAUD_4800, 4800 },
+	{ BAUD_7200, 7200 }, { BAUD_9600, 9600 }, { BAUD_14400, 14400 },
+	{ BAUD_19200, 19200 }, { BAUD_38400, 38400 }, { BAUD_56K, 56000 },
+	{ BAUD_57600, 57600 }, { BAUD_115200, 115200 }, { BAUD_128K, 128000 }
+};
+
+bool ProbePortCaps(const std::string &strDevPath, const std::string &strPortName,
+	BOOL bUsbDevice, SPortCaps &caps)
+{
+	HANDLE hCom = CreateFile(strDevPath.c_str(), GENERIC_READ | GENERIC_WRITE,
+		0, NULL, OPEN_EXISTING, 0, NULL);
+	if (hCom == INVALID_HANDLE_VALUE)
+		return false;
+
+	COMMPROP cp;
+	memset(&cp, 0, sizeof(cp));
+	if (GetCommProperties(hCom, &cp)) {
+		const size_t nBits = sizeof(s_aBaudBits) / sizeof(s_aBaudBits[0]);
+		for (size_t ii = 0; ii < nBits; ii++) {
+			if (!(cp.dwSettableBaud & s_aBaudBits[ii].dwBit))
+				continue;
+			if (caps.dwMinBaud == 0)
+				caps.dwMinBaud = s_aBaudBits[ii].dwBaud;
+			caps.dwMaxBaud = s_aBaudBits[ii].dwBaud;
+		}
+		// dwMaxBaud is BAUD_USER for programmable rates: the settable ones
+		// are the best we know then.
+		for (size_t ii = 0; ii < nBits; ii++) {
+			if (cp.dwMaxBaud == s_aBaudBits[ii].dwBit)
+				caps.dwMaxBaud = s_aBaudBits[ii].dwBaud;
+		}
+		caps.bModemControl = (cp.dwProvCapabilities & (PCF_DTRDSR | PCF_RTSCTS)) != 0;
+	}
+	(void) strPortName;
+	if (bUsbDevice)
+		caps.intKind = PORT_KIND_USB_SERIAL;
+	else if (cp.dwProvSubType == PST_RS232)
+		caps.intKind = PORT_KIND_UART;
+	else
+		caps.intKind = PORT_KIND_UNKNOWN;
+
+	::CloseHandle(hCom);
+	return true;
+}
+
+#else
+
+// Standard termios rates, in increasing order.
+static const struct {
+	speed_t speed;
+	DWORD dwBaud;
+} s_aSpeeds[] = {
+	{ B50, 50 }, { B75, 75 }, { B110, 110 }, { B134, 134 }, { B150, 150 },
+	{ B200, 200 }, { B300, 300 }, { B600, 600 }, { B1200, 1200 },
+	{ B1800, 1800 }, { B2400, 2400 }, { B4800, 4800 }, { B9600, 9600 },
+	{ B19200, 19200 }, { B38400, 38400 }, { B57600, 57600 },
+	{ B115200, 115200 }, { B230400, 230400 },
+#ifdef B4000000
+	{ B460800, 460800 }, { B500000, 500000 }, { B576000, 576000 },
+	{ B921600, 921600 }, { B1000000, 1000000 }, { B1152000, 1152000 },
+	{ B1500000, 1500000 }, { B2000000, 2000000 }, { B2500000, 2500000 },
+	{ B3000000, 3000000 }, { B3500000, 3500000 }, { B4000000, 4000000 },
+#endif
+};
+
+// true if the driver keeps speed when asked for it (drivers put back
+// the previous rate, or the nearest they can do, when they can't).
+static bool TrySpeed(int fd, const struct termios &tios, speed_t speed)
+{
+	struct termios tiosTry = tios;
+	cfsetispeed(&tiosTry, speed);
+	cfsetospeed(&tiosTry, speed);
+	if (tcsetattr(fd, TCSANOW, &tiosTry) != 0)
+		return false;
+	struct termios tiosGot;
+	return tcgetattr(fd, &tiosGot) == 0 && cfgetospeed(&tiosGot) == speed;
+}
+
+static void RestoreTermios(int fd, const struct termios &tios)
+{
+	while (tcsetattr(fd, TCSANOW, &tios) != 0 && errno == EINTR)
+		;
+}
+
+bool ProbePortCaps(const std::string &strDevPath, const std::string &strPortName,
+	BOOL bUsbDevice, SPortCaps &caps)
+{
+	// O_NONBLOCK so a modem port doesn't wait for carrier detect.
+	int fd = open(strDevPath.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	// The speeds are tried on the live port: take the advisory lock that
+	// programs using it hold (see ProbePort) and leave it alone if
+	// one does.
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		close(fd);
+		return false;
+	}
+
+	struct serial_struct ss;
+	memset(&ss, 0, sizeof(ss));
+	bool bSerial = (ioctl(fd, TIOCGSERIAL, &ss) == 0);
+	if (bSerial)
+		caps.intUartType = ss.type;
+	int intLines;
+	caps.bModemControl = (ioctl(fd, TIOCMGET, &intLines) == 0);
+
+	struct termios tios;
+	bool bTty = (tcgetattr(fd, &tios) == 0);
+	if (strPortName.compare(0, 6, "ttyACM") == 0)
+		caps.intKind = PORT_KIND_CDC_ACM;
+	else if (bUsbDevice)
+		caps.intKind = PORT_KIND_USB_SERIAL;
+	else if (bSerial && ss.type != PORT_UNKNOWN)
+		caps.intKind = PORT_KIND_UART;
+	else if (bTty)
+		caps.intKind = PORT_KIND_VIRTUAL;
+
+	const size_t nSpeeds = sizeof(s_aSpeeds) / sizeof(s_aSpeeds[0]);
+	if (caps.intKind == PORT_KIND_UART && ss.baud_base > 0) {
+		// The divisor latch gives the range without touching the port.
+		caps.dwMinBaud = s_aSpeeds[0].dwBaud;
+		caps.dwMaxBaud = (DWORD) ss.baud_base;
+	}
+	else if (bTty && (caps.intKind == PORT_KIND_USB_SERIAL
+		|| caps.intKind == PORT_KIND_VIRTUAL)) {
+		// Ask for each rate and see what sticks, then put the settings
+		// back, whatever the tries did. CDC-ACM devices are left alone:
+		// the rate is only passed on to the device, which the driver
+		// can't vouch for.
+		for (size_t ii = 0; ii < nSpeeds && caps.dwMinBaud == 0; ii++) {
+			if (TrySpeed(fd, tios, s_aSpeeds[ii].speed))
+				caps.dwMinBaud = s_aSpeeds[ii].dwBaud;
+		}
+		for (size_t ii = nSpeeds; ii > 0 && caps.dwMinBaud != 0; ii--) {
+			if (TrySpeed(fd, tios, s_aSpeeds[ii - 1].speed)) {
+				caps.dwMaxBaud = s_aSpeeds[ii - 1].dwBaud;
+				break;
+			}
+		}
+		RestoreTermios(fd, tios);
+	}
+
+	// Also releases the lock.
+	close(fd);
+	return true;
+}
+
+#endif
+
+CPortCapsCache::CPortCapsCache()
+	: m_bDirty(false)
+{
+}
+
+// The device path comes first, so that the entries of a path are
+// contiguous in the map.
+std::string CPortCapsCache::Key(const std::string &strDevPath, int intVendorId,
+	int intProductId, const std::string &strSerial)
+{
+	return strDevPath + '\n' + std::to_string(intVendorId) + ':'
+		+ std::to_string(intProductId) + '\n' + strSerial;
+}
+
+void CPortCapsCache::Add(const SEntry &entry)
+{
+	std::string strPrefix = entry.strDevPath + '\n';
+	std::map<std::string, SEntry>::iterator it = m_entries.lower_bound(strPrefix);
+	while (it != m_entries.end() && it->first.compare(0, strPrefix.size(), strPrefix) == 0)
+		it = m_entries.erase(it);
+	m_entries[Key(entry.strDevPath, entry.intVendorId, entry.intProductId,
+		entry.strSerial)] = entry;
+}
+
+bool CPortCapsCache::Find(const SSerInfo &si, SPortCaps &caps)
+{
+	std::map<std::string, SEntry>::iterator it = m_entries.find(Key(si.strDevPath,
+		si.usb.intVendorId, si.usb.intProductId, si.usb.strSerial));
+	if (it == m_entries.end())
+		return false;
+	caps = it->second.caps;
+	uint32_t dwNow = (uint32_t) time(NULL);
+	if (dwNow - it->second.dwLastSeen >= PORT_CAPS_SEEN_STEP) {
+		it->second.dwLastSeen = dwNow;
+		m_bDirty = true;
+	}
+	return true;
+}
+
+void CPortCapsCache::Store(const SSerInfo &si, const SPortCaps &caps)
+{
+	SEntry entry;
+	entry.strDevPath = si.strDevPath;
+	entry.intVendorId = si.usb.intVendorId;
+	entry.intProductId = si.usb.intProductId;
+	entry.strSerial = si.usb.strSerial;
+	entry.caps = caps;
+	entry.dwLastSeen = (uint32_t) time(NULL);
+	Add(entry);
+	m_bDirty = true;
+}
+
+static void AppendUInt32(std::string &str, uint32_t dwValue)
+{
+	str.append((const char*) &dwValue, sizeof(dwValue));
+}
+
+static bool ReadUInt32(const std::string &str, size_t &nPos, uint32_t &dwValue)
+{
+	if (str.size() - nPos < sizeof(dwValue))
+		return false;
+	memcpy(&dwValue, str.data() + nPos, sizeof(dwValue));
+	nPos += sizeof(dwValue);
+	return true;
+}
+
+static bool ReadString(const std::string &str, size_t &nPos, std::string &strValue)
+{
+	uint32_t dwLen;
+	if (!ReadUInt32(str, nPos, dwLen) || str.size() - nPos < dwLen)
+		return false;
+	strValue.assign(str, nPos, dwLen);
+	nPos += dwLen;
+	return true;
+}
+
+bool CPortCapsCache::Load(const std::string &strFile)
+{
+	m_entries.clear();
+	m_bDirty = false;
+	std::string strData;
+	if (!LoadCacheFile(strFile, strData))
+		return false;
+
+	size_t nPos = 0;
+	uint32_t dwMagic, dwVersion, dwCount;
+	if (!ReadUInt32(strData, nPos, dwMagic) || dwMagic != PORT_CAPS_MAGIC
+		|| !ReadUInt32(strData, nPos, dwVersion) || dwVersion != PORT_CAPS_VERSION
+		|| !ReadUInt32(strData, nPos, dwCount))
+		return false;
+	uint32_t dwNow = (uint32_t) time(NULL);
+	for (uint32_t ii = 0; ii < dwCount; ii++) {
+		SEntry entry;
+		uint32_t adwIds[3], adwCaps[6];
+		bool bValid = ReadString(strData, nPos, entry.strDevPath)
+			&& ReadString(strData, nPos, entry.strSerial);
+		for (size_t cc = 0; bValid && cc < 3; cc++)
+			bValid = ReadUInt32(strData, nPos, adwIds[cc]);
+		for (size_t cc = 0; bValid && cc < 6; cc++)
+			bValid = ReadUInt32(strData, nPos, adwCaps[cc]);
+		if (!bValid) {
+			m_entries.clear();
+			return false;
+		}
+		entry.intVendorId = (int) adwIds[0];
+		entry.intProductId = (int) adwIds[1];
+		entry.dwLastSeen = adwIds[2];
+		// Stale entries are left out, and the file rewritten without them.
+		if (dwNow - entry.dwLastSeen > PORT_CAPS_MAX_AGE) {
+			m_bDirty = true;
+			continue;
+		}
+		entry.caps.intState = PORT_CAPS_CACHED;
+		entry.caps.intKind = (int) adwCaps[0];
+		entry.caps.intUartType = (int) adwCaps[1];
+		entry.caps.dwMinBaud = adwCaps[2];
+		entry.caps.dwMaxBaud = adwCaps[3];
+		entry.caps.bModemControl = adwCaps[4] ? TRUE : FALSE;
+		Add(entry);
+	}
+	return true;
+}
+
+bool CPortCapsCache::Save(const std::string &strFile)
+{
+	if (!m_bDirty)
+		return true;
+
+	std::string strData;
+	AppendUInt32(strData, PORT_CAPS_MAGIC);
+	AppendUInt32(strData, PORT_CAPS_VERSION);
+	AppendUInt32(strData, (uint32_t) m_entries.size());
+	for (std::map<std::string, SEntry>::const_iterator it = m_entries.begin();
+		it != m_entries.end(); ++it) {
+		const SEntry &entry = it->second;
+		AppendUInt32(strData, (uint32_t) entry.strDevPath.size());
+		strData.append(entry.strDevPath);
+		AppendUInt32(strData, (uint32_t) entry.strSerial.size());
+		strData.append(entry.strSerial);
+		AppendUInt32(strData, (uint32_t) entry.intVendorId);
+		AppendUInt32(strData, (uint32_t) entry.intProductId);
+		AppendUInt32(strData, entry.dwLastSeen);
+		const SPortCaps &caps = entry.caps;
+		AppendUInt32(strData, (uint32_t) caps.intKind);
+		AppendUInt32(strData, (uint32_t) caps.intUartType);
+		AppendUInt32(strData, caps.dwMinBaud);
+		AppendUInt32(strData, caps.dwMaxBaud);
+		AppendUInt32(strData, caps.bModemControl ? 1 : 0);
+		AppendUInt32(strData, 0);	// Reserved
+	}
+	if (!SaveCacheFile(strFile, strData))
+		return false;
+	m_bDirty = false;
+	return true;
+}
+
+std::string GetDefaultCapsCachePath()
+{
+	// enumcom.cache -> enumcom-caps.cache
+	std::string strPath = GetDefaultPortCachePath();
+	size_t nDot = strPath.rfind('.');
+	if (strPath.empty() || nDot == std::string::npos)
+		return std::string();
+	return strPath.insert(nDot, "-caps");
+}
+
+// What a probe needs, copied: an abandoned probe may still use it after
+// ProbePortsCaps returns.
+struct SCapsProbe {
+	std::string strDevPath;
+	std::string strPortName;
+	BOOL bUsbDevice;
+	SPortCaps caps;
+};
+
+void ProbePortsCaps(std::vector<SSerInfo> &asi, const std::string &strCacheFile,
+	unsigned nWorkers, DWORD dwTimeoutMs)
+{
+	CPortCapsCache cache;
+	if (!strCacheFile.empty())
+		cache.Load(strCacheFile);
+
+	std::vector<size_t> anToProbe;
+	std::shared_ptr<std::vector<SCapsProbe> > pProbes =
+		std::make_shared<std::vector<SCapsProbe> >();
+	for (size_t ii = 0; ii < asi.size(); ii++) {
+		if (cache.Find(asi[ii], asi[ii].caps))
+			continue;
+		SCapsProbe probe;
+		probe.strDevPath = asi[ii].strDevPath;
+		probe.strPortName = asi[ii].strPortName;
+		probe.bUsbDevice = asi[ii].bUsbDevice;
+		pProbes->push_back(probe);
+		anToProbe.push_back(ii);
+	}
+	if (anToProbe.empty()) {
+		// Still save what Find refreshed and Load pruned, or the entries
+		// of ports seen every day would expire all the same.
+		if (!strCacheFile.empty())
+			cache.Save(strCacheFile);
+		return;
+	}
+
+	// Each probe only writes its own slot, and those that time out are
+	// never read.
+	std::vector<int> aiResults;
+	RunBoundedProbes(anToProbe.size(), nWorkers, dwTimeoutMs,
+		[pProbes](size_t ii) {
+			SCapsProbe &probe = (*pProbes)[ii];
+			return ProbePortCaps(probe.strDevPath, probe.strPortName,
+				probe.bUsbDevice, probe.caps) ? 1 : 0;
+		}, aiResults);
+
+	for (size_t ii = 0; ii < anToProbe.size(); ii++) {
+		SSerInfo &si = asi[anToProbe[ii]];
+		if (aiResults[ii] == 1) {
+			si.caps = (*pProbes)[ii].caps;
+			si.caps.intState = PORT_CAPS_PROBED;
+			cache.Store(si, si.caps);
+		}
+		else
+			si.caps.intState = PORT_CAPS_FAILED;
+	}
+	if (!strCacheFile.empty())
+		cache.Save(strCacheFile);
+}
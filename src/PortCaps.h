@@ -0,0 +1,92 @@
+/*************************************************************************
+* Port capability probing
+*
+* Besides its names, a tool often needs to know what a port can do: its
+* baud range, whether it has modem control lines, whether it is a real
+* UART or a USB modem. Finding out means opening the port, so it is an
+* opt-in stage run after the enumeration: ProbePortsCaps opens the ports
+* on the bounded worker pool of PortProbe.h, each with a deadline, and
+* keeps the results in a small cache file keyed by each port's identity
+* (device path, USB vendor and product ids and serial number). A device
+* that is still there on the next run is not opened again; a different
+* adapter showing up under the same path has other ids, so it is.
+************************************************************************/
+
+#ifndef __PORTCAPS__
+#define __PORTCAPS__
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "EnumSerial.h"
+#include "PortProbe.h"
+
+// Short name of a PORT_KIND_* value: "uart", "cdc-acm", "usb-serial",
+// "virtual" or "unknown".
+const char *PortKindName(int intKind);
+
+// Opens the port and reads its capabilities into caps (intState is left
+// alone). Never blocks on carrier detect, but a misbehaving driver can
+// still hang: ProbePortsCaps runs it on a worker with a deadline. Returns
+// false if the port can't be opened, or, on Linux, if another program
+// holds its advisory lock; the settings tried are always put back.
+bool ProbePortCaps(const std::string &strDevPath, const std::string &strPortName,
+	BOOL bUsbDevice, SPortCaps &caps);
+
+// Entries not seen for this long are dropped, in seconds.
+#define PORT_CAPS_MAX_AGE (90 * 24 * 3600)
+
+// Capabilities already probed, by port identity. There is one entry per
+// device path, the latest device probed there.
+class CPortCapsCache {
+public:
+	CPortCapsCache();
+
+	// Replaces the content with that of strFile, less the entries older
+	// than PORT_CAPS_MAX_AGE. Returns false if it is missing or malformed,
+	// leaving the cache empty.
+	bool Load(const std::string &strFile);
+	// Saves the content to strFile if it changed since Load.
+	bool Save(const std::string &strFile);
+
+	// Finding an entry marks it as seen (at most once a day, so the file
+	// isn't rewritten on every run).
+	bool Find(const SSerInfo &si, SPortCaps &caps);
+	// Replaces any entry of the same device path.
+	void Store(const SSerInfo &si, const SPortCaps &caps);
+
+	size_t size() const { return m_entries.size(); }
+
+private:
+	struct SEntry {
+		std::string strDevPath;
+		int intVendorId;
+		int intProductId;
+		std::string strSerial;
+		SPortCaps caps;
+		uint32_t dwLastSeen;        // time(), in seconds
+	};
+
+	static std::string Key(const std::string &strDevPath, int intVendorId,
+		int intProductId, const std::string &strSerial);
+	void Add(const SEntry &entry);
+
+	std::map<std::string, SEntry> m_entries;
+	bool m_bDirty;                  // Changed since Load
+};
+
+// Per-user capability cache file, next to the port cache (see
+// GetDefaultPortCachePath). Empty if there is no such directory.
+std::string GetDefaultCapsCachePath();
+
+// Fills the caps of every port of asi: from the cache file strCacheFile
+// (none if empty) when it knows the port, else by probing it, at most
+// nWorkers at a time, giving up on a port after dwTimeoutMs. New results
+// are saved to the cache; failures aren't, so they are retried next time.
+void ProbePortsCaps(std::vector<SSerInfo> &asi, const std::string &strCacheFile,
+	unsigned nWorkers=PORT_PROBE_WORKERS, DWORD dwTimeoutMs=PORT_PROBE_TIMEOUT_MS);
+
+#endif /* __PORTCAPS__ */
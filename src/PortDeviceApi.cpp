@@ -0,0 +1,110 @@
+/*************************************************************************
+* Device and registry API of the Windows backends
+*
+* See PortDeviceApi.h for an overview.
+************************************************************************/
+
+#include "PortDeviceApi.h"
+
+#ifdef _WIN32
+
+class CLiveDeviceApi : public CDeviceApi {
+public:
+	DWORD GetLastError()
+	{
+		return ::GetLastError();
+	}
+
+	HDEVINFO GetClassDevs(const GUID *pGuid, DWORD dwFlags)
+	{
+		return ::SetupDiGetClassDevs(pGuid, NULL, NULL, dwFlags);
+	}
+
+	HDEVINFO CreateDeviceInfoList()
+	{
+		return ::SetupDiCreateDeviceInfoList(NULL, NULL);
+	}
+
+	BOOL DestroyDeviceInfoList(HDEVINFO hDevInfo)
+	{
+		return ::SetupDiDestroyDeviceInfoList(hDevInfo);
+	}
+
+	BOOL EnumDeviceInterfaces(HDEVINFO hDevInfo, const GUID *pGuid,
+		DWORD dwIndex, SP_DEVICE_INTERFACE_DATA *pIfcData)
+	{
+		return ::SetupDiEnumDeviceInterfaces(hDevInfo, NULL, pGuid, dwIndex, pIfcData);
+	}
+
+	BOOL OpenDeviceInterface(HDEVINFO hDevInfo, const char *szPath,
+		SP_DEVICE_INTERFACE_DATA *pIfcData)
+	{
+		return ::SetupDiOpenDeviceInterface(hDevInfo, szPath, 0, pIfcData);
+	}
+
+	BOOL GetDeviceInterfaceDetail(HDEVINFO hDevInfo,
+		SP_DEVICE_INTERFACE_DATA *pIfcData, SP_DEVICE_INTERFACE_DETAIL_DATA *pDetData,
+		DWORD dwSize, DWORD *pdwRequired, SP_DEVINFO_DATA *pDevData)
+	{
+		return ::SetupDiGetDeviceInterfaceDetail(hDevInfo, pIfcData, pDetData,
+			dwSize, pdwRequired, pDevData);
+	}
+
+	BOOL GetDeviceRegistryProperty(HDEVINFO hDevInfo,
+		SP_DEVINFO_DATA *pDevData, DWORD dwProperty, BYTE *pBuffer, DWORD dwSize,
+		DWORD *pdwRequired)
+	{
+		return ::SetupDiGetDeviceRegistryProperty(hDevInfo, pDevData, dwProperty,
+			NULL, pBuffer, dwSize, pdwRequired);
+	}
+
+	CONFIGRET GetDeviceId(DEVINST devInst, char *pBuffer, ULONG ulSize)
+	{
+		return ::CM_Get_Device_ID(devInst, pBuffer, ulSize, 0);
+	}
+
+	CONFIGRET GetParent(DEVINST *pParent, DEVINST devInst)
+	{
+		return ::CM_Get_Parent(pParent, devInst, 0);
+	}
+
+	CONFIGRET GetDevNodeRegistryProperty(DEVINST devInst,
+		ULONG ulProperty, void *pBuffer, ULONG *pulSize)
+	{
+		return ::CM_Get_DevNode_Registry_Property(devInst, ulProperty, NULL,
+			pBuffer, pulSize, 0);
+	}
+
+	DWORD QueryDosDevices(const char *szName, char *pBuffer, DWORD dwSize)
+	{
+		return ::QueryDosDevice(szName, pBuffer, dwSize);
+	}
+
+	LONG OpenKey(HKEY hKey, const char *szSubKey, HKEY *phResult)
+	{
+		return ::RegOpenKeyEx(hKey, szSubKey, 0, KEY_READ, phResult);
+	}
+
+	LONG EnumKey(HKEY hKey, DWORD dwIndex, char *pName, DWORD *pdwSize)
+	{
+		return ::RegEnumKeyEx(hKey, dwIndex, pName, pdwSize, NULL, NULL, NULL, NULL);
+	}
+
+	LONG QueryValue(HKEY hKey, const char *szValue, BYTE *pData, DWORD *pdwSize)
+	{
+		return ::RegQueryValueEx(hKey, szValue, NULL, NULL, pData, pdwSize);
+	}
+
+	LONG CloseKey(HKEY hKey)
+	{
+		return ::RegCloseKey(hKey);
+	}
+};
+
+CDeviceApi &GetLiveDeviceApi()
+{
+	static CLiveDeviceApi s_api;
+	return s_api;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,146 @@
+/*************************************************************************
+* Device and registry API of the Windows backends
+*
+* The Windows backends (PortWindows.cpp) make their SetupAPI, configuration
+* manager, DOS device and registry calls through CDeviceApi rather than
+* directly. GetLiveDeviceApi() forwards them to Windows; CFakeDeviceApi
+* (PortFakeDeviceApi.h) answers them from scripted devices, so the same
+* backends also build and run on Linux, for benchmarks.
+*
+* Outside of Windows, this header declares the subset of the Windows types
+* and constants that these calls use.
+************************************************************************/
+
+#ifndef __PORTDEVICEAPI__
+#define __PORTDEVICEAPI__
+
+#include "EnumSerial.h"
+
+#ifdef _WIN32
+#include <setupapi.h>
+#include <cfgmgr32.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+
+typedef char CHAR;
+typedef char TCHAR;
+typedef unsigned char BYTE;
+typedef BYTE *PBYTE;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uintptr_t ULONG_PTR;
+typedef void *HANDLE;
+typedef void *HDEVINFO;
+typedef struct HKEY__ *HKEY;
+typedef DWORD DEVINST;
+typedef DWORD CONFIGRET;
+
+typedef struct {
+	uint32_t Data1;
+	uint16_t Data2;
+	uint16_t Data3;
+	uint8_t Data4[8];
+} GUID;
+
+typedef struct {
+	DWORD cbSize;
+	GUID InterfaceClassGuid;
+	DWORD Flags;
+	ULONG_PTR Reserved;
+} SP_DEVICE_INTERFACE_DATA;
+
+typedef struct {
+	DWORD cbSize;
+	GUID ClassGuid;
+	DEVINST DevInst;
+	ULONG_PTR Reserved;
+} SP_DEVINFO_DATA;
+
+typedef struct {
+	DWORD cbSize;
+	CHAR DevicePath[1];
+} SP_DEVICE_INTERFACE_DETAIL_DATA;
+
+static const GUID GUID_CLASS_COMPORT = { 0x86e0d1e0L, 0x8089, 0x11d0,
+	{ 0x9c, 0xe4, 0x08, 0x00, 0x3e, 0x30, 0x1f, 0x73 } };
+
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define HKEY_LOCAL_MACHINE ((HKEY)(uintptr_t)0x80000002)
+#define KEY_READ 0x20019
+#define MAX_PATH 260
+#define MAX_DEVICE_ID_LEN 200
+
+#define ERROR_SUCCESS 0
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_INVALID_HANDLE 6
+#define ERROR_INVALID_DATA 13
+#define ERROR_INSUFFICIENT_BUFFER 122
+#define ERROR_MORE_DATA 234
+#define ERROR_NO_MORE_ITEMS 259
+
+#define DIGCF_PRESENT 0x00000002
+#define DIGCF_DEVICEINTERFACE 0x00000010
+
+#define SPDRP_DEVICEDESC 0x00000000
+#define SPDRP_SERVICE 0x00000004
+#define SPDRP_MFG 0x0000000B
+#define SPDRP_FRIENDLYNAME 0x0000000C
+#define SPDRP_LOCATION_INFORMATION 0x0000000D
+
+// The CM_DRP_* values are the SPDRP_* ones plus one.
+#define CM_DRP_DEVICEDESC 0x00000001
+#define CM_DRP_MFG 0x0000000C
+
+#define CR_SUCCESS 0x00000000
+#define CR_NO_SUCH_DEVNODE 0x0000000D
+#define CR_BUFFER_SMALL 0x0000001A
+
+#define _strnicmp strncasecmp
+#endif
+
+class CDeviceApi {
+public:
+	virtual ~CDeviceApi() {}
+
+	virtual DWORD GetLastError() = 0;
+
+	// SetupAPI
+	virtual HDEVINFO GetClassDevs(const GUID *pGuid, DWORD dwFlags) = 0;
+	virtual HDEVINFO CreateDeviceInfoList() = 0;
+	virtual BOOL DestroyDeviceInfoList(HDEVINFO hDevInfo) = 0;
+	virtual BOOL EnumDeviceInterfaces(HDEVINFO hDevInfo, const GUID *pGuid,
+		DWORD dwIndex, SP_DEVICE_INTERFACE_DATA *pIfcData) = 0;
+	virtual BOOL OpenDeviceInterface(HDEVINFO hDevInfo, const char *szPath,
+		SP_DEVICE_INTERFACE_DATA *pIfcData) = 0;
+	virtual BOOL GetDeviceInterfaceDetail(HDEVINFO hDevInfo,
+		SP_DEVICE_INTERFACE_DATA *pIfcData, SP_DEVICE_INTERFACE_DETAIL_DATA *pDetData,
+		DWORD dwSize, DWORD *pdwRequired, SP_DEVINFO_DATA *pDevData) = 0;
+	virtual BOOL GetDeviceRegistryProperty(HDEVINFO hDevInfo,
+		SP_DEVINFO_DATA *pDevData, DWORD dwProperty, BYTE *pBuffer, DWORD dwSize,
+		DWORD *pdwRequired) = 0;
+
+	// Configuration manager
+	virtual CONFIGRET GetDeviceId(DEVINST devInst, char *pBuffer, ULONG ulSize) = 0;
+	virtual CONFIGRET GetParent(DEVINST *pParent, DEVINST devInst) = 0;
+	virtual CONFIGRET GetDevNodeRegistryProperty(DEVINST devInst,
+		ULONG ulProperty, void *pBuffer, ULONG *pulSize) = 0;
+
+	// DOS device names
+	virtual DWORD QueryDosDevices(const char *szName, char *pBuffer, DWORD dwSize) = 0;
+
+	// Registry
+	virtual LONG OpenKey(HKEY hKey, const char *szSubKey, HKEY *phResult) = 0;
+	virtual LONG EnumKey(HKEY hKey, DWORD dwIndex, char *pName, DWORD *pdwSize) = 0;
+	virtual LONG QueryValue(HKEY hKey, const char *szValue, BYTE *pData,
+		DWORD *pdwSize) = 0;
+	virtual LONG CloseKey(HKEY hKey) = 0;
+};
+
+#ifdef _WIN32
+// Forwards every call to Windows.
+CDeviceApi &GetLiveDeviceApi();
+#endif
+
+#endif /* __PORTDEVICEAPI__ */
@@ -0,0 +1,37 @@
+/*************************************************************************
+* Port snapshot differences
+*
+* See PortDiff.h for an overview.
+************************************************************************/
+
+#include "PortDiff.h"
+
+size_t DiffPortSnapshots(const std::vector<SSerInfo> &asiOld,
+	const std::vector<SSerInfo> &asiNew, const PortEventCallback &fnEvent)
+{
+	size_t nEvents = 0;
+	size_t iOld = 0;
+	size_t iNew = 0;
+	while (iOld < asiOld.size() || iNew < asiNew.size()) {
+		if (iNew == asiNew.size()
+			|| (iOld < asiOld.size() && compareSerialInfoByIndex(asiOld[iOld], asiNew[iNew]))) {
+			fnEvent(PORT_EVENT_REMOVE, asiOld[iOld++]);
+			nEvents++;
+		}
+		else if (iOld == asiOld.size()
+			|| compareSerialInfoByIndex(asiNew[iNew], asiOld[iOld])) {
+			fnEvent(PORT_EVENT_ADD, asiNew[iNew++]);
+			nEvents++;
+		}
+		else {
+			// Same index and device path.
+			if (!IsSameSerInfo(asiOld[iOld], asiNew[iNew])) {
+				fnEvent(PORT_EVENT_CHANGE, asiNew[iNew]);
+				nEvents++;
+			}
+			iOld++;
+			iNew++;
+		}
+	}
+	return nEvents;
+}
@@ -0,0 +1,38 @@
+/*************************************************************************
+* Port snapshot differences
+*
+* DiffPortSnapshots compares two port lists sorted the way EnumSerialPorts
+* sorts them (compareSerialInfoByIndex: port index, then device path) in a
+* single merge pass, and reports the ports added, removed and changed. Its
+* cost is linear in the size of the lists, and it calls back only for what
+* differs, so that callers can print or forward just the changes.
+************************************************************************/
+
+#ifndef __PORTDIFF__
+#define __PORTDIFF__
+
+#include <functional>
+#include <vector>
+
+#include "EnumSerial.h"
+
+// Kind of change between two port lists.
+enum {
+	PORT_EVENT_ADD = 1,
+	PORT_EVENT_REMOVE,
+	PORT_EVENT_CHANGE
+};
+
+// Called once per changed port. For PORT_EVENT_REMOVE si holds the last
+// known information.
+typedef std::function<void(int intEvent, const SSerInfo &si)> PortEventCallback;
+
+// Calls fnEvent for each port of asiNew missing from asiOld (ADD), each
+// port of asiOld missing from asiNew (REMOVE) and each port in both whose
+// fields differ (CHANGE, see IsSameSerInfo), in list order. Ports are
+// matched on their index and device path; both lists must be sorted with
+// compareSerialInfoByIndex. Returns the number of events.
+size_t DiffPortSnapshots(const std::vector<SSerInfo> &asiOld,
+	const std::vector<SSerInfo> &asiNew, const PortEventCallback &fnEvent);
+
+#endif /* __PORTDIFF__ */
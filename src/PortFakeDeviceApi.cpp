@@ -0,0 +1,341 @@
+/*************************************************************************
+* In-memory device and registry API
+*
+* See PortFakeDeviceApi.h for an overview.
+************************************************************************/
+
+#include <cctype>
+#include <cstring>
+
+#include "PortFakeDeviceApi.h"
+
+#ifndef CR_NO_SUCH_VALUE
+#define CR_NO_SUCH_VALUE 0x00000025
+#endif
+
+// Registry key names are compared without regard to case.
+static std::string UpperCase(const std::string &str)
+{
+	std::string strUpper(str);
+	for (size_t ii = 0; ii < strUpper.size(); ii++)
+		strUpper[ii] = (char) toupper((unsigned char) strUpper[ii]);
+	return strUpper;
+}
+
+CFakeDeviceApi::CFakeDeviceApi()
+	: m_keys(1), m_dwLastError(ERROR_SUCCESS)
+{
+	ResetCalls();
+}
+
+DEVINST CFakeDeviceApi::AddDevice(const std::string &strInstanceId, DEVINST devParent)
+{
+	SDevice device;
+	device.strInstanceId = strInstanceId;
+	device.devParent = devParent;
+	m_aDevices.push_back(device);
+	return (DEVINST) m_aDevices.size();
+}
+
+void CFakeDeviceApi::SetProperty(DEVINST devInst, DWORD dwProperty,
+	const std::string &strValue)
+{
+	m_aDevices[devInst - 1].properties[dwProperty] = strValue;
+}
+
+void CFakeDeviceApi::AddInterface(DEVINST devInst, const std::string &strDevPath)
+{
+	SInterface ifc;
+	ifc.strDevPath = strDevPath;
+	ifc.devInst = devInst;
+	m_byDevPath[UpperCase(strDevPath)] = m_aInterfaces.size();
+	m_aInterfaces.push_back(ifc);
+}
+
+void CFakeDeviceApi::AddDosDevice(const std::string &strName)
+{
+	m_astrDosDevices.push_back(strName);
+}
+
+void CFakeDeviceApi::SetRegistryValue(const std::string &strKey,
+	const std::string &strValue, const std::string &strData)
+{
+	FindSubKey(&m_keys[0], strKey, true)->values[UpperCase(strValue)] = strData;
+}
+
+unsigned long CFakeDeviceApi::TotalCalls() const
+{
+	unsigned long ulTotal = 0;
+	for (int ii = 0; ii < FAKE_API_COUNT; ii++)
+		ulTotal += m_aulCalls[ii];
+	return ulTotal;
+}
+
+void CFakeDeviceApi::ResetCalls()
+{
+	memset(m_aulCalls, 0, sizeof(m_aulCalls));
+}
+
+const char *CFakeDeviceApi::ApiName(int intApi)
+{
+	static const char *const s_aszNames[FAKE_API_COUNT] = {
+		"SetupDiGetClassDevs", "SetupDiCreateDeviceInfoList",
+		"SetupDiDestroyDeviceInfoList", "SetupDiEnumDeviceInterfaces",
+		"SetupDiOpenDeviceInterface", "SetupDiGetDeviceInterfaceDetail",
+		"SetupDiGetDeviceRegistryProperty", "CM_Get_Device_ID", "CM_Get_Parent",
+		"CM_Get_DevNode_Registry_Property", "QueryDosDevice", "RegOpenKeyEx",
+		"RegEnumKeyEx", "RegQueryValueEx", "RegCloseKey"
+	};
+	return (intApi >= 0 && intApi < FAKE_API_COUNT) ? s_aszNames[intApi] : "";
+}
+
+const CFakeDeviceApi::SDevice *CFakeDeviceApi::Device(DEVINST devInst) const
+{
+	return (devInst == 0 || devInst > m_aDevices.size()) ? NULL : &m_aDevices[devInst - 1];
+}
+
+CFakeDeviceApi::SKey *CFakeDeviceApi::Key(HKEY hKey)
+{
+	return (hKey == HKEY_LOCAL_MACHINE) ? &m_keys[0] : (SKey*) hKey;
+}
+
+CFakeDeviceApi::SKey *CFakeDeviceApi::FindSubKey(SKey *pKey,
+	const std::string &strPath, bool bCreate)
+{
+	size_t nStart = 0;
+	while (pKey != NULL && nStart < strPath.size()) {
+		size_t nSlash = strPath.find('\\', nStart);
+		if (nSlash == std::string::npos)
+			nSlash = strPath.size();
+		std::string strName = strPath.substr(nStart, nSlash - nStart);
+		std::map<std::string, SKey*>::iterator it = pKey->subkeys.find(UpperCase(strName));
+		if (it != pKey->subkeys.end())
+			pKey = it->second;
+		else if (bCreate) {
+			m_keys.push_back(SKey());
+			SKey *pSubKey = &m_keys.back();
+			pKey->subkeys[UpperCase(strName)] = pSubKey;
+			pKey->astrOrder.push_back(strName);
+			pKey = pSubKey;
+		}
+		else
+			pKey = NULL;
+		nStart = nSlash + 1;
+	}
+	return pKey;
+}
+
+// Copies a NUL-terminated string value. Returns the size needed, which is
+// also stored in *pdwRequired if not NULL; nothing is copied if dwSize is
+// smaller than that.
+DWORD CFakeDeviceApi::CopyString(const std::string &strValue, void *pBuffer,
+	DWORD dwSize, DWORD *pdwRequired)
+{
+	DWORD dwRequired = (DWORD) strValue.size() + 1;
+	if (pdwRequired != NULL)
+		*pdwRequired = dwRequired;
+	if (pBuffer != NULL && dwSize >= dwRequired)
+		memcpy(pBuffer, strValue.c_str(), dwRequired);
+	return dwRequired;
+}
+
+DWORD CFakeDeviceApi::GetLastError()
+{
+	return m_dwLastError;
+}
+
+HDEVINFO CFakeDeviceApi::GetClassDevs(const GUID * /*pGuid*/, DWORD /*dwFlags*/)
+{
+	m_aulCalls[FAKE_API_GET_CLASS_DEVS]++;
+	return (HDEVINFO) this;
+}
+
+HDEVINFO CFakeDeviceApi::CreateDeviceInfoList()
+{
+	m_aulCalls[FAKE_API_CREATE_DEVICE_INFO_LIST]++;
+	return (HDEVINFO) this;
+}
+
+BOOL CFakeDeviceApi::DestroyDeviceInfoList(HDEVINFO /*hDevInfo*/)
+{
+	m_aulCalls[FAKE_API_DESTROY_DEVICE_INFO_LIST]++;
+	return TRUE;
+}
+
+BOOL CFakeDeviceApi::EnumDeviceInterfaces(HDEVINFO /*hDevInfo*/, const GUID * /*pGuid*/,
+	DWORD dwIndex, SP_DEVICE_INTERFACE_DATA *pIfcData)
+{
+	m_aulCalls[FAKE_API_ENUM_DEVICE_INTERFACES]++;
+	if (dwIndex >= m_aInterfaces.size()) {
+		m_dwLastError = ERROR_NO_MORE_ITEMS;
+		return FALSE;
+	}
+	pIfcData->Reserved = (ULONG_PTR) dwIndex + 1;
+	return TRUE;
+}
+
+BOOL CFakeDeviceApi::OpenDeviceInterface(HDEVINFO /*hDevInfo*/, const char *szPath,
+	SP_DEVICE_INTERFACE_DATA *pIfcData)
+{
+	m_aulCalls[FAKE_API_OPEN_DEVICE_INTERFACE]++;
+	std::map<std::string, size_t>::const_iterator it = m_byDevPath.find(UpperCase(szPath));
+	if (it == m_byDevPath.end()) {
+		m_dwLastError = ERROR_NO_MORE_ITEMS;
+		return FALSE;
+	}
+	pIfcData->Reserved = (ULONG_PTR) it->second + 1;
+	return TRUE;
+}
+
+BOOL CFakeDeviceApi::GetDeviceInterfaceDetail(HDEVINFO /*hDevInfo*/,
+	SP_DEVICE_INTERFACE_DATA *pIfcData, SP_DEVICE_INTERFACE_DETAIL_DATA *pDetData,
+	DWORD dwSize, DWORD *pdwRequired, SP_DEVINFO_DATA *pDevData)
+{
+	m_aulCalls[FAKE_API_GET_DEVICE_INTERFACE_DETAIL]++;
+	if (pIfcData->Reserved == 0 || pIfcData->Reserved > m_aInterfaces.size()) {
+		m_dwLastError = ERROR_INVALID_HANDLE;
+		return FALSE;
+	}
+	const SInterface &ifc = m_aInterfaces[pIfcData->Reserved - 1];
+	DWORD dwRequired = (DWORD)(offsetof(SP_DEVICE_INTERFACE_DETAIL_DATA, DevicePath)
+		+ ifc.strDevPath.size() + 1);
+	if (pdwRequired != NULL)
+		*pdwRequired = dwRequired;
+	if (pDetData == NULL || dwSize < dwRequired) {
+		m_dwLastError = ERROR_INSUFFICIENT_BUFFER;
+		return FALSE;
+	}
+	memcpy(pDetData->DevicePath, ifc.strDevPath.c_str(), ifc.strDevPath.size() + 1);
+	if (pDevData != NULL)
+		pDevData->DevInst = ifc.devInst;
+	return TRUE;
+}
+
+BOOL CFakeDeviceApi::GetDeviceRegistryProperty(HDEVINFO /*hDevInfo*/,
+	SP_DEVINFO_DATA *pDevData, DWORD dwProperty, BYTE *pBuffer, DWORD dwSize,
+	DWORD *pdwRequired)
+{
+	m_aulCalls[FAKE_API_GET_DEVICE_REGISTRY_PROPERTY]++;
+	const SDevice *pDevice = Device(pDevData->DevInst);
+	std::map<DWORD, std::string>::const_iterator it;
+	if (pDevice == NULL
+		|| (it = pDevice->properties.find(dwProperty)) == pDevice->properties.end()) {
+		m_dwLastError = ERROR_INVALID_DATA;
+		return FALSE;
+	}
+	if (CopyString(it->second, pBuffer, dwSize, pdwRequired) > dwSize) {
+		m_dwLastError = ERROR_INSUFFICIENT_BUFFER;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+CONFIGRET CFakeDeviceApi::GetDeviceId(DEVINST devInst, char *pBuffer, ULONG ulSize)
+{
+	m_aulCalls[FAKE_API_GET_DEVICE_ID]++;
+	const SDevice *pDevice = Device(devInst);
+	if (pDevice == NULL)
+		return CR_NO_SUCH_DEVNODE;
+	return (CopyString(pDevice->strInstanceId, pBuffer, ulSize, NULL) > ulSize)
+		? CR_BUFFER_SMALL : CR_SUCCESS;
+}
+
+CONFIGRET CFakeDeviceApi::GetParent(DEVINST *pParent, DEVINST devInst)
+{
+	m_aulCalls[FAKE_API_GET_PARENT]++;
+	const SDevice *pDevice = Device(devInst);
+	if (pDevice == NULL || pDevice->devParent == 0)
+		return CR_NO_SUCH_DEVNODE;
+	*pParent = pDevice->devParent;
+	return CR_SUCCESS;
+}
+
+CONFIGRET CFakeDeviceApi::GetDevNodeRegistryProperty(DEVINST devInst,
+	ULONG ulProperty, void *pBuffer, ULONG *pulSize)
+{
+	m_aulCalls[FAKE_API_GET_DEVNODE_REGISTRY_PROPERTY]++;
+	const SDevice *pDevice = Device(devInst);
+	if (pDevice == NULL)
+		return CR_NO_SUCH_DEVNODE;
+	std::map<DWORD, std::string>::const_iterator it =
+		pDevice->properties.find(ulProperty - 1);
+	if (ulProperty == 0 || it == pDevice->properties.end())
+		return CR_NO_SUCH_VALUE;
+	DWORD dwRequired;
+	CONFIGRET cr = (CopyString(it->second, pBuffer, *pulSize, &dwRequired) > *pulSize)
+		? CR_BUFFER_SMALL : CR_SUCCESS;
+	*pulSize = dwRequired;
+	return cr;
+}
+
+DWORD CFakeDeviceApi::QueryDosDevices(const char *szName, char *pBuffer, DWORD dwSize)
+{
+	m_aulCalls[FAKE_API_QUERY_DOS_DEVICES]++;
+	std::string strList;
+	if (szName == NULL) {
+		for (size_t ii = 0; ii < m_astrDosDevices.size(); ii++)
+			strList.append(m_astrDosDevices[ii]).append(1, '\0');
+	}
+	else {
+		for (size_t ii = 0; ii < m_astrDosDevices.size() && strList.empty(); ii++)
+			if (UpperCase(m_astrDosDevices[ii]) == UpperCase(szName))
+				strList = "\\Device\\Serial" + std::to_string(ii) + std::string(1, '\0');
+		if (strList.empty()) {
+			m_dwLastError = ERROR_FILE_NOT_FOUND;
+			return 0;
+		}
+	}
+	strList.append(1, '\0');
+	if (strList.size() > dwSize) {
+		m_dwLastError = ERROR_INSUFFICIENT_BUFFER;
+		return 0;
+	}
+	memcpy(pBuffer, strList.data(), strList.size());
+	return (DWORD) strList.size();
+}
+
+LONG CFakeDeviceApi::OpenKey(HKEY hKey, const char *szSubKey, HKEY *phResult)
+{
+	m_aulCalls[FAKE_API_OPEN_KEY]++;
+	SKey *pKey = FindSubKey(Key(hKey), szSubKey, false);
+	if (pKey == NULL)
+		return ERROR_FILE_NOT_FOUND;
+	*phResult = (HKEY) pKey;
+	return ERROR_SUCCESS;
+}
+
+LONG CFakeDeviceApi::EnumKey(HKEY hKey, DWORD dwIndex, char *pName, DWORD *pdwSize)
+{
+	m_aulCalls[FAKE_API_ENUM_KEY]++;
+	SKey *pKey = Key(hKey);
+	if (dwIndex >= pKey->astrOrder.size())
+		return ERROR_NO_MORE_ITEMS;
+	// The size is in characters, without the NUL on return.
+	const std::string &strName = pKey->astrOrder[dwIndex];
+	if (*pdwSize <= strName.size())
+		return ERROR_MORE_DATA;
+	memcpy(pName, strName.c_str(), strName.size() + 1);
+	*pdwSize = (DWORD) strName.size();
+	return ERROR_SUCCESS;
+}
+
+LONG CFakeDeviceApi::QueryValue(HKEY hKey, const char *szValue, BYTE *pData,
+	DWORD *pdwSize)
+{
+	m_aulCalls[FAKE_API_QUERY_VALUE]++;
+	SKey *pKey = Key(hKey);
+	std::map<std::string, std::string>::const_iterator it =
+		pKey->values.find(UpperCase(szValue));
+	if (it == pKey->values.end())
+		return ERROR_FILE_NOT_FOUND;
+	DWORD dwSize = *pdwSize;
+	if (CopyString(it->second, pData, dwSize, pdwSize) > dwSize && pData != NULL)
+		return ERROR_MORE_DATA;
+	return ERROR_SUCCESS;
+}
+
+LONG CFakeDeviceApi::CloseKey(HKEY /*hKey*/)
+{
+	m_aulCalls[FAKE_API_CLOSE_KEY]++;
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,123 @@
+/*************************************************************************
+* In-memory device and registry API
+*
+* CFakeDeviceApi answers the calls of the Windows backends from devices,
+* DOS device names and registry keys scripted in memory, so the backends
+* can run anywhere against any number of ports. It behaves like Windows
+* where the backends depend on it: buffers that are too small fail with
+* ERROR_INSUFFICIENT_BUFFER (CR_BUFFER_SMALL, ERROR_MORE_DATA) and report
+* the size needed, and enumerations end with ERROR_NO_MORE_ITEMS.
+*
+* Every call is counted, by API, to measure the round-trips a backend
+* makes per device.
+************************************************************************/
+
+#ifndef __PORTFAKEDEVICEAPI__
+#define __PORTFAKEDEVICEAPI__
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PortDeviceApi.h"
+
+// Calls counted by CFakeDeviceApi.
+enum {
+	FAKE_API_GET_CLASS_DEVS = 0,
+	FAKE_API_CREATE_DEVICE_INFO_LIST,
+	FAKE_API_DESTROY_DEVICE_INFO_LIST,
+	FAKE_API_ENUM_DEVICE_INTERFACES,
+	FAKE_API_OPEN_DEVICE_INTERFACE,
+	FAKE_API_GET_DEVICE_INTERFACE_DETAIL,
+	FAKE_API_GET_DEVICE_REGISTRY_PROPERTY,
+	FAKE_API_GET_DEVICE_ID,
+	FAKE_API_GET_PARENT,
+	FAKE_API_GET_DEVNODE_REGISTRY_PROPERTY,
+	FAKE_API_QUERY_DOS_DEVICES,
+	FAKE_API_OPEN_KEY,
+	FAKE_API_ENUM_KEY,
+	FAKE_API_QUERY_VALUE,
+	FAKE_API_CLOSE_KEY,
+	FAKE_API_COUNT
+};
+
+class CFakeDeviceApi : public CDeviceApi {
+public:
+	CFakeDeviceApi();
+
+	// Adds a device node with the given instance id under devParent (0 for
+	// a root device). Returns its DEVINST.
+	DEVINST AddDevice(const std::string &strInstanceId, DEVINST devParent=0);
+	// Sets a SPDRP_* property of a device.
+	void SetProperty(DEVINST devInst, DWORD dwProperty, const std::string &strValue);
+	// Registers a COM port interface for a device.
+	void AddInterface(DEVINST devInst, const std::string &strDevPath);
+	void AddDosDevice(const std::string &strName);
+	// Sets a string value, creating the key and its parents. strKey is
+	// relative to HKEY_LOCAL_MACHINE, e.g. "Enum\USBPORTS\0000".
+	void SetRegistryValue(const std::string &strKey, const std::string &strValue,
+		const std::string &strData);
+
+	unsigned long Calls(int intApi) const { return m_aulCalls[intApi]; }
+	unsigned long TotalCalls() const;
+	void ResetCalls();
+	static const char *ApiName(int intApi);
+
+	// CDeviceApi
+	DWORD GetLastError();
+	HDEVINFO GetClassDevs(const GUID *pGuid, DWORD dwFlags);
+	HDEVINFO CreateDeviceInfoList();
+	BOOL DestroyDeviceInfoList(HDEVINFO hDevInfo);
+	BOOL EnumDeviceInterfaces(HDEVINFO hDevInfo, const GUID *pGuid,
+		DWORD dwIndex, SP_DEVICE_INTERFACE_DATA *pIfcData);
+	BOOL OpenDeviceInterface(HDEVINFO hDevInfo, const char *szPath,
+		SP_DEVICE_INTERFACE_DATA *pIfcData);
+	BOOL GetDeviceInterfaceDetail(HDEVINFO hDevInfo,
+		SP_DEVICE_INTERFACE_DATA *pIfcData, SP_DEVICE_INTERFACE_DETAIL_DATA *pDetData,
+		DWORD dwSize, DWORD *pdwRequired, SP_DEVINFO_DATA *pDevData);
+	BOOL GetDeviceRegistryProperty(HDEVINFO hDevInfo,
+		SP_DEVINFO_DATA *pDevData, DWORD dwProperty, BYTE *pBuffer, DWORD dwSize,
+		DWORD *pdwRequired);
+	CONFIGRET GetDeviceId(DEVINST devInst, char *pBuffer, ULONG ulSize);
+	CONFIGRET GetParent(DEVINST *pParent, DEVINST devInst);
+	CONFIGRET GetDevNodeRegistryProperty(DEVINST devInst,
+		ULONG ulProperty, void *pBuffer, ULONG *pulSize);
+	DWORD QueryDosDevices(const char *szName, char *pBuffer, DWORD dwSize);
+	LONG OpenKey(HKEY hKey, const char *szSubKey, HKEY *phResult);
+	LONG EnumKey(HKEY hKey, DWORD dwIndex, char *pName, DWORD *pdwSize);
+	LONG QueryValue(HKEY hKey, const char *szValue, BYTE *pData, DWORD *pdwSize);
+	LONG CloseKey(HKEY hKey);
+
+private:
+	struct SDevice {
+		std::string strInstanceId;
+		DEVINST devParent;
+		std::map<DWORD, std::string> properties;
+	};
+	struct SInterface {
+		std::string strDevPath;
+		DEVINST devInst;
+	};
+	struct SKey {
+		std::map<std::string, SKey*> subkeys;   // By upper-case name
+		std::vector<std::string> astrOrder;     // Subkey names, in creation order
+		std::map<std::string, std::string> values;
+	};
+
+	const SDevice *Device(DEVINST devInst) const;
+	SKey *Key(HKEY hKey);
+	SKey *FindSubKey(SKey *pKey, const std::string &strPath, bool bCreate);
+	DWORD CopyString(const std::string &strValue, void *pBuffer, DWORD dwSize,
+		DWORD *pdwRequired);
+
+	std::vector<SDevice> m_aDevices;
+	std::vector<SInterface> m_aInterfaces;
+	std::map<std::string, size_t> m_byDevPath;
+	std::vector<std::string> m_astrDosDevices;
+	std::deque<SKey> m_keys;               // m_keys[0] is HKEY_LOCAL_MACHINE
+	DWORD m_dwLastError;
+	unsigned long m_aulCalls[FAKE_API_COUNT];
+};
+
+#endif /* __PORTFAKEDEVICEAPI__ */
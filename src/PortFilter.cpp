@@ -0,0 +1,179 @@
+/*************************************************************************
+* Port filters
+*
+* See PortFilter.h for an overview.
+************************************************************************/
+
+#include <cctype>
+#include <cstdlib>
+
+#include "PortFilter.h"
+
+static bool EqualNoCase(char a, char b)
+{
+	return tolower((unsigned char) a) == tolower((unsigned char) b);
+}
+
+bool MatchPortGlob(const std::string &strGlob, const std::string &strName)
+{
+	// Greedy match, backtracking to the last '*' on a mismatch.
+	size_t nGlob = 0, nName = 0;
+	size_t nStarGlob = std::string::npos, nStarName = 0;
+	while (nName < strName.size()) {
+		if (nGlob < strGlob.size() && (strGlob[nGlob] == '?'
+			|| (strGlob[nGlob] != '*' && EqualNoCase(strGlob[nGlob], strName[nName])))) {
+			nGlob++;
+			nName++;
+		}
+		else if (nGlob < strGlob.size() && strGlob[nGlob] == '*') {
+			nStarGlob = nGlob++;
+			nStarName = nName;
+		}
+		else if (nStarGlob != std::string::npos) {
+			nGlob = nStarGlob + 1;
+			nName = ++nStarName;
+		}
+		else
+			return false;
+	}
+	while (nGlob < strGlob.size() && strGlob[nGlob] == '*')
+		nGlob++;
+	return nGlob == strGlob.size();
+}
+
+// Parses 4 hex digits at str[nPos], or -1.
+static int ParseHexId(const std::string &str, size_t nPos)
+{
+	if (nPos + 4 > str.size())
+		return -1;
+	int intId = 0;
+	for (size_t ii = nPos; ii < nPos + 4; ii++) {
+		if (!isxdigit((unsigned char) str[ii]))
+			return -1;
+		char c = (char) tolower((unsigned char) str[ii]);
+		intId = intId * 16 + ((c <= '9') ? c - '0' : c - 'a' + 10);
+	}
+	return intId;
+}
+
+static size_t FindNoCase(const std::string &str, const char *szNeedle)
+{
+	for (size_t ii = 0; ii < str.size(); ii++) {
+		size_t jj = 0;
+		while (szNeedle[jj] != '\0' && ii + jj < str.size()
+			&& EqualNoCase(str[ii + jj], szNeedle[jj]))
+			jj++;
+		if (szNeedle[jj] == '\0')
+			return ii;
+	}
+	return std::string::npos;
+}
+
+bool ParseUsbIds(const std::string &strId, int &intVendorId, int &intProductId)
+{
+	// USB devices have "vid_0403&pid_6001", FTDI's own bus enumerator
+	// "vid_0403+pid_6001".
+	size_t nVid = FindNoCase(strId, "vid_");
+	if (nVid == std::string::npos)
+		return false;
+	intVendorId = ParseHexId(strId, nVid + 4);
+	size_t nPid = FindNoCase(strId, "pid_");
+	intProductId = (nPid == std::string::npos) ? -1 : ParseHexId(strId, nPid + 4);
+	return intVendorId >= 0;
+}
+
+bool SPortFilter::IsEmpty() const
+{
+	return !bUsbOnly && !NeedsUsbInfo() && strNameGlob.empty()
+		&& strDriver.empty() && strDevPathPrefix.empty();
+}
+
+bool SPortFilter::MatchDevPath(const std::string &strDevPath) const
+{
+	return strDevPath.compare(0, strDevPathPrefix.size(), strDevPathPrefix) == 0;
+}
+
+bool SPortFilter::MatchName(const std::string &strPortName) const
+{
+	return strNameGlob.empty() || MatchPortGlob(strNameGlob, strPortName);
+}
+
+bool SPortFilter::MatchDriver(const std::string &strName) const
+{
+	if (strDriver.empty())
+		return true;
+	if (strName.size() != strDriver.size())
+		return false;
+	for (size_t ii = 0; ii < strName.size(); ii++)
+		if (!EqualNoCase(strName[ii], strDriver[ii]))
+			return false;
+	return true;
+}
+
+bool SPortFilter::MatchUsbIds(int intVendor, int intProduct) const
+{
+	return (intVendorId < 0 || intVendorId == intVendor)
+		&& (intProductId < 0 || intProductId == intProduct);
+}
+
+bool SPortFilter::MatchUsbInfo(const SUsbInfo &usb) const
+{
+	return MatchUsbIds(usb.intVendorId, usb.intProductId)
+		&& (strSerial.empty() || strSerial == usb.strSerial);
+}
+
+bool SPortFilter::MatchPartial(const SSerInfo &si) const
+{
+	return strDriver.empty() && !NeedsUsbInfo()
+		&& (!bUsbOnly || si.bUsbDevice)
+		&& MatchDevPath(si.strDevPath) && MatchName(si.strPortName);
+}
+
+// Parses a vendor or product id of a VVVV:PPPP term.
+static bool ParseIdTerm(const std::string &str, int &intId)
+{
+	if (str == "*") {
+		intId = -1;
+		return true;
+	}
+	if (str.empty() || str.size() > 4)
+		return false;
+	char *pEnd = NULL;
+	long lId = strtol(str.c_str(), &pEnd, 16);
+	if (*pEnd != '\0')
+		return false;
+	intId = (int) lId;
+	return true;
+}
+
+bool ParsePortFilter(const std::string &strSpec, SPortFilter &filter)
+{
+	size_t nStart = 0;
+	while (nStart <= strSpec.size()) {
+		size_t nEnd = strSpec.find(',', nStart);
+		if (nEnd == std::string::npos)
+			nEnd = strSpec.size();
+		std::string strTerm = strSpec.substr(nStart, nEnd - nStart);
+		nStart = nEnd + 1;
+
+		size_t nColon = strTerm.find(':');
+		if (strTerm == "usb")
+			filter.bUsbOnly = true;
+		else if (strTerm.compare(0, 5, "name=") == 0)
+			filter.strNameGlob = strTerm.substr(5);
+		else if (strTerm.compare(0, 7, "driver=") == 0)
+			filter.strDriver = strTerm.substr(7);
+		else if (strTerm.compare(0, 5, "path=") == 0)
+			filter.strDevPathPrefix = strTerm.substr(5);
+		else if (strTerm.compare(0, 7, "serial=") == 0)
+			filter.strSerial = strTerm.substr(7);
+		else if (nColon != std::string::npos) {
+			if (!ParseIdTerm(strTerm.substr(0, nColon), filter.intVendorId)
+				|| !ParseIdTerm(strTerm.substr(nColon + 1), filter.intProductId))
+				return false;
+		}
+		else if (!strTerm.empty())
+			return false;
+	}
+	return true;
+}
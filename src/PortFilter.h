@@ -0,0 +1,66 @@
+/*************************************************************************
+* Port filters
+*
+* An SPortFilter is handed down to the enumeration backends, which test
+* each predicate as soon as the property it needs is known, cheapest
+* first: device path, then name, driver and USB ids. The properties only
+* needed for the result (friendly name, description, location...) are
+* only read for the ports that pass every predicate.
+************************************************************************/
+
+#ifndef __PORTFILTER__
+#define __PORTFILTER__
+
+#include <string>
+
+#include "EnumSerial.h"
+
+struct SPortFilter {
+	SPortFilter() : bUsbOnly(false), intVendorId(-1), intProductId(-1) {}
+
+	bool bUsbOnly;                  // Only ports on a USB bus
+	int intVendorId;                // USB vendor id, -1 for any
+	int intProductId;               // USB product id, -1 for any
+	std::string strNameGlob;        // Port name, '*' and '?' wildcards
+	std::string strDriver;          // Driver (Linux) or service (Windows)
+	std::string strDevPathPrefix;   // Start of the device path
+	std::string strSerial;          // USB serial number
+
+	bool IsEmpty() const;
+	// true if the USB vendor/product ids have to be read.
+	bool NeedsUsbIds() const { return intVendorId >= 0 || intProductId >= 0; }
+	// true if the USB device of the port has to be read.
+	bool NeedsUsbInfo() const { return NeedsUsbIds() || !strSerial.empty(); }
+	bool NeedsUsb() const { return bUsbOnly || NeedsUsbInfo(); }
+
+	// Predicates, each true when its field is unset. Names and drivers
+	// are compared without regard to case.
+	bool MatchDevPath(const std::string &strDevPath) const;
+	bool MatchName(const std::string &strPortName) const;
+	bool MatchDriver(const std::string &strDriver) const;
+	bool MatchUsbIds(int intVendorId, int intProductId) const;
+	bool MatchUsbInfo(const SUsbInfo &usb) const;
+
+	// For sources that only know a port's path, name and bus: false if
+	// the filter tests anything else, since it can't be proven to match.
+	bool MatchPartial(const SSerInfo &si) const;
+};
+
+// Adds the comma-separated terms of strSpec to filter:
+//   usb            USB ports only
+//   VVVV:PPPP      USB vendor and product ids in hex, either may be '*'
+//   name=GLOB      port name, e.g. "COM1*" or "ttyUSB?"
+//   driver=NAME    driver name, e.g. "ftdi_sio" or "FTSER2K"
+//   path=PREFIX    device path prefix
+//   serial=SERIAL  USB serial number
+// Returns false on a malformed term.
+bool ParsePortFilter(const std::string &strSpec, SPortFilter &filter);
+
+// Case-insensitive glob match supporting '*' and '?'.
+bool MatchPortGlob(const std::string &strGlob, const std::string &strName);
+
+// Finds "vid_XXXX" and "pid_XXXX" (any case) in a Windows device path or
+// instance id. Returns false if there is no vendor id.
+bool ParseUsbIds(const std::string &strId, int &intVendorId, int &intProductId);
+
+#endif /* __PORTFILTER__ */
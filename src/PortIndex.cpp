@@ -0,0 +1,151 @@
+/*************************************************************************
+* Stable port identities
+*
+* See PortIndex.h for an overview.
+************************************************************************/
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#endif
+
+#include <cctype>
+
+#include "PortIndex.h"
+
+std::string CPortIndex::Key(const std::string &strId)
+{
+#ifdef _WIN32
+	std::string strKey = strId;
+	for (size_t ii = 0; ii < strKey.size(); ii++)
+		strKey[ii] = (char) toupper((unsigned char) strKey[ii]);
+	return strKey;
+#else
+	return strId;
+#endif
+}
+
+void CPortIndex::Add(const std::string &strId, size_t nPort)
+{
+	// The first port claiming an identity keeps it.
+	if (!strId.empty())
+		m_index.insert(std::make_pair(Key(strId), nPort));
+}
+
+const SSerInfo *CPortIndex::Find(const std::string &strId) const
+{
+	std::unordered_map<std::string, size_t>::const_iterator it = m_index.find(Key(strId));
+	return (it == m_index.end()) ? NULL : &m_asi[it->second];
+}
+
+#ifdef _WIN32
+
+// The device path of an interface is its instance id in disguise:
+// \\?\ftdibus#vid_0403+pid_6001+a9x123a#0000#{86e0d1e0-...} belongs to
+// FTDIBUS\VID_0403+PID_6001+A9X123A\0000.
+static std::string InstanceIdFromPath(const std::string &strDevPath)
+{
+	if (strDevPath.compare(0, 4, "\\\\?\\") != 0)
+		return std::string();
+	std::string strId = strDevPath.substr(4);
+	size_t nGuid = strId.rfind("#{");
+	if (nGuid != std::string::npos)
+		strId.erase(nGuid);
+	for (size_t ii = 0; ii < strId.size(); ii++)
+		if (strId[ii] == '#')
+			strId[ii] = '\\';
+	return strId;
+}
+
+#else
+
+typedef std::vector<std::pair<std::string, size_t> > PortIdList;
+
+// Lists the links of strDir pointing to known ports, by name and path.
+static void ReadLinkIds(const std::string &strDir,
+	const std::unordered_map<std::string, size_t> &byDevPath, PortIdList &aIds)
+{
+	int fdDir = open(strDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fdDir < 0)
+		return;
+	int fdList = dup(fdDir);
+	DIR *pDir = (fdList < 0) ? NULL : fdopendir(fdList);
+	if (pDir == NULL) {
+		if (fdList >= 0)
+			close(fdList);
+		close(fdDir);
+		return;
+	}
+
+	struct dirent *pEnt;
+	while ((pEnt = readdir(pDir)) != NULL) {
+		if (pEnt->d_name[0] == '.')
+			continue;
+		char acTarget[PATH_MAX];
+		ssize_t len = readlinkat(fdDir, pEnt->d_name, acTarget, sizeof(acTarget) - 1);
+		if (len <= 0)
+			continue;
+		// Links are relative, e.g. "../../ttyUSB0".
+		std::string strTarget(acTarget, len);
+		size_t nSlash = strTarget.rfind('/');
+		std::string strDevPath = "/dev/" + ((nSlash == std::string::npos)
+			? strTarget : strTarget.substr(nSlash + 1));
+		std::unordered_map<std::string, size_t>::const_iterator it =
+			byDevPath.find(strDevPath);
+		if (it == byDevPath.end())
+			continue;
+		aIds.push_back(std::make_pair(std::string(pEnt->d_name), it->second));
+		aIds.push_back(std::make_pair(strDir + "/" + pEnt->d_name, it->second));
+	}
+
+	closedir(pDir);
+	close(fdDir);
+}
+
+#endif
+
+void CPortIndex::Build(std::vector<SSerInfo> &asi, const std::string &strRoot)
+{
+	m_asi.swap(asi);
+	asi.clear();
+	m_index.clear();
+	m_index.reserve(m_asi.size() * 6);
+
+	for (size_t ii = 0; ii < m_asi.size(); ii++) {
+		const SSerInfo &si = m_asi[ii];
+		Add(si.strDevPath, ii);
+		Add(si.strPortName, ii);
+		if (!si.usb.strSerial.empty()) {
+			Add(si.usb.strSerial, ii);
+			if (si.usb.intInterface >= 0)
+				Add(si.usb.strSerial + ":" + std::to_string(si.usb.intInterface), ii);
+		}
+#ifdef _WIN32
+		Add(InstanceIdFromPath(si.strDevPath), ii);
+#endif
+	}
+
+#ifdef _WIN32
+	(void) strRoot;
+#else
+	// The udev links are resolved in one pass per directory.
+	std::unordered_map<std::string, size_t> byDevPath;
+	byDevPath.reserve(m_asi.size());
+	for (size_t ii = 0; ii < m_asi.size(); ii++)
+		byDevPath.insert(std::make_pair(m_asi[ii].strDevPath, ii));
+	PortIdList aIds;
+	ReadLinkIds(strRoot + "/dev/serial/by-id", byDevPath, aIds);
+	ReadLinkIds(strRoot + "/dev/serial/by-path", byDevPath, aIds);
+	for (size_t ii = 0; ii < aIds.size(); ii++)
+		Add(aIds[ii].first, aIds[ii].second);
+#endif
+}
+
+void EnumSerialPortsIndexed(CPortIndex &index)
+{
+	std::vector<SSerInfo> asi;
+	EnumSerialPorts(asi, FALSE /*include all*/);
+	index.Build(asi);
+}
@@ -0,0 +1,51 @@
+/*************************************************************************
+* Stable port identities
+*
+* COM numbers and /dev/ttyUSBn names change across reboots and replugs;
+* fixtures rather refer to an adapter by its USB serial number or by the
+* hub port it is plugged into. CPortIndex maps all the identities of each
+* port to its record, so resolving an identity is a single hash lookup.
+*
+* Identities of a port:
+*   - its device path and port name;
+*   - its USB serial number, alone (first port of the device) and as
+*     "<serial>:<interface>";
+*   - Linux: the names and full paths of its /dev/serial/by-id and
+*     /dev/serial/by-path links;
+*   - Windows: its device instance id (e.g. FTDIBUS\VID_0403+PID_6001+
+*     A9X123A\0000), compared without regard to case like the port name.
+************************************************************************/
+
+#ifndef __PORTINDEX__
+#define __PORTINDEX__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EnumSerial.h"
+
+class CPortIndex {
+public:
+	// Takes the ports of asi (which is left empty) and indexes them.
+	// strRoot is the root of the /dev tree on Linux, as for EnumPortsSysfs.
+	void Build(std::vector<SSerInfo> &asi, const std::string &strRoot="");
+
+	// Returns the port known as strId, or NULL.
+	const SSerInfo *Find(const std::string &strId) const;
+
+	const std::vector<SSerInfo> &Ports() const { return m_asi; }
+
+private:
+	void Add(const std::string &strId, size_t nPort);
+	static std::string Key(const std::string &strId);
+
+	std::vector<SSerInfo> m_asi;
+	std::unordered_map<std::string, size_t> m_index;
+};
+
+// Enumerates the ports (EnumSerialPorts(asi, FALSE)) into index. Throws a
+// std::string like EnumSerialPorts.
+void EnumSerialPortsIndexed(CPortIndex &index);
+
+#endif /* __PORTINDEX__ */
@@ -0,0 +1,85 @@
+/*************************************************************************
+* Merging of enumeration sources
+*
+* See PortMerge.h for an overview.
+************************************************************************/
+
+#include <cctype>
+#include <utility>
+
+#include "PortMerge.h"
+
+CPortMerger::CPortMerger(std::vector<SSerInfo> &asi, DWORD dwFields, int intKey)
+	: m_asi(asi), m_dwFields(dwFields), m_intKey(intKey)
+{
+}
+
+std::string CPortMerger::Key(const SSerInfo &si) const
+{
+	if (m_intKey == PORT_KEY_DEVPATH)
+		return si.strDevPath;
+	std::string strKey = si.strPortName.empty() ? si.strDevPath : si.strPortName;
+	for (size_t ii = 0; ii < strKey.size(); ii++)
+		strKey[ii] = (char) toupper((unsigned char) strKey[ii]);
+	return strKey;
+}
+
+static void MergeField(std::string &strTo, std::string &strFrom, bool bOverwrite)
+{
+	if (!strFrom.empty() && (bOverwrite || strTo.empty()))
+		strTo.swap(strFrom);
+}
+
+bool CPortMerger::Add(SSerInfo &si, int intSource)
+{
+	// The fields are derived from each other, so drop the unwanted ones
+	// (which some sources always provide) only after normalizing.
+	si.dwFields = m_dwFields;
+	NormalizeSerInfo(si);
+	if (!(m_dwFields & PORT_FIELD_FRIENDLYNAME))
+		si.strFriendlyName.clear();
+	if (!(m_dwFields & PORT_FIELD_DESC))
+		si.strPortDesc.clear();
+	if (!(m_dwFields & PORT_FIELD_USB))
+		si.bUsbDevice = FALSE;
+	if (!(m_dwFields & PORT_FIELD_USBINFO))
+		si.usb = SUsbInfo();
+
+	std::pair<std::unordered_map<std::string, size_t>::iterator, bool> ins =
+		m_index.insert(std::make_pair(Key(si), m_asi.size()));
+	if (ins.second) {
+		m_asi.push_back(std::move(si));
+		m_aiSource.push_back(intSource);
+		return true;
+	}
+
+	size_t ii = ins.first->second;
+	SSerInfo &rsi = m_asi[ii];
+	bool bOverwrite = (intSource >= m_aiSource[ii]);
+	MergeField(rsi.strDevPath, si.strDevPath, bOverwrite);
+	MergeField(rsi.strPortName, si.strPortName, bOverwrite);
+	MergeField(rsi.strFriendlyName, si.strFriendlyName, bOverwrite);
+	MergeField(rsi.strPortDesc, si.strPortDesc, bOverwrite);
+	rsi.bUsbDevice = rsi.bUsbDevice || si.bUsbDevice;
+	if (si.usb.intVendorId >= 0 && (bOverwrite || rsi.usb.intVendorId < 0))
+		rsi.usb = std::move(si.usb);
+	if (bOverwrite) {
+		rsi.intPortIndex = si.intPortIndex;
+		m_aiSource[ii] = intSource;
+	}
+	return false;
+}
+
+void CPortMerger::AddAll(std::vector<SSerInfo> &asiSource, int intSource)
+{
+	m_index.reserve(m_index.size() + asiSource.size());
+	m_asi.reserve(m_asi.size() + asiSource.size());
+	m_aiSource.reserve(m_aiSource.size() + asiSource.size());
+	for (size_t ii = 0; ii < asiSource.size(); ii++)
+		Add(asiSource[ii], intSource);
+}
+
+bool CPortMerger::Has(const SSerInfo &si) const
+{
+	return m_index.find(Key(si)) != m_index.end();
+}
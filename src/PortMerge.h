@@ -0,0 +1,76 @@
+/*************************************************************************
+* Merging of enumeration sources
+*
+* Several sources can report the same port: the WDM device interfaces and
+* the DOS device names on Windows, sysfs and /dev/serial/by-id on Linux.
+* CPortMerger folds them into one result set in linear time, using a hash
+* index on the canonical identity of each port.
+************************************************************************/
+
+#ifndef __PORTMERGE__
+#define __PORTMERGE__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EnumSerial.h"
+
+// Precedence of the sources, the highest wins.
+enum {
+	PORT_SOURCE_LEGACY = 0,          // COM range / DOS devices, by-id links
+	PORT_SOURCE_REGISTRY,            // HKLM\Enum on Windows 9x
+	PORT_SOURCE_DEVICE               // WDM device interfaces, sysfs
+};
+
+// Identity of a port, see CPortMerger::Key.
+enum {
+	PORT_KEY_NAME = 0,               // Port name, case insensitive (COM names)
+	PORT_KEY_DEVPATH                 // Device path
+};
+
+#ifdef _WIN32
+#define PORT_KEY_DEFAULT PORT_KEY_NAME
+#else
+#define PORT_KEY_DEFAULT PORT_KEY_DEVPATH
+#endif
+
+class CPortMerger {
+public:
+	// Merged entries are appended to asi, which should be empty. They only
+	// keep the fields of dwFields (PORT_FIELD_* values). intKey (a PORT_KEY_*
+	// value) is the identity of the ports; the default is the one of the
+	// platform's own backends.
+	explicit CPortMerger(std::vector<SSerInfo> &asi, DWORD dwFields=PORT_FIELD_ALL,
+		int intKey=PORT_KEY_DEFAULT);
+
+	// Normalizes si and adds it to the set. If the port is already known,
+	// the non-empty fields of the source with the highest precedence win
+	// (the latest one on a tie) and the other source only fills the blanks.
+	// Returns true if si is a new port.
+	bool Add(SSerInfo &si, int intSource);
+
+	// Adds every entry of asiSource.
+	void AddAll(std::vector<SSerInfo> &asiSource, int intSource);
+
+	// true if a port with the same key as si was added. si must have its
+	// key fields (see Key) set already, Has doesn't normalize it.
+	bool Has(const SSerInfo &si) const;
+
+	// Identity used to detect duplicates: the upper-cased port name (or
+	// device path if there is none) with PORT_KEY_NAME, as COM names are
+	// case insensitive; the device path with PORT_KEY_DEVPATH.
+	std::string Key(const SSerInfo &si) const;
+
+private:
+	CPortMerger(const CPortMerger &);
+	CPortMerger &operator=(const CPortMerger &);
+
+	std::vector<SSerInfo> &m_asi;
+	DWORD m_dwFields;
+	int m_intKey;
+	std::vector<int> m_aiSource;     // Best source seen for each entry
+	std::unordered_map<std::string, size_t> m_index;
+};
+
+#endif /* __PORTMERGE__ */
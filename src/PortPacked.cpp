@@ -0,0 +1,142 @@
+/*************************************************************************
+* Packed port tables
+*
+* See PortPacked.h for an overview.
+************************************************************************/
+
+#include "PortPacked.h"
+
+static void PackString(std::string &strPacked, size_t &pos,
+	SerialPortString &ref, const std::string &str)
+{
+	ref.offset = (unsigned int) pos;
+	ref.length = (unsigned int) str.size();
+	memcpy(&strPacked[pos], str.data(), str.size());
+	pos += str.size();
+	strPacked[pos++] = '\0';
+}
+
+void PackSerInfo(const std::vector<SSerInfo> &asi, unsigned int uGeneration,
+	std::string &strPacked)
+{
+	// Size everything first so the buffer is allocated once.
+	size_t stringsSize = 0;
+	for (size_t ii = 0; ii < asi.size(); ii++) {
+		const SSerInfo &si = asi[ii];
+		stringsSize += si.strDevPath.size() + si.strPortName.size()
+			+ si.strFriendlyName.size() + si.strPortDesc.size()
+			+ si.usb.strSerial.size() + si.usb.strManufacturer.size()
+			+ si.usb.strProduct.size() + 7;
+	}
+	size_t entriesOffset = sizeof(SerialPortsPackedHeader);
+	size_t stringsOffset = entriesOffset + asi.size() * sizeof(SerialPortPackedEntry);
+	strPacked.assign(stringsOffset + stringsSize, '\0');
+
+	SerialPortsPackedHeader header;
+	header.magic = SERIAL_PORTS_PACKED_MAGIC;
+	header.version = SERIAL_PORTS_PACKED_VERSION;
+	header.totalSize = (unsigned int) strPacked.size();
+	header.generation = uGeneration;
+	header.count = (unsigned int) asi.size();
+	header.entrySize = sizeof(SerialPortPackedEntry);
+	header.entriesOffset = (unsigned int) entriesOffset;
+	header.stringsOffset = (unsigned int) stringsOffset;
+	memcpy(&strPacked[0], &header, sizeof(header));
+
+	size_t pos = stringsOffset;
+	for (size_t ii = 0; ii < asi.size(); ii++) {
+		const SSerInfo &si = asi[ii];
+		SerialPortPackedEntry entry;
+		entry.intPortIndex = si.intPortIndex;
+		entry.bUsbDevice = si.bUsbDevice;
+		PackString(strPacked, pos, entry.strDevPath, si.strDevPath);
+		PackString(strPacked, pos, entry.strPortName, si.strPortName);
+		PackString(strPacked, pos, entry.strFriendlyName, si.strFriendlyName);
+		PackString(strPacked, pos, entry.strPortDesc, si.strPortDesc);
+		entry.intVendorId = si.usb.intVendorId;
+		entry.intProductId = si.usb.intProductId;
+		entry.intInterface = si.usb.intInterface;
+		PackString(strPacked, pos, entry.strSerial, si.usb.strSerial);
+		PackString(strPacked, pos, entry.strManufacturer, si.usb.strManufacturer);
+		PackString(strPacked, pos, entry.strProduct, si.usb.strProduct);
+		memcpy(&strPacked[entriesOffset + ii * sizeof(entry)], &entry, sizeof(entry));
+	}
+}
+
+static bool CheckPackedString(const SerialPortsPackedHeader *pHeader,
+	const SerialPortString &ref)
+{
+	const char *pBase = (const char*) pHeader;
+	return ref.offset >= pHeader->stringsOffset
+		&& ref.offset < pHeader->totalSize
+		&& ref.length < pHeader->totalSize - ref.offset
+		&& pBase[ref.offset + ref.length] == '\0';
+}
+
+const SerialPortsPackedHeader *CheckPackedSerInfo(const void *pData, size_t len)
+{
+	if (pData == NULL || len < sizeof(SerialPortsPackedHeader))
+		return NULL;
+	const SerialPortsPackedHeader *pHeader = (const SerialPortsPackedHeader*) pData;
+	if (pHeader->magic != SERIAL_PORTS_PACKED_MAGIC
+		|| pHeader->version != SERIAL_PORTS_PACKED_VERSION
+		|| pHeader->totalSize > len
+		|| pHeader->entrySize != sizeof(SerialPortPackedEntry)
+		|| pHeader->entriesOffset < sizeof(SerialPortsPackedHeader)
+		|| pHeader->stringsOffset > pHeader->totalSize
+		|| pHeader->entriesOffset > pHeader->stringsOffset
+		|| (pHeader->stringsOffset - pHeader->entriesOffset) / pHeader->entrySize
+			< pHeader->count)
+		return NULL;
+
+	const char *pBase = (const char*) pData;
+	for (unsigned int ii = 0; ii < pHeader->count; ii++) {
+		SerialPortPackedEntry entry;
+		memcpy(&entry, pBase + pHeader->entriesOffset + ii * sizeof(entry),
+			sizeof(entry));
+		if (!CheckPackedString(pHeader, entry.strDevPath)
+			|| !CheckPackedString(pHeader, entry.strPortName)
+			|| !CheckPackedString(pHeader, entry.strFriendlyName)
+			|| !CheckPackedString(pHeader, entry.strPortDesc)
+			|| !CheckPackedString(pHeader, entry.strSerial)
+			|| !CheckPackedString(pHeader, entry.strManufacturer)
+			|| !CheckPackedString(pHeader, entry.strProduct))
+			return NULL;
+	}
+	return pHeader;
+}
+
+bool UnpackSerInfo(const void *pData, size_t len, std::vector<SSerInfo> &asi,
+	unsigned int *puGeneration)
+{
+	const SerialPortsPackedHeader *pHeader = CheckPackedSerInfo(pData, len);
+	if (pHeader == NULL)
+		return false;
+
+	const char *pBase = (const char*) pData;
+	asi.resize(pHeader->count);
+	for (unsigned int ii = 0; ii < pHeader->count; ii++) {
+		SerialPortPackedEntry entry;
+		memcpy(&entry, pBase + pHeader->entriesOffset + ii * sizeof(entry),
+			sizeof(entry));
+		SSerInfo &si = asi[ii];
+		si.intPortIndex = entry.intPortIndex;
+		si.bUsbDevice = entry.bUsbDevice;
+		si.strDevPath.assign(pBase + entry.strDevPath.offset, entry.strDevPath.length);
+		si.strPortName.assign(pBase + entry.strPortName.offset, entry.strPortName.length);
+		si.strFriendlyName.assign(pBase + entry.strFriendlyName.offset,
+			entry.strFriendlyName.length);
+		si.strPortDesc.assign(pBase + entry.strPortDesc.offset, entry.strPortDesc.length);
+		si.usb.intVendorId = entry.intVendorId;
+		si.usb.intProductId = entry.intProductId;
+		si.usb.intInterface = entry.intInterface;
+		si.usb.strSerial.assign(pBase + entry.strSerial.offset, entry.strSerial.length);
+		si.usb.strManufacturer.assign(pBase + entry.strManufacturer.offset,
+			entry.strManufacturer.length);
+		si.usb.strProduct.assign(pBase + entry.strProduct.offset, entry.strProduct.length);
+		si.dwFields = PORT_FIELD_ALL;
+	}
+	if (puGeneration != NULL)
+		*puGeneration = pHeader->generation;
+	return true;
+}
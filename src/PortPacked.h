@@ -0,0 +1,31 @@
+/*************************************************************************
+* Packed port tables
+*
+* Converts between std::vector<SSerInfo> and the position-independent
+* layout described by SerialPortsPackedHeader in library.hpp: fixed-size
+* entries pointing into a single string pool. The same bytes can be
+* handed to DLL callers, written to disk or shared between processes.
+************************************************************************/
+
+#ifndef __PORTPACKED__
+#define __PORTPACKED__
+
+#include <string>
+#include <vector>
+
+#include "EnumSerial.h"
+#include "library.hpp"
+
+// Serializes asi into strPacked (which is replaced).
+void PackSerInfo(const std::vector<SSerInfo> &asi, unsigned int uGeneration,
+	std::string &strPacked);
+
+// Checks that the len bytes at pData hold a well-formed packed table: every
+// entry and string must lie inside the buffer. Returns NULL if not.
+const SerialPortsPackedHeader *CheckPackedSerInfo(const void *pData, size_t len);
+
+// Deserializes a packed table. Returns false if it is malformed.
+bool UnpackSerInfo(const void *pData, size_t len, std::vector<SSerInfo> &asi,
+	unsigned int *puGeneration=NULL);
+
+#endif /* __PORTPACKED__ */
@@ -0,0 +1,233 @@
+/*************************************************************************
+* Concurrent port probing
+*
+* See PortProbe.h for an overview.
+************************************************************************/
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include "PortProbe.h"
+
+typedef std::chrono::steady_clock ProbeClock;
+
+// Workers abandoned by RunBoundedProbes whose probe hasn't returned yet, in
+// all calls.
+static std::atomic<unsigned> s_nAbandoned(0);
+
+// State shared between RunBoundedProbes and its workers. It is reference
+// counted because abandoned workers may outlive the call.
+struct SProbeShared {
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::function<int(size_t)> fnProbe;
+	std::vector<int> aiResults;
+	std::vector<char> abDone;
+	std::vector<ProbeClock::time_point> atStarted;
+	std::vector<size_t> aiRunning;   // Items being probed right now
+	size_t nCount;
+	size_t nNext;                    // Next item to hand out
+	size_t nPending;                 // Items without a result yet
+};
+
+static void ProbeWorker(std::shared_ptr<SProbeShared> pShared)
+{
+	SProbeShared &rs = *pShared;
+	std::unique_lock<std::mutex> lock(rs.mtx);
+	while (rs.nNext < rs.nCount) {
+		size_t ii = rs.nNext++;
+		rs.atStarted[ii] = ProbeClock::now();
+		rs.aiRunning.push_back(ii);
+		lock.unlock();
+
+		int result = rs.fnProbe(ii);
+
+		lock.lock();
+		if (rs.abDone[ii]) {
+			// We were too slow and a replacement worker has been started,
+			// don't compete with it.
+			s_nAbandoned--;
+			return;
+		}
+		rs.aiRunning.erase(std::find(rs.aiRunning.begin(),
+			rs.aiRunning.end(), ii));
+		rs.aiResults[ii] = result;
+		rs.abDone[ii] = 1;
+		rs.nPending--;
+		rs.cv.notify_one();
+	}
+}
+
+// Starts a detached worker. Returns false if no thread could be created, or
+// if too many are hung already.
+static bool SpawnProbeWorker(const std::shared_ptr<SProbeShared> &pShared)
+{
+	if (s_nAbandoned >= PORT_PROBE_MAX_ABANDONED)
+		return false;
+	try {
+		std::thread(ProbeWorker, pShared).detach();
+		return true;
+	}
+	catch (const std::system_error &) {
+		return false;
+	}
+}
+
+void RunBoundedProbes(size_t nCount, unsigned nWorkers, DWORD dwTimeoutMs,
+	const std::function<int(size_t)> &fnProbe, std::vector<int> &aiResults)
+{
+	aiResults.assign(nCount, PROBE_TIMEOUT);
+	if (nCount == 0)
+		return;
+
+	std::shared_ptr<SProbeShared> pShared = std::make_shared<SProbeShared>();
+	SProbeShared &rs = *pShared;
+	rs.fnProbe = fnProbe;
+	rs.aiResults.assign(nCount, PROBE_TIMEOUT);
+	rs.abDone.assign(nCount, 0);
+	rs.atStarted.resize(nCount);
+	rs.nCount = nCount;
+	rs.nNext = 0;
+	rs.nPending = nCount;
+
+	if (nWorkers == 0)
+		nWorkers = 1;
+	if (nWorkers > nCount)
+		nWorkers = (unsigned)nCount;
+
+	unsigned nStarted = 0;
+	for (unsigned ww = 0; ww < nWorkers; ww++) {
+		if (SpawnProbeWorker(pShared))
+			nStarted++;
+	}
+	if (nStarted == 0) {
+		// Too many hung probes: whatever hangs them may hang this one too,
+		// so give up on everything.
+		if (s_nAbandoned >= PORT_PROBE_MAX_ABANDONED)
+			return;
+		// Out of threads: fall back to probing serially without timeout.
+		for (size_t ii = 0; ii < nCount; ii++)
+			aiResults[ii] = fnProbe(ii);
+		return;
+	}
+
+	const ProbeClock::duration timeout = std::chrono::milliseconds(dwTimeoutMs);
+	std::unique_lock<std::mutex> lock(rs.mtx);
+	while (rs.nPending > 0) {
+		if (rs.aiRunning.empty()) {
+			// Workers are between two items.
+			rs.cv.wait_for(lock, timeout);
+			continue;
+		}
+
+		// Sleep until a result comes in or the oldest probe expires.
+		ProbeClock::time_point tDeadline = rs.atStarted[rs.aiRunning[0]];
+		for (size_t rr = 1; rr < rs.aiRunning.size(); rr++) {
+			if (rs.atStarted[rs.aiRunning[rr]] < tDeadline)
+				tDeadline = rs.atStarted[rs.aiRunning[rr]];
+		}
+		rs.cv.wait_until(lock, tDeadline + timeout);
+
+		// Abandon the expired probes and replace their workers.
+		ProbeClock::time_point tNow = ProbeClock::now();
+		for (size_t rr = 0; rr < rs.aiRunning.size(); ) {
+			size_t ii = rs.aiRunning[rr];
+			if (tNow - rs.atStarted[ii] < timeout) {
+				rr++;
+				continue;
+			}
+			rs.aiRunning.erase(rs.aiRunning.begin() + rr);
+			rs.abDone[ii] = 1;
+			rs.nPending--;
+			s_nAbandoned++;
+			if (rs.nNext < rs.nCount && !SpawnProbeWorker(pShared)
+				&& rs.aiRunning.empty()) {
+				// Nobody left to take the remaining items.
+				rs.nPending -= rs.nCount - rs.nNext;
+				rs.nNext = rs.nCount;
+			}
+		}
+	}
+
+	aiResults = rs.aiResults;
+}
+
+unsigned GetAbandonedProbeCount()
+{
+	return s_nAbandoned;
+}
+
+#ifdef _WIN32
+
+int ProbePort(const std::string &strDevPath)
+{
+	HANDLE hCom = CreateFile(strDevPath.c_str(),
+		GENERIC_READ | GENERIC_WRITE,
+		0,    /* comm devices must be opened w/exclusive-access */
+		NULL, /* no security attrs */
+		OPEN_EXISTING, /* comm devices must use OPEN_EXISTING */
+		0,    /* not overlapped I/O */
+		NULL  /* hTemplate must be NULL for comm devices */
+		);
+	if (hCom == INVALID_HANDLE_VALUE)
+		return PORT_STATE_BUSY;
+
+	// It can be opened! Close it.
+	::CloseHandle(hCom);
+	return PORT_STATE_AVAILABLE;
+}
+
+#else
+
+int ProbePort(const std::string &strDevPath)
+{
+	// O_NONBLOCK so a modem port doesn't wait for carrier detect.
+	int fd = open(strDevPath.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return PORT_STATE_BUSY;
+
+	// Linux doesn't enforce exclusive access to ttys; well-behaved
+	// programs (minicom, pyserial, screen...) hold an advisory lock.
+	int state = PORT_STATE_AVAILABLE;
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0 && errno == EWOULDBLOCK)
+		state = PORT_STATE_BUSY;
+	close(fd);
+	return state;
+}
+
+#endif
+
+void ProbeBusyPorts(std::vector<SSerInfo> &asi, unsigned nWorkers,
+	DWORD dwTimeoutMs)
+{
+	// Copy the paths: an abandoned probe may still read them after
+	// we return.
+	std::shared_ptr<std::vector<std::string> > pPaths =
+		std::make_shared<std::vector<std::string> >();
+	pPaths->reserve(asi.size());
+	for (size_t ii = 0; ii < asi.size(); ii++)
+		pPaths->push_back(asi[ii].strDevPath);
+
+	std::vector<int> aiResults;
+	RunBoundedProbes(asi.size(), nWorkers, dwTimeoutMs,
+		[pPaths](size_t ii) { return ProbePort((*pPaths)[ii]); },
+		aiResults);
+
+	for (size_t ii = 0; ii < asi.size(); ii++) {
+		asi[ii].intPortState = (aiResults[ii] == PROBE_TIMEOUT)
+			? PORT_STATE_UNKNOWN : aiResults[ii];
+	}
+}
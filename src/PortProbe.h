@@ -0,0 +1,54 @@
+/*************************************************************************
+* Concurrent port probing
+*
+* Opening a serial port can block for a long time when its driver is
+* misbehaving (unplugged USB adapters, Bluetooth SPP links...). The
+* routines below open the candidates on a small pool of worker threads
+* and give up on any port that doesn't answer in time, so the whole
+* enumeration is bounded by the slowest single probe.
+************************************************************************/
+
+#ifndef __PORTPROBE__
+#define __PORTPROBE__
+
+#include <functional>
+#include <vector>
+
+#include "EnumSerial.h"
+
+// Value stored by RunBoundedProbes for a probe that didn't complete in time.
+#define PROBE_TIMEOUT (-1)
+
+// Default settings used by EnumSerialPorts.
+#define PORT_PROBE_WORKERS 16
+#define PORT_PROBE_TIMEOUT_MS 1000
+
+// Abandoned workers (see RunBoundedProbes) allowed in the whole process.
+// A driver stuck in open() would otherwise leave one more hung thread
+// behind on every scan.
+#define PORT_PROBE_MAX_ABANDONED 32
+
+// Runs fnProbe(ii) for every ii in [0, nCount) on at most nWorkers threads
+// and stores each return value in aiResults[ii]. A probe still running after
+// dwTimeoutMs is abandoned: its slot gets PROBE_TIMEOUT and a fresh worker
+// takes over the remaining items. Abandoned probes finish in the background,
+// so fnProbe must only capture data by value. Once PORT_PROBE_MAX_ABANDONED
+// of them are still hung, no worker is started any more: the items left get
+// PROBE_TIMEOUT until some of them return.
+void RunBoundedProbes(size_t nCount, unsigned nWorkers, DWORD dwTimeoutMs,
+	const std::function<int(size_t)> &fnProbe, std::vector<int> &aiResults);
+
+// Number of abandoned workers still running.
+unsigned GetAbandonedProbeCount();
+
+// Tries to open the port exclusively and returns PORT_STATE_AVAILABLE or
+// PORT_STATE_BUSY. Never blocks on carrier detect.
+int ProbePort(const std::string &strDevPath);
+
+// Sets intPortState of every entry of asi, probing them concurrently.
+// Ports that time out are reported as PORT_STATE_UNKNOWN.
+void ProbeBusyPorts(std::vector<SSerInfo> &asi,
+	unsigned nWorkers=PORT_PROBE_WORKERS,
+	DWORD dwTimeoutMs=PORT_PROBE_TIMEOUT_MS);
+
+#endif /* __PORTPROBE__ */
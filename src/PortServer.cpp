@@ -0,0 +1,362 @@
+/*************************************************************************
+* Port list daemon
+*
+* See PortServer.h for an overview.
+************************************************************************/
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "PortCache.h"
+#include "PortPacked.h"
+#include "PortServer.h"
+#include "PortWatcher.h"
+
+bool EnumSerialPortsClient(std::vector<SSerInfo> &asi,
+	const std::string &strSocketPath)
+{
+	if (!strSocketPath.empty() && QueryPortServer(strSocketPath, asi))
+		return true;
+	EnumSerialPorts(asi, FALSE /*include all*/);
+	return false;
+}
+
+#ifdef _WIN32
+
+std::string GetDefaultPortServerPath()
+{
+	return std::string();
+}
+
+void RunPortServer(const std::string & /*strSocketPath*/,
+	const volatile sig_atomic_t * /*pbStop*/)
+{
+	throw std::string("The port server isn't supported on this platform.");
+}
+
+bool QueryPortServer(const std::string & /*strSocketPath*/,
+	std::vector<SSerInfo> & /*asi*/)
+{
+	return false;
+}
+
+#else
+
+// Time a client gets to send its request and read the answer.
+#define PORT_SERVER_IO_TIMEOUT_MS 1000
+
+// Clients served at once; more wait in the listen backlog.
+#define PORT_SERVER_MAX_CLIENTS 256
+
+std::string GetDefaultPortServerPath()
+{
+	const char *szDir = getenv("XDG_RUNTIME_DIR");
+	if (szDir != NULL && szDir[0] != '\0')
+		return std::string(szDir) + "/enumcom.sock";
+	return "/tmp/enumcom-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool MakeUnixAddress(const std::string &strPath, struct sockaddr_un &addr)
+{
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strPath.empty() || strPath.size() >= sizeof(addr.sun_path))
+		return false;
+	memcpy(addr.sun_path, strPath.c_str(), strPath.size() + 1);
+	return true;
+}
+
+static void SetSocketTimeouts(int fd, int msTimeout)
+{
+	struct timeval tv;
+	tv.tv_sec = msTimeout / 1000;
+	tv.tv_usec = (msTimeout % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static int ConnectUnix(const std::string &strPath)
+{
+	struct sockaddr_un addr;
+	if (!MakeUnixAddress(strPath, addr))
+		return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	SetSocketTimeouts(fd, PORT_SERVER_IO_TIMEOUT_MS);
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// true if the process at the other end of fd runs as the same user as
+// this one. The default socket may live in /tmp, where anybody could have
+// bound it first.
+static bool IsPeerOurs(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0
+		&& len == sizeof(cred) && cred.uid == getuid();
+}
+
+static int ListenUnix(const std::string &strPath)
+{
+	struct sockaddr_un addr;
+	if (!MakeUnixAddress(strPath, addr))
+		throw std::string("Invalid socket path: ") + strPath;
+
+	// Non-blocking: RunPortServer accepts until there is nobody left.
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		throw std::string("Could not create the server socket. (err=")
+			+ std::to_string(errno) + ")";
+
+	int rc = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+	if (rc != 0 && errno == EADDRINUSE) {
+		// Either another server is running, or one died and left its
+		// socket file behind.
+		int fdOther = ConnectUnix(strPath);
+		if (fdOther >= 0) {
+			close(fdOther);
+			close(fd);
+			throw std::string("A server is already listening on ") + strPath;
+		}
+		unlink(strPath.c_str());
+		rc = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+	}
+	if (rc != 0) {
+		int err = errno;
+		close(fd);
+		throw std::string("Could not bind ") + strPath + ". (err="
+			+ std::to_string(err) + ")";
+	}
+
+	if (listen(fd, SOMAXCONN) != 0) {
+		int err = errno;
+		close(fd);
+		unlink(strPath.c_str());
+		throw std::string("Could not listen on ") + strPath + ". (err="
+			+ std::to_string(err) + ")";
+	}
+	return fd;
+}
+
+static bool WriteAll(int fd, const char *pData, size_t len)
+{
+	while (len > 0) {
+		ssize_t done = send(fd, pData, len, MSG_NOSIGNAL);
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done <= 0)
+			return false;
+		pData += done;
+		len -= (size_t) done;
+	}
+	return true;
+}
+
+typedef std::chrono::steady_clock SteadyClock;
+
+// A connection of RunPortServer.
+struct SServerClient {
+	int fd;
+	std::shared_ptr<const std::string> pAnswer;  // Set once requested
+	size_t nSent;
+	SteadyClock::time_point tDeadline;
+};
+
+// Moves client along after poll() returned intEvents for it: reads its
+// request, then writes the answer as the socket takes it. Returns false
+// once it is done with, answered or not.
+static bool ServeClient(SServerClient &client, int intEvents,
+	SteadyClock::time_point tNow, std::mutex &mtx,
+	const std::shared_ptr<const std::string> &pPacked)
+{
+	if (!client.pAnswer && (intEvents & (POLLIN | POLLHUP | POLLERR))) {
+		char cRequest = 0;
+		ssize_t len = recv(client.fd, &cRequest, 1, 0);
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return tNow < client.tDeadline;
+		if (len != 1 || cRequest != PORT_SERVER_REQUEST_PACKED)
+			return false;
+		std::lock_guard<std::mutex> lock(mtx);
+		client.pAnswer = pPacked;
+		if (!client.pAnswer)
+			return false;
+		// Most answers fit the socket buffer: try at once.
+		intEvents = POLLOUT;
+	}
+	if (client.pAnswer && (intEvents & (POLLOUT | POLLHUP | POLLERR))) {
+		const std::string &strAnswer = *client.pAnswer;
+		while (client.nSent < strAnswer.size()) {
+			ssize_t done = send(client.fd, strAnswer.data() + client.nSent,
+				strAnswer.size() - client.nSent, MSG_NOSIGNAL);
+			if (done < 0 && errno == EINTR)
+				continue;
+			if (done < 0 && errno == EAGAIN)
+				return tNow < client.tDeadline;
+			if (done <= 0)
+				return false;
+			client.nSent += (size_t) done;
+		}
+		return false;
+	}
+	return tNow < client.tDeadline;
+}
+
+void RunPortServer(const std::string &strSocketPath,
+	const volatile sig_atomic_t *pbStop)
+{
+	int fdListen = ListenUnix(strSocketPath);
+
+	// The answer is packed once per change and shared by all queries.
+	std::mutex mtx;
+	std::shared_ptr<const std::string> pPacked;
+	unsigned int uGeneration = 0;
+	auto publish = [&](const std::vector<SSerInfo> &asi) {
+		std::shared_ptr<std::string> pNew = std::make_shared<std::string>();
+		std::lock_guard<std::mutex> lock(mtx);
+		PackSerInfo(asi, ++uGeneration, *pNew);
+		pPacked = pNew;
+	};
+
+	// Hotplug events keep the table current. Without them (no netlink in
+	// some containers), re-enumerate when the device tree fingerprint moves.
+	CPortWatcher watcher;
+	bool bWatching = true;
+	try {
+		watcher.Start([&](int /*intEvent*/, const SSerInfo & /*si*/) {
+			std::vector<SSerInfo> asi;
+			watcher.GetPorts(asi);
+			publish(asi);
+		});
+		std::vector<SSerInfo> asi;
+		watcher.GetPorts(asi);
+		publish(asi);
+	}
+	catch (std::string) {
+		bWatching = false;
+	}
+	unsigned long long ullFingerprint = 0;
+
+	// Clients are served together, on non-blocking sockets, so that a slow
+	// or idle one doesn't hold up the others: each has until its deadline
+	// to send the request byte and read the answer.
+	std::vector<SServerClient> aClients;
+	std::vector<struct pollfd> apfd;
+	while (!*pbStop) {
+		SteadyClock::time_point tNow = SteadyClock::now();
+		int intTimeoutMs = -1;
+		apfd.resize(aClients.size() + 1);
+		for (size_t ii = 0; ii < aClients.size(); ii++) {
+			apfd[ii].fd = aClients[ii].fd;
+			apfd[ii].events = aClients[ii].pAnswer ? POLLOUT : POLLIN;
+			apfd[ii].revents = 0;
+			long long llLeftMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+				aClients[ii].tDeadline - tNow).count() + 1;
+			if (llLeftMs < 0)
+				llLeftMs = 0;
+			if (intTimeoutMs < 0 || llLeftMs < intTimeoutMs)
+				intTimeoutMs = (int) llLeftMs;
+		}
+		// The listening socket last, and only while there is room.
+		struct pollfd &pfdListen = apfd[aClients.size()];
+		pfdListen.fd = (aClients.size() < PORT_SERVER_MAX_CLIENTS) ? fdListen : -1;
+		pfdListen.events = POLLIN;
+		pfdListen.revents = 0;
+		if (poll(apfd.data(), apfd.size(), intTimeoutMs) < 0)
+			continue; // EINTR: check the stop flag
+
+		tNow = SteadyClock::now();
+		for (size_t ii = 0; ii < aClients.size(); ii++) {
+			if (!ServeClient(aClients[ii], apfd[ii].revents, tNow, mtx, pPacked)) {
+				close(aClients[ii].fd);
+				aClients[ii].fd = -1;
+			}
+		}
+		size_t nKept = 0;
+		for (size_t ii = 0; ii < aClients.size(); ii++) {
+			if (aClients[ii].fd >= 0)
+				aClients[nKept++] = aClients[ii];
+		}
+		aClients.resize(nKept);
+
+		if (!(pfdListen.revents & POLLIN))
+			continue;
+		if (!bWatching) {
+			unsigned long long ullNow = GetDeviceTreeFingerprint();
+			if (ullNow != ullFingerprint || !pPacked) {
+				std::vector<SSerInfo> asi;
+				try {
+					EnumSerialPorts(asi, FALSE /*include all*/);
+					publish(asi);
+					ullFingerprint = ullNow;
+				}
+				catch (std::string) {
+				}
+			}
+		}
+		while (aClients.size() < PORT_SERVER_MAX_CLIENTS) {
+			int fdClient = accept4(fdListen, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (fdClient < 0)
+				break;
+			SServerClient client;
+			client.fd = fdClient;
+			client.nSent = 0;
+			client.tDeadline = tNow + std::chrono::milliseconds(PORT_SERVER_IO_TIMEOUT_MS);
+			aClients.push_back(client);
+		}
+	}
+
+	for (size_t ii = 0; ii < aClients.size(); ii++)
+		close(aClients[ii].fd);
+	watcher.Stop();
+	close(fdListen);
+	unlink(strSocketPath.c_str());
+}
+
+bool QueryPortServer(const std::string &strSocketPath, std::vector<SSerInfo> &asi)
+{
+	int fd = ConnectUnix(strSocketPath);
+	if (fd < 0)
+		return false;
+	if (!IsPeerOurs(fd)) {
+		close(fd);
+		return false;
+	}
+
+	char cRequest = PORT_SERVER_REQUEST_PACKED;
+	std::string strPacked;
+	bool bOk = WriteAll(fd, &cRequest, 1);
+	while (bOk) {
+		char acBuffer[16384];
+		ssize_t len = recv(fd, acBuffer, sizeof(acBuffer), 0);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			bOk = false;
+		if (len <= 0)
+			break;
+		strPacked.append(acBuffer, (size_t) len);
+	}
+	close(fd);
+
+	return bOk && UnpackSerInfo(strPacked.data(), strPacked.size(), asi);
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*************************************************************************
+* Port list daemon
+*
+* RunPortServer keeps a live port table (updated by CPortWatcher) and
+* answers queries on a Unix domain socket, so that many short-lived tools
+* share a single enumeration. A query is one request byte; the answer is
+* the table in the packed layout of library.hpp, after which the server
+* closes the connection.
+*
+* Only available where AF_UNIX sockets are (not on Windows for now): there
+* the client calls simply fall back to a direct enumeration.
+************************************************************************/
+
+#ifndef __PORTSERVER__
+#define __PORTSERVER__
+
+#include <signal.h>
+
+#include <string>
+#include <vector>
+
+#include "EnumSerial.h"
+
+// Request byte asking for the packed table.
+#define PORT_SERVER_REQUEST_PACKED 'P'
+
+// $XDG_RUNTIME_DIR/enumcom.sock, or /tmp/enumcom-<uid>.sock.
+std::string GetDefaultPortServerPath();
+
+// Serves queries on strSocketPath until *pbStop becomes non-zero (set it
+// from a signal handler). Throws a std::string if the socket can't be
+// created or another server already listens on it.
+void RunPortServer(const std::string &strSocketPath,
+	const volatile sig_atomic_t *pbStop);
+
+// Asks the server listening on strSocketPath for the ports. Returns false
+// if no server answers, or if it runs as another user.
+bool QueryPortServer(const std::string &strSocketPath, std::vector<SSerInfo> &asi);
+
+// QueryPortServer, falling back to EnumSerialPorts(asi, FALSE) when no
+// server is running. Returns true if the server answered.
+bool EnumSerialPortsClient(std::vector<SSerInfo> &asi,
+	const std::string &strSocketPath);
+
+#endif /* __PORTSERVER__ */
@@ -0,0 +1,441 @@
+/*************************************************************************
+* Cross-process shared port snapshot
+*
+* See PortShared.h for an overview.
+*
+* The segment is a SSharedHeader followed by room for dwCapacity bytes of
+* packed table. The publisher writes as follows:
+*   seq = seq + 1 (odd), release fence
+*   table and dwSize
+*   seq = seq + 1 (even again), release
+* and a reader as follows:
+*   s1 = seq (acquire), retry while odd
+*   dwSize and table
+*   acquire fence, s2 = seq, retry if s2 != s1
+************************************************************************/
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "PortPacked.h"
+#include "PortShared.h"
+
+#define PORT_SHARED_MAGIC 0x4853434D	// "MCSH"
+#define PORT_SHARED_VERSION 2
+
+// Attempts of a read before giving up on a publisher stuck mid-write.
+#define PORT_SHARED_READ_TRIES 100000
+
+// Attempts at locking the segment, which the previous publisher may be
+// removing meanwhile.
+#define PORT_SHARED_LOCK_TRIES 10
+
+struct SSharedHeader {
+	uint32_t dwMagic;
+	uint32_t dwVersion;
+	std::atomic<uint32_t> seq;       // Odd while the table is written
+	uint32_t dwCapacity;             // Room for the table, in bytes
+	std::atomic<uint32_t> dwSize;    // Size of the table, 0 if none yet
+	std::atomic<uint32_t> dwClosed;  // Set when the publisher leaves
+	std::atomic<uint32_t> dwPid;     // Process id of the publisher
+};
+
+static char *SharedData(SSharedHeader *pHeader)
+{
+	return (char*) pHeader + sizeof(SSharedHeader);
+}
+
+static const char *SharedData(const SSharedHeader *pHeader)
+{
+	return (const char*) pHeader + sizeof(SSharedHeader);
+}
+
+std::string GetDefaultSharedSnapshotName()
+{
+#ifdef _WIN32
+	return "Local\\enumcom-ports";
+#else
+	return "/enumcom-ports-" + std::to_string(getuid());
+#endif
+}
+
+// Whether process dwPid still runs. A publisher that was killed never sets
+// dwClosed.
+static bool IsPublisherAlive(uint32_t dwPid)
+{
+	if (dwPid == 0)
+		return false;
+#ifdef _WIN32
+	HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, dwPid);
+	if (hProcess == NULL)
+		return GetLastError() == ERROR_ACCESS_DENIED;
+	bool bAlive = WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT;
+	CloseHandle(hProcess);
+	return bAlive;
+#else
+	return kill((pid_t) dwPid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+CSharedSnapshotWriter::CSharedSnapshotWriter()
+	: m_pHeader(NULL), m_nMapSize(0)
+#ifdef _WIN32
+	, m_hMapping(NULL), m_hLock(INVALID_HANDLE_VALUE)
+#else
+	, m_fd(-1)
+#endif
+{
+}
+
+#ifdef _WIN32
+
+// The lock file of segment strName, in the temporary directory. Mappings
+// can't be locked, and one existing already may just be held open by a
+// reader.
+static std::string SharedLockPath(const std::string &strName)
+{
+	char acTemp[MAX_PATH + 1];
+	DWORD dwLen = GetTempPath(sizeof(acTemp), acTemp);
+	std::string strPath((dwLen > 0 && dwLen < sizeof(acTemp)) ? acTemp : ".\\");
+	strPath += "enumcom-";
+	for (size_t ii = 0; ii < strName.size(); ii++)
+		strPath += (strName[ii] == '\\' || strName[ii] == '/' || strName[ii] == ':')
+			? '-' : strName[ii];
+	return strPath + ".lock";
+}
+
+#else
+
+// Opens segment strName and locks it. Returns -1 with err set on failure,
+// with err EWOULDBLOCK if another publisher holds it.
+static int OpenLockedSegment(const std::string &strName, int &err)
+{
+	for (int tries = 0; tries < PORT_SHARED_LOCK_TRIES; tries++) {
+		int fd = shm_open(strName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (fd < 0) {
+			err = errno;
+			return -1;
+		}
+		// Another user could have created it first, to feed our readers.
+		struct stat stOwner;
+		if (fstat(fd, &stOwner) != 0 || stOwner.st_uid != getuid()) {
+			err = EACCES;
+			close(fd);
+			return -1;
+		}
+		if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+			err = errno;
+			close(fd);
+			return -1;
+		}
+		// The lock may come from a publisher that removed the segment
+		// after we opened it: only keep it if the name still leads there.
+		int fdName = shm_open(strName.c_str(), O_RDONLY | O_CLOEXEC, 0);
+		struct stat st, stName;
+		bool bSame = fdName >= 0 && fstat(fd, &st) == 0
+			&& fstat(fdName, &stName) == 0 && st.st_ino == stName.st_ino;
+		if (fdName >= 0)
+			close(fdName);
+		if (bSame)
+			return fd;
+		close(fd);
+	}
+	err = EAGAIN;
+	return -1;
+}
+
+#endif
+
+CSharedSnapshotWriter::~CSharedSnapshotWriter()
+{
+	Close();
+}
+
+void CSharedSnapshotWriter::Open(const std::string &strName, size_t nCapacity)
+{
+	Close();
+	if (nCapacity > 0x40000000)
+		throw std::string("Shared snapshot capacity too large.");
+	size_t nMapSize = sizeof(SSharedHeader) + nCapacity;
+
+#ifdef _WIN32
+	// The lock file is opened without sharing, and deleted with its handle.
+	std::string strLock = SharedLockPath(strName);
+	HANDLE hLock = CreateFile(strLock.c_str(), GENERIC_WRITE, 0, NULL,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (hLock == INVALID_HANDLE_VALUE) {
+		DWORD dwErr = GetLastError();
+		if (dwErr == ERROR_SHARING_VIOLATION)
+			throw std::string("Another publisher has ") + strName + " open.";
+		throw std::string("Could not lock ") + strName + ". (err="
+			+ std::to_string(dwErr) + ")";
+	}
+	HANDLE hMapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+		PAGE_READWRITE, 0, (DWORD) nMapSize, strName.c_str());
+	if (hMapping == NULL) {
+		DWORD dwErr = GetLastError();
+		CloseHandle(hLock);
+		throw std::string("Could not create ") + strName + ". (err="
+			+ std::to_string(dwErr) + ")";
+	}
+	void *pView = MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, nMapSize);
+	if (pView == NULL) {
+		DWORD dwErr = GetLastError();
+		CloseHandle(hMapping);
+		CloseHandle(hLock);
+		throw std::string("Could not map ") + strName + ". (err="
+			+ std::to_string(dwErr) + ")";
+	}
+	m_hMapping = hMapping;
+	m_hLock = hLock;
+#else
+	int err = 0;
+	int fd = OpenLockedSegment(strName, err);
+	if (fd < 0 && err == EWOULDBLOCK)
+		throw std::string("Another publisher has ") + strName + " open.";
+	if (fd < 0)
+		throw std::string("Could not create ") + strName + ". (err="
+			+ std::to_string(err) + ")";
+	// A segment left by a previous publisher may be smaller: grow it. The
+	// readers that mapped the old size only read that much.
+	struct stat st;
+	if (fstat(fd, &st) != 0 || ((size_t) st.st_size < nMapSize
+		&& ftruncate(fd, (off_t) nMapSize) != 0)) {
+		int err = errno;
+		close(fd);
+		throw std::string("Could not size ") + strName + ". (err="
+			+ std::to_string(err) + ")";
+	}
+	void *pView = mmap(NULL, nMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (pView == MAP_FAILED) {
+		int err = errno;
+		close(fd);
+		throw std::string("Could not map ") + strName + ". (err="
+			+ std::to_string(err) + ")";
+	}
+	m_fd = fd;
+#endif
+
+	m_strName = strName;
+	m_pHeader = (SSharedHeader*) pView;
+	m_nMapSize = nMapSize;
+
+	// Take over from a previous publisher: keep counting from its sequence
+	// (made even, it may have died mid-write) so that readers notice the
+	// change, and keep its table until the first Publish.
+	if (m_pHeader->dwMagic != PORT_SHARED_MAGIC
+		|| m_pHeader->dwVersion != PORT_SHARED_VERSION) {
+		m_pHeader->seq.store(0, std::memory_order_relaxed);
+		m_pHeader->dwSize.store(0, std::memory_order_relaxed);
+		m_pHeader->dwVersion = PORT_SHARED_VERSION;
+		std::atomic_thread_fence(std::memory_order_release);
+		m_pHeader->dwMagic = PORT_SHARED_MAGIC;
+	}
+	else {
+		uint32_t seq = m_pHeader->seq.load(std::memory_order_relaxed);
+		m_pHeader->seq.store((seq + 2) & ~1u, std::memory_order_release);
+		if (m_pHeader->dwSize.load(std::memory_order_relaxed) > nCapacity)
+			m_pHeader->dwSize.store(0, std::memory_order_relaxed);
+	}
+	m_pHeader->dwCapacity = (uint32_t) nCapacity;
+#ifdef _WIN32
+	m_pHeader->dwPid.store((uint32_t) GetCurrentProcessId(), std::memory_order_relaxed);
+#else
+	m_pHeader->dwPid.store((uint32_t) getpid(), std::memory_order_relaxed);
+#endif
+	m_pHeader->dwClosed.store(0, std::memory_order_release);
+}
+
+void CSharedSnapshotWriter::Close()
+{
+	if (m_pHeader == NULL)
+		return;
+	m_pHeader->dwClosed.store(1, std::memory_order_release);
+#ifdef _WIN32
+	UnmapViewOfFile(m_pHeader);
+	CloseHandle(m_hMapping);
+	m_hMapping = NULL;
+	CloseHandle(m_hLock);
+	m_hLock = INVALID_HANDLE_VALUE;
+#else
+	// Still locked, so the segment removed is ours.
+	munmap(m_pHeader, m_nMapSize);
+	shm_unlink(m_strName.c_str());
+	close(m_fd);
+	m_fd = -1;
+#endif
+	m_pHeader = NULL;
+	m_nMapSize = 0;
+}
+
+bool CSharedSnapshotWriter::Publish(const std::vector<SSerInfo> &asi,
+	unsigned int uGeneration)
+{
+	PackSerInfo(asi, uGeneration, m_strPacked);
+	return Publish(m_strPacked);
+}
+
+bool CSharedSnapshotWriter::Publish(const std::string &strPacked)
+{
+	if (m_pHeader == NULL || strPacked.size() > m_pHeader->dwCapacity)
+		return false;
+
+	uint32_t seq = m_pHeader->seq.load(std::memory_order_relaxed);
+	m_pHeader->seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(SharedData(m_pHeader), strPacked.data(), strPacked.size());
+	m_pHeader->dwSize.store((uint32_t) strPacked.size(), std::memory_order_relaxed);
+	m_pHeader->seq.store(seq + 2, std::memory_order_release);
+	return true;
+}
+
+CSharedSnapshotReader::CSharedSnapshotReader()
+	: m_pHeader(NULL), m_nMapSize(0)
+#ifdef _WIN32
+	, m_hMapping(NULL)
+#endif
+{
+}
+
+CSharedSnapshotReader::~CSharedSnapshotReader()
+{
+	Detach();
+}
+
+bool CSharedSnapshotReader::Attach(const std::string &strName)
+{
+	Detach();
+#ifdef _WIN32
+	HANDLE hMapping = OpenFileMapping(FILE_MAP_READ, FALSE, strName.c_str());
+	if (hMapping == NULL)
+		return false;
+	void *pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION mbi;
+	if (pView == NULL || VirtualQuery(pView, &mbi, sizeof(mbi)) == 0) {
+		if (pView != NULL)
+			UnmapViewOfFile(pView);
+		CloseHandle(hMapping);
+		return false;
+	}
+	size_t nMapSize = mbi.RegionSize;
+	m_hMapping = hMapping;
+#else
+	int fd = shm_open(strName.c_str(), O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+	// Only trust a segment of our own user.
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_uid != getuid()
+		|| (size_t) st.st_size < sizeof(SSharedHeader)) {
+		close(fd);
+		return false;
+	}
+	size_t nMapSize = (size_t) st.st_size;
+	void *pView = mmap(NULL, nMapSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (pView == MAP_FAILED)
+		return false;
+#endif
+
+	m_pHeader = (const SSharedHeader*) pView;
+	m_nMapSize = nMapSize;
+	if (m_pHeader->dwMagic != PORT_SHARED_MAGIC
+		|| m_pHeader->dwVersion != PORT_SHARED_VERSION || IsClosed()) {
+		Detach();
+		return false;
+	}
+	return true;
+}
+
+void CSharedSnapshotReader::Detach()
+{
+	if (m_pHeader == NULL)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(m_pHeader);
+	CloseHandle(m_hMapping);
+	m_hMapping = NULL;
+#else
+	munmap((void*) m_pHeader, m_nMapSize);
+#endif
+	m_pHeader = NULL;
+	m_nMapSize = 0;
+}
+
+bool CSharedSnapshotReader::Read(void *pBuffer, size_t nBufferSize,
+	size_t &nSize) const
+{
+	if (m_pHeader == NULL)
+		return false;
+	// Our mapping may be older, and smaller, than the segment.
+	const size_t nMapped = m_nMapSize - sizeof(SSharedHeader);
+
+	for (int tries = 0; tries < PORT_SHARED_READ_TRIES; tries++) {
+		uint32_t seq = m_pHeader->seq.load(std::memory_order_acquire);
+		if (seq & 1) {
+			// Being written, a memcpy away from done.
+			if (tries % 64 == 63)
+				std::this_thread::yield();
+			continue;
+		}
+		nSize = m_pHeader->dwSize.load(std::memory_order_relaxed);
+		if (nSize > nMapped)
+			continue;
+		if (nSize <= nBufferSize)
+			memcpy(pBuffer, SharedData(m_pHeader), nSize);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_pHeader->seq.load(std::memory_order_relaxed) != seq)
+			continue;
+		if (nSize == 0)
+			return false;
+		return nSize > nBufferSize || CheckPackedSerInfo(pBuffer, nSize) != NULL;
+	}
+	return false;
+}
+
+bool CSharedSnapshotReader::Read(std::string &strPacked) const
+{
+	size_t nSize = 0;
+	// Grows at most a couple of times, if the table grows while we read.
+	for (int tries = 0; tries < 4; tries++) {
+		if (!Read(&strPacked[0], strPacked.size(), nSize))
+			return false;
+		if (nSize <= strPacked.size()) {
+			strPacked.resize(nSize);
+			return true;
+		}
+		strPacked.resize(nSize);
+	}
+	return false;
+}
+
+bool CSharedSnapshotReader::Read(std::vector<SSerInfo> &asi) const
+{
+	std::string strPacked;
+	return Read(strPacked) && UnpackSerInfo(strPacked.data(), strPacked.size(), asi);
+}
+
+unsigned int CSharedSnapshotReader::Sequence() const
+{
+	if (m_pHeader == NULL)
+		return 0;
+	return m_pHeader->seq.load(std::memory_order_acquire);
+}
+
+bool CSharedSnapshotReader::IsClosed() const
+{
+	return m_pHeader == NULL
+		|| m_pHeader->dwClosed.load(std::memory_order_acquire) != 0
+		|| !IsPublisherAlive(m_pHeader->dwPid.load(std::memory_order_relaxed));
+}
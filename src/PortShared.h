@@ -0,0 +1,120 @@
+/*************************************************************************
+* Cross-process shared port snapshot
+*
+* A publisher process (enumcom --publish) keeps the current port table in
+* a named shared memory segment (shm_open on Linux, a named file mapping
+* on Windows), in the packed layout of PortPacked.h. Any number of reader
+* processes attach to it and copy the table out without a system call or
+* a lock: the segment header holds a sequence counter which the publisher
+* makes odd while it writes and even again when it is done (a seqlock),
+* so a reader just copies the table and starts over if the counter moved
+* meanwhile. A read costs a memcpy of the table, a few KB, instead of an
+* enumeration.
+*
+* There is a single publisher per segment: it holds an exclusive lock
+* (flock on the segment on Linux, a lock file on Windows) as long as it
+* has it open. On Linux the segment is only readable by its owner, and
+* both sides refuse a segment of another user. The header holds the pid
+* of the publisher, so that readers notice when it was killed.
+************************************************************************/
+
+#ifndef __PORTSHARED__
+#define __PORTSHARED__
+
+#include <string>
+#include <vector>
+
+#include "EnumSerial.h"
+
+// Bytes reserved for the table when the segment is created; 1 MB holds
+// several thousand ports. On Linux, pages are only backed by memory once
+// written.
+#define PORT_SHARED_DEFAULT_CAPACITY (1024 * 1024)
+
+struct SSharedHeader;
+
+// Name of the segment: "/enumcom-ports-<uid>" on Linux (per user),
+// "Local\enumcom-ports" on Windows (per session).
+std::string GetDefaultSharedSnapshotName();
+
+class CSharedSnapshotWriter {
+public:
+	CSharedSnapshotWriter();
+	~CSharedSnapshotWriter();
+
+	// Creates the segment, or takes over the one a previous publisher left,
+	// with room for nCapacity bytes of table. Throws a std::string on
+	// failure, if another publisher has the segment open, or if it belongs
+	// to another user.
+	void Open(const std::string &strName,
+		size_t nCapacity=PORT_SHARED_DEFAULT_CAPACITY);
+	// Removes the segment (Linux; on Windows it goes away with its last
+	// handle), then lets go of the lock. Readers already attached keep
+	// their mapping.
+	void Close();
+
+	// Writes asi as the current table, with generation uGeneration.
+	// Returns false if it doesn't fit, leaving the previous table.
+	bool Publish(const std::vector<SSerInfo> &asi, unsigned int uGeneration);
+	// Same with an already packed table.
+	bool Publish(const std::string &strPacked);
+
+private:
+	CSharedSnapshotWriter(const CSharedSnapshotWriter &);
+	CSharedSnapshotWriter &operator=(const CSharedSnapshotWriter &);
+
+	std::string m_strName;
+	SSharedHeader *m_pHeader;
+	size_t m_nMapSize;
+	std::string m_strPacked;        // Reused by Publish
+#ifdef _WIN32
+	HANDLE m_hMapping;
+	HANDLE m_hLock;                 // Lock file, open without sharing
+#else
+	int m_fd;                       // Segment, holding the flock
+#endif
+};
+
+class CSharedSnapshotReader {
+public:
+	CSharedSnapshotReader();
+	~CSharedSnapshotReader();
+
+	// Maps the segment read-only. Returns false if no running publisher of
+	// our user has it.
+	bool Attach(const std::string &strName);
+	void Detach();
+	bool IsAttached() const { return m_pHeader != NULL; }
+
+	// Copies a consistent table to pBuffer if it holds nBufferSize bytes or
+	// more, and sets nSize to its size either way. Returns false if there
+	// is no table yet, or if the publisher kept writing the whole time
+	// (it died in the middle of a write).
+	bool Read(void *pBuffer, size_t nBufferSize, size_t &nSize) const;
+	// Same into strPacked, which is only reallocated when it grows.
+	bool Read(std::string &strPacked) const;
+	// Same, unpacked.
+	bool Read(std::vector<SSerInfo> &asi) const;
+
+	// Sequence counter of the segment, even when stable. It changes on
+	// every publication; a reader polling for changes can compare it to
+	// the previous value before copying anything.
+	unsigned int Sequence() const;
+
+	// true once the publisher has closed the segment or died: attach again
+	// to follow the next one. Costs a system call, to look for the
+	// publisher process.
+	bool IsClosed() const;
+
+private:
+	CSharedSnapshotReader(const CSharedSnapshotReader &);
+	CSharedSnapshotReader &operator=(const CSharedSnapshotReader &);
+
+	const SSharedHeader *m_pHeader;
+	size_t m_nMapSize;
+#ifdef _WIN32
+	HANDLE m_hMapping;
+#endif
+};
+
+#endif /* __PORTSHARED__ */
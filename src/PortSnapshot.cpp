@@ -0,0 +1,69 @@
+/*************************************************************************
+* Versioned port snapshots
+*
+* See PortSnapshot.h for an overview.
+*
+* Readers announce themselves in one of two counters, selected by the
+* parity of g_uEpoch, before loading g_pCurrent. A publisher swaps the
+* pointer, then flips the epoch twice and waits each time for the counter
+* that no longer receives newcomers to drain. A reader that registered
+* before a wait is waited for; one that registered after it can only have
+* loaded the new pointer. New readers always go to the other counter, so
+* a publisher can't be starved.
+************************************************************************/
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "PortPacked.h"
+#include "PortSnapshot.h"
+
+static std::atomic<const SPortSnapshot*> g_pCurrent(NULL);
+static std::atomic<unsigned> g_uEpoch(0);
+static std::atomic<long> g_alReaders[2];
+static std::mutex g_publishMutex;
+
+CSnapshotReader::CSnapshotReader()
+{
+	m_uParity = g_uEpoch.load() & 1;
+	g_alReaders[m_uParity].fetch_add(1);
+	m_pSnapshot = g_pCurrent.load();
+}
+
+CSnapshotReader::~CSnapshotReader()
+{
+	g_alReaders[m_uParity].fetch_sub(1);
+}
+
+static void WaitForReaders()
+{
+	for (int ii = 0; ii < 2; ii++) {
+		unsigned uOld = g_uEpoch.fetch_add(1) & 1;
+		while (g_alReaders[uOld].load() != 0)
+			std::this_thread::yield();
+	}
+}
+
+unsigned int PublishSnapshot(const std::vector<SSerInfo> &asi)
+{
+	std::lock_guard<std::mutex> lock(g_publishMutex);
+
+	// Only publishers write g_pCurrent, and we hold their lock.
+	const SPortSnapshot *pOld = g_pCurrent.load();
+	if (pOld != NULL && pOld->asi.size() == asi.size()
+		&& std::equal(asi.begin(), asi.end(), pOld->asi.begin(), IsSameSerInfo))
+		return pOld->uGeneration;
+
+	SPortSnapshot *pNew = new SPortSnapshot;
+	pNew->uGeneration = (pOld != NULL) ? pOld->uGeneration + 1 : 1;
+	pNew->asi = asi;
+	PackSerInfo(pNew->asi, pNew->uGeneration, pNew->strPacked);
+	g_pCurrent.store(pNew);
+
+	if (pOld != NULL) {
+		WaitForReaders();
+		delete pOld;
+	}
+	return pNew->uGeneration;
+}
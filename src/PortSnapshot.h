@@ -0,0 +1,47 @@
+/*************************************************************************
+* Versioned port snapshots
+*
+* The library keeps the last enumeration in an immutable snapshot that is
+* replaced atomically, read-copy-update style. Readers never take a lock
+* and never see a partially written table; the refresh that publishes a
+* new snapshot waits until no reader still uses the previous one before
+* freeing it.
+************************************************************************/
+
+#ifndef __PORTSNAPSHOT__
+#define __PORTSNAPSHOT__
+
+#include <string>
+#include <vector>
+
+#include "EnumSerial.h"
+
+struct SPortSnapshot {
+	unsigned int uGeneration;        // Bumped each time the content changes
+	std::vector<SSerInfo> asi;
+	std::string strPacked;           // asi in the GetSerialPortsPacked layout
+};
+
+// Holds the current snapshot for as long as the object lives. Cheap, never
+// blocks. get() is NULL until the first PublishSnapshot().
+class CSnapshotReader {
+public:
+	CSnapshotReader();
+	~CSnapshotReader();
+	const SPortSnapshot *get() const { return m_pSnapshot; }
+	const SPortSnapshot *operator->() const { return m_pSnapshot; }
+
+private:
+	CSnapshotReader(const CSnapshotReader &);
+	CSnapshotReader &operator=(const CSnapshotReader &);
+
+	unsigned m_uParity;
+	const SPortSnapshot *m_pSnapshot;
+};
+
+// Replaces the current snapshot with a copy of asi unless it has the same
+// content. Returns the generation of the current snapshot.
+// Publishers are serialized; only they may wait for readers.
+unsigned int PublishSnapshot(const std::vector<SSerInfo> &asi);
+
+#endif /* __PORTSNAPSHOT__ */
@@ -0,0 +1,97 @@
+/*************************************************************************
+* Enumeration statistics
+*
+* See PortStats.h for an overview.
+************************************************************************/
+
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+#include "PortStats.h"
+
+SEnumStats::SEnumStats()
+	: ullTotalNs(0), uPorts(0), uDevices(0), uPropertyReads(0), uProbes(0),
+	ullAllocations(0), ullBytesAllocated(0), ullSlowestPortNs(0)
+{
+	memset(aullPhaseNs, 0, sizeof(aullPhaseNs));
+}
+
+const char *SEnumStats::PhaseName(int intPhase)
+{
+	static const char *const s_aszNames[ENUM_PHASE_COUNT] = {
+		"list", "ports", "legacy", "merge", "probe", "sort"
+	};
+	return (intPhase >= 0 && intPhase < ENUM_PHASE_COUNT) ? s_aszNames[intPhase] : "";
+}
+
+#ifdef ENUMCOM_STATS
+
+thread_local SEnumStats *t_pEnumStats = NULL;
+
+static std::mutex s_mtxLast;
+static SEnumStats s_statsLast;
+static bool s_bHaveLast = false;
+
+bool GetLastEnumStats(SEnumStats &stats)
+{
+	std::lock_guard<std::mutex> lock(s_mtxLast);
+	if (s_bHaveLast)
+		stats = s_statsLast;
+	return s_bHaveLast;
+}
+
+unsigned long long EnumStatsNow()
+{
+	return (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void EnumStatsPort(unsigned long long ullStartNs, const std::string &strPort)
+{
+	if (t_pEnumStats == NULL)
+		return;
+	unsigned long long ullNs = EnumStatsNow() - ullStartNs;
+	if (ullNs > t_pEnumStats->ullSlowestPortNs) {
+		t_pEnumStats->ullSlowestPortNs = ullNs;
+		t_pEnumStats->strSlowestPort = strPort;
+	}
+}
+
+void EnumStatsAllocation(size_t nBytes)
+{
+	// No allocation here: this runs inside operator new.
+	SEnumStats *pStats = t_pEnumStats;
+	if (pStats != NULL) {
+		pStats->ullAllocations++;
+		pStats->ullBytesAllocated += nBytes;
+	}
+}
+
+CEnumStatsScope::CEnumStatsScope()
+	: m_bOwner(t_pEnumStats == NULL), m_ullStartNs(EnumStatsNow())
+{
+	if (m_bOwner)
+		t_pEnumStats = &m_stats;
+}
+
+CEnumStatsScope::~CEnumStatsScope()
+{
+	if (!m_bOwner)
+		return;
+	t_pEnumStats = NULL;
+	m_stats.ullTotalNs = EnumStatsNow() - m_ullStartNs;
+
+	std::lock_guard<std::mutex> lock(s_mtxLast);
+	s_statsLast = m_stats;
+	s_bHaveLast = true;
+}
+
+#else
+
+bool GetLastEnumStats(SEnumStats & /*stats*/)
+{
+	return false;
+}
+
+#endif /* ENUMCOM_STATS */
@@ -0,0 +1,105 @@
+/*************************************************************************
+* Enumeration statistics
+*
+* EnumSerialPorts and its backends time each phase of an enumeration and
+* count the expensive calls they make, so a slow enumeration on a user's
+* machine can be diagnosed from enumcom --stats (or the DLL) without a
+* profiler. The numbers of the last enumeration of the process are kept.
+*
+* Collecting them costs a clock read per phase and per port. Build with
+* "make STATS=0" to compile all of it out: the ENUM_STATS_* macros then
+* expand to nothing and GetLastEnumStats always returns false.
+************************************************************************/
+
+#ifndef __PORTSTATS__
+#define __PORTSTATS__
+
+#include <string>
+
+#include "EnumSerial.h"
+
+// Phases of an enumeration.
+#define ENUM_PHASE_LIST      0      // SetupDiGetClassDevs (Windows)
+#define ENUM_PHASE_PORTS     1      // Per-port interface and property reads,
+                                    // listing /sys/class/tty (Linux)
+#define ENUM_PHASE_LEGACY    2      // Secondary sources (DOS devices, by-id...)
+#define ENUM_PHASE_MERGE     3      // Normalization and merge of the sources
+#define ENUM_PHASE_PROBE     4      // Busy-port probes
+#define ENUM_PHASE_SORT      5      // Final sort
+#define ENUM_PHASE_COUNT     6
+
+struct SEnumStats {
+	SEnumStats();
+
+	unsigned long long aullPhaseNs[ENUM_PHASE_COUNT];
+	unsigned long long ullTotalNs;
+	unsigned int uPorts;                // Ports returned
+	unsigned int uDevices;              // Interfaces or ttys examined
+	unsigned int uPropertyReads;        // Registry properties, sysfs lookups
+	unsigned int uProbes;               // Ports opened by the busy probe
+	unsigned long long ullAllocations;  // Counted by enumcom only
+	unsigned long long ullBytesAllocated;
+	unsigned long long ullSlowestPortNs;    // Longest per-port read
+	std::string strSlowestPort;
+
+	static const char *PhaseName(int intPhase);
+};
+
+// Copies the statistics of the last enumeration. Returns false if there
+// was none, or if statistics are compiled out.
+bool GetLastEnumStats(SEnumStats &stats);
+
+#ifdef ENUMCOM_STATS
+
+// Statistics of the enumeration running on this thread, if any.
+extern thread_local SEnumStats *t_pEnumStats;
+
+unsigned long long EnumStatsNow();
+void EnumStatsPort(unsigned long long ullStartNs, const std::string &strPort);
+// For the operator new of the host program.
+void EnumStatsAllocation(size_t nBytes);
+
+// Collects the statistics of everything run in its scope, unless an outer
+// scope already does, and keeps them as the last ones when done.
+class CEnumStatsScope {
+public:
+	CEnumStatsScope();
+	~CEnumStatsScope();
+private:
+	SEnumStats m_stats;
+	bool m_bOwner;
+	unsigned long long m_ullStartNs;
+};
+
+// Adds the time spent in its scope to a phase.
+class CEnumStatsPhase {
+public:
+	explicit CEnumStatsPhase(int intPhase)
+		: m_intPhase(intPhase), m_ullStartNs(EnumStatsNow()) {}
+	~CEnumStatsPhase() {
+		if (t_pEnumStats != NULL)
+			t_pEnumStats->aullPhaseNs[m_intPhase] += EnumStatsNow() - m_ullStartNs;
+	}
+private:
+	int m_intPhase;
+	unsigned long long m_ullStartNs;
+};
+
+#define ENUM_STATS_SCOPE() CEnumStatsScope enumStatsScope
+#define ENUM_STATS_PHASE(phase) CEnumStatsPhase enumStatsPhase(phase)
+#define ENUM_STATS_COUNT(field, n) \
+	do { if (t_pEnumStats != NULL) t_pEnumStats->field += (n); } while (0)
+#define ENUM_STATS_PORT_START(var) unsigned long long var = EnumStatsNow()
+#define ENUM_STATS_PORT_END(var, port) EnumStatsPort(var, port)
+
+#else
+
+#define ENUM_STATS_SCOPE()
+#define ENUM_STATS_PHASE(phase)
+#define ENUM_STATS_COUNT(field, n) do { } while (0)
+#define ENUM_STATS_PORT_START(var)
+#define ENUM_STATS_PORT_END(var, port)
+
+#endif /* ENUMCOM_STATS */
+
+#endif /* __PORTSTATS__ */
@@ -0,0 +1,134 @@
+/*************************************************************************
+* Background streaming enumeration
+*
+* See PortStream.h for an overview.
+************************************************************************/
+
+#include "PortStream.h"
+
+CPortStream::CPortStream()
+	: m_bCancel(false), m_intState(PORT_STREAM_DONE), m_nQueueSize(0)
+{
+}
+
+CPortStream::~CPortStream()
+{
+	Cancel();
+	Join();
+}
+
+void CPortStream::Join()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void CPortStream::Start(PortFoundCallback fnFound, PortStreamDoneCallback fnDone,
+	const SPortFilter &filter, DWORD dwFields, DWORD dwOptions)
+{
+	Launch(fnFound, fnDone, 0, filter, dwFields, dwOptions);
+}
+
+void CPortStream::Start(size_t nQueueSize, const SPortFilter &filter,
+	DWORD dwFields, DWORD dwOptions)
+{
+	Launch(PortFoundCallback(), PortStreamDoneCallback(),
+		(nQueueSize > 0) ? nQueueSize : 1, filter, dwFields, dwOptions);
+}
+
+void CPortStream::Launch(PortFoundCallback fnFound, PortStreamDoneCallback fnDone,
+	size_t nQueueSize, const SPortFilter &filter, DWORD dwFields, DWORD dwOptions)
+{
+	Cancel();
+	Join();
+	m_bCancel = false;
+	m_intState = PORT_STREAM_RUNNING;
+	m_queue.clear();
+	m_nQueueSize = nQueueSize;
+	m_asi.clear();
+	m_strError.clear();
+	m_thread = std::thread(&CPortStream::Run, this, fnFound, fnDone, filter,
+		dwFields, dwOptions);
+}
+
+// Queues si (if there is a queue), waiting for room. Returns false if the
+// scan was cancelled.
+bool CPortStream::Push(const SSerInfo &si)
+{
+	if (m_nQueueSize == 0)
+		return !m_bCancel;
+	std::unique_lock<std::mutex> lock(m_mtx);
+	m_cv.wait(lock, [this]() { return m_queue.size() < m_nQueueSize || m_bCancel; });
+	if (m_bCancel)
+		return false;
+	m_queue.push_back(si);
+	m_cv.notify_all();
+	return true;
+}
+
+void CPortStream::Run(PortFoundCallback fnFound, PortStreamDoneCallback fnDone,
+	SPortFilter filter, DWORD dwFields, DWORD dwOptions)
+{
+	std::vector<SSerInfo> asi;
+	std::string strError;
+	int intState;
+	try {
+		bool bDone = EnumSerialPortsStreaming(asi, [&](const SSerInfo &si) {
+			if (m_bCancel)
+				return false;
+			if (fnFound)
+				return fnFound(si) && !m_bCancel;
+			return Push(si);
+		}, filter, dwFields, dwOptions);
+		intState = (bDone && !m_bCancel) ? PORT_STREAM_DONE : PORT_STREAM_CANCELLED;
+	}
+	catch (std::string strCatchErr) {
+		strError = strCatchErr;
+		intState = PORT_STREAM_FAILED;
+	}
+	catch (...) {
+		// Out of memory or threads; nothing may leave the thread.
+		strError = "Enumeration failed unexpectedly.";
+		intState = PORT_STREAM_FAILED;
+	}
+
+	if (fnDone)
+		fnDone(intState, asi);
+
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_asi.swap(asi);
+	m_strError = strError;
+	m_intState = intState;
+	m_cv.notify_all();
+}
+
+bool CPortStream::Next(SSerInfo &si)
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+	m_cv.wait(lock, [this]() {
+		return !m_queue.empty() || m_intState != PORT_STREAM_RUNNING;
+	});
+	if (m_queue.empty())
+		return false;
+	si = std::move(m_queue.front());
+	m_queue.pop_front();
+	m_cv.notify_all();
+	return true;
+}
+
+void CPortStream::Cancel()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_bCancel = true;
+	m_cv.notify_all();
+}
+
+int CPortStream::Wait(std::vector<SSerInfo> &asi, std::string *pstrError)
+{
+	Join();
+	std::lock_guard<std::mutex> lock(m_mtx);
+	asi = m_asi;
+	if (pstrError != NULL)
+		*pstrError = m_strError;
+	return m_intState;
+}
@@ -0,0 +1,89 @@
+/*************************************************************************
+* Background streaming enumeration
+*
+* CPortStream runs EnumSerialPortsStreaming on a thread of its own, so a
+* user interface can list each port as soon as it is found instead of
+* waiting for the whole scan. Ports are either passed to a callback, from
+* the scan thread, or queued for the owner to pick up with Next(); the
+* queue is bounded and the scan waits while it is full. A scan can be
+* cancelled at any time, it stops at the next port.
+************************************************************************/
+
+#ifndef __PORTSTREAM__
+#define __PORTSTREAM__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EnumSerial.h"
+#include "PortFilter.h"
+
+// State of a CPortStream scan.
+enum {
+	PORT_STREAM_RUNNING = 0,
+	PORT_STREAM_DONE,
+	PORT_STREAM_CANCELLED,
+	PORT_STREAM_FAILED
+};
+
+// Called from the scan thread once it is over, with its final state and
+// list (see EnumSerialPortsStreaming).
+typedef std::function<void(int intState, const std::vector<SSerInfo> &asi)>
+	PortStreamDoneCallback;
+
+class CPortStream {
+public:
+	CPortStream();
+	// Cancels the scan and waits for it.
+	~CPortStream();
+
+	// Starts a scan, after cancelling and waiting for the previous one.
+	// fnFound is called with each port found, then fnDone if set. Neither
+	// may call Start, Wait or delete the stream.
+	void Start(PortFoundCallback fnFound, PortStreamDoneCallback fnDone,
+		const SPortFilter &filter, DWORD dwFields, DWORD dwOptions);
+	// Same, queueing the ports found, at most nQueueSize at a time.
+	void Start(size_t nQueueSize, const SPortFilter &filter, DWORD dwFields,
+		DWORD dwOptions);
+
+	// Waits for the next port queued. Returns false once the scan is over
+	// and the queue is empty.
+	bool Next(SSerInfo &si);
+
+	// Asks the scan to stop. Doesn't wait, so any thread can call it,
+	// callbacks included.
+	void Cancel();
+
+	// Waits for the end of the scan and returns its state
+	// (PORT_STREAM_*). asi receives the final list; pstrError, if not NULL,
+	// the error of a failed scan.
+	int Wait(std::vector<SSerInfo> &asi, std::string *pstrError=NULL);
+
+private:
+	CPortStream(const CPortStream &);
+	CPortStream &operator=(const CPortStream &);
+
+	void Join();
+	void Launch(PortFoundCallback fnFound, PortStreamDoneCallback fnDone,
+		size_t nQueueSize, const SPortFilter &filter, DWORD dwFields, DWORD dwOptions);
+	void Run(PortFoundCallback fnFound, PortStreamDoneCallback fnDone,
+		SPortFilter filter, DWORD dwFields, DWORD dwOptions);
+	bool Push(const SSerInfo &si);
+
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	std::atomic<bool> m_bCancel;
+	int m_intState;
+	std::deque<SSerInfo> m_queue;
+	size_t m_nQueueSize;                // 0 without a queue
+	std::vector<SSerInfo> m_asi;        // Final list
+	std::string m_strError;
+	std::thread m_thread;
+};
+
+#endif /* __PORTSTREAM__ */
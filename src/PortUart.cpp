@@ -0,0 +1,129 @@
+/*************************************************************************
+* Legacy UART placeholder detection (Linux)
+*
+* See PortUart.h for an overview.
+************************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#include "PortProbe.h"
+#include "PortUart.h"
+
+bool IsLegacyUartName(const char *szName)
+{
+	return strncmp(szName, "ttyS", 4) == 0 && szName[4] >= '0' && szName[4] <= '9';
+}
+
+int UartStateFromSysfs(const std::string &strType)
+{
+	if (strType.empty())
+		return UART_STATE_UNKNOWN;
+	return (atoi(strType.c_str()) != 0) ? UART_STATE_PRESENT : UART_STATE_ABSENT;
+}
+
+CUartTable::CUartTable(const std::string &strRoot)
+	: m_strRoot(strRoot), m_bLoaded(false)
+{
+}
+
+void CUartTable::Parse(const std::string &strContent)
+{
+	m_bLoaded = true;
+	m_aiStates.clear();
+	size_t nStart = 0;
+	while (nStart < strContent.size()) {
+		size_t nEnd = strContent.find('\n', nStart);
+		if (nEnd == std::string::npos)
+			nEnd = strContent.size();
+		std::string strLine = strContent.substr(nStart, nEnd - nStart);
+		nStart = nEnd + 1;
+
+		// "<line>: uart:<type> ...", the header has no leading number.
+		char *pEnd;
+		long lLine = strtol(strLine.c_str(), &pEnd, 10);
+		if (pEnd == strLine.c_str() || *pEnd != ':' || lLine < 0 || lLine > 4096)
+			continue;
+		size_t nUart = strLine.find(" uart:");
+		if (nUart == std::string::npos)
+			continue;
+		nUart += 6;
+		size_t nUartEnd = strLine.find(' ', nUart);
+		std::string strUart = strLine.substr(nUart,
+			(nUartEnd == std::string::npos) ? std::string::npos : nUartEnd - nUart);
+		if ((size_t) lLine >= m_aiStates.size())
+			m_aiStates.resize(lLine + 1, UART_STATE_UNKNOWN);
+		m_aiStates[lLine] = (strUart == "unknown") ? UART_STATE_ABSENT : UART_STATE_PRESENT;
+	}
+}
+
+int CUartTable::Lookup(int intLine)
+{
+#ifndef _WIN32
+	if (!m_bLoaded) {
+		m_bLoaded = true;
+		std::string strPath = m_strRoot + "/proc/tty/driver/serial";
+		int fd = open(strPath.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			// A few dozen lines; procfs reports no size, read it all.
+			std::string strContent;
+			char acBuffer[4096];
+			ssize_t len;
+			while ((len = read(fd, acBuffer, sizeof(acBuffer))) > 0)
+				strContent.append(acBuffer, len);
+			close(fd);
+			Parse(strContent);
+		}
+	}
+#endif
+	if (intLine < 0 || (size_t) intLine >= m_aiStates.size())
+		return UART_STATE_UNKNOWN;
+	return m_aiStates[intLine];
+}
+
+#ifndef _WIN32
+static int ProbeUartIoctl(const std::string &strDevPath)
+{
+	// O_NONBLOCK: don't wait for carrier detect.
+	int fd = open(strDevPath.c_str(), O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return UART_STATE_UNKNOWN;
+	struct serial_struct ss;
+	memset(&ss, 0, sizeof(ss));
+	int intState = UART_STATE_UNKNOWN;
+	if (ioctl(fd, TIOCGSERIAL, &ss) == 0)
+		intState = (ss.type == PORT_UNKNOWN) ? UART_STATE_ABSENT : UART_STATE_PRESENT;
+	close(fd);
+	return intState;
+}
+#endif
+
+void ProbeUartsIoctl(const std::vector<SSerInfo> &asi, std::vector<int> &aiStates)
+{
+#ifndef _WIN32
+	// Copy the paths: an abandoned probe may still read them after
+	// we return.
+	std::shared_ptr<std::vector<std::string> > pPaths =
+		std::make_shared<std::vector<std::string> >();
+	pPaths->reserve(asi.size());
+	for (size_t ii = 0; ii < asi.size(); ii++)
+		pPaths->push_back(asi[ii].strDevPath);
+
+	RunBoundedProbes(asi.size(), PORT_PROBE_WORKERS, PORT_PROBE_TIMEOUT_MS,
+		[pPaths](size_t ii) { return ProbeUartIoctl((*pPaths)[ii]); }, aiStates);
+	for (size_t ii = 0; ii < aiStates.size(); ii++) {
+		if (aiStates[ii] == PROBE_TIMEOUT)
+			aiStates[ii] = UART_STATE_UNKNOWN;
+	}
+#else
+	aiStates.assign(asi.size(), UART_STATE_UNKNOWN);
+#endif
+}
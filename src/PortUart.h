@@ -0,0 +1,70 @@
+/*************************************************************************
+* Legacy UART placeholder detection (Linux)
+*
+* The 8250 driver creates ttyS0 to ttyS<nr_uarts-1> whether or not there is
+* a UART behind them, and every one has a device link in sysfs. Telling the
+* real ones apart used to mean opening each of them for TIOCGSERIAL, which
+* is slow and can block. CUartTable answers without opening anything: the
+* serial core exposes the UART type (PORT_UNKNOWN is 0) as a sysfs "type"
+* attribute, and /proc/tty/driver/serial lists "uart:unknown" for the empty
+* slots; the latter is only read, once per scan, for drivers that lack the
+* attribute. Ports neither source knows about can optionally be checked
+* with TIOCGSERIAL, on a few threads at once (see ProbeUartsIoctl and
+* PORT_ENUM_PROBE_UARTS); that opens them, so it is off by default.
+************************************************************************/
+
+#ifndef __PORTUART__
+#define __PORTUART__
+
+#include <string>
+#include <vector>
+
+#include "EnumSerial.h"
+
+// What is known of the UART behind a legacy tty.
+enum {
+	UART_STATE_UNKNOWN = 0,
+	UART_STATE_PRESENT,
+	UART_STATE_ABSENT
+};
+
+// true for the ttys that may be legacy UART placeholders (ttyS<n>).
+bool IsLegacyUartName(const char *szName);
+
+// State of a UART from its sysfs "type" attribute (empty if missing). The
+// "port" attribute doesn't help: the empty legacy slots keep their I/O
+// address (ttyS1 at 0x2F8...).
+int UartStateFromSysfs(const std::string &strType);
+
+class CUartTable {
+public:
+	// strRoot is the root of the fake tree to read, empty for the live
+	// system.
+	explicit CUartTable(const std::string &strRoot="");
+
+	// State of the UART behind ttyS<intLine> according to
+	// /proc/tty/driver/serial, read on the first call. UART_STATE_UNKNOWN if
+	// the file can't be read (it is often only readable by root) or doesn't
+	// list the line.
+	int Lookup(int intLine);
+
+	// Parses the content of /proc/tty/driver/serial, e.g.
+	//   serinfo:1.0 driver revision:
+	//   0: uart:16550A port:000003F8 irq:4 tx:0 rx:0
+	//   1: uart:unknown port:000002F8 irq:3
+	// Lookup then uses it instead of reading the file.
+	void Parse(const std::string &strContent);
+
+private:
+	std::string m_strRoot;
+	bool m_bLoaded;
+	std::vector<int> m_aiStates;    // By line
+};
+
+// Asks the driver of each port for its UART type with TIOCGSERIAL, opening
+// them concurrently and without waiting for carrier, and sets aiStates to
+// the UART_STATE_* of each. A port that can't be opened, or doesn't answer
+// in time, is UART_STATE_UNKNOWN.
+void ProbeUartsIoctl(const std::vector<SSerInfo> &asi, std::vector<int> &aiStates);
+
+#endif /* __PORTUART__ */
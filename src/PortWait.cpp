@@ -0,0 +1,357 @@
+/*************************************************************************
+* Waiting for a port to show up
+*
+* See PortWait.h for an overview.
+************************************************************************/
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <set>
+#include <vector>
+
+#include "PortFilter.h"
+#include "PortIndex.h"
+#include "PortWait.h"
+
+#ifdef _WIN32
+#include <condition_variable>
+#include <mutex>
+
+#include "PortWatcher.h"
+#endif
+
+typedef std::chrono::steady_clock WaitClock;
+
+// Longest sleep between two checks of *pbStop, in milliseconds.
+#define PORT_WAIT_SLICE_MS 100
+
+// What WaitForSerialPort waits for.
+class CWaitTarget {
+public:
+	CWaitTarget(const std::string &strId, const std::string &strRoot);
+
+	// true if si is the port waited for.
+	bool Match(const SSerInfo &si) const;
+#ifndef _WIN32
+	// Enumerates the ports and looks for it.
+	bool Find(SSerInfo &si) const;
+#endif
+
+private:
+	std::string m_strId;
+	std::string m_strRoot;
+	bool m_bUsbIds;          // m_filter holds the USB ids of m_strId
+	SPortFilter m_filter;
+};
+
+CWaitTarget::CWaitTarget(const std::string &strId, const std::string &strRoot)
+	: m_strId(strId), m_strRoot(strRoot), m_bUsbIds(false)
+{
+	if (strId.empty())
+		throw std::string("No port to wait for.");
+
+	// "VVVV:PPPP" takes precedence over a "<serial>:<interface>" identity,
+	// which is unlikely to look the same.
+	if (strId.find(':') != std::string::npos
+		&& strId.find_first_of("=,") == std::string::npos) {
+		SPortFilter filter;
+		if (ParsePortFilter(strId, filter) && filter.NeedsUsbIds()) {
+			m_filter = filter;
+			m_filter.bUsbOnly = true;
+			m_bUsbIds = true;
+		}
+	}
+}
+
+bool CWaitTarget::Match(const SSerInfo &si) const
+{
+	if (m_bUsbIds)
+		return si.bUsbDevice && m_filter.MatchUsbInfo(si.usb);
+	// Indexing a single port also resolves its udev links.
+	std::vector<SSerInfo> asi(1, si);
+	CPortIndex index;
+	index.Build(asi, m_strRoot);
+	return index.Find(m_strId) != NULL;
+}
+
+#ifndef _WIN32
+bool CWaitTarget::Find(SSerInfo &si) const
+{
+	std::vector<SSerInfo> asi;
+	EnumSerialPortsAt(m_strRoot, asi, m_filter, PORT_FIELD_ALL, FALSE /*include all*/);
+	if (m_bUsbIds) {
+		if (asi.empty())
+			return false;
+		si = asi[0];
+		return true;
+	}
+	CPortIndex index;
+	index.Build(asi, m_strRoot);
+	const SSerInfo *pPort = index.Find(m_strId);
+	if (pPort == NULL)
+		return false;
+	si = *pPort;
+	return true;
+}
+#endif
+
+#ifdef _WIN32
+
+bool WaitForSerialPort(const std::string &strId, int intTimeoutMs,
+	SSerInfo &si, const volatile sig_atomic_t *pbStop)
+{
+	CWaitTarget target(strId, std::string());
+	WaitClock::time_point tDeadline = WaitClock::now()
+		+ std::chrono::milliseconds((intTimeoutMs > 0) ? intTimeoutMs : 0);
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool bFound = false;
+	CPortWatcher watcher;
+	watcher.Start([&](int intEvent, const SSerInfo &siEvent) {
+		if (intEvent == PORT_EVENT_REMOVE || !target.Match(siEvent))
+			return;
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!bFound) {
+			si = siEvent;
+			bFound = true;
+			cv.notify_all();
+		}
+	});
+
+	// The ports present before the watcher started.
+	std::vector<SSerInfo> asi;
+	watcher.GetPorts(asi);
+	for (size_t ii = 0; ii < asi.size(); ii++) {
+		if (target.Match(asi[ii])) {
+			watcher.Stop();
+			si = asi[ii];
+			return true;
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(mtx);
+	while (!bFound && !(pbStop != NULL && *pbStop)) {
+		if (intTimeoutMs >= 0 && WaitClock::now() >= tDeadline)
+			break;
+		// In slices, to notice *pbStop.
+		WaitClock::time_point tWake = WaitClock::now()
+			+ std::chrono::milliseconds(PORT_WAIT_SLICE_MS);
+		if (intTimeoutMs >= 0 && tDeadline < tWake)
+			tWake = tDeadline;
+		cv.wait_until(lock, tWake);
+	}
+	bool bResult = bFound;
+	lock.unlock();
+	watcher.Stop();
+	return bResult;
+}
+
+#else
+
+// Events of interest on /dev. IN_ATTRIB: udev sets the mode of a node
+// after creating it, another chance to read a tty that wasn't ready.
+#define PORT_WAIT_DEV_EVENTS (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)
+
+// Milliseconds left until tDeadline, -1 without one.
+static int RemainingMs(bool bDeadline, WaitClock::time_point tDeadline)
+{
+	if (!bDeadline)
+		return -1;
+	WaitClock::duration left = tDeadline - WaitClock::now();
+	if (left <= WaitClock::duration::zero())
+		return 0;
+	// Rounded up, so that poll() doesn't return just before the deadline.
+	return (int) std::chrono::duration_cast<std::chrono::milliseconds>(
+		left + std::chrono::microseconds(999)).count();
+}
+
+// Reads the tty strName and checks it against target.
+static bool CheckTty(const CWaitTarget &target, const std::string &strRoot,
+	const std::string &strName, SSerInfo &si)
+{
+	SSerInfo siPort;
+	if (!ReadPortSysfs(strName, siPort, strRoot))
+		return false;
+	NormalizeSerInfo(siPort);
+	if (!target.Match(siPort))
+		return false;
+	si = siPort;
+	return true;
+}
+
+// Name of the tty a /dev/serial link points to, e.g. "../../ttyUSB0".
+static std::string LinkTarget(const std::string &strLink)
+{
+	char acTarget[PATH_MAX];
+	ssize_t len = readlink(strLink.c_str(), acTarget, sizeof(acTarget) - 1);
+	if (len <= 0)
+		return std::string();
+	std::string strTarget(acTarget, len);
+	size_t nSlash = strTarget.rfind('/');
+	return (nSlash == std::string::npos) ? strTarget : strTarget.substr(nSlash + 1);
+}
+
+// Watches a /dev/serial/by-* directory, returning its watch descriptor.
+// The links already there are added to setTtys: they may have been made
+// before the watch.
+static int WatchLinkDir(int fd, const std::string &strDir, std::set<std::string> &setTtys)
+{
+	int wd = inotify_add_watch(fd, strDir.c_str(), IN_CREATE | IN_MOVED_TO);
+	if (wd < 0)
+		return -1;
+	DIR *pDir = opendir(strDir.c_str());
+	if (pDir != NULL) {
+		struct dirent *pEnt;
+		while ((pEnt = readdir(pDir)) != NULL) {
+			if (pEnt->d_name[0] == '.')
+				continue;
+			std::string strTty = LinkTarget(strDir + "/" + pEnt->d_name);
+			if (!strTty.empty())
+				setTtys.insert(strTty);
+		}
+		closedir(pDir);
+	}
+	return wd;
+}
+
+bool WaitForSerialPortAt(const std::string &strRoot, const std::string &strId,
+	int intTimeoutMs, SSerInfo &si, const volatile sig_atomic_t *pbStop)
+{
+	CWaitTarget target(strId, strRoot);
+	bool bDeadline = intTimeoutMs >= 0;
+	WaitClock::time_point tDeadline = WaitClock::now()
+		+ std::chrono::milliseconds(bDeadline ? intTimeoutMs : 0);
+
+	// Watch first, then enumerate: a port showing up in between is seen
+	// by both at worst.
+	std::string strDev = strRoot + "/dev";
+	std::string strSerial = strDev + "/serial";
+	std::string strById = strSerial + "/by-id";
+	std::string strByPath = strSerial + "/by-path";
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		throw std::string("Could not create an inotify instance. (err=")
+			+ std::to_string(errno) + ")";
+	int wdDev = inotify_add_watch(fd, strDev.c_str(), PORT_WAIT_DEV_EVENTS);
+	if (wdDev < 0) {
+		int err = errno;
+		close(fd);
+		throw std::string("Could not watch ") + strDev + ". (err="
+			+ std::to_string(err) + ")";
+	}
+	// /dev/serial and its subdirectories come and go with the USB ports.
+	std::set<std::string> setTtys;
+	int wdSerial = inotify_add_watch(fd, strSerial.c_str(), IN_CREATE | IN_MOVED_TO);
+	int wdById = WatchLinkDir(fd, strById, setTtys);
+	int wdByPath = WatchLinkDir(fd, strByPath, setTtys);
+
+	bool bFound = false;
+	try {
+		bFound = target.Find(si);
+		bool bRescan = false;
+		alignas(struct inotify_event) char acEvents[4096];
+		while (!bFound && !(pbStop != NULL && *pbStop)) {
+			int intWaitMs = RemainingMs(bDeadline, tDeadline);
+			if (intWaitMs == 0)
+				break;
+			// In slices, to notice *pbStop set by another thread.
+			if (pbStop != NULL && (intWaitMs < 0 || intWaitMs > PORT_WAIT_SLICE_MS))
+				intWaitMs = PORT_WAIT_SLICE_MS;
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, intWaitMs) <= 0)
+				continue; // Timeout or EINTR: check the deadline and the stop flag
+
+			// Only the ttys behind the entries created are read again, each
+			// once per batch of events.
+			setTtys.clear();
+			for (;;) {
+				ssize_t len = read(fd, acEvents, sizeof(acEvents));
+				if (len <= 0)
+					break;
+				for (ssize_t nOffset = 0; nOffset < len; ) {
+					const struct inotify_event *pEvent =
+						(const struct inotify_event*) (acEvents + nOffset);
+					nOffset += sizeof(struct inotify_event) + pEvent->len;
+					if (pEvent->mask & IN_Q_OVERFLOW) {
+						bRescan = true;
+						continue;
+					}
+					if (pEvent->mask & IN_IGNORED) {
+						// The directory was removed.
+						if (pEvent->wd == wdSerial)
+							wdSerial = -1;
+						else if (pEvent->wd == wdById)
+							wdById = -1;
+						else if (pEvent->wd == wdByPath)
+							wdByPath = -1;
+						continue;
+					}
+					if (pEvent->len == 0)
+						continue;
+					std::string strName(pEvent->name);
+					if (pEvent->wd == wdDev) {
+						if (strName == "serial" && (pEvent->mask & IN_ISDIR) && wdSerial < 0) {
+							// udev makes by-id and by-path right after it,
+							// likely before this watch: look for them now.
+							wdSerial = inotify_add_watch(fd, strSerial.c_str(), IN_CREATE | IN_MOVED_TO);
+							if (wdById < 0)
+								wdById = WatchLinkDir(fd, strById, setTtys);
+							if (wdByPath < 0)
+								wdByPath = WatchLinkDir(fd, strByPath, setTtys);
+						}
+						else
+							setTtys.insert(strName);
+					}
+					else if (pEvent->wd == wdSerial) {
+						if (strName == "by-id" && wdById < 0)
+							wdById = WatchLinkDir(fd, strById, setTtys);
+						else if (strName == "by-path" && wdByPath < 0)
+							wdByPath = WatchLinkDir(fd, strByPath, setTtys);
+					}
+					else if (pEvent->wd == wdById || pEvent->wd == wdByPath) {
+						std::string strDir = (pEvent->wd == wdById) ? strById : strByPath;
+						std::string strTty = LinkTarget(strDir + "/" + strName);
+						if (!strTty.empty())
+							setTtys.insert(strTty);
+					}
+				}
+			}
+
+			if (bRescan) {
+				// Events were lost: enumerate everything again.
+				bRescan = false;
+				bFound = target.Find(si);
+				continue;
+			}
+			for (std::set<std::string>::const_iterator it = setTtys.begin();
+				it != setTtys.end() && !bFound; ++it)
+				bFound = CheckTty(target, strRoot, *it, si);
+		}
+	}
+	catch (std::string) {
+		close(fd);
+		throw;
+	}
+
+	close(fd);
+	return bFound;
+}
+
+bool WaitForSerialPort(const std::string &strId, int intTimeoutMs,
+	SSerInfo &si, const volatile sig_atomic_t *pbStop)
+{
+	return WaitForSerialPortAt(std::string(), strId, intTimeoutMs, si, pbStop);
+}
+
+#endif
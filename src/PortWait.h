@@ -0,0 +1,37 @@
+/*************************************************************************
+* Waiting for a port to show up
+*
+* WaitForSerialPort blocks until a given port is present, instead of
+* enumerating in a loop, e.g. while a board reboots into its bootloader.
+* The ports are enumerated once; after that, on Linux, the thread sleeps
+* on inotify watches on /dev and /dev/serial/by-id (and by-path), and only
+* the tty behind each entry created there is read again. On Windows it
+* sleeps until CPortWatcher reports a port added or changed.
+************************************************************************/
+
+#ifndef __PORTWAIT__
+#define __PORTWAIT__
+
+#include <signal.h>
+
+#include <string>
+
+#include "EnumSerial.h"
+
+// Waits for the port known as strId: any identity CPortIndex resolves
+// (port name, device path, USB serial number, by-id link...), or USB ids
+// as "VVVV:PPPP" (hex, either may be '*'; see ParsePortFilter). Returns
+// true with the port in si as soon as it is present, false once
+// intTimeoutMs milliseconds have passed (never if negative) or *pbStop
+// (if not NULL) becomes non-zero. Throws a std::string on failure.
+bool WaitForSerialPort(const std::string &strId, int intTimeoutMs,
+	SSerInfo &si, const volatile sig_atomic_t *pbStop=NULL);
+
+#ifndef _WIN32
+// Same, watching <strRoot>/dev and reading <strRoot>/sys (see
+// EnumPortsSysfs).
+bool WaitForSerialPortAt(const std::string &strRoot, const std::string &strId,
+	int intTimeoutMs, SSerInfo &si, const volatile sig_atomic_t *pbStop=NULL);
+#endif
+
+#endif /* __PORTWAIT__ */
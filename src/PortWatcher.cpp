@@ -0,0 +1,370 @@
+/*************************************************************************
+* Serial port hotplug watcher
+*
+* See PortWatcher.h for an overview.
+************************************************************************/
+
+#ifdef _WIN32
+#include <dbt.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+#include "PortFilter.h"
+#include "PortWatcher.h"
+
+CPortWatcher::CPortWatcher()
+{
+#ifdef _WIN32
+	m_dwThreadId = 0;
+	m_hReady = NULL;
+#else
+	m_fdEvents = -1;
+	m_afdWake[0] = m_afdWake[1] = -1;
+#endif
+}
+
+CPortWatcher::~CPortWatcher()
+{
+	Stop();
+}
+
+void CPortWatcher::GetPorts(std::vector<SSerInfo> &asi) const
+{
+	asi.clear();
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		asi.reserve(m_ports.size());
+		for (std::map<std::string, SSerInfo>::const_iterator it = m_ports.begin();
+			it != m_ports.end(); ++it)
+			asi.push_back(it->second);
+	}
+	std::sort(asi.begin(), asi.end(), compareSerialInfoByIndex);
+}
+
+void CPortWatcher::Notify(int intEvent, const SSerInfo &si)
+{
+	if (m_fnCallback)
+		m_fnCallback(intEvent, si);
+}
+
+#ifdef _WIN32
+
+static LRESULT CALLBACK WatcherWndProc(HWND hWnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam)
+{
+	if (uMsg == WM_DEVICECHANGE && (wParam == DBT_DEVICEARRIVAL
+		|| wParam == DBT_DEVICEREMOVECOMPLETE)) {
+		// Sent messages are handled inside GetMessage(); defer the rescan
+		// to the message loop of CPortWatcher::Run().
+		PostMessage(hWnd, WM_APP, 0, 0);
+		return TRUE;
+	}
+	return DefWindowProc(hWnd, uMsg, wParam, lParam);
+}
+
+void CPortWatcher::Start(PortEventCallback fnCallback)
+{
+	Stop();
+
+	std::vector<SSerInfo> asi;
+	EnumSerialPorts(asi, FALSE /*include all*/);
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_ports.clear();
+		for (size_t ii = 0; ii < asi.size(); ii++)
+			m_ports[asi[ii].strDevPath] = asi[ii];
+	}
+	m_fnCallback = fnCallback;
+
+	// The window must be created by the thread that pumps its messages;
+	// wait until it is ready so Stop() can always reach it.
+	m_hReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+	m_thread = std::thread(&CPortWatcher::Run, this);
+	WaitForSingleObject(m_hReady, INFINITE);
+	CloseHandle(m_hReady);
+	m_hReady = NULL;
+}
+
+void CPortWatcher::Stop()
+{
+	if (!m_thread.joinable())
+		return;
+	PostThreadMessage(m_dwThreadId, WM_QUIT, 0, 0);
+	m_thread.join();
+	m_dwThreadId = 0;
+}
+
+void CPortWatcher::Run()
+{
+	static const char szClass[] = "EnumComWatcher";
+	m_dwThreadId = GetCurrentThreadId();
+
+	WNDCLASSEX wc;
+	memset(&wc, 0, sizeof(wc));
+	wc.cbSize = sizeof(wc);
+	wc.lpfnWndProc = WatcherWndProc;
+	wc.hInstance = GetModuleHandle(NULL);
+	wc.lpszClassName = szClass;
+	RegisterClassEx(&wc); // Fails harmlessly if already registered
+
+	HWND hWnd = CreateWindowEx(0, szClass, "", 0, 0, 0, 0, 0,
+		HWND_MESSAGE, NULL, wc.hInstance, NULL);
+	HDEVNOTIFY hNotify = NULL;
+	if (hWnd != NULL) {
+		DEV_BROADCAST_DEVICEINTERFACE filter;
+		memset(&filter, 0, sizeof(filter));
+		filter.dbcc_size = sizeof(filter);
+		filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+		filter.dbcc_classguid = GUID_DEVINTERFACE_COMPORT;
+		hNotify = RegisterDeviceNotification(hWnd, &filter,
+			DEVICE_NOTIFY_WINDOW_HANDLE);
+	}
+
+	// Make sure the message queue exists before releasing Start().
+	MSG msg;
+	PeekMessage(&msg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+	SetEvent(m_hReady);
+
+	while (GetMessage(&msg, NULL, 0, 0) > 0) {
+		if (msg.hwnd == hWnd && msg.message == WM_APP) {
+			// Coalesce bursts of notifications into a single rescan.
+			MSG extra;
+			while (PeekMessage(&extra, hWnd, WM_APP, WM_APP, PM_REMOVE))
+				;
+			Rescan();
+			continue;
+		}
+		DispatchMessage(&msg);
+	}
+
+	if (hNotify != NULL)
+		UnregisterDeviceNotification(hNotify);
+	if (hWnd != NULL)
+		DestroyWindow(hWnd);
+}
+
+void CPortWatcher::Rescan()
+{
+	// SetupAPI can't be asked for a single COM port cheaply, so diff a
+	// fresh enumeration against the table and report what moved.
+	std::vector<SSerInfo> asi;
+	try {
+		EnumSerialPorts(asi, FALSE /*include all*/);
+	}
+	catch (std::string) {
+		return;
+	}
+
+	std::vector<std::pair<int, SSerInfo> > aEvents;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		std::map<std::string, SSerInfo> fresh;
+		for (size_t ii = 0; ii < asi.size(); ii++)
+			fresh[asi[ii].strDevPath] = asi[ii];
+
+		for (std::map<std::string, SSerInfo>::const_iterator it = m_ports.begin();
+			it != m_ports.end(); ++it) {
+			if (fresh.find(it->first) == fresh.end())
+				aEvents.push_back(std::make_pair((int)PORT_EVENT_REMOVE, it->second));
+		}
+		for (std::map<std::string, SSerInfo>::const_iterator it = fresh.begin();
+			it != fresh.end(); ++it) {
+			std::map<std::string, SSerInfo>::const_iterator old = m_ports.find(it->first);
+			if (old == m_ports.end())
+				aEvents.push_back(std::make_pair((int)PORT_EVENT_ADD, it->second));
+			else if (!IsSameSerInfo(old->second, it->second))
+				aEvents.push_back(std::make_pair((int)PORT_EVENT_CHANGE, it->second));
+		}
+		m_ports.swap(fresh);
+	}
+
+	for (size_t ii = 0; ii < aEvents.size(); ii++)
+		Notify(aEvents[ii].first, aEvents[ii].second);
+}
+
+#else
+
+void CPortWatcher::Start(PortEventCallback fnCallback)
+{
+	// Kernel uevents only (group 1), not the ones udev rebroadcasts.
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+		NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		throw std::string("Could not open the uevent netlink socket. (err=")
+			+ std::to_string(errno) + ")";
+	}
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		int err = errno;
+		close(fd);
+		throw std::string("Could not bind the uevent netlink socket. (err=")
+			+ std::to_string(err) + ")";
+	}
+	Start(fnCallback, fd, std::string());
+}
+
+void CPortWatcher::Start(PortEventCallback fnCallback, int fdEvents,
+	const std::string &strRoot)
+{
+	Stop();
+
+	m_fdEvents = fdEvents;
+	m_strRoot = strRoot;
+	if (pipe2(m_afdWake, O_CLOEXEC) != 0) {
+		int err = errno;
+		close(m_fdEvents);
+		m_fdEvents = -1;
+		throw std::string("Could not create the watcher pipe. (err=")
+			+ std::to_string(err) + ")";
+	}
+
+	// The event source is already open, so nothing that happens while the
+	// snapshot is taken can be missed. Same list as EnumSerialPorts, udev
+	// links included, so that it can stand in for it.
+	std::vector<SSerInfo> asi;
+	try {
+		EnumSerialPortsAt(m_strRoot, asi, SPortFilter(), PORT_FIELD_ALL,
+			FALSE /*include all*/);
+	}
+	catch (std::string) {
+		close(m_fdEvents);
+		close(m_afdWake[0]);
+		close(m_afdWake[1]);
+		m_fdEvents = m_afdWake[0] = m_afdWake[1] = -1;
+		throw;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_ports.clear();
+		for (size_t ii = 0; ii < asi.size(); ii++)
+			m_ports[asi[ii].strDevPath] = asi[ii];
+	}
+	m_fnCallback = fnCallback;
+	m_thread = std::thread(&CPortWatcher::Run, this);
+}
+
+void CPortWatcher::Stop()
+{
+	if (m_thread.joinable()) {
+		char c = 0;
+		while (write(m_afdWake[1], &c, 1) < 0 && errno == EINTR)
+			;
+		m_thread.join();
+	}
+	if (m_fdEvents >= 0)
+		close(m_fdEvents);
+	if (m_afdWake[0] >= 0)
+		close(m_afdWake[0]);
+	if (m_afdWake[1] >= 0)
+		close(m_afdWake[1]);
+	m_fdEvents = m_afdWake[0] = m_afdWake[1] = -1;
+}
+
+void CPortWatcher::Run()
+{
+	// Uevents are at most UEVENT_BUFFER_SIZE (2048) bytes of environment
+	// plus the header line.
+	char acMsg[8192 + 1];
+	struct pollfd afd[2];
+	afd[0].fd = m_fdEvents;
+	afd[0].events = POLLIN;
+	afd[1].fd = m_afdWake[0];
+	afd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(afd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		if (afd[1].revents != 0)
+			return;
+		if (afd[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+			return;
+		if (!(afd[0].revents & POLLIN))
+			continue;
+
+		struct sockaddr_nl addr;
+		socklen_t addrlen = sizeof(addr);
+		ssize_t len = recvfrom(m_fdEvents, acMsg, sizeof(acMsg) - 1,
+			MSG_DONTWAIT, (struct sockaddr*) &addr, &addrlen);
+		if (len <= 0)
+			continue;
+		// On netlink, only trust messages coming from the kernel.
+		if (addrlen == sizeof(addr) && addr.nl_family == AF_NETLINK
+			&& addr.nl_pid != 0)
+			continue;
+		acMsg[len] = '\0';
+		HandleUevent(acMsg, (size_t) len);
+	}
+}
+
+void CPortWatcher::HandleUevent(const char *pMsg, size_t len)
+{
+	// A uevent is "ACTION@DEVPATH\0" followed by "KEY=VALUE\0" pairs.
+	const char *szAction = NULL;
+	const char *szSubsystem = NULL;
+	const char *szDevName = NULL;
+	size_t pos = strlen(pMsg) + 1;
+	while (pos < len) {
+		const char *szPair = pMsg + pos;
+		if (strncmp(szPair, "ACTION=", 7) == 0)
+			szAction = szPair + 7;
+		else if (strncmp(szPair, "SUBSYSTEM=", 10) == 0)
+			szSubsystem = szPair + 10;
+		else if (strncmp(szPair, "DEVNAME=", 8) == 0)
+			szDevName = szPair + 8;
+		pos += strlen(szPair) + 1;
+	}
+	if (szAction == NULL || szSubsystem == NULL || szDevName == NULL
+		|| strcmp(szSubsystem, "tty") != 0)
+		return;
+
+	// DEVNAME is relative to /dev, but may already be absolute.
+	std::string strName(szDevName);
+	if (strName.compare(0, 5, "/dev/") == 0)
+		strName.erase(0, 5);
+	std::string strDevPath = "/dev/" + strName;
+
+	int intEvent = 0;
+	SSerInfo si;
+	if (strcmp(szAction, "remove") == 0) {
+		std::lock_guard<std::mutex> lock(m_mtx);
+		std::map<std::string, SSerInfo>::iterator it = m_ports.find(strDevPath);
+		if (it != m_ports.end()) {
+			si = it->second;
+			m_ports.erase(it);
+			intEvent = PORT_EVENT_REMOVE;
+		}
+	}
+	else if (ReadPortSysfs(strName, si, m_strRoot)) {
+		// add, change, move, bind... all mean "read it again".
+		NormalizeSerInfo(si);
+		std::lock_guard<std::mutex> lock(m_mtx);
+		std::map<std::string, SSerInfo>::iterator it = m_ports.find(strDevPath);
+		if (it == m_ports.end()) {
+			m_ports[strDevPath] = si;
+			intEvent = PORT_EVENT_ADD;
+		}
+		else if (!IsSameSerInfo(it->second, si)) {
+			it->second = si;
+			intEvent = PORT_EVENT_CHANGE;
+		}
+	}
+
+	if (intEvent != 0)
+		Notify(intEvent, si);
+}
+
+#endif
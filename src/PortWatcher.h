@@ -0,0 +1,79 @@
+/*************************************************************************
+* Serial port hotplug watcher
+*
+* CPortWatcher keeps an in-memory table of the serial ports present in the
+* system and updates it as devices come and go, instead of enumerating
+* everything again. On Linux it listens to the kernel uevents broadcast on
+* a netlink socket and only reads the tty that changed; on Windows it
+* registers for WM_DEVICECHANGE notifications on the COM port interface.
+************************************************************************/
+
+#ifndef __PORTWATCHER__
+#define __PORTWATCHER__
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EnumSerial.h"
+#include "PortDiff.h"
+
+// The watcher reports changes with a PortEventCallback (see PortDiff.h),
+// called from the watcher thread.
+
+class CPortWatcher {
+public:
+	CPortWatcher();
+	~CPortWatcher();
+
+	// Takes the initial snapshot and starts listening. No callback is made
+	// for the ports already present. Throws a std::string on failure.
+	void Start(PortEventCallback fnCallback);
+
+#ifndef _WIN32
+	// Same as Start, but reads the uevents from fdEvents (one message per
+	// datagram, as the kernel sends them) and the ports from the sysfs tree
+	// under strRoot. Used to feed the watcher from a socketpair. The watcher
+	// takes ownership of fdEvents.
+	void Start(PortEventCallback fnCallback, int fdEvents,
+		const std::string &strRoot);
+#endif
+
+	// Stops listening. Safe to call several times.
+	void Stop();
+
+	// Copies the current port table, sorted like EnumSerialPorts does.
+	void GetPorts(std::vector<SSerInfo> &asi) const;
+
+private:
+	CPortWatcher(const CPortWatcher &);
+	CPortWatcher &operator=(const CPortWatcher &);
+
+	void Run();
+	void Notify(int intEvent, const SSerInfo &si);
+
+#ifdef _WIN32
+	void Rescan();
+#else
+	void HandleUevent(const char *pMsg, size_t len);
+#endif
+
+	mutable std::mutex m_mtx;
+	std::map<std::string, SSerInfo> m_ports;    // Keyed by device path
+	PortEventCallback m_fnCallback;
+	std::thread m_thread;
+
+#ifdef _WIN32
+	DWORD m_dwThreadId;
+	HANDLE m_hReady;
+#else
+	int m_fdEvents;
+	int m_afdWake[2];                            // Pipe used to stop Run()
+	std::string m_strRoot;
+#endif
+};
+
+#endif /* __PORTWATCHER__ */
@@ -0,0 +1,513 @@
+/*************************************************************************
+* Windows enumeration backends
+*
+* See PortWindows.h for an overview. Moved from EnumSerial.cpp.
+************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+#include "PortStats.h"
+#include "PortWindows.h"
+
+// Message thrown when an API call fails.
+static std::string ApiError(const char *szCall, DWORD err)
+{
+	char acMessage[128];
+	snprintf(acMessage, sizeof(acMessage), "%s failed. (err=%lx)", szCall,
+		(unsigned long) err);
+	return std::string(acMessage);
+}
+
+// Reads a string property of a device. Most values fit in the buffer on
+// the stack; longer ones are read again into a buffer of the size reported.
+static bool WdmReadProperty(CDeviceApi &api, HDEVINFO hDevInfo,
+	SP_DEVINFO_DATA *pDevData, DWORD dwProperty, std::string &strValue)
+{
+	char acValue[256];
+	DWORD dwRequired = 0;
+	ENUM_STATS_COUNT(uPropertyReads, 1);
+	if (api.GetDeviceRegistryProperty(hDevInfo, pDevData, dwProperty,
+		(PBYTE)acValue, sizeof(acValue), &dwRequired)) {
+		strValue.assign(acValue, strnlen(acValue, sizeof(acValue)));
+		return true;
+	}
+	if (api.GetLastError() != ERROR_INSUFFICIENT_BUFFER || dwRequired <= sizeof(acValue))
+		return false;
+
+	std::vector<char> acLong(dwRequired + 1, '\0');
+	ENUM_STATS_COUNT(uPropertyReads, 1);
+	if (!api.GetDeviceRegistryProperty(hDevInfo, pDevData, dwProperty,
+		(PBYTE)&acLong[0], dwRequired, NULL))
+		return false;
+	strValue.assign(&acLong[0]);
+	return true;
+}
+
+// Reads the path of a device interface, growing acDetail (which is kept
+// between calls) if it doesn't fit.
+static bool WdmReadInterfacePath(CDeviceApi &api, HDEVINFO hDevInfo,
+	SP_DEVICE_INTERFACE_DATA *pIfcData, std::vector<char> &acDetail,
+	SP_DEVINFO_DATA *pDevData, std::string &strDevPath)
+{
+	for (int ii = 0; ii < 2; ii++) {
+		SP_DEVICE_INTERFACE_DETAIL_DATA *pDetData =
+			(SP_DEVICE_INTERFACE_DETAIL_DATA*) &acDetail[0];
+		// This is required, according to the documentation. Yes,
+		// it's weird.
+		pDetData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+		DWORD dwRequired = 0;
+		if (api.GetDeviceInterfaceDetail(hDevInfo, pIfcData, pDetData,
+			(DWORD) acDetail.size(), &dwRequired, pDevData)) {
+			strDevPath = pDetData->DevicePath;
+			return true;
+		}
+		if (api.GetLastError() != ERROR_INSUFFICIENT_BUFFER || dwRequired <= acDetail.size())
+			return false;
+		acDetail.resize(dwRequired);
+	}
+	return false;
+}
+
+// Tests the predicates of filter that don't need the friendly name,
+// reading as few properties as possible: the device path (and the USB ids
+// it contains) comes with the interface.
+static bool WdmMatchFilter(CDeviceApi &api, HDEVINFO hDevInfo,
+	SP_DEVINFO_DATA *pDevData, const std::string &strDevPath, const SPortFilter &filter)
+{
+	if (!filter.MatchDevPath(strDevPath))
+		return false;
+
+	// The ids are only a shortcut: ports of other bus drivers are checked
+	// against the USB device itself afterwards.
+	int intVendorId = -1, intProductId = -1;
+	BOOL bHasIds = ParseUsbIds(strDevPath, intVendorId, intProductId);
+	BOOL bUsbDevice = bHasIds || strDevPath.compare(0, 8, "\\\\?\\usb#") == 0;
+	if (bHasIds && filter.NeedsUsbIds() && !filter.MatchUsbIds(intVendorId, intProductId))
+		return false;
+	std::string strValue;
+	if (filter.bUsbOnly && !bUsbDevice) {
+		if (!WdmReadProperty(api, hDevInfo, pDevData, SPDRP_LOCATION_INFORMATION, strValue)
+			|| strValue.compare(0, 3, "USB") != 0)
+			return false;
+	}
+
+	if (!filter.strDriver.empty()) {
+		if (!WdmReadProperty(api, hDevInfo, pDevData, SPDRP_SERVICE, strValue)
+			|| !filter.MatchDriver(strValue))
+			return false;
+	}
+	return true;
+}
+
+// USB devices already read during a scan, by device instance id.
+typedef std::unordered_map<std::string, SUsbInfo> WdmUsbCache;
+
+static std::string WdmReadDevNodeProperty(CDeviceApi &api, DEVINST devInst,
+	ULONG ulProperty)
+{
+	char acValue[256];
+	ULONG ulSize = sizeof(acValue);
+	ENUM_STATS_COUNT(uPropertyReads, 1);
+	CONFIGRET cr = api.GetDevNodeRegistryProperty(devInst, ulProperty, acValue, &ulSize);
+	if (cr == CR_SUCCESS)
+		return std::string(acValue, strnlen(acValue, sizeof(acValue)));
+	if (cr != CR_BUFFER_SMALL || ulSize <= sizeof(acValue))
+		return std::string();
+
+	std::vector<char> acLong(ulSize + 1, '\0');
+	ENUM_STATS_COUNT(uPropertyReads, 1);
+	if (api.GetDevNodeRegistryProperty(devInst, ulProperty, &acLong[0], &ulSize) != CR_SUCCESS)
+		return std::string();
+	return std::string(&acLong[0]);
+}
+
+// Walks up from the device node of a port to its USB device. The port may
+// be a USB interface ("USB\VID_0403&PID_6011&MI_01\..."), a child of one
+// (FTDIBUS\...), or the USB device itself. Returns false if there is no
+// USB device above it.
+static bool WdmReadUsbInfo(CDeviceApi &api, DEVINST devInst, WdmUsbCache &cache,
+	SUsbInfo &usb)
+{
+	char acId[MAX_DEVICE_ID_LEN];
+	int intInterface = -1;
+	bool bFound = false;
+	for (int ii = 0; ii < 4 && !bFound; ii++) {
+		if (api.GetDeviceId(devInst, acId, sizeof(acId)) != CR_SUCCESS)
+			return false;
+		if (_strnicmp(acId, "USB\\", 4) == 0) {
+			const char *szInterface = strstr(acId, "&MI_");
+			if (szInterface == NULL)
+				bFound = true;
+			else if (intInterface < 0)
+				intInterface = (int) strtol(szInterface + 4, NULL, 16);
+		}
+		if (!bFound && api.GetParent(&devInst, devInst) != CR_SUCCESS)
+			return false;
+	}
+	if (!bFound)
+		return false;
+
+	std::string strId(acId);
+	std::pair<WdmUsbCache::iterator, bool> ins =
+		cache.insert(std::make_pair(strId, SUsbInfo()));
+	SUsbInfo &usbDevice = ins.first->second;
+	if (ins.second) {
+		// "USB\VID_0403&PID_6001\A9X123": the last part is the serial
+		// number, unless Windows made one up (they contain '&').
+		ParseUsbIds(strId, usbDevice.intVendorId, usbDevice.intProductId);
+		size_t nSlash = strId.rfind('\\');
+		if (nSlash != std::string::npos
+			&& strId.find('&', nSlash) == std::string::npos)
+			usbDevice.strSerial = strId.substr(nSlash + 1);
+		usbDevice.strManufacturer = WdmReadDevNodeProperty(api, devInst, CM_DRP_MFG);
+		usbDevice.strProduct = WdmReadDevNodeProperty(api, devInst, CM_DRP_DEVICEDESC);
+	}
+	usb = usbDevice;
+	usb.intInterface = intInterface;
+	return true;
+}
+
+void EnumPortsWdm(CDeviceApi &api, std::vector<SSerInfo> &asi,
+	const SPortFilter *pFilter, DWORD dwFields)
+{
+	EnumPortsWdm(api, [&asi](SSerInfo &si) {
+		asi.push_back(std::move(si));
+		return true;
+	}, pFilter, dwFields);
+}
+
+void EnumPortsWdm(CDeviceApi &api, const PortSink &fnSink,
+	const SPortFilter *pFilter, DWORD dwFields)
+{
+	std::string strErr;
+	// Create a device information set that will be the container for
+	// the device interfaces.
+	const GUID *guidDev = &GUID_CLASS_COMPORT;
+
+	HDEVINFO hDevInfo = INVALID_HANDLE_VALUE;
+	WdmUsbCache usbCache;
+	BOOL bNeedUsbInfo = (dwFields & PORT_FIELD_USBINFO)
+		|| (pFilter != NULL && pFilter->NeedsUsbInfo());
+
+	try {
+		{
+			ENUM_STATS_PHASE(ENUM_PHASE_LIST);
+			hDevInfo = api.GetClassDevs(guidDev, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+		}
+
+		if(hDevInfo == INVALID_HANDLE_VALUE)
+			throw ApiError("SetupDiGetClassDevs", api.GetLastError());
+
+		// Enumerate the serial ports. Most device paths fit in the
+		// detail buffer, which is grown for the others.
+		ENUM_STATS_PHASE(ENUM_PHASE_PORTS);
+		BOOL bOk = TRUE;
+		SP_DEVICE_INTERFACE_DATA ifcData;
+		std::vector<char> acDetail(sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA) + 256);
+		ifcData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+		std::string strFriendly, strDesc, strLocation;
+		for (DWORD ii=0; bOk; ii++) {
+			bOk = api.EnumDeviceInterfaces(hDevInfo, guidDev, ii, &ifcData);
+			if (bOk) {
+				// Got a device. Get the details.
+				ENUM_STATS_COUNT(uDevices, 1);
+				ENUM_STATS_PORT_START(ullPortStart);
+				SP_DEVINFO_DATA devdata = {};
+				devdata.cbSize = sizeof(SP_DEVINFO_DATA);
+				std::string strDevPath;
+				if (!WdmReadInterfacePath(api, hDevInfo, &ifcData, acDetail,
+					&devdata, strDevPath))
+					throw ApiError("SetupDiGetDeviceInterfaceDetail", api.GetLastError());
+
+				if (pFilter != NULL
+					&& !WdmMatchFilter(api, hDevInfo, &devdata, strDevPath, *pFilter))
+					continue;
+				SUsbInfo usb;
+				if (bNeedUsbInfo) {
+					WdmReadUsbInfo(api, devdata.DevInst, usbCache, usb);
+					if (pFilter != NULL && !pFilter->MatchUsbInfo(usb))
+						continue;
+				}
+
+				// Got a path to the device. Try to get some more info.
+				// The friendly name is always read since the port
+				// name is only known from it.
+				std::string_view svDesc, svPort;
+				BOOL bSuccess = WdmReadProperty(api, hDevInfo, &devdata,
+					SPDRP_FRIENDLYNAME, strFriendly);
+				BOOL bSplit = bSuccess && SplitFriendlyName(strFriendly, svDesc, svPort);
+				if (bSuccess && pFilter != NULL && !pFilter->strNameGlob.empty()
+					&& (!bSplit || !pFilter->MatchName(std::string(svPort))))
+					continue;
+				if (dwFields & PORT_FIELD_DESC) {
+					bSuccess = bSuccess && WdmReadProperty(api, hDevInfo, &devdata,
+						SPDRP_DEVICEDESC, strDesc);
+				}
+				BOOL bUsbDevice = FALSE;
+				if ((dwFields & PORT_FIELD_USB) && WdmReadProperty(api, hDevInfo,
+					&devdata, SPDRP_LOCATION_INFORMATION, strLocation))
+				{
+					// Just check the first three characters to determine
+					// if the port is connected to the USB bus. This isn't
+					// an infallible method; it would be better to use the
+					// BUS GUID. Currently, Windows doesn't let you query
+					// that though (SPDRP_BUSTYPEGUID seems to exist in
+					// documentation only).
+					bUsbDevice = (strLocation.compare(0, 3, "USB") == 0);
+				}
+				if (bSuccess) {
+					// Add an entry to the array
+					SSerInfo si;
+					si.dwFields = dwFields;
+					si.strDevPath = strDevPath;
+					if (dwFields & PORT_FIELD_FRIENDLYNAME)
+						si.strFriendlyName = strFriendly;
+					else if (bSplit)
+						si.strPortName.assign(svPort);
+					if (dwFields & PORT_FIELD_DESC)
+						si.strPortDesc = strDesc;
+					si.bUsbDevice = bUsbDevice;
+					if (dwFields & PORT_FIELD_USBINFO)
+						si.usb = usb;
+					ENUM_STATS_PORT_END(ullPortStart, strFriendly);
+					if (!fnSink(si))
+						break;
+				}
+			}
+			else {
+				DWORD err = api.GetLastError();
+				if (err != ERROR_NO_MORE_ITEMS)
+					throw ApiError("SetupDiEnumDeviceInterfaces", err);
+			}
+		}
+	}
+	catch (std::string strCatchErr) {
+		strErr = strCatchErr;
+	}
+
+	if (hDevInfo != INVALID_HANDLE_VALUE)
+		api.DestroyDeviceInfoList(hDevInfo);
+
+	if (!strErr.empty())
+		throw strErr;
+}
+
+void EnumPortsWNt4(std::vector<SSerInfo> &asi)
+{
+	// NT4's driver model is totally different, and not that
+	// many people use NT4 anymore. Just try all the COM ports
+	// between 1 and 16
+	SSerInfo si;
+	for (int ii=1; ii<=16; ii++) {
+		std::string strPort = "COM" + std::to_string(ii);
+		si.strDevPath = std::string("\\\\.\\") + strPort;
+		si.strPortName = strPort;
+		asi.push_back(si);
+	}
+}
+
+void EnumPortsDosDevices(CDeviceApi &api, std::vector<SSerInfo> &asi)
+{
+	// List every DOS device name and keep the COMx ones. The buffer is
+	// grown until the whole list fits.
+	std::vector<char> acNames(16384);
+	for (;;) {
+		DWORD dwLen = api.QueryDosDevices(NULL, &acNames[0], (DWORD) acNames.size());
+		if (dwLen != 0)
+			break;
+		DWORD err = api.GetLastError();
+		if (err != ERROR_INSUFFICIENT_BUFFER || acNames.size() >= (16u << 20))
+			throw ApiError("QueryDosDevice", err);
+		acNames.resize(acNames.size() * 2);
+	}
+
+	SSerInfo si;
+	for (const char *szName = &acNames[0]; *szName != '\0';
+		szName += strlen(szName) + 1) {
+		if (_strnicmp(szName, "COM", 3) != 0 || szName[3] == '\0'
+			|| strspn(szName + 3, "0123456789") != strlen(szName + 3))
+			continue;
+		si.strPortName = szName;
+		si.strDevPath = std::string("\\\\.\\") + szName;
+		asi.push_back(si);
+	}
+}
+
+// Reads a string value of a registry key, whatever its length.
+static bool RegReadString(CDeviceApi &api, HKEY hKey, const char *szValue,
+	std::string &strValue)
+{
+	char acValue[128];
+	DWORD dwSize = sizeof(acValue);
+	LONG lResult = api.QueryValue(hKey, szValue, (BYTE*)acValue, &dwSize);
+	if (lResult == ERROR_SUCCESS) {
+		strValue.assign(acValue, strnlen(acValue, dwSize));
+		return true;
+	}
+	if (lResult != ERROR_MORE_DATA)
+		return false;
+
+	std::vector<char> acLong(dwSize + 1, '\0');
+	if (api.QueryValue(hKey, szValue, (BYTE*)&acLong[0], &dwSize) != ERROR_SUCCESS)
+		return false;
+	strValue.assign(&acLong[0]);
+	return true;
+}
+
+static void SearchPnpKeyW9x(CDeviceApi &api, HKEY hkPnp, BOOL bUsbDevice,
+	CPortMerger &merger, const SPortFilter *pFilter)
+{
+	// Enumerate the subkeys of the given PNP key, looking for values with
+	// the name "PORTNAME"
+	HKEY hkSubPnp = NULL;
+
+	try {
+		// Enumerate the subkeys of HKLM\Enum\*\PNP050[01]. Key names
+		// have at most 255 characters.
+		char acSubPnp[256];
+		DWORD dwSubPnpIndex = 0;
+		DWORD dwSize = sizeof(acSubPnp);
+		while (api.EnumKey(hkPnp, dwSubPnpIndex++, acSubPnp, &dwSize) == ERROR_SUCCESS)
+		{
+			if (api.OpenKey(hkPnp, acSubPnp, &hkSubPnp) != ERROR_SUCCESS)
+				throw std::string("Could not read from HKLM\\Enum\\...\\")
+				+ acSubPnp;
+
+			// Look for the PORTNAME value
+			std::string strPortName;
+			if (RegReadString(api, hkSubPnp, "PORTNAME", strPortName))
+			{
+				// Got the portname value. Look for a friendly name.
+				std::string strFriendlyName;
+				RegReadString(api, hkSubPnp, "FRIENDLYNAME", strFriendlyName);
+
+				// Prepare an entry for the output array.
+				SSerInfo si;
+				si.strDevPath = std::string("\\\\.\\") + strPortName;
+				si.strPortName = strPortName;
+				si.strFriendlyName = strFriendlyName;
+				si.bUsbDevice = bUsbDevice;
+
+				// Add an entry to the array, overwriting duplicates.
+				if (pFilter == NULL || pFilter->MatchPartial(si))
+					merger.Add(si, PORT_SOURCE_REGISTRY);
+			}
+
+			api.CloseKey(hkSubPnp);
+			hkSubPnp = NULL;
+			dwSize = sizeof(acSubPnp);  // restore the buffer size
+		}
+	}
+	catch (std::string strError) {
+		if (hkSubPnp != NULL)
+			api.CloseKey(hkSubPnp);
+		throw strError;
+	}
+}
+
+void EnumPortsW9x(CDeviceApi &api, CPortMerger &merger, const SPortFilter *pFilter)
+{
+	// Look at all keys in HKLM\Enum, searching for subkeys named
+	// *PNP0500 and *PNP0501. Within these subkeys, search for
+	// sub-subkeys containing value entries with the name "PORTNAME"
+	// Search all subkeys of HKLM\Enum\USBPORTS for PORTNAME entries.
+
+	// First, open HKLM\Enum
+	HKEY hkEnum = NULL;
+	HKEY hkSubEnum = NULL;
+	HKEY hkSubSubEnum = NULL;
+
+	try {
+		if (api.OpenKey(HKEY_LOCAL_MACHINE, "Enum", &hkEnum) != ERROR_SUCCESS)
+			throw std::string("Could not read from HKLM\\Enum");
+
+		// Enumerate the subkeys of HKLM\Enum
+		char acSubEnum[256];
+		DWORD dwSubEnumIndex = 0;
+		DWORD dwSize = sizeof(acSubEnum);
+		while (api.EnumKey(hkEnum, dwSubEnumIndex++, acSubEnum, &dwSize) == ERROR_SUCCESS)
+		{
+			if (api.OpenKey(hkEnum, acSubEnum, &hkSubEnum) != ERROR_SUCCESS)
+				throw std::string("Could not read from HKLM\\Enum\\")+acSubEnum;
+
+			// Enumerate the subkeys of HKLM\Enum\*\, looking for keys
+			// named *PNP0500 and *PNP0501 (or anything in USBPORTS)
+			BOOL bUsbDevice = (strcmp(acSubEnum,"USBPORTS")==0);
+			char acSubSubEnum[256];
+			dwSize = sizeof(acSubSubEnum);  // set the buffer size
+			DWORD dwSubSubEnumIndex = 0;
+			while (api.EnumKey(hkSubEnum, dwSubSubEnumIndex++, acSubSubEnum,
+				&dwSize) == ERROR_SUCCESS)
+			{
+				BOOL bMatch = (strcmp(acSubSubEnum,"*PNP0500")==0 ||
+					strcmp(acSubSubEnum,"*PNP0501")==0 ||
+					bUsbDevice);
+				if (bMatch) {
+					if (api.OpenKey(hkSubEnum, acSubSubEnum, &hkSubSubEnum) != ERROR_SUCCESS)
+						throw std::string("Could not read from HKLM\\Enum\\") +
+						acSubEnum + "\\" + acSubSubEnum;
+					SearchPnpKeyW9x(api, hkSubSubEnum, bUsbDevice, merger, pFilter);
+					api.CloseKey(hkSubSubEnum);
+					hkSubSubEnum = NULL;
+				}
+
+				dwSize = sizeof(acSubSubEnum);  // restore the buffer size
+			}
+
+			api.CloseKey(hkSubEnum);
+			hkSubEnum = NULL;
+			dwSize = sizeof(acSubEnum); // restore the buffer size
+		}
+	}
+	catch (std::string strError) {
+		if (hkEnum != NULL)
+			api.CloseKey(hkEnum);
+		if (hkSubEnum != NULL)
+			api.CloseKey(hkSubEnum);
+		if (hkSubSubEnum != NULL)
+			api.CloseKey(hkSubSubEnum);
+		throw strError;
+	}
+
+	api.CloseKey(hkEnum);
+}
+
+BOOL WdmReadSerInfoByPath(CDeviceApi &api, SSerInfo &si)
+{
+	// Device interfaces can be looked up again by their path; the DOS
+	// devices only have a name.
+	if (si.strDevPath.compare(0, 4, "\\\\?\\") != 0) {
+		char acTarget[MAX_PATH];
+		return !si.strPortName.empty()
+			&& api.QueryDosDevices(si.strPortName.c_str(), acTarget, sizeof(acTarget)) != 0;
+	}
+
+	HDEVINFO hDevInfo = api.CreateDeviceInfoList();
+	if (hDevInfo == INVALID_HANDLE_VALUE)
+		return FALSE;
+	SP_DEVICE_INTERFACE_DATA ifcData;
+	ifcData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+	std::vector<char> acDetail(sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA) + 256);
+	SP_DEVINFO_DATA devdata = {};
+	devdata.cbSize = sizeof(SP_DEVINFO_DATA);
+
+	std::string strDevPath, strLocation;
+	BOOL bOk = api.OpenDeviceInterface(hDevInfo, si.strDevPath.c_str(), &ifcData)
+		&& WdmReadInterfacePath(api, hDevInfo, &ifcData, acDetail, &devdata, strDevPath)
+		&& WdmReadProperty(api, hDevInfo, &devdata, SPDRP_FRIENDLYNAME, si.strFriendlyName)
+		&& WdmReadProperty(api, hDevInfo, &devdata, SPDRP_DEVICEDESC, si.strPortDesc);
+	if (bOk) {
+		si.bUsbDevice = WdmReadProperty(api, hDevInfo, &devdata,
+			SPDRP_LOCATION_INFORMATION, strLocation)
+			&& strLocation.compare(0, 3, "USB") == 0;
+		WdmUsbCache usbCache;
+		WdmReadUsbInfo(api, devdata.DevInst, usbCache, si.usb);
+	}
+
+	api.DestroyDeviceInfoList(hDevInfo);
+	return bOk;
+}
@@ -0,0 +1,48 @@
+/*************************************************************************
+* Windows enumeration backends
+*
+* The backends EnumSerialPorts uses on Windows, written against CDeviceApi
+* so they can run on the live system (GetLiveDeviceApi) or on scripted
+* devices (CFakeDeviceApi). They throw a std::string on failure, like
+* EnumSerialPorts.
+*
+* Property values, device paths and registry strings are read into a
+* fixed buffer first and read again with the size Windows asks for when
+* they don't fit, so they are never truncated.
+************************************************************************/
+
+#ifndef __PORTWINDOWS__
+#define __PORTWINDOWS__
+
+#include <vector>
+
+#include "EnumSerial.h"
+#include "PortDeviceApi.h"
+#include "PortFilter.h"
+#include "PortMerge.h"
+
+// Windows 2000 and later: the COM port device interfaces. Ports not
+// matching pFilter (if not NULL) are skipped, and only the fields of
+// dwFields are read.
+void EnumPortsWdm(CDeviceApi &api, std::vector<SSerInfo> &asi,
+	const SPortFilter *pFilter, DWORD dwFields);
+// Same, handing each port to fnSink as soon as it is read.
+void EnumPortsWdm(CDeviceApi &api, const PortSink &fnSink,
+	const SPortFilter *pFilter, DWORD dwFields);
+
+// The COMx DOS device names, which some virtual port drivers (com0com...)
+// register without a device interface.
+void EnumPortsDosDevices(CDeviceApi &api, std::vector<SSerInfo> &asi);
+
+// Windows NT4: COM1 to COM16, whether they exist or not.
+void EnumPortsWNt4(std::vector<SSerInfo> &asi);
+
+// Windows 9x: the PORTNAME values below HKLM\Enum, added to merger.
+void EnumPortsW9x(CDeviceApi &api, CPortMerger &merger, const SPortFilter *pFilter);
+
+// Reads the friendly name, description and USB properties of the device
+// interface si.strDevPath, or checks that the DOS device si.strPortName
+// exists. Returns FALSE if the port is gone.
+BOOL WdmReadSerInfoByPath(CDeviceApi &api, SSerInfo &si);
+
+#endif /* __PORTWINDOWS__ */
@@ -0,0 +1,267 @@
+/*************************************************************************
+* Port list output formats
+*
+* See PortWriter.h for an overview.
+************************************************************************/
+
+#include "PortCaps.h"
+#include "PortDiff.h"
+#include "PortWriter.h"
+
+#define CSV_DELIMITER '|'
+
+CPortWriter::CPortWriter(int intFormat, FILE *pFile)
+	: m_intFormat(intFormat), m_pFile(pFile), m_nRows(0), m_bCaps(false),
+	m_bFailed(false)
+{
+	m_strBuffer.reserve(PORT_WRITER_FLUSH_SIZE);
+}
+
+CPortWriter::~CPortWriter()
+{
+	WriteBuffer();
+}
+
+bool CPortWriter::ParseFormat(const std::string &strName, int &intFormat)
+{
+	if (strName == "csv")
+		intFormat = PORT_FORMAT_CSV;
+	else if (strName == "json")
+		intFormat = PORT_FORMAT_JSON;
+	else if (strName == "ndjson")
+		intFormat = PORT_FORMAT_NDJSON;
+	else if (strName == "binary")
+		intFormat = PORT_FORMAT_BINARY;
+	else
+		return false;
+	return true;
+}
+
+void CPortWriter::Begin()
+{
+	switch (m_intFormat) {
+	case PORT_FORMAT_CSV:
+		m_strBuffer += "\"Index\"|\"DevicePath\"|\"Name\"|\"FriendlyName\"|"
+			"\"IsUSBDevice\"|\"Description\"";
+		if (m_bCaps)
+			m_strBuffer += "|\"Kind\"|\"UartType\"|\"MinBaud\"|\"MaxBaud\"|\"ModemControl\"";
+		m_strBuffer += '\n';
+		break;
+	case PORT_FORMAT_JSON:
+		m_strBuffer += '[';
+		break;
+	}
+}
+
+void CPortWriter::Write(const SSerInfo &si)
+{
+	switch (m_intFormat) {
+	case PORT_FORMAT_CSV:
+		m_strBuffer += std::to_string(si.intPortIndex);
+		m_strBuffer += CSV_DELIMITER;
+		AppendCsvString(si.strDevPath);
+		m_strBuffer += CSV_DELIMITER;
+		AppendCsvString(si.strPortName);
+		m_strBuffer += CSV_DELIMITER;
+		AppendCsvString(si.strFriendlyName);
+		m_strBuffer += CSV_DELIMITER;
+		m_strBuffer += si.bUsbDevice ? "TRUE" : "FALSE";
+		m_strBuffer += CSV_DELIMITER;
+		AppendCsvString(si.strPortDesc);
+		if (m_bCaps) {
+			m_strBuffer += CSV_DELIMITER;
+			AppendCsvString(PortKindName(si.caps.intKind));
+			m_strBuffer += CSV_DELIMITER;
+			m_strBuffer += std::to_string(si.caps.intUartType);
+			m_strBuffer += CSV_DELIMITER;
+			m_strBuffer += std::to_string(si.caps.dwMinBaud);
+			m_strBuffer += CSV_DELIMITER;
+			m_strBuffer += std::to_string(si.caps.dwMaxBaud);
+			m_strBuffer += CSV_DELIMITER;
+			m_strBuffer += si.caps.bModemControl ? "TRUE" : "FALSE";
+		}
+		m_strBuffer += '\n';
+		break;
+	case PORT_FORMAT_JSON:
+		m_strBuffer += (m_nRows == 0) ? "\n  " : ",\n  ";
+		AppendJsonObject(si);
+		break;
+	case PORT_FORMAT_NDJSON:
+		AppendJsonObject(si);
+		m_strBuffer += '\n';
+		break;
+	case PORT_FORMAT_BINARY:
+		AppendRecord(si);
+		break;
+	}
+	m_nRows++;
+
+	if (m_strBuffer.size() >= PORT_WRITER_FLUSH_SIZE)
+		WriteBuffer();
+}
+
+void CPortWriter::WriteEvent(int intEvent, const SSerInfo &si)
+{
+	switch (intEvent) {
+	case PORT_EVENT_ADD:
+		m_strBuffer += "{\"event\":\"add\",\"port\":";
+		break;
+	case PORT_EVENT_REMOVE:
+		m_strBuffer += "{\"event\":\"remove\",\"port\":";
+		break;
+	default:
+		m_strBuffer += "{\"event\":\"change\",\"port\":";
+		break;
+	}
+	AppendJsonObject(si);
+	m_strBuffer += "}\n";
+	m_nRows++;
+
+	if (m_strBuffer.size() >= PORT_WRITER_FLUSH_SIZE)
+		WriteBuffer();
+}
+
+bool CPortWriter::End()
+{
+	if (m_intFormat == PORT_FORMAT_JSON)
+		m_strBuffer += (m_nRows == 0) ? "]\n" : "\n]\n";
+	Flush();
+	return !m_bFailed;
+}
+
+void CPortWriter::AppendCsvString(const std::string &str)
+{
+	m_strBuffer += '"';
+	size_t nStart = 0;
+	for (size_t ii = 0; ii < str.size(); ii++) {
+		if (str[ii] == '"') {
+			m_strBuffer.append(str, nStart, ii + 1 - nStart);
+			m_strBuffer += '"';
+			nStart = ii + 1;
+		}
+	}
+	m_strBuffer.append(str, nStart, std::string::npos);
+	m_strBuffer += '"';
+}
+
+void CPortWriter::AppendJsonString(const std::string &str)
+{
+	static const char acHex[] = "0123456789abcdef";
+
+	m_strBuffer += '"';
+	size_t nStart = 0;
+	for (size_t ii = 0; ii < str.size(); ii++) {
+		unsigned char c = (unsigned char) str[ii];
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		m_strBuffer.append(str, nStart, ii - nStart);
+		nStart = ii + 1;
+		switch (c) {
+		case '"': m_strBuffer += "\\\""; break;
+		case '\\': m_strBuffer += "\\\\"; break;
+		case '\n': m_strBuffer += "\\n"; break;
+		case '\r': m_strBuffer += "\\r"; break;
+		case '\t': m_strBuffer += "\\t"; break;
+		default:
+			m_strBuffer += "\\u00";
+			m_strBuffer += acHex[c >> 4];
+			m_strBuffer += acHex[c & 0x0f];
+			break;
+		}
+	}
+	m_strBuffer.append(str, nStart, std::string::npos);
+	m_strBuffer += '"';
+}
+
+void CPortWriter::AppendJsonObject(const SSerInfo &si)
+{
+	m_strBuffer += "{\"index\":";
+	m_strBuffer += std::to_string(si.intPortIndex);
+	m_strBuffer += ",\"devicePath\":";
+	AppendJsonString(si.strDevPath);
+	m_strBuffer += ",\"name\":";
+	AppendJsonString(si.strPortName);
+	m_strBuffer += ",\"friendlyName\":";
+	AppendJsonString(si.strFriendlyName);
+	m_strBuffer += ",\"usb\":";
+	m_strBuffer += si.bUsbDevice ? "true" : "false";
+	m_strBuffer += ",\"description\":";
+	AppendJsonString(si.strPortDesc);
+	if (si.usb.intVendorId >= 0) {
+		char acIds[48];
+		snprintf(acIds, sizeof(acIds), ",\"vendorId\":\"%04x\",\"productId\":\"%04x\"",
+			si.usb.intVendorId & 0xffff, si.usb.intProductId & 0xffff);
+		m_strBuffer += acIds;
+		m_strBuffer += ",\"interface\":";
+		m_strBuffer += std::to_string(si.usb.intInterface);
+		m_strBuffer += ",\"serialNumber\":";
+		AppendJsonString(si.usb.strSerial);
+		m_strBuffer += ",\"manufacturer\":";
+		AppendJsonString(si.usb.strManufacturer);
+		m_strBuffer += ",\"product\":";
+		AppendJsonString(si.usb.strProduct);
+	}
+	if (si.caps.intState == PORT_CAPS_PROBED || si.caps.intState == PORT_CAPS_CACHED) {
+		m_strBuffer += ",\"caps\":{\"kind\":\"";
+		m_strBuffer += PortKindName(si.caps.intKind);
+		m_strBuffer += "\",\"uartType\":";
+		m_strBuffer += std::to_string(si.caps.intUartType);
+		m_strBuffer += ",\"minBaud\":";
+		m_strBuffer += std::to_string(si.caps.dwMinBaud);
+		m_strBuffer += ",\"maxBaud\":";
+		m_strBuffer += std::to_string(si.caps.dwMaxBaud);
+		m_strBuffer += ",\"modemControl\":";
+		m_strBuffer += si.caps.bModemControl ? "true" : "false";
+		m_strBuffer += ",\"cached\":";
+		m_strBuffer += (si.caps.intState == PORT_CAPS_CACHED) ? "true" : "false";
+		m_strBuffer += '}';
+	}
+	m_strBuffer += '}';
+}
+
+void CPortWriter::AppendUInt32(uint32_t dwValue)
+{
+	char acBytes[4];
+	acBytes[0] = (char) (dwValue & 0xff);
+	acBytes[1] = (char) ((dwValue >> 8) & 0xff);
+	acBytes[2] = (char) ((dwValue >> 16) & 0xff);
+	acBytes[3] = (char) ((dwValue >> 24) & 0xff);
+	m_strBuffer.append(acBytes, 4);
+}
+
+void CPortWriter::AppendRecord(const SSerInfo &si)
+{
+	const std::string *apStrings[] = {
+		&si.strDevPath, &si.strPortName, &si.strFriendlyName, &si.strPortDesc
+	};
+	const size_t nStrings = sizeof(apStrings) / sizeof(apStrings[0]);
+
+	uint32_t dwLength = 8;
+	for (size_t ii = 0; ii < nStrings; ii++)
+		dwLength += 4 + (uint32_t) apStrings[ii]->size();
+
+	AppendUInt32(dwLength);
+	AppendUInt32((uint32_t) si.intPortIndex);
+	AppendUInt32(si.bUsbDevice ? PORT_RECORD_FLAG_USB : 0);
+	for (size_t ii = 0; ii < nStrings; ii++) {
+		AppendUInt32((uint32_t) apStrings[ii]->size());
+		m_strBuffer += *apStrings[ii];
+	}
+}
+
+void CPortWriter::Flush()
+{
+	WriteBuffer();
+	if (fflush(m_pFile) != 0)
+		m_bFailed = true;
+}
+
+void CPortWriter::WriteBuffer()
+{
+	if (m_strBuffer.empty())
+		return;
+	if (fwrite(m_strBuffer.data(), 1, m_strBuffer.size(), m_pFile)
+		!= m_strBuffer.size())
+		m_bFailed = true;
+	m_strBuffer.clear();
+}
@@ -0,0 +1,85 @@
+/*************************************************************************
+* Port list output formats
+*
+* CPortWriter formats ports into a single reusable buffer which is written
+* out once at the end (or whenever it grows past PORT_WRITER_FLUSH_SIZE),
+* instead of one stream insertion per field. Rows can be written as they
+* are produced.
+*
+* Formats:
+*   csv     the historical pipe-delimited output, every string field
+*           between double quotes, embedded quotes doubled.
+*   json    a single array of objects; USB ports also get their vendor
+*           and product ids, interface, serial number, manufacturer and
+*           product, and probed ports a "caps" object (see PortCaps.h).
+*   ndjson  one object per line. WriteEvent writes change events in
+*           this format whatever the writer's: one
+*           {"event":"add|remove|change","port":{...}} object per line.
+*   binary  one length-prefixed record per port, all integers 32-bit
+*           little-endian:
+*             u32 length of what follows
+*             i32 port index
+*             u32 flags (bit 0: USB device)
+*             4 strings (device path, name, friendly name, description),
+*             each a u32 length followed by that many UTF-8/ANSI bytes,
+*             without terminating NUL.
+************************************************************************/
+
+#ifndef __PORTWRITER__
+#define __PORTWRITER__
+
+#include <cstdio>
+#include <string>
+
+#include "EnumSerial.h"
+
+#define PORT_FORMAT_CSV 0
+#define PORT_FORMAT_JSON 1
+#define PORT_FORMAT_NDJSON 2
+#define PORT_FORMAT_BINARY 3
+
+#define PORT_WRITER_FLUSH_SIZE 65536
+
+#define PORT_RECORD_FLAG_USB 0x00000001
+
+class CPortWriter {
+public:
+	CPortWriter(int intFormat, FILE *pFile);
+	~CPortWriter();
+
+	// Maps "csv", "json", "ndjson" or "binary" to a PORT_FORMAT_* value.
+	static bool ParseFormat(const std::string &strName, int &intFormat);
+
+	// Adds the capability columns to the CSV output. Call before Begin.
+	void SetCaps(bool bCaps) { m_bCaps = bCaps; }
+
+	// Writes the header (CSV) or opening bracket (JSON).
+	void Begin();
+	void Write(const SSerInfo &si);
+	// Writes a PORT_EVENT_* change of si (see PortDiff.h).
+	void WriteEvent(int intEvent, const SSerInfo &si);
+	// Writes the closing bracket (JSON) and flushes. Returns false if
+	// anything failed to be written.
+	bool End();
+
+	// Writes out the rows so far, for a reader waiting on them (when they
+	// are written as they are produced).
+	void Flush();
+
+private:
+	void AppendCsvString(const std::string &str);
+	void AppendJsonString(const std::string &str);
+	void AppendJsonObject(const SSerInfo &si);
+	void AppendUInt32(uint32_t dwValue);
+	void AppendRecord(const SSerInfo &si);
+	void WriteBuffer();
+
+	int m_intFormat;
+	FILE *m_pFile;
+	std::string m_strBuffer;
+	size_t m_nRows;
+	bool m_bCaps;
+	bool m_bFailed;
+};
+
+#endif /* __PORTWRITER__ */
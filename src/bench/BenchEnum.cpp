@@ -0,0 +1,422 @@
+/*************************************************************************
+* Enumeration scaling benchmark
+*
+* Runs the whole pipeline (backend, merge of the sources, normalization,
+* sort and JSON output) on synthetic machines with 1 to 100k ports, so
+* anything worse than linear shows up long before it reaches a real one.
+*
+* Scenarios:
+*   sysfs  a fake /sys and /dev tree, written to a temporary directory
+*          and enumerated by EnumSerialPortsAt: quad-port FTDI adapters,
+*          their /dev/serial/by-id links and 64 virtual ttys.
+*   wdm    the WDM and DOS device backends, run on a CFakeDeviceApi with
+*          quad-port FTDI adapters (some with paths and names longer than
+*          256 characters) and merged like EnumSerialPorts does.
+*
+* Prints one JSON object per scenario and size: latency percentiles over
+* the rounds, heap allocations per round and the peak RSS of the process
+* so far (sizes run in increasing order), plus the API calls made per port
+* for wdm.
+*
+* Usage: BenchEnum [SIZE,SIZE...]   (default 1,10,100,1000,10000,100000)
+*
+* A fake tree takes about 25 KiB of disk per port, so by default the sysfs
+* scenario stops at BENCH_SYSFS_DEFAULT_MAX ports; sizes given on the
+* command line run both scenarios.
+************************************************************************/
+
+#ifdef _WIN32
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortFakeDeviceApi.h"
+#include "../PortFilter.h"
+#include "../PortMerge.h"
+#include "../PortWindows.h"
+#include "../PortWriter.h"
+
+static unsigned long long g_ullAllocations = 0;
+static unsigned long long g_ullAllocatedBytes = 0;
+
+void *operator new(std::size_t size)
+{
+	g_ullAllocations++;
+	g_ullAllocatedBytes += size;
+	void *p = std::malloc(size ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+#define BENCH_PORTS_PER_DEVICE 4
+#define BENCH_VIRTUAL_TTYS 64
+#define BENCH_SYSFS_DEFAULT_MAX 1000
+#define BENCH_LONG_PATH_EVERY 16
+
+// Peak resident set size of the process, in KiB.
+static unsigned long long PeakRssKb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.PeakWorkingSetSize / 1024;
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+	return (unsigned long long) ru.ru_maxrss;
+#endif
+}
+
+// Writes the ports where nothing will read them: the output stage is part
+// of the pipeline, the terminal isn't.
+static void WritePorts(const std::vector<SSerInfo> &asi, FILE *pNull)
+{
+	CPortWriter writer(PORT_FORMAT_JSON, pNull);
+	writer.Begin();
+	for (size_t ii = 0; ii < asi.size(); ii++)
+		writer.Write(asi[ii]);
+	writer.End();
+}
+
+#ifndef _WIN32
+
+static bool MakeDirs(const std::string &strPath)
+{
+	for (size_t nSlash = strPath.find('/', 1); ; nSlash = strPath.find('/', nSlash + 1)) {
+		std::string strDir = strPath.substr(0, nSlash);
+		if (mkdir(strDir.c_str(), 0755) != 0 && errno != EEXIST)
+			return false;
+		if (nSlash == std::string::npos)
+			return true;
+	}
+}
+
+static bool WriteFile(const std::string &strPath, const std::string &strValue)
+{
+	FILE *pFile = fopen(strPath.c_str(), "w");
+	if (pFile == NULL)
+		return false;
+	fprintf(pFile, "%s\n", strValue.c_str());
+	return fclose(pFile) == 0;
+}
+
+// Builds the fake tree of nPorts ports under strRoot, laid out like the
+// kernel does, e.g. for the second port of the first adapter:
+//   sys/class/tty/ttyUSB1 ->
+//     ../../devices/pci0/usb1/1-0/1-0:1.1/ttyUSB1/tty/ttyUSB1
+//   .../1-0:1.1/ttyUSB1/tty/ttyUSB1/device -> ../..
+//   .../1-0:1.1/ttyUSB1/driver -> .../drivers/ftdi_sio
+//   dev/serial/by-id/usb-FTDI_Quad_RS232-HS_FT0-if01-port0 -> ../../ttyUSB1
+static bool MakeSysfsTree(const std::string &strRoot, size_t nPorts)
+{
+	std::string strClass = strRoot + "/sys/class/tty";
+	std::string strById = strRoot + "/dev/serial/by-id";
+	if (!MakeDirs(strClass) || !MakeDirs(strById))
+		return false;
+
+	for (size_t ii = 0; ii < BENCH_VIRTUAL_TTYS; ii++) {
+		std::string strName = "tty" + std::to_string(ii);
+		std::string strDevice = "devices/virtual/tty/" + strName;
+		if (!MakeDirs(strRoot + "/sys/" + strDevice)
+			|| symlink(("../../" + strDevice).c_str(), (strClass + "/" + strName).c_str()) != 0)
+			return false;
+	}
+
+	for (size_t ii = 0; ii < nPorts; ii++) {
+		size_t nDevice = ii / BENCH_PORTS_PER_DEVICE;
+		size_t nInterface = ii % BENCH_PORTS_PER_DEVICE;
+		std::string strName = "ttyUSB" + std::to_string(ii);
+		std::string strUsb = "devices/pci0/usb1/1-" + std::to_string(nDevice);
+		std::string strPort = strUsb + "/1-" + std::to_string(nDevice) + ":1."
+			+ std::to_string(nInterface) + "/" + strName;
+		std::string strTty = strPort + "/tty/" + strName;
+
+		if (nInterface == 0) {
+			std::string strDir = strRoot + "/sys/" + strUsb;
+			if (!MakeDirs(strDir)
+				|| !WriteFile(strDir + "/idVendor", "0403")
+				|| !WriteFile(strDir + "/idProduct", "6011")
+				|| !WriteFile(strDir + "/serial", "FT" + std::to_string(nDevice))
+				|| !WriteFile(strDir + "/manufacturer", "FTDI")
+				|| !WriteFile(strDir + "/product", "Quad RS232-HS"))
+				return false;
+		}
+		char acById[128];
+		snprintf(acById, sizeof(acById), "/usb-FTDI_Quad_RS232-HS_FT%zu-if%02zu-port0",
+			nDevice, nInterface);
+		if (!MakeDirs(strRoot + "/sys/" + strTty)
+			|| symlink("../..", (strRoot + "/sys/" + strTty + "/device").c_str()) != 0
+			|| symlink("../../../../../bus/usb-serial/drivers/ftdi_sio",
+				(strRoot + "/sys/" + strPort + "/driver").c_str()) != 0
+			|| symlink(("../../" + strTty).c_str(), (strClass + "/" + strName).c_str()) != 0
+			|| symlink(("../../" + strName).c_str(), (strById + acById).c_str()) != 0)
+			return false;
+	}
+	return true;
+}
+
+static int RemoveEntry(const char *szPath, const struct stat *, int intFlag, struct FTW *)
+{
+	return (intFlag == FTW_DP) ? rmdir(szPath) : unlink(szPath);
+}
+
+static void RemoveTree(const std::string &strRoot)
+{
+	nftw(strRoot.c_str(), RemoveEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+#endif
+
+// Scripts nPorts ports on quad adapters, laid out like Windows does for
+// the second port of the first adapter:
+//   USB\VID_0403&PID_6011\FT0                       (USB device)
+//     USB\VID_0403&PID_6011&MI_01\6&2A1B&0&0001     (interface)
+//       FTDIBUS\VID_0403+PID_6011+FT0B\0000         (port, COM2)
+// plus a DOS device name for each port. The ports of every 16th adapter
+// have a device path and a friendly name longer than 256 characters;
+// astrPaths receives the device path of each port, by port number.
+static void MakeFakeDevices(CFakeDeviceApi &api, size_t nPorts,
+	std::vector<std::string> &astrPaths)
+{
+	static const char szGuid[] = "{86e0d1e0-8089-11d0-9ce4-08003e301f73}";
+	api.AddDosDevice("NUL");
+	api.AddDosDevice("C:");
+	astrPaths.resize(nPorts);
+	DEVINST devUsb = 0;
+	for (size_t ii = 0; ii < nPorts; ii++) {
+		size_t nDevice = ii / BENCH_PORTS_PER_DEVICE;
+		size_t nInterface = ii % BENCH_PORTS_PER_DEVICE;
+		bool bLong = (nDevice % BENCH_LONG_PATH_EVERY) == BENCH_LONG_PATH_EVERY - 1;
+		std::string strSerial = "FT" + std::to_string(nDevice);
+		std::string strName = "COM" + std::to_string(ii + 1);
+		char acId[64];
+
+		if (nInterface == 0) {
+			devUsb = api.AddDevice("USB\\VID_0403&PID_6011\\" + strSerial);
+			api.SetProperty(devUsb, SPDRP_MFG, "FTDI");
+			api.SetProperty(devUsb, SPDRP_DEVICEDESC, "Quad RS232-HS");
+		}
+		snprintf(acId, sizeof(acId), "USB\\VID_0403&PID_6011&MI_%02zu\\6&%zx&0&%04zu",
+			nInterface, nDevice, nInterface);
+		DEVINST devInterface = api.AddDevice(acId, devUsb);
+		snprintf(acId, sizeof(acId), "FTDIBUS\\VID_0403+PID_6011+%s%c\\0000",
+			strSerial.c_str(), (char)('A' + nInterface));
+		DEVINST devPort = api.AddDevice(acId, devInterface);
+
+		std::string strDesc = bLong ? "USB Serial Port " + std::string(300, '-')
+			: "USB Serial Port";
+		api.SetProperty(devPort, SPDRP_FRIENDLYNAME, strDesc + " (" + strName + ")");
+		api.SetProperty(devPort, SPDRP_DEVICEDESC, strDesc);
+		api.SetProperty(devPort, SPDRP_LOCATION_INFORMATION, "USB Serial Converter");
+		api.SetProperty(devPort, SPDRP_SERVICE, "FTDIBUS");
+
+		std::string strPath = "\\\\?\\ftdibus#vid_0403+pid_6011+" + strSerial
+			+ (char)('a' + nInterface) + "#0000#" + szGuid;
+		if (bLong)
+			strPath += "\\" + std::string(300, 'x');
+		api.AddInterface(devPort, strPath);
+		api.AddDosDevice(strName);
+		astrPaths[ii] = strPath;
+	}
+}
+
+// EnumSerialPorts on Windows 2000 and later, minus the OS version check,
+// against api. Ports are identified by name, as on Windows.
+static void EnumFakeDevices(CFakeDeviceApi &api, std::vector<SSerInfo> &asi)
+{
+	asi.clear();
+	CPortMerger merger(asi, PORT_FIELD_ALL, PORT_KEY_NAME);
+	std::vector<SSerInfo> asiSource;
+	EnumPortsWdm(api, asiSource, NULL, PORT_FIELD_ALL);
+	merger.AddAll(asiSource, PORT_SOURCE_DEVICE);
+	asiSource.clear();
+	EnumPortsDosDevices(api, asiSource);
+	merger.AddAll(asiSource, PORT_SOURCE_LEGACY);
+	std::sort(asi.begin(), asi.end(), compareSerialInfoByIndex);
+}
+
+// true if every port was found with its full device path and USB device.
+static bool CheckFakeDevices(const std::vector<SSerInfo> &asi,
+	const std::vector<std::string> &astrPaths)
+{
+	if (asi.size() != astrPaths.size())
+		return false;
+	for (size_t ii = 0; ii < asi.size(); ii++) {
+		if (asi[ii].strDevPath != astrPaths[ii] || asi[ii].usb.intVendorId != 0x0403
+			|| asi[ii].usb.intInterface != (int)(ii % BENCH_PORTS_PER_DEVICE)) {
+			fprintf(stderr, "enum: wdm port %zu is \"%s\"\n", ii + 1,
+				asi[ii].strDevPath.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+struct SBenchResult {
+	std::vector<double> adUs;           // Latency of each round
+	unsigned long long ullAllocations;  // Per round
+	unsigned long long ullBytes;
+	size_t nPortsFound;
+	double dApiCallsPerPort;            // -1 if not measured
+};
+
+static double Percentile(const std::vector<double> &adSorted, double dRank)
+{
+	size_t nIndex = (size_t)(dRank * (adSorted.size() - 1) + 0.5);
+	return adSorted[nIndex];
+}
+
+static void PrintResult(const char *szScenario, size_t nPorts, SBenchResult &result)
+{
+	std::vector<double> &adUs = result.adUs;
+	std::sort(adUs.begin(), adUs.end());
+	printf("{\"bench\":\"enum\",\"scenario\":\"%s\",\"ports\":%zu,\"found\":%zu,"
+		"\"rounds\":%zu,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,"
+		"\"max_us\":%.1f,\"allocations\":%llu,\"bytes_allocated\":%llu,"
+		"\"peak_rss_kb\":%llu",
+		szScenario, nPorts, result.nPortsFound, adUs.size(),
+		Percentile(adUs, 0.5), Percentile(adUs, 0.9), Percentile(adUs, 0.99),
+		adUs.back(), result.ullAllocations / adUs.size(),
+		result.ullBytes / adUs.size(), PeakRssKb());
+	if (result.dApiCallsPerPort >= 0)
+		printf(",\"api_calls_per_port\":%.2f", result.dApiCallsPerPort);
+	printf("}\n");
+	fflush(stdout);
+}
+
+// Runs fnRound often enough to get stable percentiles on small sets, at
+// least 5 times on large ones.
+template<typename Fn>
+static void RunRounds(size_t nPorts, SBenchResult &result, Fn fnRound)
+{
+	size_t nRounds = std::min<size_t>(200, std::max<size_t>(5, 200000 / (nPorts + 1)));
+	result.ullAllocations = 0;
+	result.ullBytes = 0;
+	result.dApiCallsPerPort = -1;
+	for (size_t rr = 0; rr < nRounds; rr++) {
+		unsigned long long ullAllocs = g_ullAllocations;
+		unsigned long long ullBytes = g_ullAllocatedBytes;
+		std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+		result.nPortsFound = fnRound();
+		std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - tStart;
+		result.ullAllocations += g_ullAllocations - ullAllocs;
+		result.ullBytes += g_ullAllocatedBytes - ullBytes;
+		result.adUs.push_back(std::chrono::duration_cast<
+			std::chrono::nanoseconds>(elapsed).count() / 1000.0);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<size_t> anSizes;
+	std::string strSizes = (argc > 1) ? argv[1] : "1,10,100,1000,10000,100000";
+	size_t nSysfsMax = (argc > 1) ? (size_t) -1 : BENCH_SYSFS_DEFAULT_MAX;
+#ifdef _WIN32
+	(void) nSysfsMax;				// The sysfs scenario is Linux only
+#endif
+	for (size_t nStart = 0; nStart < strSizes.size(); ) {
+		size_t nComma = strSizes.find(',', nStart);
+		if (nComma == std::string::npos)
+			nComma = strSizes.size();
+		anSizes.push_back(strtoul(strSizes.substr(nStart, nComma - nStart).c_str(), NULL, 10));
+		nStart = nComma + 1;
+	}
+
+#ifdef _WIN32
+	FILE *pNull = fopen("NUL", "wb");
+#else
+	FILE *pNull = fopen("/dev/null", "wb");
+#endif
+	if (pNull == NULL) {
+		fprintf(stderr, "enum: could not open the null device\n");
+		return 1;
+	}
+
+	int intResult = 0;
+	for (size_t ss = 0; ss < anSizes.size(); ss++) {
+		size_t nPorts = anSizes[ss];
+
+		CFakeDeviceApi api;
+		std::vector<std::string> astrPaths;
+		std::vector<SSerInfo> asi;
+		MakeFakeDevices(api, nPorts, astrPaths);
+		SBenchResult wdm;
+		RunRounds(nPorts, wdm, [&]() {
+			EnumFakeDevices(api, asi);
+			WritePorts(asi, pNull);
+			return asi.size();
+		});
+		wdm.dApiCallsPerPort = (double) api.TotalCalls()
+			/ wdm.adUs.size() / std::max<size_t>(nPorts, 1);
+		PrintResult("wdm", nPorts, wdm);
+		if (!CheckFakeDevices(asi, astrPaths)) {
+			fprintf(stderr, "enum: wdm found %zu ports instead of %zu\n",
+				wdm.nPortsFound, nPorts);
+			intResult = 1;
+		}
+
+#ifndef _WIN32
+		if (nPorts > nSysfsMax)
+			continue;
+		const char *szTmp = getenv("TMPDIR");
+		std::string strRoot = std::string((szTmp != NULL && *szTmp) ? szTmp : "/tmp")
+			+ "/enumcom-bench-XXXXXX";
+		if (mkdtemp(&strRoot[0]) == NULL) {
+			perror("enum: mkdtemp");
+			return 1;
+		}
+		if (!MakeSysfsTree(strRoot, nPorts)) {
+			perror("enum: could not build the fake sysfs tree");
+			RemoveTree(strRoot);
+			return 1;
+		}
+		SBenchResult sysfs;
+		std::vector<SSerInfo> asiSysfs;
+		RunRounds(nPorts, sysfs, [&]() {
+			EnumSerialPortsAt(strRoot, asiSysfs, SPortFilter(), PORT_FIELD_ALL, FALSE);
+			WritePorts(asiSysfs, pNull);
+			return asiSysfs.size();
+		});
+		RemoveTree(strRoot);
+		PrintResult("sysfs", nPorts, sysfs);
+		if (sysfs.nPortsFound != nPorts) {
+			fprintf(stderr, "enum: sysfs found %zu ports instead of %zu\n",
+				sysfs.nPortsFound, nPorts);
+			intResult = 1;
+		}
+#endif
+	}
+
+	fclose(pNull);
+	return intResult;
+}
@@ -0,0 +1,174 @@
+/*************************************************************************
+* Stress test for the shared port snapshot
+*
+* A writer publishes two tables of different sizes (A and B) in turn, as
+* fast as it can, while reader processes (threads on Windows) copy the
+* table out of the segment and check that every copy is exactly A or B:
+* anything else is a torn read, and fails the run. Prints the reads per
+* second and the size of the tables.
+*
+* Usage: BenchShared [READERS] [MS]   (default 4 readers, 1000 ms)
+************************************************************************/
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortPacked.h"
+#include "../PortShared.h"
+
+struct SReaderResult {
+	unsigned long long ullReads;
+	unsigned long long ullTorn;
+	unsigned long long ullMissed;   // No table, or the writer never let go
+};
+
+static void MakeTable(size_t nPorts, const char *pszTag, unsigned int uGeneration,
+	std::string &strPacked)
+{
+	std::vector<SSerInfo> asi(nPorts);
+	for (size_t ii = 0; ii < nPorts; ii++) {
+		char acName[64];
+		snprintf(acName, sizeof(acName), "COM%zu", ii + 1);
+		asi[ii].strPortName = acName;
+		asi[ii].strDevPath = std::string("\\\\?\\bench#") + pszTag + "#" + acName;
+		asi[ii].strFriendlyName = std::string(pszTag) + " Port (" + acName + ")";
+		asi[ii].strPortDesc = std::string(pszTag) + " Port";
+		asi[ii].intPortIndex = (int) ii + 1;
+		asi[ii].bUsbDevice = TRUE;
+		asi[ii].usb.intVendorId = 0x0403;
+		asi[ii].usb.intProductId = 0x6011;
+		asi[ii].usb.strSerial = std::string("FT") + pszTag + acName;
+	}
+	PackSerInfo(asi, uGeneration, strPacked);
+}
+
+static void RunReader(const std::string &strName, const std::string &strA,
+	const std::string &strB, int intMs, SReaderResult &result)
+{
+	result.ullReads = result.ullTorn = result.ullMissed = 0;
+	CSharedSnapshotReader reader;
+	if (!reader.Attach(strName)) {
+		result.ullMissed = 1;
+		return;
+	}
+	std::string strPacked;
+	std::chrono::steady_clock::time_point tEnd =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(intMs);
+	while (std::chrono::steady_clock::now() < tEnd) {
+		for (int ii = 0; ii < 64; ii++) {
+			if (!reader.Read(strPacked))
+				result.ullMissed++;
+			else if (strPacked != strA && strPacked != strB)
+				result.ullTorn++;
+			result.ullReads++;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const int nReaders = (argc > 1) ? atoi(argv[1]) : 4;
+	const int intMs = (argc > 2) ? atoi(argv[2]) : 1000;
+
+	std::string strA, strB;
+	MakeTable(16, "ACME", 1, strA);
+	MakeTable(64, "Contoso", 2, strB);
+
+	std::string strName = GetDefaultSharedSnapshotName() + "-bench";
+	CSharedSnapshotWriter writer;
+	try {
+		writer.Open(strName, 64 * 1024);
+	}
+	catch (std::string strCatchErr) {
+		fprintf(stderr, "shared: %s\n", strCatchErr.c_str());
+		return 1;
+	}
+	writer.Publish(strA);
+
+	std::atomic<bool> bStop(false);
+	unsigned long long ullWrites = 0;
+	std::thread writerThread([&]() {
+		while (!bStop) {
+			writer.Publish((ullWrites & 1) ? strA : strB);
+			ullWrites++;
+		}
+	});
+
+	std::vector<SReaderResult> aResults(nReaders);
+#ifdef _WIN32
+	std::vector<std::thread> aThreads;
+	for (int ii = 0; ii < nReaders; ii++) {
+		aThreads.emplace_back(RunReader, std::cref(strName), std::cref(strA),
+			std::cref(strB), intMs, std::ref(aResults[ii]));
+	}
+	for (size_t ii = 0; ii < aThreads.size(); ii++)
+		aThreads[ii].join();
+#else
+	// Each reader is a process of its own, reporting through a pipe.
+	std::vector<int> aiPipes;
+	std::vector<pid_t> aPids;
+	for (int ii = 0; ii < nReaders; ii++) {
+		int fds[2];
+		if (pipe(fds) != 0)
+			break;
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(fds[0]);
+			SReaderResult result;
+			RunReader(strName, strA, strB, intMs, result);
+			ssize_t rc = write(fds[1], &result, sizeof(result));
+			_exit(rc == (ssize_t) sizeof(result) ? 0 : 1);
+		}
+		close(fds[1]);
+		if (pid < 0) {
+			close(fds[0]);
+			break;
+		}
+		aiPipes.push_back(fds[0]);
+		aPids.push_back(pid);
+	}
+	aResults.resize(aPids.size());
+	for (size_t ii = 0; ii < aPids.size(); ii++) {
+		SReaderResult &result = aResults[ii];
+		if (read(aiPipes[ii], &result, sizeof(result)) != (ssize_t) sizeof(result)) {
+			result.ullReads = result.ullTorn = 0;
+			result.ullMissed = 1;
+		}
+		close(aiPipes[ii]);
+		waitpid(aPids[ii], NULL, 0);
+	}
+#endif
+
+	bStop = true;
+	writerThread.join();
+	writer.Close();
+
+	SReaderResult total = { 0, 0, 0 };
+	for (size_t ii = 0; ii < aResults.size(); ii++) {
+		total.ullReads += aResults[ii].ullReads;
+		total.ullTorn += aResults[ii].ullTorn;
+		total.ullMissed += aResults[ii].ullMissed;
+	}
+	double dSeconds = intMs / 1000.0;
+	printf("{\"bench\":\"shared\",\"readers\":%zu,\"table_bytes\":[%zu,%zu],"
+		"\"writes_per_s\":%.0f,\"reads_per_s\":%.0f,\"torn\":%llu,\"missed\":%llu}\n",
+		aResults.size(), strA.size(), strB.size(), ullWrites / dSeconds,
+		total.ullReads / dSeconds, total.ullTorn, total.ullMissed);
+
+	if (aResults.size() != (size_t) nReaders || total.ullTorn != 0) {
+		fprintf(stderr, "shared: %llu torn reads\n", total.ullTorn);
+		return 1;
+	}
+	return 0;
+}
@@ -1,15 +1,21 @@
 #ifndef __LIBRARY__
 #define __LIBRARY__
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <string.h>
 #include <cstring>
 
+#ifdef _WIN32
 #define DLLEXPORT __declspec(dllexport)
 #define STDCALL __stdcall
+#else
+#define DLLEXPORT __attribute__((visibility("default")))
+#define STDCALL
+#endif
 
 #define BUFFERSIZE 1024
-#define MAX_SERIAL_PORT_COUNT 256
 
 typedef struct {
 	int intPortIndex;
@@ -20,4 +26,109 @@ typedef struct {
 	char strPortDesc[BUFFERSIZE];			// friendly name without the COMx
 } SerialPortInformation;
 
+// Compact layout returned by GetSerialPortsPacked. The buffer starts with a
+// header, followed by count fixed-size entries and a pool of NUL-terminated
+// strings. All offsets are relative to the start of the buffer, so it can be
+// copied or mapped anywhere and used as is.
+#define SERIAL_PORTS_PACKED_MAGIC 0x4D4F4345	// "ECOM"
+#define SERIAL_PORTS_PACKED_VERSION 2			// 2: USB device fields
+
+typedef struct {
+	unsigned int offset;					// Start of the string in the buffer
+	unsigned int length;					// Length in bytes, NUL excluded
+} SerialPortString;
+
+typedef struct {
+	int intPortIndex;
+	int bUsbDevice;
+	SerialPortString strDevPath;
+	SerialPortString strPortName;
+	SerialPortString strFriendlyName;
+	SerialPortString strPortDesc;
+	int intVendorId;						// -1 if not on a USB device
+	int intProductId;
+	int intInterface;						// -1 if unknown
+	SerialPortString strSerial;				// USB serial number, empty if none
+	SerialPortString strManufacturer;
+	SerialPortString strProduct;
+} SerialPortPackedEntry;
+
+typedef struct {
+	unsigned int magic;						// SERIAL_PORTS_PACKED_MAGIC
+	unsigned int version;					// SERIAL_PORTS_PACKED_VERSION
+	unsigned int totalSize;					// Size of the whole buffer
+	unsigned int generation;				// Snapshot generation
+	unsigned int count;						// Number of entries
+	unsigned int entrySize;					// sizeof(SerialPortPackedEntry)
+	unsigned int entriesOffset;				// Offset of the first entry
+	unsigned int stringsOffset;				// Offset of the string pool
+} SerialPortsPackedHeader;
+
+// Statistics of the last enumeration, returned by GetSerialPortsStats. All
+// durations are in nanoseconds. Allocations are only counted by enumcom.
+#define SERIAL_PORTS_STATS_PHASES 6			// list, ports, legacy, merge, probe, sort
+
+typedef struct {
+	unsigned long long phaseNs[SERIAL_PORTS_STATS_PHASES];
+	unsigned long long totalNs;
+	unsigned int ports;						// Ports returned
+	unsigned int devices;					// Interfaces examined
+	unsigned int propertyReads;				// Device properties read
+	unsigned int probes;					// Ports opened by the busy probe
+	unsigned long long allocations;
+	unsigned long long bytesAllocated;
+	unsigned long long slowestPortNs;		// Longest time spent on a port
+	char slowestPort[BUFFERSIZE];			// and its name
+} SerialPortsStats;
+
+// Values of intEvent passed to SerialPortCallback.
+#define SERIAL_PORT_ADDED 1
+#define SERIAL_PORT_REMOVED 2
+#define SERIAL_PORT_CHANGED 3
+// Events of EnumSerialPortsAsync. pInfo is NULL for the last three.
+#define SERIAL_PORT_FOUND 4					// A port, as soon as it is found
+#define SERIAL_PORT_SORTED 5				// The final list, one port at a time
+#define SERIAL_PORT_ENUM_DONE 6
+#define SERIAL_PORT_ENUM_CANCELLED 7
+#define SERIAL_PORT_ENUM_FAILED 8
+
+// Options of EnumSerialPortsAsync.
+#define SERIAL_PORTS_ASYNC_SORT 1			// Send the sorted list at the end
+#define SERIAL_PORTS_ASYNC_IGNORE_BUSY 2	// Leave busy ports out of it
+
+// Hotplug and asynchronous enumeration notification, called from a
+// background thread of the library. pInfo is only valid during the call.
+typedef void (STDCALL *SerialPortCallback)(int intEvent,
+	const SerialPortInformation* pInfo, void* pUserData);
+
+// Enumeration context, see OpenSerialPortsContext. Each context holds its
+// own port list, of any size.
+typedef void* SerialPortsContext;
+
+// Options of EnumSerialPortsInContext.
+#define SERIAL_PORTS_IGNORE_BUSY 2			// Leave busy ports out
+#define SERIAL_PORTS_PROBE_CAPS 4			// Read the capabilities too
+#define SERIAL_PORTS_PROBE_UARTS 8			// Open the ttyS ports sysfs doesn't describe (Linux)
+
+// Capabilities of a port, returned by GetSerialPortsCapsRange.
+#define SERIAL_PORT_CAPS_UNPROBED 0
+#define SERIAL_PORT_CAPS_PROBED 1
+#define SERIAL_PORT_CAPS_CACHED 2			// From the capability cache
+#define SERIAL_PORT_CAPS_FAILED 3			// Couldn't be opened in time
+
+#define SERIAL_PORT_KIND_UNKNOWN 0
+#define SERIAL_PORT_KIND_UART 1
+#define SERIAL_PORT_KIND_CDC_ACM 2			// USB modem class
+#define SERIAL_PORT_KIND_USB_SERIAL 3		// USB-serial bridge
+#define SERIAL_PORT_KIND_VIRTUAL 4			// No hardware (pty...)
+
+typedef struct {
+	int state;								// SERIAL_PORT_CAPS_*
+	int kind;								// SERIAL_PORT_KIND_*
+	int uartType;							// Linux UART type, -1 if none
+	unsigned int minBaud;					// 0 if unknown
+	unsigned int maxBaud;
+	int modemControl;						// DTR/RTS... lines available?
+} SerialPortCapabilities;
+
 #endif /* __LIBRARY__ */
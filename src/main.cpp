@@ -1,100 +1,981 @@
 #include <iostream>
 #include <algorithm>
 #include <string>
+#include <string_view>
+#include <cstdio>
+#include <cstring>
 
 #include "EnumSerial.h"
 
 #ifdef LIBRARY
 
+#include <mutex>
+#include <new>
+
 #include "library.hpp"
+#include "PortCaps.h"
+#include "PortFilter.h"
+#include "PortShared.h"
+#include "PortSnapshot.h"
+#include "PortStats.h"
+#include "PortStream.h"
+#include "PortWait.h"
+#include "PortWatcher.h"
+
+static std::mutex g_watcher_mutex;
+static CPortWatcher *g_watcher = NULL;
+
+// g_stream_start_mutex serializes EnumSerialPortsAsync; g_stream_mutex only
+// guards the pointer, so that CancelSerialPortsAsync never waits for a scan.
+static std::mutex g_stream_start_mutex;
+static std::mutex g_stream_mutex;
+static CPortStream *g_stream = NULL;
+
+// Attached to the segment of enumcom --publish on first use, and again
+// whenever that publisher goes away.
+static std::mutex g_shared_mutex;
+static CSharedSnapshotReader g_shared;
 
-static SerialPortInformation g_serial_ports[MAX_SERIAL_PORT_COUNT];
-static int g_serial_ports_count = 0;
+// Behind a SerialPortsContext. The mutex only serializes the calls made on
+// the same context; different contexts never wait for each other.
+struct SPortsContext {
+	std::mutex mtx;
+	std::vector<SSerInfo> asi;
+};
+
+// Truncating string copy, strncpy_s(..., _TRUNCATE) isn't available outside
+// of the Microsoft runtime.
+static void copy_string(char *dest, size_t size, std::string_view src)
+{
+	size_t len = (src.size() < size) ? src.size() : size - 1;
+	memcpy(dest, src.data(), len);
+	dest[len] = '\0';
+}
 
+static void FillSerialPortInformation(SerialPortInformation &info, const SSerInfo &item)
+{
+	info.intPortIndex = item.intPortIndex;
+	info.bUsbDevice = item.bUsbDevice;
+	copy_string(info.strDevPath, BUFFERSIZE, item.strDevPath);
+	copy_string(info.strPortName, BUFFERSIZE, item.strPortName);
+	copy_string(info.strFriendlyName, BUFFERSIZE, item.strFriendlyName);
+	copy_string(info.strPortDesc, BUFFERSIZE, item.strPortDesc);
+}
+
+static unsigned int RefreshSnapshot()
+{
+	std::vector<SSerInfo> asi;
+	try {
+		EnumSerialPorts(asi, FALSE /*include all*/);
+		return PublishSnapshot(asi);
+	}
+	catch (std::string) {
+	}
+	catch (...) {
+		// Out of memory or threads: nothing may leave an export.
+	}
+	// Keep serving the previous snapshot.
+	CSnapshotReader snapshot;
+	return snapshot.get() ? snapshot->uGeneration : 0;
+}
+
+// Enumerates on first use rather than in DllMain, where the loader lock
+// is held.
+static void EnsureSnapshot()
+{
+	static std::once_flag s_once;
+	std::call_once(s_once, RefreshSnapshot);
+}
+
+// Every export that enumerates opens the ports on worker threads (see
+// PortProbe.h). A port whose driver doesn't answer in time is given up on,
+// but its worker keeps running library code until the driver returns: the
+// library must not be unloaded while such a probe is hung. At most
+// PORT_PROBE_MAX_ABANDONED of them are left running; past that, ports are
+// reported as unknown without being opened.
 extern "C" {
 	
 	DLLEXPORT int STDCALL GetSerialPortsCount()
 	{
-		return g_serial_ports_count;
+		EnsureSnapshot();
+		CSnapshotReader snapshot;
+		return snapshot.get() ? (int) snapshot->asi.size() : 0;
 	}
 	
 	DLLEXPORT int STDCALL GetSerialPorts(SerialPortInformation* outArray, int maxCount)
 	{
-		if (!outArray || maxCount <= 0 || g_serial_ports_count <= 0)
+		if (!outArray || maxCount <= 0)
+		{
+			return 0;
+		}
+
+		EnsureSnapshot();
+		CSnapshotReader snapshot;
+		if (!snapshot.get())
+		{
+			return 0;
+		}
+
+		int count = (int) snapshot->asi.size();
+		int actualCount = (maxCount < count) ? maxCount : count;
+
+		for (int i = 0; i < actualCount; i++) {
+			FillSerialPortInformation(outArray[i], snapshot->asi[i]);
+		}
+
+		return actualCount;
+	}
+
+	// Copies the port list in the compact layout described by
+	// SerialPortsPackedHeader. Returns the size of the whole layout: nothing
+	// is copied if buffer is NULL or bufferSize is smaller than that, so call
+	// it once with NULL to size the buffer. The size may grow between two
+	// calls if the ports change; just call again.
+	DLLEXPORT int STDCALL GetSerialPortsPacked(void* buffer, int bufferSize)
+	{
+		EnsureSnapshot();
+		CSnapshotReader snapshot;
+		if (!snapshot.get())
+		{
+			return 0;
+		}
+
+		int size = (int) snapshot->strPacked.size();
+		if (buffer && bufferSize >= size) {
+			memcpy(buffer, snapshot->strPacked.data(), size);
+		}
+		return size;
+	}
+
+	// Same as GetSerialPortsPacked, but copies the list kept in shared memory
+	// by enumcom --publish instead of enumerating in this process. Returns 0
+	// if no publisher of this user is running, or if it was killed.
+	DLLEXPORT int STDCALL ReadSharedSerialPorts(void* buffer, int bufferSize)
+	{
+		std::lock_guard<std::mutex> lock(g_shared_mutex);
+		try {
+			if (g_shared.IsClosed() && !g_shared.Attach(GetDefaultSharedSnapshotName()))
+			{
+				return 0;
+			}
+		}
+		catch (...) {
+			return 0;
+		}
+
+		size_t size = 0;
+		if (!g_shared.Read(buffer, (buffer && bufferSize > 0) ? bufferSize : 0, size))
+		{
+			return 0;
+		}
+		return (int) size;
+	}
+
+	// Enumerates the ports again and publishes the result if it differs from
+	// the current snapshot. Returns the generation of the current snapshot.
+	DLLEXPORT unsigned int STDCALL RefreshSerialPorts()
+	{
+		return RefreshSnapshot();
+	}
+
+	// Returns the generation of the snapshot read by GetSerialPortsCount and
+	// GetSerialPorts. It only changes when the port list changes.
+	DLLEXPORT unsigned int STDCALL GetSerialPortsGeneration()
+	{
+		EnsureSnapshot();
+		CSnapshotReader snapshot;
+		return snapshot.get() ? snapshot->uGeneration : 0;
+	}
+
+	// Starts watching for ports being added or removed; callback is invoked
+	// for each change, after the snapshot has been updated. Pass NULL to stop
+	// watching (never from the callback itself). Returns 1 on success, 0 if
+	// the watcher couldn't be started.
+	DLLEXPORT int STDCALL RegisterSerialPortCallback(SerialPortCallback callback, void* userData)
+	{
+		std::lock_guard<std::mutex> lock(g_watcher_mutex);
+		if (g_watcher) {
+			delete g_watcher;
+			g_watcher = NULL;
+		}
+		if (!callback)
+			return 1;
+
+		CPortWatcher *pWatcher = NULL;
+		try {
+			pWatcher = new CPortWatcher();
+			pWatcher->Start([pWatcher, callback, userData](int intEvent, const SSerInfo &si) {
+				// Runs on the watcher thread; the snapshot just stays
+				// behind if it can't be copied.
+				try {
+					std::vector<SSerInfo> asi;
+					pWatcher->GetPorts(asi);
+					PublishSnapshot(asi);
+				}
+				catch (...) {
+				}
+
+				SerialPortInformation info;
+				FillSerialPortInformation(info, si);
+				callback(intEvent, &info, userData);
+			});
+		}
+		catch (std::string) {
+			delete pWatcher;
+			return 0;
+		}
+		catch (...) {
+			delete pWatcher;
+			return 0;
+		}
+		g_watcher = pWatcher;
+		return 1;
+	}
+
+	// Enumerates the ports on a background thread and returns at once.
+	// callback receives SERIAL_PORT_FOUND with each port as soon as it is
+	// found (not checked for being busy, in no particular order), then, with
+	// SERIAL_PORTS_ASYNC_SORT, SERIAL_PORT_SORTED with each port of the final
+	// list, and at last SERIAL_PORT_ENUM_DONE, _CANCELLED or _FAILED. A scan
+	// still running is cancelled and waited for first; pass a NULL callback
+	// to only do that, e.g. before unloading the library (which hung probes
+	// still prevent, see above). Neither this
+	// function nor RegisterSerialPortCallback may be called from the
+	// callback. Returns 1 if a scan was started, 0 if callback is NULL or
+	// the scan couldn't be started.
+	DLLEXPORT int STDCALL EnumSerialPortsAsync(SerialPortCallback callback, void* userData, int options)
+	{
+		std::lock_guard<std::mutex> start_lock(g_stream_start_mutex);
+		CPortStream *pOld;
+		{
+			std::lock_guard<std::mutex> lock(g_stream_mutex);
+			pOld = g_stream;
+			g_stream = NULL;
+		}
+		if (pOld) {
+			pOld->Cancel();
+			delete pOld;
+		}
+		if (!callback)
+			return 0;
+
+		DWORD dwOptions = 0;
+		if (options & SERIAL_PORTS_ASYNC_SORT)
+			dwOptions |= PORT_STREAM_SORT;
+		if (options & SERIAL_PORTS_ASYNC_IGNORE_BUSY)
+			dwOptions |= PORT_STREAM_IGNORE_BUSY;
+
+		CPortStream *pStream = NULL;
+		try {
+			pStream = new CPortStream();
+			pStream->Start([callback, userData](const SSerInfo &si) {
+				SerialPortInformation info;
+				FillSerialPortInformation(info, si);
+				callback(SERIAL_PORT_FOUND, &info, userData);
+				return true;
+			}, [callback, userData, dwOptions](int intState, const std::vector<SSerInfo> &asi) {
+				if (intState == PORT_STREAM_DONE) {
+					// Same list as RefreshSerialPorts: share it, if it can be
+					// copied.
+					if (dwOptions == PORT_STREAM_SORT) {
+						try {
+							PublishSnapshot(asi);
+						}
+						catch (...) {
+						}
+					}
+					if (dwOptions & PORT_STREAM_SORT) {
+						SerialPortInformation info;
+						for (size_t i = 0; i < asi.size(); i++) {
+							FillSerialPortInformation(info, asi[i]);
+							callback(SERIAL_PORT_SORTED, &info, userData);
+						}
+					}
+				}
+				int intEvent = SERIAL_PORT_ENUM_DONE;
+				if (intState == PORT_STREAM_CANCELLED)
+					intEvent = SERIAL_PORT_ENUM_CANCELLED;
+				else if (intState == PORT_STREAM_FAILED)
+					intEvent = SERIAL_PORT_ENUM_FAILED;
+				callback(intEvent, NULL, userData);
+			}, SPortFilter(), PORT_FIELD_ALL, dwOptions);
+		}
+		catch (...) {
+			delete pStream;
+			return 0;
+		}
+
+		std::lock_guard<std::mutex> lock(g_stream_mutex);
+		g_stream = pStream;
+		return 1;
+	}
+
+	// Asks the scan started by EnumSerialPortsAsync to stop; it ends with
+	// SERIAL_PORT_ENUM_CANCELLED. Doesn't wait, so it can be called from the
+	// callback.
+	DLLEXPORT void STDCALL CancelSerialPortsAsync()
+	{
+		std::lock_guard<std::mutex> lock(g_stream_mutex);
+		if (g_stream)
+			g_stream->Cancel();
+	}
+
+	// Blocks until the port known as id is present, e.g. after a board
+	// rebooted: id is anything enumcom --resolve takes, or "VVVV:PPPP" USB
+	// ids. The ports are enumerated once, then only the devices that show
+	// up are read. timeoutMs is negative to wait without a limit. Returns 1
+	// with the port in outInfo, 0 on timeout, -1 if id is empty or the
+	// ports couldn't be watched or enumerated.
+	DLLEXPORT int STDCALL WaitForSerialPort(const char* id, int timeoutMs, SerialPortInformation* outInfo)
+	{
+		if (!id || !outInfo)
+		{
+			return -1;
+		}
+
+		SSerInfo si;
+		try {
+			if (!WaitForSerialPort(std::string(id), timeoutMs, si))
+				return 0;
+		}
+		catch (std::string) {
+			return -1;
+		}
+		catch (...) {
+			return -1;
+		}
+		FillSerialPortInformation(*outInfo, si);
+		return 1;
+	}
+
+	// Creates an enumeration context, independent of the snapshot read by
+	// GetSerialPorts and of the other contexts, so that several threads can
+	// each enumerate into their own. Returns NULL if out of memory.
+	DLLEXPORT SerialPortsContext STDCALL OpenSerialPortsContext()
+	{
+		return new (std::nothrow) SPortsContext();
+	}
+
+	// Enumerates the ports into context, replacing what it held. filter
+	// selects ports as enumcom --filter does (NULL or "" for all); options
+	// is a combination of SERIAL_PORTS_*. Returns the number of ports, or -1
+	// if the filter is malformed or the enumeration failed, in which case
+	// context is left empty.
+	DLLEXPORT int STDCALL EnumSerialPortsInContext(SerialPortsContext context, const char* filter, int options)
+	{
+		SPortsContext *pContext = (SPortsContext*) context;
+		if (!pContext)
+		{
+			return -1;
+		}
+
+		std::lock_guard<std::mutex> lock(pContext->mtx);
+		pContext->asi.clear();
+		try {
+			SPortFilter portFilter;
+			if (filter && !ParsePortFilter(filter, portFilter))
+			{
+				return -1;
+			}
+			BOOL bIgnoreBusy = (options & SERIAL_PORTS_IGNORE_BUSY) ? TRUE : FALSE;
+			DWORD dwOptions = (options & SERIAL_PORTS_PROBE_UARTS) ? PORT_ENUM_PROBE_UARTS : 0;
+			EnumSerialPorts(pContext->asi, portFilter, PORT_FIELD_ALL, bIgnoreBusy,
+				dwOptions);
+			if (options & SERIAL_PORTS_PROBE_CAPS)
+				ProbePortsCaps(pContext->asi, GetDefaultCapsCachePath());
+		}
+		catch (std::string) {
+			pContext->asi.clear();
+			return -1;
+		}
+		catch (...) {
+			pContext->asi.clear();
+			return -1;
+		}
+		return (int) pContext->asi.size();
+	}
+
+	// Returns the number of ports held by context.
+	DLLEXPORT int STDCALL GetSerialPortsContextCount(SerialPortsContext context)
+	{
+		SPortsContext *pContext = (SPortsContext*) context;
+		if (!pContext)
+		{
+			return 0;
+		}
+
+		std::lock_guard<std::mutex> lock(pContext->mtx);
+		return (int) pContext->asi.size();
+	}
+
+	// Copies up to count ports of context, starting at offset, to outArray.
+	// Returns the number of ports copied, 0 past the end.
+	DLLEXPORT int STDCALL GetSerialPortsRange(SerialPortsContext context, int offset, SerialPortInformation* outArray, int count)
+	{
+		SPortsContext *pContext = (SPortsContext*) context;
+		if (!pContext || !outArray || offset < 0 || count <= 0)
+		{
+			return 0;
+		}
+
+		std::lock_guard<std::mutex> lock(pContext->mtx);
+		int total = (int) pContext->asi.size();
+		int actualCount = (offset < total) ? total - offset : 0;
+		if (count < actualCount)
+			actualCount = count;
+
+		for (int i = 0; i < actualCount; i++) {
+			FillSerialPortInformation(outArray[i], pContext->asi[offset + i]);
+		}
+
+		return actualCount;
+	}
+
+	// Copies the capabilities of up to count ports of context, starting at
+	// offset, to outArray; they are only probed if context was filled with
+	// SERIAL_PORTS_PROBE_CAPS. Returns the number of ports copied.
+	DLLEXPORT int STDCALL GetSerialPortsCapsRange(SerialPortsContext context, int offset, SerialPortCapabilities* outArray, int count)
+	{
+		SPortsContext *pContext = (SPortsContext*) context;
+		if (!pContext || !outArray || offset < 0 || count <= 0)
 		{
 			return 0;
 		}
 
-		int actualCount = (maxCount < g_serial_ports_count) ? maxCount : g_serial_ports_count;
+		std::lock_guard<std::mutex> lock(pContext->mtx);
+		int total = (int) pContext->asi.size();
+		int actualCount = (offset < total) ? total - offset : 0;
+		if (count < actualCount)
+			actualCount = count;
 
 		for (int i = 0; i < actualCount; i++) {
-			outArray[i].intPortIndex = g_serial_ports[i].intPortIndex;
-			outArray[i].bUsbDevice = g_serial_ports[i].bUsbDevice;
-			strncpy_s(outArray[i].strDevPath, sizeof(outArray[i].strDevPath), g_serial_ports[i].strDevPath, _TRUNCATE);
-			strncpy_s(outArray[i].strPortName, sizeof(outArray[i].strPortName), g_serial_ports[i].strPortName, _TRUNCATE);
-			strncpy_s(outArray[i].strFriendlyName, sizeof(outArray[i].strFriendlyName), g_serial_ports[i].strFriendlyName, _TRUNCATE);
-			strncpy_s(outArray[i].strPortDesc, sizeof(outArray[i].strPortDesc), g_serial_ports[i].strPortDesc, _TRUNCATE);
+			const SPortCaps &caps = pContext->asi[offset + i].caps;
+			outArray[i].state = caps.intState;
+			outArray[i].kind = caps.intKind;
+			outArray[i].uartType = caps.intUartType;
+			outArray[i].minBaud = caps.dwMinBaud;
+			outArray[i].maxBaud = caps.dwMaxBaud;
+			outArray[i].modemControl = caps.bModemControl;
 		}
 
 		return actualCount;
 	}
+
+	// Frees context. It must not be in use by another thread.
+	DLLEXPORT void STDCALL CloseSerialPortsContext(SerialPortsContext context)
+	{
+		delete (SPortsContext*) context;
+	}
+
+	// Copies the statistics of the last enumeration done by the library.
+	// Returns 0 if there was none yet, or if it was built with STATS=0.
+	DLLEXPORT int STDCALL GetSerialPortsStats(SerialPortsStats* outStats)
+	{
+		SEnumStats stats;
+		try {
+			if (!outStats || !GetLastEnumStats(stats))
+			{
+				return 0;
+			}
+		}
+		catch (...) {
+			return 0;
+		}
+
+		memset(outStats, 0, sizeof(SerialPortsStats));
+		for (int i = 0; i < SERIAL_PORTS_STATS_PHASES && i < ENUM_PHASE_COUNT; i++) {
+			outStats->phaseNs[i] = stats.aullPhaseNs[i];
+		}
+		outStats->totalNs = stats.ullTotalNs;
+		outStats->ports = stats.uPorts;
+		outStats->devices = stats.uDevices;
+		outStats->propertyReads = stats.uPropertyReads;
+		outStats->probes = stats.uProbes;
+		outStats->allocations = stats.ullAllocations;
+		outStats->bytesAllocated = stats.ullBytesAllocated;
+		outStats->slowestPortNs = stats.ullSlowestPortNs;
+		copy_string(outStats->slowestPort, BUFFERSIZE, stats.strSlowestPort);
+		return 1;
+	}
+}
+
+#else
+
+#include <chrono>
+#include <mutex>
+#include <new>
+#include <signal.h>
+#include <stdlib.h>
+#include <thread>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "PortCache.h"
+#include "PortCaps.h"
+#include "PortDiff.h"
+#include "PortFilter.h"
+#include "PortIndex.h"
+#include "PortServer.h"
+#include "PortShared.h"
+#include "PortStats.h"
+#include "PortWait.h"
+#include "PortWatcher.h"
+#include "PortWriter.h"
+
+#ifdef ENUMCOM_STATS
+// Counts the allocations of the enumeration for --stats. Only the program
+// may replace these, the library reports no allocations.
+void *operator new(size_t nSize)
+{
+	EnumStatsAllocation(nSize);
+	void *p = malloc(nSize ? nSize : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+#endif
+
+static volatile sig_atomic_t g_bStop = 0;
+
+static void on_stop_signal(int) {
+	g_bStop = 1;
+}
+
+// Sets g_bStop on SIGINT or SIGTERM.
+static void catch_stop_signals() {
+#ifndef _WIN32
+	// No SA_RESTART: the signal must interrupt poll() to be noticed.
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_stop_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+#else
+	signal(SIGINT, on_stop_signal);
+	signal(SIGTERM, on_stop_signal);
+#endif
+}
+
+// Runs the port server until SIGINT or SIGTERM.
+static int serve(const std::string &strSocketPath) {
+#ifndef _WIN32
+	catch_stop_signals();
+#endif
+	try {
+		RunPortServer(strSocketPath, &g_bStop);
+	}
+	catch (std::string strErr) {
+		std::cerr << strErr << std::endl;
+		return 1;
+	}
+	return 0;
 }
 
-BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
-    if (fdwReason == DLL_PROCESS_ATTACH) {
+// Keeps the port list in the shared memory segment strName, for the
+// readers of ReadSharedSerialPorts, until SIGINT or SIGTERM. Like the
+// server, it follows hotplug events, or the device tree fingerprint every
+// second where there are none.
+static int publish(const std::string &strName) {
+	catch_stop_signals();
+	CSharedSnapshotWriter shared;
+	try {
+		shared.Open(strName);
+	}
+	catch (std::string strErr) {
+		std::cerr << strErr << std::endl;
+		return 1;
+	}
+
+	std::mutex mtx;
+	unsigned int uGeneration = 0;
+	auto update = [&](const std::vector<SSerInfo> &asi) {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!shared.Publish(asi, ++uGeneration))
+			std::cerr << strName << ": the port list doesn't fit" << std::endl;
+	};
+
+	CPortWatcher watcher;
+	bool bWatching = true;
+	try {
+		watcher.Start([&](int /*intEvent*/, const SSerInfo & /*si*/) {
+			std::vector<SSerInfo> asi;
+			watcher.GetPorts(asi);
+			update(asi);
+		});
 		std::vector<SSerInfo> asi;
-		
-		EnumSerialPorts(asi, FALSE /*include all*/);
-		
-		for (int i = 0; i < asi.size(); i++) {
-			SSerInfo item = asi[i];
-			g_serial_ports[i].intPortIndex = item.intPortIndex;
-			strncpy_s(g_serial_ports[i].strDevPath, BUFFERSIZE, item.strDevPath.c_str(), _TRUNCATE); 
-			strncpy_s(g_serial_ports[i].strPortName, BUFFERSIZE, item.strPortName.c_str(), _TRUNCATE);
-			strncpy_s(g_serial_ports[i].strFriendlyName, BUFFERSIZE, item.strFriendlyName.c_str(), _TRUNCATE);
-			g_serial_ports[i].bUsbDevice = item.bUsbDevice;
-			strncpy_s(g_serial_ports[i].strPortDesc, BUFFERSIZE, item.strPortDesc.c_str(), _TRUNCATE);
+		watcher.GetPorts(asi);
+		update(asi);
+	}
+	catch (std::string) {
+		bWatching = false;
+	}
+
+	unsigned long long ullFingerprint = 0;
+	bool bEnumerated = false;
+	while (!g_bStop) {
+		if (!bWatching) {
+			unsigned long long ullNow = GetDeviceTreeFingerprint();
+			if (!bEnumerated || ullNow != ullFingerprint) {
+				std::vector<SSerInfo> asi;
+				try {
+					EnumSerialPorts(asi, FALSE /*include all*/);
+					update(asi);
+					ullFingerprint = ullNow;
+					bEnumerated = true;
+				}
+				catch (std::string strErr) {
+					std::cerr << strErr << std::endl;
+				}
+			}
 		}
+		for (int intSlept = 0; intSlept < 1000 && !g_bStop; intSlept += 50)
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
 
-		g_serial_ports_count = asi.size();
-    }
-    return TRUE;
+	watcher.Stop();
+	shared.Close();
+	return 0;
 }
 
-#else
+// Prints the changes of the port list as NDJSON events, every intIntervalMs,
+// until SIGINT or SIGTERM. The ports present at first are reported as
+// added. The ports are only enumerated again when the device tree
+// fingerprint (see PortCache.h) changes, so a quiet tick costs a few
+// directory listings (registry reads on Windows) and prints nothing.
+static int watch(int intIntervalMs, const SPortFilter &filter, DWORD dwOptions) {
+	catch_stop_signals();
+	CPortWriter writer(PORT_FORMAT_NDJSON, stdout);
+	std::vector<SSerInfo> asiOld;
+	std::vector<SSerInfo> asiNew;
+	unsigned long long ullFingerprint = 0;
+	bool bEnumerated = false;
+	while (!g_bStop) {
+		unsigned long long ullNow = GetDeviceTreeFingerprint();
+		if (!bEnumerated || ullNow != ullFingerprint) {
+			try {
+				EnumSerialPorts(asiNew, filter, PORT_FIELD_ALL, FALSE/*include all*/,
+					dwOptions);
+				DiffPortSnapshots(asiOld, asiNew,
+					[&writer](int intEvent, const SSerInfo &si) {
+						writer.WriteEvent(intEvent, si);
+					});
+				asiOld.swap(asiNew);
+				ullFingerprint = ullNow;
+				bEnumerated = true;
+			}
+			catch (std::string strErr) {
+				// Try again on the next tick.
+				std::cerr << strErr << std::endl;
+			}
+			if (!writer.End())
+				return 1;
+		}
 
-#define DELIMITER "|"
+		// Sleep in slices, to stop soon after a signal.
+		for (int intSlept = 0; intSlept < intIntervalMs && !g_bStop; intSlept += 50) {
+			int intSlice = (intIntervalMs - intSlept < 50) ? intIntervalMs - intSlept : 50;
+			std::this_thread::sleep_for(std::chrono::milliseconds(intSlice));
+		}
+	}
+	return 0;
+}
 
-std::string quoted(std::string& str) {
-	std::replace( str.begin(), str.end(), '"', '\"');
-	return "\"" + str + "\"";
+// Waits for the port known as strId for up to intTimeoutMs (no limit if
+// negative), or until SIGINT or SIGTERM, and prints it.
+static int wait_for(const std::string &strId, int intTimeoutMs, int intFormat) {
+	catch_stop_signals();
+	SSerInfo si;
+	try {
+		if (!WaitForSerialPort(strId, intTimeoutMs, si, &g_bStop)) {
+			if (!g_bStop)
+				std::cerr << strId << ": timed out" << std::endl;
+			return 1;
+		}
+	}
+	catch (std::string strErr) {
+		std::cerr << strErr << std::endl;
+		return 1;
+	}
+
+#ifdef _WIN32
+	if (intFormat == PORT_FORMAT_BINARY)
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	CPortWriter writer(intFormat, stdout);
+	writer.Begin();
+	writer.Write(si);
+	return writer.End() ? 0 : 1;
+}
+
+// Parses a --watch interval or a --timeout, in milliseconds, of at least
+// intMinMs.
+static bool parse_interval(const std::string &strValue, int &intIntervalMs,
+	int intMinMs=1) {
+	if (strValue.empty() || strValue.size() > 9
+		|| strValue.find_first_not_of("0123456789") != std::string::npos)
+		return false;
+	intIntervalMs = atoi(strValue.c_str());
+	return intIntervalMs >= intMinMs;
+}
+
+// Prints the statistics of the last enumeration, if any, to stderr.
+static void print_stats() {
+	SEnumStats stats;
+	if (!GetLastEnumStats(stats)) {
+		fprintf(stderr, "stats: no enumeration was run\n");
+		return;
+	}
+	fprintf(stderr, "stats: %u ports from %u devices in %.3f ms\n",
+		stats.uPorts, stats.uDevices, stats.ullTotalNs / 1e6);
+	for (int ii = 0; ii < ENUM_PHASE_COUNT; ii++)
+		fprintf(stderr, "  %-8s %10.3f ms\n", SEnumStats::PhaseName(ii),
+			stats.aullPhaseNs[ii] / 1e6);
+	fprintf(stderr, "  property reads: %u, probes: %u\n",
+		stats.uPropertyReads, stats.uProbes);
+	fprintf(stderr, "  allocations: %llu (%llu bytes)\n",
+		stats.ullAllocations, stats.ullBytesAllocated);
+	if (!stats.strSlowestPort.empty())
+		fprintf(stderr, "  slowest port: %s (%.3f ms)\n",
+			stats.strSlowestPort.c_str(), stats.ullSlowestPortNs / 1e6);
+}
+
+static void usage(const char *szProgram) {
+	std::cerr << "Usage: " << szProgram << " [options]" << std::endl <<
+		"  --cache[=FILE]   reuse the previous result while the devices don't change" << std::endl <<
+		"  --serve[=SOCK]   keep the port list up to date and serve it to clients" << std::endl <<
+		"  --client[=SOCK]  ask the server for the list, enumerate if none runs" << std::endl <<
+		"  --publish[=NAME] keep the port list up to date in shared memory, for" << std::endl <<
+		"                   ReadSharedSerialPorts" << std::endl <<
+		"  --format=FMT     csv (default), json, ndjson or binary" << std::endl <<
+		"  --filter=TERMS   only list the matching ports, enumerating directly;" << std::endl <<
+		"                   comma-separated usb, VVVV:PPPP, serial=SERIAL, name=GLOB," << std::endl <<
+		"                   driver=NAME, path=PREFIX" << std::endl <<
+		"  --resolve ID     only list the port known as ID: by-id or by-path link," << std::endl <<
+		"                   USB serial number, instance id, name... (repeatable)" << std::endl <<
+		"  --caps           also open the ports to read their kind, baud range and" << std::endl <<
+		"                   modem control lines, cached per device" << std::endl <<
+		"  --probe-uarts    ask the driver of the legacy ttyS ports that sysfs and" << std::endl <<
+		"                   /proc don't describe whether they have a UART (Linux);" << std::endl <<
+		"                   enumerates directly" << std::endl <<
+		"  --stream         print each port as soon as it is found, unsorted, rather" << std::endl <<
+		"                   than by index once all are found; enumerates directly" << std::endl <<
+		"  --stats          time the enumeration and print where it went to stderr" << std::endl <<
+		"  --wait-for ID    wait for the port known as ID (as for --resolve) or with" << std::endl <<
+		"                   the USB ids VVVV:PPPP to show up, then list it" << std::endl <<
+		"  --timeout MS     give up waiting after MS milliseconds (0: only check once)" << std::endl <<
+		"  --watch [MS]     print the ports added, removed or changed as NDJSON" << std::endl <<
+		"                   events, checking every MS milliseconds (1000)" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
 	std::vector<SSerInfo> asi;
+	bool bUseCache = false;
+	bool bUseServer = false;
+	std::string strCacheFile;
+	std::string strSocketPath;
+	int intFormat = PORT_FORMAT_CSV;
+	SPortFilter filter;
+	std::vector<std::string> astrResolve;
+	bool bStats = false;
+	bool bWatch = false;
+	bool bCaps = false;
+	bool bStream = false;
+	DWORD dwEnumOptions = 0;
+	int intIntervalMs = 1000;
+	std::string strWaitFor;
+	int intTimeoutMs = -1;
+
+	for (int ii = 1; ii < argc; ii++) {
+		std::string strArg(argv[ii]);
+		if (strArg == "--cache") {
+			bUseCache = true;
+			strCacheFile = GetDefaultPortCachePath();
+		}
+		else if (strArg.compare(0, 8, "--cache=") == 0) {
+			bUseCache = true;
+			strCacheFile = strArg.substr(8);
+		}
+		else if (strArg == "--serve") {
+			return serve(GetDefaultPortServerPath());
+		}
+		else if (strArg.compare(0, 8, "--serve=") == 0) {
+			return serve(strArg.substr(8));
+		}
+		else if (strArg == "--publish") {
+			return publish(GetDefaultSharedSnapshotName());
+		}
+		else if (strArg.compare(0, 10, "--publish=") == 0) {
+			return publish(strArg.substr(10));
+		}
+		else if (strArg == "--client") {
+			bUseServer = true;
+			strSocketPath = GetDefaultPortServerPath();
+		}
+		else if (strArg.compare(0, 9, "--client=") == 0) {
+			bUseServer = true;
+			strSocketPath = strArg.substr(9);
+		}
+		else if (strArg.compare(0, 9, "--filter=") == 0) {
+			if (!ParsePortFilter(strArg.substr(9), filter)) {
+				usage(argv[0]);
+				return 2;
+			}
+		}
+		else if (strArg == "--resolve" && ii + 1 < argc) {
+			astrResolve.push_back(argv[++ii]);
+		}
+		else if (strArg.compare(0, 10, "--resolve=") == 0) {
+			astrResolve.push_back(strArg.substr(10));
+		}
+		else if (strArg == "--watch") {
+			bWatch = true;
+			if (ii + 1 < argc && parse_interval(argv[ii + 1], intIntervalMs))
+				ii++;
+		}
+		else if (strArg.compare(0, 8, "--watch=") == 0) {
+			bWatch = true;
+			if (!parse_interval(strArg.substr(8), intIntervalMs)) {
+				usage(argv[0]);
+				return 2;
+			}
+		}
+		else if (strArg == "--wait-for" && ii + 1 < argc) {
+			strWaitFor = argv[++ii];
+		}
+		else if (strArg.compare(0, 11, "--wait-for=") == 0) {
+			strWaitFor = strArg.substr(11);
+		}
+		else if (strArg == "--timeout" && ii + 1 < argc) {
+			if (!parse_interval(argv[++ii], intTimeoutMs, 0)) {
+				usage(argv[0]);
+				return 2;
+			}
+		}
+		else if (strArg.compare(0, 10, "--timeout=") == 0) {
+			if (!parse_interval(strArg.substr(10), intTimeoutMs, 0)) {
+				usage(argv[0]);
+				return 2;
+			}
+		}
+		else if (strArg == "--caps") {
+			bCaps = true;
+		}
+		else if (strArg == "--probe-uarts") {
+			dwEnumOptions |= PORT_ENUM_PROBE_UARTS;
+		}
+		else if (strArg == "--stream") {
+			bStream = true;
+		}
+		else if (strArg == "--stats") {
+			bStats = true;
+		}
+		else if (strArg.compare(0, 9, "--format=") == 0) {
+			if (!CPortWriter::ParseFormat(strArg.substr(9), intFormat)) {
+				usage(argv[0]);
+				return 2;
+			}
+		}
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (bWatch)
+		return watch(intIntervalMs, filter, dwEnumOptions);
+	if (!strWaitFor.empty())
+		return wait_for(strWaitFor, intTimeoutMs, intFormat);
+
+#ifdef _WIN32
+	if (intFormat == PORT_FORMAT_BINARY)
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	CPortWriter writer(intFormat, stdout);
+	writer.SetCaps(bCaps);
+	writer.Begin();
+
+	// With --stream, each row goes out as soon as its port is found, unless
+	// the list has to be probed or resolved first. A terminal gets each row
+	// at once; anything else gets them in one write at the end, like the
+	// sorted list.
+	bStream = bStream && !bCaps && astrResolve.empty();
+#ifdef _WIN32
+	bool bFlushRows = bStream && _isatty(_fileno(stdout));
+#else
+	bool bFlushRows = bStream && isatty(fileno(stdout));
+#endif
 
-	std::cout <<
-		"\"Index\"" << DELIMITER <<
-		"\"DevicePath\"" << DELIMITER <<
-		"\"Name\"" << DELIMITER <<
-		"\"FriendlyName\"" << DELIMITER <<
-		"\"IsUSBDevice\"" << DELIMITER <<
-		"\"Description\"" << std::endl;
-		
 	// Populate the list of serial ports.
-	EnumSerialPorts(asi, FALSE/*include all*/);
-	for (int ii = 0; ii < asi.size(); ii++) {
-		SSerInfo item = asi[ii];
-		std::cout <<
-			item.intPortIndex << DELIMITER <<
-			quoted(item.strDevPath) << DELIMITER <<
-			quoted(item.strPortName) << DELIMITER <<
-			quoted(item.strFriendlyName) << DELIMITER <<
-			(item.bUsbDevice ? "TRUE" : "FALSE") << DELIMITER <<
-			quoted(item.strPortDesc) << std::endl;
+	try {
+		// The filter is tested by the backends themselves, and identities
+		// are resolved, on properties that the cache and the server don't
+		// keep; neither probes the UARTs either.
+		if (bStream) {
+			EnumSerialPortsStreaming(asi, [&writer, bFlushRows](const SSerInfo &si) {
+				writer.Write(si);
+				if (bFlushRows)
+					writer.Flush();
+				return true;
+			}, filter, PORT_FIELD_ALL, dwEnumOptions);
+		}
+		else if (!filter.IsEmpty() || !astrResolve.empty() || dwEnumOptions != 0)
+			EnumSerialPorts(asi, filter, PORT_FIELD_ALL, FALSE/*include all*/,
+				dwEnumOptions);
+		else if (bUseServer)
+			EnumSerialPortsClient(asi, strSocketPath);
+		else if (bUseCache)
+			EnumSerialPortsCached(asi, strCacheFile);
+		else
+			EnumSerialPorts(asi, FALSE/*include all*/);
 	}
-	
-	return 0;
+	catch (std::string strErr) {
+		std::cerr << strErr << std::endl;
+		writer.End();
+		return 1;
+	}
+	if (bCaps)
+		ProbePortsCaps(asi, GetDefaultCapsCachePath());
+
+	int intResult = 0;
+	if (bStream) {
+		// Written already.
+	}
+	else if (astrResolve.empty()) {
+		for (size_t ii = 0; ii < asi.size(); ii++)
+			writer.Write(asi[ii]);
+	}
+	else {
+		CPortIndex index;
+		index.Build(asi);
+		for (size_t ii = 0; ii < astrResolve.size(); ii++) {
+			const SSerInfo *pPort = index.Find(astrResolve[ii]);
+			if (pPort != NULL)
+				writer.Write(*pPort);
+			else {
+				std::cerr << astrResolve[ii] << ": no such port" << std::endl;
+				intResult = 1;
+			}
+		}
+	}
+	if (!writer.End())
+		intResult = 1;
+	if (bStats)
+		print_stats();
+	return intResult;
 }
 
 #endif
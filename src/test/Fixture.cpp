@@ -0,0 +1,196 @@
+/*************************************************************************
+* Test helpers
+*
+* See Fixture.h for an overview.
+************************************************************************/
+
+#ifndef _WIN32
+#include <errno.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "Fixture.h"
+
+static int s_intFailures = 0;
+
+bool TestCheck(bool bOk, const char *szExpr, const char *szFile, int intLine)
+{
+	if (!bOk) {
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", szFile, intLine, szExpr);
+		s_intFailures++;
+	}
+	return bOk;
+}
+
+int TestResult(const char *szName)
+{
+	if (s_intFailures == 0) {
+		printf("%s: ok\n", szName);
+		return 0;
+	}
+	printf("%s: %d failed\n", szName, s_intFailures);
+	return 1;
+}
+
+const SSerInfo *FindPort(const std::vector<SSerInfo> &asi, const char *szName)
+{
+	for (size_t ii = 0; ii < asi.size(); ii++) {
+		if (asi[ii].strPortName == szName)
+			return &asi[ii];
+	}
+	return NULL;
+}
+
+bool IsSameList(const std::vector<SSerInfo> &asiA, const std::vector<SSerInfo> &asiB)
+{
+	if (asiA.size() != asiB.size())
+		return false;
+	for (size_t ii = 0; ii < asiA.size(); ii++) {
+		if (!IsSameSerInfo(asiA[ii], asiB[ii]))
+			return false;
+	}
+	return true;
+}
+
+bool IsSameDevPaths(const std::vector<SSerInfo> &asiA, const std::vector<SSerInfo> &asiB)
+{
+	if (asiA.size() != asiB.size())
+		return false;
+	for (size_t ii = 0; ii < asiA.size(); ii++) {
+		if (asiA[ii].strDevPath != asiB[ii].strDevPath)
+			return false;
+	}
+	return true;
+}
+
+#ifndef _WIN32
+
+CFixtureTree::CFixtureTree()
+{
+	const char *szTmp = getenv("TMPDIR");
+	std::string strTemplate = std::string((szTmp != NULL && *szTmp) ? szTmp : "/tmp")
+		+ "/enumcom-test-XXXXXX";
+	if (mkdtemp(&strTemplate[0]) == NULL)
+		throw std::string("Could not create ") + strTemplate + ". (err="
+			+ std::to_string(errno) + ")";
+	m_strRoot = strTemplate;
+	if (!MakeDirs("sys/class/tty") || !MakeDirs("dev")) {
+		int err = errno;
+		Remove("");
+		throw std::string("Could not populate ") + m_strRoot + ". (err="
+			+ std::to_string(err) + ")";
+	}
+}
+
+CFixtureTree::~CFixtureTree()
+{
+	Remove("");
+}
+
+bool CFixtureTree::MakeDirs(const std::string &strPath)
+{
+	std::string strFull = m_strRoot + "/" + strPath;
+	for (size_t nSlash = strFull.find('/', 1); ; nSlash = strFull.find('/', nSlash + 1)) {
+		std::string strDir = strFull.substr(0, nSlash);
+		if (mkdir(strDir.c_str(), 0755) != 0 && errno != EEXIST)
+			return false;
+		if (nSlash == std::string::npos)
+			return true;
+	}
+}
+
+bool CFixtureTree::WriteFile(const std::string &strPath, const std::string &strValue)
+{
+	FILE *pFile = fopen((m_strRoot + "/" + strPath).c_str(), "w");
+	if (pFile == NULL)
+		return false;
+	fprintf(pFile, "%s\n", strValue.c_str());
+	return fclose(pFile) == 0;
+}
+
+bool CFixtureTree::MakeLink(const std::string &strTarget, const std::string &strPath)
+{
+	return symlink(strTarget.c_str(), (m_strRoot + "/" + strPath).c_str()) == 0;
+}
+
+static int RemoveEntry(const char *szPath, const struct stat *, int intFlag, struct FTW *)
+{
+	return (intFlag == FTW_DP) ? rmdir(szPath) : unlink(szPath);
+}
+
+bool CFixtureTree::Remove(const std::string &strPath)
+{
+	return nftw((m_strRoot + "/" + strPath).c_str(), RemoveEntry, 64,
+		FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+static std::string Hex4(int intValue)
+{
+	char acHex[8];
+	snprintf(acHex, sizeof(acHex), "%04x", intValue);
+	return acHex;
+}
+
+bool CFixtureTree::AddUsbTty(const std::string &strName, const std::string &strUsb,
+	int intInterface, const std::string &strDriver, int intVendorId,
+	int intProductId, const std::string &strSerial, const std::string &strProduct)
+{
+	std::string strDevice = "devices/pci0/usb1/" + strUsb;
+	std::string strPort = strDevice + "/" + strUsb + ":1."
+		+ std::to_string(intInterface) + "/" + strName;
+	std::string strTty = strPort + "/tty/" + strName;
+	struct stat st;
+	if (stat((m_strRoot + "/sys/" + strDevice).c_str(), &st) != 0) {
+		if (!MakeDirs("sys/" + strDevice)
+			|| !WriteFile("sys/" + strDevice + "/idVendor", Hex4(intVendorId))
+			|| !WriteFile("sys/" + strDevice + "/idProduct", Hex4(intProductId))
+			|| !WriteFile("sys/" + strDevice + "/serial", strSerial)
+			|| !WriteFile("sys/" + strDevice + "/product", strProduct))
+			return false;
+	}
+	char acById[256];
+	snprintf(acById, sizeof(acById), "dev/serial/by-id/usb-%s_%s-if%02d-port0",
+		strProduct.c_str(), strSerial.c_str(), intInterface);
+	return MakeDirs("sys/" + strTty) && MakeDirs("dev/serial/by-id")
+		&& MakeLink("../..", "sys/" + strTty + "/device")
+		&& MakeLink("../../../../../../bus/usb-serial/drivers/" + strDriver,
+			"sys/" + strPort + "/driver")
+		&& MakeLink("../../" + strTty, "sys/class/tty/" + strName)
+		&& MakeLink("../../" + strName, acById)
+		&& WriteFile("dev/" + strName, "");
+}
+
+bool CFixtureTree::AddUartTty(const std::string &strName, const char *szType)
+{
+	std::string strTty = "devices/platform/serial8250/tty/" + strName;
+	struct stat st;
+	return MakeDirs("sys/" + strTty)
+		&& MakeLink("../..", "sys/" + strTty + "/device")
+		&& (lstat((m_strRoot + "/sys/devices/platform/serial8250/driver").c_str(), &st) == 0
+			|| MakeLink("../../../bus/platform/drivers/serial8250",
+				"sys/devices/platform/serial8250/driver"))
+		&& (szType == NULL || WriteFile("sys/" + strTty + "/type", szType))
+		&& MakeLink("../../" + strTty, "sys/class/tty/" + strName)
+		&& WriteFile("dev/" + strName, "");
+}
+
+bool CFixtureTree::AddVirtualTty(const std::string &strName)
+{
+	std::string strTty = "devices/virtual/tty/" + strName;
+	return MakeDirs("sys/" + strTty)
+		&& MakeLink("../../" + strTty, "sys/class/tty/" + strName)
+		&& WriteFile("dev/" + strName, "");
+}
+
+bool CFixtureTree::RemoveTty(const std::string &strName)
+{
+	return unlink((m_strRoot + "/sys/class/tty/" + strName).c_str()) == 0
+		&& unlink((m_strRoot + "/dev/" + strName).c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*************************************************************************
+* Test helpers
+*
+* Each test/Test*.cpp is a program checking one area of the library; it
+* runs all of its CHECKs, reports the failed ones on stderr and exits with
+* a non-zero status if there were any ("make check" runs them all).
+*
+* On Linux, CFixtureTree builds a fake sysfs and devtmpfs tree in a
+* temporary directory, laid out like the kernel does, which the *At
+* variants of the enumeration (EnumSerialPortsAt, ReadPortSysfs...) read
+* instead of the live system.
+************************************************************************/
+
+#ifndef __FIXTURE__
+#define __FIXTURE__
+
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+
+// Records a failure, with its location, if cond is false.
+#define CHECK(cond) TestCheck((cond), #cond, __FILE__, __LINE__)
+
+bool TestCheck(bool bOk, const char *szExpr, const char *szFile, int intLine);
+
+// Prints the outcome of test szName. Returns the exit status of the test:
+// 0 if every CHECK passed.
+int TestResult(const char *szName);
+
+// The port of asi named szName ("ttyUSB0", "COM3"), or NULL.
+const SSerInfo *FindPort(const std::vector<SSerInfo> &asi, const char *szName);
+
+// Whether both lists hold the same ports, in the same order, with the same
+// properties (see IsSameSerInfo).
+bool IsSameList(const std::vector<SSerInfo> &asiA, const std::vector<SSerInfo> &asiB);
+
+// Whether both lists hold the same device paths, in the same order.
+bool IsSameDevPaths(const std::vector<SSerInfo> &asiA, const std::vector<SSerInfo> &asiB);
+
+#ifndef _WIN32
+
+class CFixtureTree {
+public:
+	// Creates an empty tree in a new temporary directory. Throws a
+	// std::string on failure.
+	CFixtureTree();
+	// Removes the tree.
+	~CFixtureTree();
+
+	const std::string &Root() const { return m_strRoot; }
+
+	// The paths below are relative to the root.
+	bool MakeDirs(const std::string &strPath);
+	// Writes strValue and a newline, like sysfs attributes read.
+	bool WriteFile(const std::string &strPath, const std::string &strValue);
+	bool MakeLink(const std::string &strTarget, const std::string &strPath);
+	// Removes a file, a link or a whole directory.
+	bool Remove(const std::string &strPath);
+
+	// A port of a USB serial adapter bound to strDriver, on interface
+	// intInterface of the USB device strUsb ("1-2"), whose attributes are
+	// written the first time; with its /dev node and /dev/serial/by-id
+	// link:
+	//   sys/class/tty/ttyUSB0 ->
+	//     ../../devices/pci0/usb1/1-2/1-2:1.0/ttyUSB0/tty/ttyUSB0
+	//   .../1-2:1.0/ttyUSB0/tty/ttyUSB0/device -> ../..
+	//   .../ttyUSB0/driver -> ../../../../../../bus/usb-serial/drivers/ftdi_sio
+	//   dev/serial/by-id/usb-<product>_<serial>-if00-port0 -> ../../ttyUSB0
+	bool AddUsbTty(const std::string &strName, const std::string &strUsb,
+		int intInterface, const std::string &strDriver, int intVendorId,
+		int intProductId, const std::string &strSerial,
+		const std::string &strProduct);
+	// A ttyS<n> slot of the 8250 driver, with a "type" attribute set to
+	// szType unless it is NULL (older kernels, other drivers).
+	bool AddUartTty(const std::string &strName, const char *szType);
+	// A tty without a device link (virtual terminal, pty...).
+	bool AddVirtualTty(const std::string &strName);
+	// Removes the class entry and /dev node of a tty, as when its device
+	// goes away.
+	bool RemoveTty(const std::string &strName);
+
+private:
+	CFixtureTree(const CFixtureTree &);
+	CFixtureTree &operator=(const CFixtureTree &);
+
+	std::string m_strRoot;
+};
+
+#endif
+
+#endif /* __FIXTURE__ */
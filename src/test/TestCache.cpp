@@ -0,0 +1,121 @@
+/*************************************************************************
+* Enumeration cache
+*
+* The device tree fingerprint of a fake tree, before and after ports come
+* and go and /dev is touched, and the cache file it keys: a hit while the
+* fingerprint holds, a miss once it moved or the file is damaged.
+************************************************************************/
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortCache.h"
+#include "../PortFilter.h"
+#include "Fixture.h"
+
+#ifndef _WIN32
+
+// Sets the modification time of strPath to tSec seconds after the epoch.
+static bool SetMtime(const std::string &strPath, time_t tSec)
+{
+	struct timespec ats[2];
+	ats[0].tv_sec = ats[1].tv_sec = tSec;
+	ats[0].tv_nsec = ats[1].tv_nsec = 0;
+	return utimensat(AT_FDCWD, strPath.c_str(), ats, 0) == 0;
+}
+
+static void TestFingerprint(CFixtureTree &tree)
+{
+	std::string strDev = tree.Root() + "/dev";
+	CHECK(SetMtime(strDev, 1000000));
+	unsigned long long ullFirst = GetDeviceTreeFingerprint(tree.Root());
+	CHECK(GetDeviceTreeFingerprint(tree.Root()) == ullFirst);
+
+	// A node added or removed moves the /dev mtime, even if the class
+	// entries are the same.
+	CHECK(SetMtime(strDev, 1000001));
+	unsigned long long ullTouched = GetDeviceTreeFingerprint(tree.Root());
+	CHECK(ullTouched != ullFirst);
+	CHECK(SetMtime(strDev, 1000000));
+	CHECK(GetDeviceTreeFingerprint(tree.Root()) == ullFirst);
+
+	// A new tty, whatever the mtimes say.
+	CHECK(tree.AddUsbTty("ttyUSB1", "1-3", 0, "pl2303", 0x067b, 0x2303, "P1", "PL2303"));
+	CHECK(SetMtime(strDev, 1000000));
+	CHECK(SetMtime(strDev + "/serial/by-id", 1000000));
+	unsigned long long ullAdded = GetDeviceTreeFingerprint(tree.Root());
+	CHECK(ullAdded != ullFirst);
+
+	// And gone again, udev link included.
+	CHECK(tree.RemoveTty("ttyUSB1"));
+	CHECK(tree.Remove("dev/serial/by-id/usb-PL2303_P1-if00-port0"));
+	CHECK(SetMtime(strDev, 1000000));
+	CHECK(GetDeviceTreeFingerprint(tree.Root()) != ullAdded);
+}
+
+static void TestCacheFile(CFixtureTree &tree)
+{
+	std::vector<SSerInfo> asi, asiCached;
+	EnumSerialPortsAt(tree.Root(), asi, SPortFilter(), PORT_FIELD_ALL, FALSE);
+	CHECK(asi.size() == 2);
+
+	// The directories of the cache file are created as needed.
+	std::string strCache = tree.Root() + "/home/.cache/enumcom.cache";
+	unsigned long long ullFingerprint = GetDeviceTreeFingerprint(tree.Root());
+	CHECK(!LoadPortCache(strCache, ullFingerprint, asiCached));
+	CHECK(SavePortCache(strCache, ullFingerprint, asi));
+	struct stat st;
+	CHECK(stat((tree.Root() + "/home/.cache").c_str(), &st) == 0
+		&& (st.st_mode & 0777) == 0700);
+
+	// Hit while the fingerprint holds, USB device included.
+	CHECK(LoadPortCache(strCache, ullFingerprint, asiCached));
+	CHECK(IsSameList(asi, asiCached));
+	CHECK(asiCached.size() == 2 && asiCached[1].usb.intVendorId == 0x0403
+		&& asiCached[1].usb.strProduct == "FT232R_USB_UART");
+
+	// Miss once /dev moved.
+	CHECK(SetMtime(tree.Root() + "/dev", 2000000));
+	unsigned long long ullMoved = GetDeviceTreeFingerprint(tree.Root());
+	CHECK(ullMoved != ullFingerprint);
+	CHECK(!LoadPortCache(strCache, ullMoved, asiCached));
+
+	// Saved again, then damaged.
+	CHECK(SavePortCache(strCache, ullMoved, asi));
+	CHECK(LoadPortCache(strCache, ullMoved, asiCached));
+	std::string strData;
+	CHECK(LoadCacheFile(strCache, strData));
+	CHECK(strData.size() > 16);
+	CHECK(SaveCacheFile(strCache, strData.substr(0, strData.size() / 2)));
+	CHECK(!LoadPortCache(strCache, ullMoved, asiCached));
+	CHECK(SaveCacheFile(strCache, std::string()));
+	CHECK(!LoadPortCache(strCache, ullMoved, asiCached));
+}
+
+#endif
+
+int main()
+{
+#ifndef _WIN32
+	try {
+		CFixtureTree tree;
+		CHECK(tree.AddUsbTty("ttyUSB0", "1-2", 0, "ftdi_sio", 0x0403, 0x6001,
+			"A9", "FT232R_USB_UART"));
+		CHECK(tree.AddUartTty("ttyS0", "4"));
+		TestFingerprint(tree);
+		TestCacheFile(tree);
+	}
+	catch (std::string strError) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		CHECK(false);
+	}
+#endif
+	return TestResult("cache");
+}
@@ -0,0 +1,216 @@
+/*************************************************************************
+* Capability probing
+*
+* ProbePortCaps on the slave side of a pty pair, which behaves like a
+* virtual port: what it finds, that it backs off while another program
+* holds the port's lock and that it puts the settings back. Then the
+* capability cache: keyed on the USB ids, one entry per device path, and
+* stale entries dropped from a hand-made file.
+************************************************************************/
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortCache.h"
+#include "../PortCaps.h"
+#include "Fixture.h"
+
+#ifndef _WIN32
+
+static void TestProbePty()
+{
+	int fdMaster = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	CHECK(fdMaster >= 0);
+	if (fdMaster < 0)
+		return;
+	CHECK(grantpt(fdMaster) == 0 && unlockpt(fdMaster) == 0);
+	std::string strSlave = ptsname(fdMaster);
+
+	// Held open at 9600 baud across the probes, to see the setting come back.
+	int fdSlave = open(strSlave.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+	CHECK(fdSlave >= 0);
+	struct termios tios;
+	CHECK(tcgetattr(fdSlave, &tios) == 0);
+	cfsetispeed(&tios, B9600);
+	cfsetospeed(&tios, B9600);
+	CHECK(tcsetattr(fdSlave, TCSANOW, &tios) == 0);
+
+	SPortCaps caps;
+	CHECK(ProbePortCaps(strSlave, "pts", FALSE, caps));
+	CHECK(caps.intKind == PORT_KIND_VIRTUAL);
+	CHECK(caps.intUartType == -1);
+	CHECK(caps.dwMinBaud > 0 && caps.dwMaxBaud > caps.dwMinBaud);
+	CHECK(tcgetattr(fdSlave, &tios) == 0 && cfgetospeed(&tios) == B9600);
+
+	// Locked by someone else: not touched.
+	CHECK(flock(fdSlave, LOCK_EX | LOCK_NB) == 0);
+	SPortCaps capsLocked;
+	CHECK(!ProbePortCaps(strSlave, "pts", FALSE, capsLocked));
+	CHECK(capsLocked.intKind == PORT_KIND_UNKNOWN);
+	CHECK(flock(fdSlave, LOCK_UN) == 0);
+
+	// Then through ProbePortsCaps, which marks what it probed.
+	std::vector<SSerInfo> asi(1);
+	asi[0].strDevPath = strSlave;
+	asi[0].strPortName = "pts";
+	ProbePortsCaps(asi, std::string());
+	CHECK(asi[0].caps.intState == PORT_CAPS_PROBED);
+	CHECK(asi[0].caps.intKind == PORT_KIND_VIRTUAL);
+	CHECK(tcgetattr(fdSlave, &tios) == 0 && cfgetospeed(&tios) == B9600);
+
+	close(fdSlave);
+	close(fdMaster);
+}
+
+static SSerInfo MakeUsbPort(const char *szDevPath, int intVendorId, int intProductId,
+	const char *szSerial)
+{
+	SSerInfo si;
+	si.strDevPath = szDevPath;
+	si.bUsbDevice = TRUE;
+	si.usb.intVendorId = intVendorId;
+	si.usb.intProductId = intProductId;
+	si.usb.strSerial = szSerial;
+	return si;
+}
+
+static void AppendUInt32(std::string &str, uint32_t dwValue)
+{
+	str.append((const char*) &dwValue, sizeof(dwValue));
+}
+
+static void AppendString(std::string &str, const std::string &strValue)
+{
+	AppendUInt32(str, (uint32_t) strValue.size());
+	str.append(strValue);
+}
+
+// A version 2 record, as CPortCapsCache::Save writes it.
+static void AppendRecord(std::string &str, const char *szDevPath, const char *szSerial,
+	uint32_t dwVendorId, uint32_t dwProductId, uint32_t dwLastSeen, uint32_t dwMaxBaud)
+{
+	AppendString(str, szDevPath);
+	AppendString(str, szSerial);
+	AppendUInt32(str, dwVendorId);
+	AppendUInt32(str, dwProductId);
+	AppendUInt32(str, dwLastSeen);
+	AppendUInt32(str, PORT_KIND_USB_SERIAL);
+	AppendUInt32(str, (uint32_t) -1);
+	AppendUInt32(str, 300);
+	AppendUInt32(str, dwMaxBaud);
+	AppendUInt32(str, 1);
+	AppendUInt32(str, 0);
+}
+
+static void TestCapsCache(const CFixtureTree &tree)
+{
+	std::string strFile = tree.Root() + "/caps.cache";
+	SPortCaps caps;
+	caps.intKind = PORT_KIND_USB_SERIAL;
+	caps.dwMinBaud = 300;
+	caps.dwMaxBaud = 3000000;
+
+	// Keyed on the ids: another adapter under the same path misses.
+	CPortCapsCache cache;
+	SSerInfo siFtdi = MakeUsbPort("/dev/ttyUSB0", 0x0403, 0x6001, "A9");
+	SSerInfo siPl2303 = MakeUsbPort("/dev/ttyUSB0", 0x067b, 0x2303, "A9");
+	SPortCaps capsFound;
+	cache.Store(siFtdi, caps);
+	CHECK(cache.Find(siFtdi, capsFound) && capsFound.dwMaxBaud == 3000000);
+	CHECK(!cache.Find(siPl2303, capsFound));
+	CHECK(!cache.Find(MakeUsbPort("/dev/ttyUSB0", 0x0403, 0x6001, "B7"), capsFound));
+
+	// And replaces the previous one.
+	cache.Store(siPl2303, caps);
+	cache.Store(MakeUsbPort("/dev/ttyUSB1", 0x0403, 0x6001, "A9"), caps);
+	CHECK(cache.size() == 2);
+	CHECK(!cache.Find(siFtdi, capsFound));
+
+	CHECK(cache.Save(strFile));
+	CPortCapsCache cacheLoaded;
+	CHECK(cacheLoaded.Load(strFile));
+	CHECK(cacheLoaded.size() == 2);
+	CHECK(cacheLoaded.Find(siPl2303, capsFound));
+	CHECK(capsFound.intState == PORT_CAPS_CACHED && capsFound.dwMinBaud == 300);
+
+	// Hand-made file: the entry last seen in 1970 is dropped, and the file
+	// rewritten without it.
+	std::string strData;
+	AppendUInt32(strData, 0x50434345);
+	AppendUInt32(strData, 2);
+	AppendUInt32(strData, 2);
+	AppendRecord(strData, "/dev/ttyUSB2", "OLD", 0x10c4, 0xea60, 0, 921600);
+	AppendRecord(strData, "/dev/ttyUSB3", "NEW", 0x10c4, 0xea60,
+		(uint32_t) time(NULL), 921600);
+	CHECK(SaveCacheFile(strFile, strData));
+	CHECK(cacheLoaded.Load(strFile));
+	CHECK(cacheLoaded.size() == 1);
+	CHECK(!cacheLoaded.Find(MakeUsbPort("/dev/ttyUSB2", 0x10c4, 0xea60, "OLD"), capsFound));
+	CHECK(cacheLoaded.Find(MakeUsbPort("/dev/ttyUSB3", 0x10c4, 0xea60, "NEW"), capsFound));
+	CHECK(capsFound.dwMaxBaud == 921600 && capsFound.bModemControl == TRUE);
+	CHECK(cacheLoaded.Save(strFile));
+	CHECK(cache.Load(strFile) && cache.size() == 1);
+
+	// Every port known already: nothing is probed, but the file is still
+	// rewritten without the stale entry and with the port seen now.
+	strData.clear();
+	AppendUInt32(strData, 0x50434345);
+	AppendUInt32(strData, 2);
+	AppendUInt32(strData, 2);
+	AppendRecord(strData, "/dev/ttyUSB2", "OLD", 0x10c4, 0xea60, 0, 921600);
+	AppendRecord(strData, "/dev/ttyUSB3", "NEW", 0x10c4, 0xea60,
+		(uint32_t) time(NULL) - 2 * 24 * 3600, 921600);
+	CHECK(SaveCacheFile(strFile, strData));
+	std::vector<SSerInfo> asi(1, MakeUsbPort("/dev/ttyUSB3", 0x10c4, 0xea60, "NEW"));
+	ProbePortsCaps(asi, strFile);
+	CHECK(asi[0].caps.intState == PORT_CAPS_CACHED);
+	std::string strSaved;
+	CHECK(LoadCacheFile(strFile, strSaved));
+	// Header, device path, serial number and ids come before the time.
+	size_t nSeenPos = 12 + 4 + strlen("/dev/ttyUSB3") + 4 + strlen("NEW") + 8;
+	uint32_t dwLastSeen = 0;
+	CHECK(strSaved.size() >= nSeenPos + 4);
+	if (strSaved.size() >= nSeenPos + 4)
+		memcpy(&dwLastSeen, strSaved.data() + nSeenPos, 4);
+	CHECK(dwLastSeen + 60 >= (uint32_t) time(NULL));
+	CHECK(cache.Load(strFile) && cache.size() == 1);
+
+	// Truncated, or of another version: rejected as a whole.
+	CHECK(SaveCacheFile(strFile, strData.substr(0, strData.size() - 2)));
+	CHECK(!cache.Load(strFile) && cache.size() == 0);
+	strData[4] = 1;
+	CHECK(SaveCacheFile(strFile, strData));
+	CHECK(!cache.Load(strFile) && cache.size() == 0);
+}
+
+#endif
+
+int main()
+{
+#ifndef _WIN32
+	try {
+		CFixtureTree tree;
+		TestProbePty();
+		TestCapsCache(tree);
+	}
+	catch (std::string strError) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		CHECK(false);
+	}
+#endif
+	return TestResult("caps");
+}
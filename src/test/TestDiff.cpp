@@ -0,0 +1,113 @@
+/*************************************************************************
+* Port snapshot differences
+*
+* DiffPortSnapshots on hand-made lists: either side empty, ports added and
+* removed at the same index under different device paths, and a changed
+* port reported with its new record.
+************************************************************************/
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortDiff.h"
+#include "Fixture.h"
+
+typedef std::vector<std::pair<int, SSerInfo> > EventList;
+
+static SSerInfo MakePort(int intIndex, const std::string &strDevPath,
+	const std::string &strFriendlyName)
+{
+	SSerInfo si;
+	si.intPortIndex = intIndex;
+	si.strDevPath = strDevPath;
+	si.strPortName = strDevPath.substr(strDevPath.rfind('/') + 1);
+	si.strFriendlyName = strFriendlyName;
+	return si;
+}
+
+static size_t Diff(const std::vector<SSerInfo> &asiOld,
+	const std::vector<SSerInfo> &asiNew, EventList &aEvents)
+{
+	aEvents.clear();
+	return DiffPortSnapshots(asiOld, asiNew, [&aEvents](int intEvent, const SSerInfo &si) {
+		aEvents.push_back(std::make_pair(intEvent, si));
+	});
+}
+
+static void TestDiffEmpty()
+{
+	std::vector<SSerInfo> asiNone, asi;
+	asi.push_back(MakePort(0, "/dev/ttyUSB0", "ftdi_sio (ttyUSB0)"));
+	asi.push_back(MakePort(1, "/dev/ttyUSB1", "ftdi_sio (ttyUSB1)"));
+	EventList aEvents;
+
+	CHECK(Diff(asiNone, asiNone, aEvents) == 0 && aEvents.empty());
+	CHECK(Diff(asi, asi, aEvents) == 0 && aEvents.empty());
+
+	CHECK(Diff(asiNone, asi, aEvents) == 2 && aEvents.size() == 2);
+	if (aEvents.size() == 2) {
+		CHECK(aEvents[0].first == PORT_EVENT_ADD
+			&& aEvents[0].second.strDevPath == "/dev/ttyUSB0");
+		CHECK(aEvents[1].first == PORT_EVENT_ADD
+			&& aEvents[1].second.strDevPath == "/dev/ttyUSB1");
+	}
+
+	CHECK(Diff(asi, asiNone, aEvents) == 2 && aEvents.size() == 2);
+	if (aEvents.size() == 2) {
+		CHECK(aEvents[0].first == PORT_EVENT_REMOVE
+			&& aEvents[0].second.strDevPath == "/dev/ttyUSB0");
+		CHECK(aEvents[1].first == PORT_EVENT_REMOVE
+			&& aEvents[1].second.strDevPath == "/dev/ttyUSB1");
+	}
+}
+
+// A port replaced by another with the same index (ttyUSB0 unplugged,
+// ttyACM0 plugged in) is a removal and an addition, not a change.
+static void TestDiffSameIndex()
+{
+	std::vector<SSerInfo> asiOld, asiNew;
+	asiOld.push_back(MakePort(0, "/dev/ttyUSB0", "ftdi_sio (ttyUSB0)"));
+	asiOld.push_back(MakePort(4, "/dev/ttyS4", "serial8250 (ttyS4)"));
+	asiNew.push_back(MakePort(0, "/dev/ttyACM0", "cdc_acm (ttyACM0)"));
+	asiNew.push_back(MakePort(4, "/dev/ttyS4", "serial8250 (ttyS4)"));
+	EventList aEvents;
+
+	CHECK(Diff(asiOld, asiNew, aEvents) == 2 && aEvents.size() == 2);
+	if (aEvents.size() == 2) {
+		// In list order: /dev/ttyACM0 sorts before /dev/ttyUSB0.
+		CHECK(aEvents[0].first == PORT_EVENT_ADD
+			&& aEvents[0].second.strDevPath == "/dev/ttyACM0");
+		CHECK(aEvents[1].first == PORT_EVENT_REMOVE
+			&& aEvents[1].second.strDevPath == "/dev/ttyUSB0"
+			&& aEvents[1].second.strFriendlyName == "ftdi_sio (ttyUSB0)");
+	}
+}
+
+static void TestDiffChange()
+{
+	std::vector<SSerInfo> asiOld, asiNew;
+	asiOld.push_back(MakePort(3, "\\\\.\\COM3", "USB Serial Port (COM3)"));
+	asiOld.push_back(MakePort(5, "\\\\.\\COM5", "Modem (COM5)"));
+	asiNew = asiOld;
+	asiNew[0].strFriendlyName = "Arduino Uno (COM3)";
+	asiNew[0].bUsbDevice = TRUE;
+	EventList aEvents;
+
+	CHECK(Diff(asiOld, asiNew, aEvents) == 1 && aEvents.size() == 1);
+	if (aEvents.size() == 1) {
+		CHECK(aEvents[0].first == PORT_EVENT_CHANGE);
+		CHECK(aEvents[0].second.strDevPath == "\\\\.\\COM3");
+		CHECK(aEvents[0].second.strFriendlyName == "Arduino Uno (COM3)");
+		CHECK(aEvents[0].second.bUsbDevice == TRUE);
+	}
+}
+
+int main()
+{
+	TestDiffEmpty();
+	TestDiffSameIndex();
+	TestDiffChange();
+	return TestResult("diff");
+}
@@ -0,0 +1,130 @@
+/*************************************************************************
+* Enumeration of a fake sysfs tree
+*
+* EnumSerialPortsAt against a tree holding a quad FTDI adapter (two of
+* its ports), a CDC-ACM modem, a real and an empty 8250 slot and virtual
+* ttys: checks which ports are listed, in which order, with what fields,
+* and that the udev links merge into them.
+************************************************************************/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortFilter.h"
+#include "Fixture.h"
+
+#ifndef _WIN32
+
+static void TestEnumAt(const CFixtureTree &tree)
+{
+	std::vector<SSerInfo> asi;
+	EnumSerialPortsAt(tree.Root(), asi, SPortFilter(), PORT_FIELD_ALL, FALSE);
+
+	// Sorted by index, then device path; no ttyS1 (empty slot), no tty0
+	// or ptmx (no device).
+	CHECK(asi.size() == 4);
+	if (asi.size() == 4) {
+		CHECK(asi[0].strDevPath == "/dev/ttyACM0");
+		CHECK(asi[1].strDevPath == "/dev/ttyS0");
+		CHECK(asi[2].strDevPath == "/dev/ttyUSB0");
+		CHECK(asi[3].strDevPath == "/dev/ttyUSB1");
+	}
+
+	const SSerInfo *pUsb = FindPort(asi, "ttyUSB1");
+	CHECK(pUsb != NULL);
+	if (pUsb != NULL) {
+		CHECK(pUsb->intPortIndex == 1);
+		CHECK(pUsb->bUsbDevice == TRUE);
+		CHECK(pUsb->strFriendlyName == "ftdi_sio (ttyUSB1)");
+		CHECK(pUsb->strPortDesc == "ftdi_sio");
+		CHECK(pUsb->usb.intVendorId == 0x0403);
+		CHECK(pUsb->usb.intProductId == 0x6011);
+		CHECK(pUsb->usb.intInterface == 1);
+		CHECK(pUsb->usb.strSerial == "FT0");
+		CHECK(pUsb->usb.strProduct == "Quad_RS232-HS");
+	}
+
+	const SSerInfo *pAcm = FindPort(asi, "ttyACM0");
+	CHECK(pAcm != NULL && pAcm->bUsbDevice && pAcm->usb.intVendorId == 0x2341
+		&& pAcm->strFriendlyName == "cdc_acm (ttyACM0)");
+
+	const SSerInfo *pUart = FindPort(asi, "ttyS0");
+	CHECK(pUart != NULL && !pUart->bUsbDevice && pUart->usb.intVendorId == -1
+		&& pUart->strFriendlyName == "serial8250 (ttyS0)");
+}
+
+static void TestFilter(const CFixtureTree &tree)
+{
+	SPortFilter filter;
+	std::vector<SSerInfo> asi;
+	CHECK(ParsePortFilter("0403:*", filter));
+	EnumSerialPortsAt(tree.Root(), asi, filter, PORT_FIELD_ALL, FALSE);
+	CHECK(asi.size() == 2);
+
+	SPortFilter filterName;
+	CHECK(ParsePortFilter("name=ttyS*", filterName));
+	EnumSerialPortsAt(tree.Root(), asi, filterName, PORT_FIELD_ALL, FALSE);
+	CHECK(asi.size() == 1 && asi[0].strPortName == "ttyS0");
+}
+
+// A by-id link to a tty sysfs doesn't list still shows up, from the link.
+static void TestByIdOnly(CFixtureTree &tree)
+{
+	CHECK(tree.MakeLink("../../ttyUSB9", "dev/serial/by-id/usb-Other_X-if00-port0"));
+	std::vector<SSerInfo> asi;
+	EnumSerialPortsAt(tree.Root(), asi, SPortFilter(), PORT_FIELD_ALL, FALSE);
+	CHECK(asi.size() == 5);
+	const SSerInfo *pLink = FindPort(asi, "ttyUSB9");
+	CHECK(pLink != NULL && pLink->bUsbDevice
+		&& pLink->strFriendlyName == "usb-Other_X-if00-port0");
+}
+
+static void TestMissingRoot()
+{
+	std::vector<SSerInfo> asi;
+	bool bThrown = false;
+	try {
+		EnumSerialPortsAt("/nonexistent/enumcom", asi, SPortFilter(), PORT_FIELD_ALL, FALSE);
+	}
+	catch (std::string) {
+		bThrown = true;
+	}
+	CHECK(bThrown);
+}
+
+int main()
+{
+	try {
+		CFixtureTree tree;
+		CHECK(tree.AddUsbTty("ttyUSB0", "1-2", 0, "ftdi_sio", 0x0403, 0x6011,
+			"FT0", "Quad_RS232-HS"));
+		CHECK(tree.AddUsbTty("ttyUSB1", "1-2", 1, "ftdi_sio", 0x0403, 0x6011,
+			"FT0", "Quad_RS232-HS"));
+		CHECK(tree.AddUsbTty("ttyACM0", "1-3", 0, "cdc_acm", 0x2341, 0x0043,
+			"A1", "Uno"));
+		CHECK(tree.AddUartTty("ttyS0", "4"));
+		CHECK(tree.AddUartTty("ttyS1", "0"));
+		CHECK(tree.AddVirtualTty("tty0"));
+		CHECK(tree.AddVirtualTty("ptmx"));
+		TestEnumAt(tree);
+		TestFilter(tree);
+		TestByIdOnly(tree);
+		TestMissingRoot();
+	}
+	catch (std::string strError) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		CHECK(false);
+	}
+	return TestResult("enum");
+}
+
+#else
+
+int main()
+{
+	return TestResult("enum");
+}
+
+#endif
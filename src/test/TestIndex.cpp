@@ -0,0 +1,104 @@
+/*************************************************************************
+* Port identities
+*
+* CPortIndex built from the enumeration of a fake sysfs tree: each port
+* is found by its name, device path, USB serial number (alone and with
+* its interface) and the names and paths of its /dev/serial links, and an
+* identity claimed by two ports goes to the first one.
+************************************************************************/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortFilter.h"
+#include "../PortIndex.h"
+#include "Fixture.h"
+
+#ifndef _WIN32
+
+// Device path of the port known as strId, "" if none is.
+static std::string FindDevPath(const CPortIndex &index, const std::string &strId)
+{
+	const SSerInfo *pPort = index.Find(strId);
+	return (pPort != NULL) ? pPort->strDevPath : std::string();
+}
+
+static void TestIndex(const CFixtureTree &tree)
+{
+	std::vector<SSerInfo> asi;
+	EnumSerialPortsAt(tree.Root(), asi, SPortFilter(), PORT_FIELD_ALL, FALSE);
+	size_t nPorts = asi.size();
+	CPortIndex index;
+	index.Build(asi, tree.Root());
+	CHECK(asi.empty());
+	CHECK(index.Ports().size() == nPorts && nPorts == 5);
+
+	CHECK(FindDevPath(index, "ttyUSB1") == "/dev/ttyUSB1");
+	CHECK(FindDevPath(index, "/dev/ttyUSB1") == "/dev/ttyUSB1");
+	CHECK(FindDevPath(index, "ttyS0") == "/dev/ttyS0");
+
+	// The bare serial number is the first interface's.
+	CHECK(FindDevPath(index, "FT0") == "/dev/ttyUSB0");
+	CHECK(FindDevPath(index, "FT0:0") == "/dev/ttyUSB0");
+	CHECK(FindDevPath(index, "FT0:1") == "/dev/ttyUSB1");
+	CHECK(FindDevPath(index, "FT0:2").empty());
+
+	CHECK(FindDevPath(index, "usb-Quad_FT0-if01-port0") == "/dev/ttyUSB1");
+	CHECK(FindDevPath(index, tree.Root()
+		+ "/dev/serial/by-id/usb-Quad_FT0-if01-port0") == "/dev/ttyUSB1");
+	CHECK(FindDevPath(index, "pci-0000:00:14.0-usb-0:2:1.1-port0") == "/dev/ttyUSB1");
+	CHECK(FindDevPath(index, tree.Root()
+		+ "/dev/serial/by-path/pci-0000:00:14.0-usb-0:2:1.1-port0") == "/dev/ttyUSB1");
+	// A link to a port that isn't there resolves to nothing.
+	CHECK(FindDevPath(index, "pci-0000:00:14.0-usb-0:9:1.0-port0").empty());
+
+	// Two adapters with the same serial number: the first port listed
+	// keeps it, and its pointer is into Ports().
+	const SSerInfo *pDup = index.Find("DUP");
+	CHECK(pDup != NULL && pDup->strDevPath == "/dev/ttyUSB2");
+	CHECK(pDup != NULL && pDup >= &index.Ports()[0]
+		&& pDup < &index.Ports()[0] + index.Ports().size());
+	CHECK(FindDevPath(index, "DUP:0") == "/dev/ttyUSB2");
+	CHECK(FindDevPath(index, "usb-CloneB_DUP-if00-port0") == "/dev/ttyUSB3");
+
+	CHECK(index.Find("") == NULL);
+	CHECK(index.Find("ttyUSB7") == NULL);
+}
+
+int main()
+{
+	try {
+		CFixtureTree tree;
+		CHECK(tree.AddUsbTty("ttyUSB0", "1-2", 0, "ftdi_sio", 0x0403, 0x6011,
+			"FT0", "Quad"));
+		CHECK(tree.AddUsbTty("ttyUSB1", "1-2", 1, "ftdi_sio", 0x0403, 0x6011,
+			"FT0", "Quad"));
+		CHECK(tree.AddUsbTty("ttyUSB2", "1-4", 0, "ch341-uart", 0x1a86, 0x7523,
+			"DUP", "CloneA"));
+		CHECK(tree.AddUsbTty("ttyUSB3", "1-5", 0, "ch341-uart", 0x1a86, 0x7523,
+			"DUP", "CloneB"));
+		CHECK(tree.AddUartTty("ttyS0", "4"));
+		CHECK(tree.MakeDirs("dev/serial/by-path"));
+		CHECK(tree.MakeLink("../../ttyUSB1",
+			"dev/serial/by-path/pci-0000:00:14.0-usb-0:2:1.1-port0"));
+		CHECK(tree.MakeLink("../../ttyUSB9",
+			"dev/serial/by-path/pci-0000:00:14.0-usb-0:9:1.0-port0"));
+		TestIndex(tree);
+	}
+	catch (std::string strError) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		CHECK(false);
+	}
+	return TestResult("index");
+}
+
+#else
+
+int main()
+{
+	return TestResult("index");
+}
+
+#endif
@@ -0,0 +1,87 @@
+/*************************************************************************
+* Bounded probes
+*
+* RunBoundedProbes with probes that hang until released: each one is
+* abandoned after the timeout, the number left hung in the process stays
+* under PORT_PROBE_MAX_ABANDONED, and no thread is started while it is at
+* the limit. Once released, they are no longer counted and probing works
+* again.
+************************************************************************/
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortProbe.h"
+#include "Fixture.h"
+
+// Holds the probes until Release. Shared with the abandoned workers, which
+// outlive the calls.
+struct SGate {
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool bOpen = false;
+
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [this] { return bOpen; });
+	}
+
+	void Release()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		bOpen = true;
+		cv.notify_all();
+	}
+};
+
+static bool IsAll(const std::vector<int> &aiResults, int intValue)
+{
+	for (size_t ii = 0; ii < aiResults.size(); ii++) {
+		if (aiResults[ii] != intValue)
+			return false;
+	}
+	return true;
+}
+
+static void TestAbandonedLimit()
+{
+	const size_t nCount = PORT_PROBE_MAX_ABANDONED + 8;
+	const unsigned nWorkers = 4;
+	std::shared_ptr<SGate> pGate = std::make_shared<SGate>();
+	std::vector<int> aiResults;
+
+	CHECK(GetAbandonedProbeCount() == 0);
+	RunBoundedProbes(nCount, nWorkers, 20, [pGate](size_t) {
+		pGate->Wait();
+		return 1;
+	}, aiResults);
+	CHECK(aiResults.size() == nCount && IsAll(aiResults, PROBE_TIMEOUT));
+	// The workers running when the limit is hit are abandoned too.
+	CHECK(GetAbandonedProbeCount() >= PORT_PROBE_MAX_ABANDONED);
+	CHECK(GetAbandonedProbeCount() < PORT_PROBE_MAX_ABANDONED + nWorkers);
+
+	// At the limit: nothing is probed.
+	RunBoundedProbes(3, nWorkers, 20, [](size_t) { return 1; }, aiResults);
+	CHECK(aiResults.size() == 3 && IsAll(aiResults, PROBE_TIMEOUT));
+
+	pGate->Release();
+	for (int ii = 0; ii < 500 && GetAbandonedProbeCount() != 0; ii++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	CHECK(GetAbandonedProbeCount() == 0);
+
+	RunBoundedProbes(3, nWorkers, 1000, [](size_t ii) { return (int) ii; }, aiResults);
+	CHECK(aiResults.size() == 3 && aiResults[0] == 0 && aiResults[2] == 2);
+}
+
+int main()
+{
+	TestAbandonedLimit();
+	return TestResult("probe");
+}
@@ -0,0 +1,91 @@
+/*************************************************************************
+* Port list daemon
+*
+* RunPortServer on a socket of its own, on a thread: QueryPortServer gets
+* the same ports as a direct enumeration, a second server on the socket
+* is turned away, and once the server stopped the client falls back to
+* enumerating.
+************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortServer.h"
+#include "Fixture.h"
+
+#ifndef _WIN32
+
+static volatile sig_atomic_t s_bStop = 0;
+
+static void RunServer(std::string strPath, std::string *pstrError)
+{
+	try {
+		RunPortServer(strPath, &s_bStop);
+	}
+	catch (std::string strError) {
+		*pstrError = strError;
+	}
+}
+
+static void TestServer(const CFixtureTree &tree)
+{
+	std::string strPath = tree.Root() + "/enumcom.sock";
+	std::vector<SSerInfo> asi, asiDirect;
+	CHECK(!QueryPortServer(strPath, asi));
+
+	std::string strError;
+	std::thread thread(RunServer, strPath, &strError);
+	bool bUp = false;
+	for (int ii = 0; ii < 500 && !bUp; ii++) {
+		bUp = QueryPortServer(strPath, asi);
+		if (!bUp)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	CHECK(bUp);
+	CHECK(strError.empty());
+
+	// The live system's ports, as the server's watcher sees them.
+	EnumSerialPorts(asiDirect, FALSE);
+	CHECK(IsSameDevPaths(asi, asiDirect));
+	CHECK(EnumSerialPortsClient(asi, strPath));
+	CHECK(IsSameDevPaths(asi, asiDirect));
+
+	// Only one server per socket.
+	bool bThrown = false;
+	try {
+		RunPortServer(strPath, &s_bStop);
+	}
+	catch (std::string) {
+		bThrown = true;
+	}
+	CHECK(bThrown);
+
+	// The stop flag is checked whenever the server wakes up: a query does.
+	s_bStop = 1;
+	QueryPortServer(strPath, asi);
+	thread.join();
+	CHECK(!QueryPortServer(strPath, asi));
+	CHECK(!EnumSerialPortsClient(asi, strPath));
+	CHECK(IsSameDevPaths(asi, asiDirect));
+}
+
+#endif
+
+int main()
+{
+#ifndef _WIN32
+	try {
+		CFixtureTree tree;
+		TestServer(tree);
+	}
+	catch (std::string strError) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		CHECK(false);
+	}
+#endif
+	return TestResult("server");
+}
@@ -0,0 +1,192 @@
+/*************************************************************************
+* Shared port snapshot
+*
+* A publisher and a reader of the same segment, in one process: the table
+* read is the one published, a second publisher is turned away while the
+* first has the segment, and the segment can be taken again once it let
+* go. On Linux, a publisher killed without closing is noticed by readers,
+* and a segment of another user is refused. The torn read check under load is BenchShared's (run by make check
+* too).
+************************************************************************/
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortShared.h"
+#include "Fixture.h"
+
+static void MakePorts(size_t nPorts, std::vector<SSerInfo> &asi)
+{
+	asi.assign(nPorts, SSerInfo());
+	for (size_t ii = 0; ii < nPorts; ii++) {
+		asi[ii].strPortName = "COM" + std::to_string(ii + 1);
+		asi[ii].strDevPath = "\\\\.\\" + asi[ii].strPortName;
+		asi[ii].strFriendlyName = "Test Port (" + asi[ii].strPortName + ")";
+		asi[ii].strPortDesc = "Test Port";
+		asi[ii].intPortIndex = (int) ii + 1;
+	}
+}
+
+// Whether Open throws.
+static bool IsOpenRefused(CSharedSnapshotWriter &writer, const std::string &strName)
+{
+	try {
+		writer.Open(strName, 4096);
+	}
+	catch (std::string) {
+		return true;
+	}
+	return false;
+}
+
+static void TestShared()
+{
+	// Not the default segment, so that a running publisher isn't disturbed.
+#ifdef _WIN32
+	int intPid = (int) GetCurrentProcessId();
+#else
+	int intPid = (int) getpid();
+#endif
+	std::string strName = GetDefaultSharedSnapshotName() + "-test-"
+		+ std::to_string(intPid);
+
+	CSharedSnapshotReader reader;
+	CHECK(!reader.Attach(strName));
+
+	CSharedSnapshotWriter writer, writerOther;
+	CHECK(!IsOpenRefused(writer, strName));
+	CHECK(IsOpenRefused(writerOther, strName));
+
+	// Attached before anything was published.
+	CHECK(reader.Attach(strName));
+	std::vector<SSerInfo> asi, asiRead;
+	CHECK(!reader.Read(asiRead));
+
+	MakePorts(3, asi);
+	CHECK(writer.Publish(asi, 1));
+	unsigned int uSequence = reader.Sequence();
+	CHECK(uSequence % 2 == 0);
+	CHECK(reader.Read(asiRead));
+	CHECK(IsSameList(asi, asiRead));
+
+	// Too big for the segment: the previous table stays.
+	std::vector<SSerInfo> asiBig;
+	MakePorts(1000, asiBig);
+	CHECK(!writer.Publish(asiBig, 2));
+	CHECK(reader.Sequence() == uSequence);
+	CHECK(reader.Read(asiRead) && IsSameList(asi, asiRead));
+
+	MakePorts(5, asi);
+	CHECK(writer.Publish(asi, 3));
+	CHECK(reader.Sequence() != uSequence && reader.Sequence() % 2 == 0);
+	CHECK(reader.Read(asiRead) && IsSameList(asi, asiRead));
+	CHECK(!reader.IsClosed());
+
+	// Closed: the reader keeps the last table and sees the segment go; it
+	// is free for another publisher.
+	writer.Close();
+	writer.Close();
+	CHECK(reader.IsClosed());
+	CHECK(reader.Read(asiRead) && asiRead.size() == 5);
+	reader.Detach();
+#ifndef _WIN32
+	CHECK(!reader.Attach(strName));
+#endif
+	CHECK(!IsOpenRefused(writerOther, strName));
+	CHECK(IsOpenRefused(writer, strName));
+	CHECK(reader.Attach(strName) && !reader.IsClosed());
+	writerOther.Close();
+}
+
+#ifndef _WIN32
+
+// A publisher killed while it has the segment: dwClosed is never set.
+static void TestSharedDeadPublisher(const std::string &strName)
+{
+	int aiReady[2], aiDie[2];
+	CHECK(pipe(aiReady) == 0 && pipe(aiDie) == 0);
+	pid_t pid = fork();
+	if (pid == 0) {
+		CSharedSnapshotWriter writer;
+		std::vector<SSerInfo> asi;
+		MakePorts(2, asi);
+		char c = 0;
+		try {
+			writer.Open(strName, 4096);
+			c = writer.Publish(asi, 1) ? 1 : 0;
+		}
+		catch (std::string) {
+		}
+		if (write(aiReady[1], &c, 1) != 1 || read(aiDie[0], &c, 1) < 0)
+			_exit(1);
+		_exit(0);
+	}
+	CHECK(pid > 0);
+	char c = 0;
+	CHECK(read(aiReady[0], &c, 1) == 1 && c == 1);
+
+	CSharedSnapshotReader reader;
+	std::vector<SSerInfo> asiRead;
+	CHECK(reader.Attach(strName) && !reader.IsClosed());
+	CHECK(reader.Read(asiRead) && asiRead.size() == 2);
+
+	CHECK(write(aiDie[1], &c, 1) == 1);
+	int intStatus = 0;
+	CHECK(waitpid(pid, &intStatus, 0) == pid);
+	CHECK(reader.IsClosed());
+	reader.Detach();
+	CHECK(!reader.Attach(strName));
+	close(aiReady[0]);
+	close(aiReady[1]);
+	close(aiDie[0]);
+	close(aiDie[1]);
+
+	// The segment it left is taken over, and removed with the new one.
+	CSharedSnapshotWriter writer;
+	CHECK(!IsOpenRefused(writer, strName));
+	CHECK(reader.Attach(strName) && !reader.IsClosed());
+	writer.Close();
+}
+
+// Only root can give a segment away; as anyone else, there is nothing to
+// test.
+static void TestSharedOtherOwner(const std::string &strName)
+{
+	if (getuid() != 0)
+		return;
+	int fd = shm_open(strName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+	CHECK(fd >= 0);
+	if (fd < 0)
+		return;
+	CHECK(ftruncate(fd, 4096) == 0 && fchown(fd, 1, 1) == 0);
+	close(fd);
+
+	CSharedSnapshotReader reader;
+	CSharedSnapshotWriter writer;
+	CHECK(!reader.Attach(strName));
+	CHECK(IsOpenRefused(writer, strName));
+	shm_unlink(strName.c_str());
+}
+
+#endif
+
+int main()
+{
+	TestShared();
+#ifndef _WIN32
+	std::string strName = GetDefaultSharedSnapshotName() + "-test-"
+		+ std::to_string((int) getpid());
+	TestSharedDeadPublisher(strName + "-dead");
+	TestSharedOtherOwner(strName + "-owner");
+#endif
+	return TestResult("shared");
+}
@@ -0,0 +1,95 @@
+/*************************************************************************
+* Legacy UART placeholders
+*
+* The 8250 slots of a fake tree, described by their sysfs "type"
+* attribute, by /proc/tty/driver/serial, by both or by neither: checks
+* which of them EnumSerialPortsAt keeps, and the parsing of the /proc
+* table.
+************************************************************************/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortFilter.h"
+#include "../PortUart.h"
+#include "Fixture.h"
+
+static void TestParse()
+{
+	CHECK(IsLegacyUartName("ttyS0"));
+	CHECK(IsLegacyUartName("ttyS31"));
+	CHECK(!IsLegacyUartName("ttyS"));
+	CHECK(!IsLegacyUartName("ttySAC0"));
+	CHECK(!IsLegacyUartName("ttyUSB0"));
+
+	CHECK(UartStateFromSysfs("") == UART_STATE_UNKNOWN);
+	CHECK(UartStateFromSysfs("0") == UART_STATE_ABSENT);
+	CHECK(UartStateFromSysfs("4") == UART_STATE_PRESENT);
+
+	CUartTable uarts("/nonexistent");
+	uarts.Parse("serinfo:1.0 driver revision:\n"
+		"0: uart:16550A port:000003F8 irq:4 tx:0 rx:0\n"
+		"1: uart:unknown port:000002F8 irq:3\n"
+		"3: uart:XR16850 port:00000000 irq:0");
+	CHECK(uarts.Lookup(0) == UART_STATE_PRESENT);
+	CHECK(uarts.Lookup(1) == UART_STATE_ABSENT);
+	CHECK(uarts.Lookup(2) == UART_STATE_UNKNOWN);
+	CHECK(uarts.Lookup(3) == UART_STATE_PRESENT);
+	CHECK(uarts.Lookup(4) == UART_STATE_UNKNOWN);
+	CHECK(uarts.Lookup(-1) == UART_STATE_UNKNOWN);
+}
+
+#ifndef _WIN32
+
+// Names of the ports found under the root of tree, in order.
+static std::string ListPorts(const CFixtureTree &tree)
+{
+	std::vector<SSerInfo> asi;
+	EnumSerialPortsAt(tree.Root(), asi, SPortFilter(), PORT_FIELD_ALL, FALSE);
+	std::string strNames;
+	for (size_t ii = 0; ii < asi.size(); ii++)
+		strNames += (ii ? "," : "") + asi[ii].strPortName;
+	return strNames;
+}
+
+static void TestPlaceholders()
+{
+	CFixtureTree tree;
+	CHECK(tree.AddUartTty("ttyS0", "4"));          // 16550A
+	CHECK(tree.AddUartTty("ttyS1", "0"));          // Empty slot
+	CHECK(tree.AddUartTty("ttyS2", NULL));
+	CHECK(tree.AddUartTty("ttyS3", NULL));
+	CHECK(tree.AddUartTty("ttyS4", NULL));
+	CHECK(tree.AddUartTty("ttyS5", "0"));          // sysfs wins over /proc
+
+	// Without /proc, the slots without a type can't be told apart.
+	CHECK(ListPorts(tree) == "ttyS0,ttyS2,ttyS3,ttyS4");
+
+	CHECK(tree.MakeDirs("proc/tty/driver"));
+	CHECK(tree.WriteFile("proc/tty/driver/serial", "serinfo:1.0 driver revision:\n"
+		"0: uart:16550A port:000003F8 irq:4\n"
+		"1: uart:unknown port:000002F8 irq:3\n"
+		"2: uart:unknown port:000003E8 irq:4\n"
+		"3: uart:16550A port:000002E8 irq:3\n"
+		"5: uart:16550A port:00000000 irq:0"));
+	CHECK(ListPorts(tree) == "ttyS0,ttyS3,ttyS4");
+}
+
+#endif
+
+int main()
+{
+	TestParse();
+#ifndef _WIN32
+	try {
+		TestPlaceholders();
+	}
+	catch (std::string strError) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		CHECK(false);
+	}
+#endif
+	return TestResult("uart");
+}
@@ -0,0 +1,147 @@
+/*************************************************************************
+* Waiting for a port
+*
+* WaitForSerialPortAt on a fake tree while another thread plugs a USB
+* adapter in the way the kernel and udev do: the /dev node first, then
+* /dev/serial and its links. The port must be found by its name and by its
+* by-id link, even when /dev/serial didn't exist when the wait started.
+* Also the timeout, and the stop flag.
+************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "../EnumSerial.h"
+#include "../PortWait.h"
+#include "Fixture.h"
+
+#ifndef _WIN32
+
+#define BY_ID_LINK "usb-FT232R_USB_UART_A9-if00-port0"
+
+static void Sleep(int intMs)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(intMs));
+}
+
+// Result of a wait run on its own thread.
+struct SWaitResult {
+	bool bFound = false;
+	SSerInfo si;
+	std::string strError;
+};
+
+static void WaitThread(std::string strRoot, std::string strId, int intTimeoutMs,
+	const volatile sig_atomic_t *pbStop, SWaitResult *pResult)
+{
+	try {
+		pResult->bFound = WaitForSerialPortAt(strRoot, strId, intTimeoutMs,
+			pResult->si, pbStop);
+	}
+	catch (std::string strError) {
+		pResult->strError = strError;
+	}
+}
+
+// Makes the sysfs side of ttyUSB0, without anything in /dev.
+static bool AddUnpluggedUsbTty(CFixtureTree &tree)
+{
+	return tree.AddUsbTty("ttyUSB0", "1-2", 0, "ftdi_sio", 0x0403, 0x6001,
+			"A9", "FT232R_USB_UART")
+		&& tree.Remove("dev/serial") && tree.Remove("dev/ttyUSB0");
+}
+
+// The node, then a moment later the udev links.
+static bool PlugUsbTty(CFixtureTree &tree)
+{
+	bool bOk = tree.WriteFile("dev/ttyUSB0", "");
+	Sleep(100);
+	return bOk && tree.MakeDirs("dev/serial/by-id")
+		&& tree.MakeLink("../../ttyUSB0", "dev/serial/by-id/" BY_ID_LINK);
+}
+
+static void TestWaitByLink()
+{
+	CFixtureTree tree;
+	CHECK(AddUnpluggedUsbTty(tree));
+
+	SWaitResult result;
+	std::thread thread(WaitThread, tree.Root(), std::string(BY_ID_LINK), 5000,
+		(const volatile sig_atomic_t*) NULL, &result);
+	Sleep(100);
+	CHECK(PlugUsbTty(tree));
+	thread.join();
+	CHECK(result.strError.empty());
+	CHECK(result.bFound);
+	CHECK(result.si.strDevPath == "/dev/ttyUSB0");
+
+	// There already: found at once, even without waiting.
+	SSerInfo si;
+	CHECK(WaitForSerialPortAt(tree.Root(), BY_ID_LINK, 0, si));
+	CHECK(WaitForSerialPortAt(tree.Root(), "0403:6001", 0, si));
+	CHECK(si.strPortName == "ttyUSB0");
+}
+
+static void TestWaitByName()
+{
+	CFixtureTree tree;
+	CHECK(AddUnpluggedUsbTty(tree));
+
+	SWaitResult result;
+	std::thread thread(WaitThread, tree.Root(), std::string("ttyUSB0"), 5000,
+		(const volatile sig_atomic_t*) NULL, &result);
+	Sleep(100);
+	CHECK(tree.WriteFile("dev/ttyUSB0", ""));
+	thread.join();
+	CHECK(result.bFound && result.si.usb.intVendorId == 0x0403);
+}
+
+static void TestWaitTimeout()
+{
+	CFixtureTree tree;
+	SSerInfo si;
+	CHECK(!WaitForSerialPortAt(tree.Root(), "ttyUSB7", 0, si));
+
+	std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+	CHECK(!WaitForSerialPortAt(tree.Root(), "ttyUSB7", 200, si));
+	CHECK(std::chrono::steady_clock::now() - tStart >= std::chrono::milliseconds(200));
+
+	// No timeout: only the stop flag ends it.
+	static volatile sig_atomic_t s_bStop = 0;
+	SWaitResult result;
+	std::thread thread(WaitThread, tree.Root(), std::string("ttyUSB7"), -1,
+		&s_bStop, &result);
+	Sleep(100);
+	s_bStop = 1;
+	thread.join();
+	CHECK(!result.bFound && result.strError.empty());
+
+	bool bThrown = false;
+	try {
+		WaitForSerialPortAt(tree.Root(), "", 0, si);
+	}
+	catch (std::string) {
+		bThrown = true;
+	}
+	CHECK(bThrown);
+}
+
+#endif
+
+int main()
+{
+#ifndef _WIN32
+	try {
+		TestWaitByLink();
+		TestWaitByName();
+		TestWaitTimeout();
+	}
+	catch (std::string strError) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		CHECK(false);
+	}
+#endif
+	return TestResult("wait");
+}
@@ -0,0 +1,182 @@
+/*************************************************************************
+* Hotplug watcher
+*
+* CPortWatcher fed from a socketpair instead of the netlink socket, over a
+* fake sysfs tree: uevents for ttys that appear, change and go must come
+* out as the matching port events, others must be ignored, and the port
+* table must start as a plain enumeration's and follow.
+************************************************************************/
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortFilter.h"
+#include "../PortWatcher.h"
+#include "Fixture.h"
+
+#ifndef _WIN32
+
+struct SEvent {
+	int intEvent;
+	SSerInfo si;
+};
+
+// Collects the events of the watcher thread.
+class CEventQueue {
+public:
+	void Push(int intEvent, const SSerInfo &si)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		SEvent ev = { intEvent, si };
+		m_events.push_back(ev);
+		m_cv.notify_all();
+	}
+
+	// Waits up to 5 seconds for the next event. Returns false on timeout.
+	bool Pop(SEvent &ev)
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		if (!m_cv.wait_for(lock, std::chrono::seconds(5),
+			[this] { return !m_events.empty(); }))
+			return false;
+		ev = m_events.front();
+		m_events.pop_front();
+		return true;
+	}
+
+	bool IsEmpty()
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		return m_events.empty();
+	}
+
+private:
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	std::deque<SEvent> m_events;
+};
+
+// Sends a uevent the way the kernel does: one datagram of NUL-terminated
+// strings.
+static bool SendUevent(int fd, const char *szAction, const char *szSubsystem,
+	const char *szDevName)
+{
+	std::string strMsg = std::string(szAction) + "@/devices/test";
+	strMsg += '\0';
+	strMsg += std::string("ACTION=") + szAction;
+	strMsg += '\0';
+	strMsg += std::string("SUBSYSTEM=") + szSubsystem;
+	strMsg += '\0';
+	strMsg += std::string("DEVNAME=") + szDevName;
+	strMsg += '\0';
+	return send(fd, strMsg.data(), strMsg.size(), 0) == (ssize_t) strMsg.size();
+}
+
+static bool HasPort(const CPortWatcher &watcher, const char *szDevPath)
+{
+	std::vector<SSerInfo> asi;
+	watcher.GetPorts(asi);
+	for (size_t ii = 0; ii < asi.size(); ii++) {
+		if (asi[ii].strDevPath == szDevPath)
+			return true;
+	}
+	return false;
+}
+
+static void TestWatcher(CFixtureTree &tree)
+{
+	int afd[2];
+	CHECK(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, afd) == 0);
+
+	// A port only known from its udev link, which a plain enumeration lists.
+	CHECK(tree.MakeLink("../../ttyUSB9", "dev/serial/by-id/usb-Other_X-if00-port0"));
+
+	CEventQueue queue;
+	CPortWatcher watcher;
+	watcher.Start([&queue](int intEvent, const SSerInfo &si) {
+		queue.Push(intEvent, si);
+	}, afd[0], tree.Root());
+
+	// The initial snapshot, without events: the same as a plain
+	// enumeration's.
+	std::vector<SSerInfo> asi, asiDirect;
+	watcher.GetPorts(asi);
+	EnumSerialPortsAt(tree.Root(), asiDirect, SPortFilter(), PORT_FIELD_ALL, FALSE);
+	CHECK(asi.size() == 3 && asi.size() == asiDirect.size());
+	for (size_t ii = 0; ii < asi.size() && ii < asiDirect.size(); ii++)
+		CHECK(IsSameSerInfo(asi[ii], asiDirect[ii]));
+	CHECK(HasPort(watcher, "/dev/ttyS0") && HasPort(watcher, "/dev/ttyUSB0"));
+	CHECK(HasPort(watcher, "/dev/ttyUSB9"));
+
+	// Events are handled in order, so the add coming out first shows that
+	// the events sent before it were dropped: not a tty, a tty that isn't
+	// a serial port, a port that is already known.
+	CHECK(tree.AddUsbTty("ttyUSB1", "1-3", 0, "pl2303", 0x067b, 0x2303, "P1", "PL2303"));
+	CHECK(SendUevent(afd[1], "add", "usb", "bus/usb/001/004"));
+	CHECK(SendUevent(afd[1], "add", "tty", "tty0"));
+	CHECK(SendUevent(afd[1], "change", "tty", "ttyUSB0"));
+	CHECK(SendUevent(afd[1], "add", "tty", "ttyUSB1"));
+	SEvent ev;
+	CHECK(queue.Pop(ev));
+	CHECK(ev.intEvent == PORT_EVENT_ADD);
+	CHECK(ev.si.strDevPath == "/dev/ttyUSB1");
+	CHECK(ev.si.bUsbDevice == TRUE && ev.si.usb.intVendorId == 0x067b);
+	CHECK(HasPort(watcher, "/dev/ttyUSB1"));
+
+	// Gone, named with an absolute path this time.
+	CHECK(tree.RemoveTty("ttyUSB1"));
+	CHECK(SendUevent(afd[1], "remove", "tty", "/dev/ttyUSB1"));
+	CHECK(queue.Pop(ev));
+	CHECK(ev.intEvent == PORT_EVENT_REMOVE);
+	CHECK(ev.si.strDevPath == "/dev/ttyUSB1");
+	CHECK(ev.si.usb.intProductId == 0x2303);
+	CHECK(!HasPort(watcher, "/dev/ttyUSB1"));
+
+	// Rebound to another driver.
+	std::string strDriver = "sys/devices/pci0/usb1/1-2/1-2:1.0/ttyUSB0/driver";
+	CHECK(tree.Remove(strDriver));
+	CHECK(tree.MakeLink("../../../../../../bus/usb-serial/drivers/usbserial_generic",
+		strDriver));
+	CHECK(SendUevent(afd[1], "bind", "tty", "ttyUSB0"));
+	CHECK(queue.Pop(ev));
+	CHECK(ev.intEvent == PORT_EVENT_CHANGE);
+	CHECK(ev.si.strDevPath == "/dev/ttyUSB0");
+	CHECK(ev.si.strPortDesc == "usbserial_generic");
+
+	watcher.Stop();
+	watcher.Stop();
+	CHECK(queue.IsEmpty());
+	close(afd[1]);
+}
+
+#endif
+
+int main()
+{
+#ifndef _WIN32
+	try {
+		CFixtureTree tree;
+		CHECK(tree.AddUsbTty("ttyUSB0", "1-2", 0, "ftdi_sio", 0x0403, 0x6001,
+			"A9", "FT232R_USB_UART"));
+		CHECK(tree.AddUartTty("ttyS0", "4"));
+		CHECK(tree.AddVirtualTty("tty0"));
+		TestWatcher(tree);
+	}
+	catch (std::string strError) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		CHECK(false);
+	}
+#endif
+	return TestResult("watcher");
+}
@@ -0,0 +1,119 @@
+/*************************************************************************
+* Windows backends on scripted devices
+*
+* The Windows 9x registry walk and the lookup of a device interface by
+* path, run on CFakeDeviceApi (so on any platform): which keys are taken
+* as ports, with what fields, that every key opened is closed again and
+* that duplicates and the filter are handled.
+************************************************************************/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../EnumSerial.h"
+#include "../PortFakeDeviceApi.h"
+#include "../PortFilter.h"
+#include "../PortMerge.h"
+#include "../PortWindows.h"
+#include "Fixture.h"
+
+// The HKLM\Enum of a machine with an on-board port, a USB adapter, a
+// modem and a USB port listed twice.
+static void FillRegistryW9x(CFakeDeviceApi &api)
+{
+	api.SetRegistryValue("Enum\\Root\\*PNP0501\\0000", "PORTNAME", "COM1");
+	api.SetRegistryValue("Enum\\Root\\*PNP0501\\0000", "FRIENDLYNAME",
+		"Communications Port (COM1)");
+	api.SetRegistryValue("Enum\\USBPORTS\\0000\\A", "PORTNAME", "COM5");
+	api.SetRegistryValue("Enum\\USBPORTS\\0001\\B", "PORTNAME", "COM5");
+	api.SetRegistryValue("Enum\\USBPORTS\\0001\\B", "FRIENDLYNAME",
+		std::string(300, 'f'));
+	api.SetRegistryValue("Enum\\Root\\MODEM\\0000", "PORTNAME", "COM9");
+}
+
+static void TestEnumW9x()
+{
+	CFakeDeviceApi api;
+	FillRegistryW9x(api);
+
+	std::vector<SSerInfo> asi;
+	{
+		CPortMerger merger(asi, PORT_FIELD_ALL, PORT_KEY_NAME);
+		EnumPortsW9x(api, merger, NULL);
+	}
+	CHECK(api.Calls(FAKE_API_OPEN_KEY) == api.Calls(FAKE_API_CLOSE_KEY));
+
+	// No COM9 (not a serial port key), a single COM5.
+	CHECK(asi.size() == 2);
+	CHECK(FindPort(asi, "COM9") == NULL);
+	const SSerInfo *pCom1 = FindPort(asi, "COM1");
+	CHECK(pCom1 != NULL);
+	if (pCom1 != NULL) {
+		CHECK(pCom1->strDevPath == "\\\\.\\COM1");
+		CHECK(pCom1->strFriendlyName == "Communications Port (COM1)");
+		CHECK(pCom1->bUsbDevice == FALSE);
+	}
+	const SSerInfo *pCom5 = FindPort(asi, "COM5");
+	CHECK(pCom5 != NULL);
+	if (pCom5 != NULL) {
+		CHECK(pCom5->strDevPath == "\\\\.\\COM5");
+		CHECK(pCom5->bUsbDevice == TRUE);
+		// Longer than the buffers the values used to be read into.
+		CHECK(pCom5->strFriendlyName.size() == 300);
+	}
+
+	// The filter is tested on each key.
+	SPortFilter filter;
+	CHECK(ParsePortFilter("usb", filter));
+	asi.clear();
+	{
+		CPortMerger merger(asi, PORT_FIELD_ALL, PORT_KEY_NAME);
+		EnumPortsW9x(api, merger, &filter);
+	}
+	CHECK(asi.size() == 1 && asi[0].strPortName == "COM5");
+
+	// No HKLM\Enum at all.
+	CFakeDeviceApi apiEmpty;
+	bool bThrown = false;
+	try {
+		CPortMerger merger(asi, PORT_FIELD_ALL, PORT_KEY_NAME);
+		EnumPortsW9x(apiEmpty, merger, NULL);
+	}
+	catch (std::string) {
+		bThrown = true;
+	}
+	CHECK(bThrown);
+}
+
+static void TestReadByPath()
+{
+	CFakeDeviceApi api;
+	DEVINST devInst = api.AddDevice("ACPI\\PNP0501\\1");
+	api.SetProperty(devInst, SPDRP_FRIENDLYNAME, "Communications Port (COM1)");
+	api.SetProperty(devInst, SPDRP_DEVICEDESC, "Communications Port");
+	api.AddInterface(devInst, "\\\\?\\acpi#pnp0501#1#{x}");
+
+	// Interface paths are case insensitive.
+	SSerInfo si;
+	si.strDevPath = "\\\\?\\ACPI#PNP0501#1#{x}";
+	CHECK(WdmReadSerInfoByPath(api, si));
+	CHECK(si.strFriendlyName == "Communications Port (COM1)");
+
+	SSerInfo siGone;
+	siGone.strDevPath = "\\\\?\\acpi#pnp0501#2#{x}";
+	CHECK(!WdmReadSerInfoByPath(api, siGone));
+}
+
+int main()
+{
+	try {
+		TestEnumW9x();
+		TestReadByPath();
+	}
+	catch (std::string strError) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		CHECK(false);
+	}
+	return TestResult("windows");
+}